@@ -4,14 +4,48 @@
  *
  * ESP32-C6 Zigbee Bridge OS - MQTT northbound adapter
  *
- * On host: Simulated MQTT (logs to console).
+ * On host: MQTT 3.1.1 over a non-blocking socket (mqtt_client.c), serviced
+ * by mqtt_poll() from mqtt_task.
  * On ESP32: Uses ESP-IDF MQTT client.
+ *
+ * Publishes go through a bounded outbound queue rather than to the socket:
+ * a newer message for a queued topic replaces the older one, the queue
+ * survives disconnects, and mqtt_poll() moves it into the client's
+ * transmit buffer highest priority first, oldest first, so one TCP write
+ * carries the whole batch. QoS 1 messages stay queued until PUBACK and are
+ * sent again after a reconnect. Payloads too large for a queue slot
+ * (discovery documents) bypass it and need a connection.
+ *
+ * State messages are built without printf: topics from a per-node prefix
+ * cached by registry slot plus a per-capability suffix, payloads with the
+ * mqtt_json writer.
+ *
+ * In aggregate mode a state change only marks its node: once the merge
+ * window has passed, mqtt_poll() publishes one bridge/<node_id>/state
+ * document built from the capability cache, so every change in the window
+ * rides in a single message.
+ *
+ * Each connect starts a snapshot that walks the capability caches slot by
+ * slot and queues every valid value retained, at low priority. A credit
+ * that grows with elapsed ticks paces it to config.snapshot_rate, and it
+ * waits whenever the queue is half full, so live changes and other fibres
+ * are never held up behind it. Live changes are retained as well, so the
+ * broker's retained copy is never older than the latest value.
+ *
+ * Inbound bridge/<node_id>/<capability>/set messages are decoded in place
+ * (topic slicing, mqtt_json scanner, hashed capability and node lookups)
+ * and handed to cap_execute_command() from the receive path. Home
+ * Assistant's "online" birth message becomes OS_EVENT_HA_ONLINE.
  */
 
 #include "mqtt_adapter.h"
 #include "capability.h"
+#include "mqtt_json.h"
 #include "os.h"
 #include "registry.h"
+#ifdef OS_PLATFORM_HOST
+#include "mqtt_client.h"
+#endif
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,6 +66,80 @@
 #define MQTT_DEFAULT_CLIENT_ID "zigbee-bridge"
 #define MQTT_DEFAULT_KEEPALIVE 30
 
+/* mqtt_task: socket service period and reconnect interval */
+#define MQTT_POLL_INTERVAL_MS 10
+#define MQTT_RECONNECT_INTERVAL_MS 5000
+
+/* "bridge/" + 16 hex digits + "/" */
+#define NODE_PREFIX_LEN (sizeof(TOPIC_BASE) + 17)
+
+/* Longest "<capability>/state" suffix */
+#define CAP_SUFFIX_MAX 40
+
+/* Bridge status, retained; the offline payload is also the will */
+#define STATUS_TOPIC TOPIC_BASE "/status"
+#define STATUS_ONLINE "{\"v\":\"online\"}"
+#define STATUS_OFFLINE "{\"v\":\"offline\"}"
+
+/* Home Assistant's birth and last-will topic */
+#define HA_STATUS_TOPIC "homeassistant/status"
+
+/* Live state is retained like the snapshot, so the broker's retained
+ * copy is always the latest value rather than the last snapshot's */
+static const mqtt_pub_opts_t state_opts = {
+    .qos = 1, .retain = true, .prio = MQTT_PRIO_NORMAL};
+
+/* Queue slot states */
+typedef enum {
+  QENTRY_FREE = 0,
+  QENTRY_QUEUED,   /* Waiting for the transmit buffer */
+  QENTRY_INFLIGHT, /* QoS 1 written, waiting for PUBACK */
+} qentry_state_t;
+
+/* Outbound queue slot */
+typedef struct {
+  qentry_state_t state;
+  uint8_t qos;
+  bool retain;
+  mqtt_prio_t prio;
+  uint16_t packet_id;
+  uint16_t len;
+  uint32_t topic_hash;
+  uint32_t seq; /* Enqueue order; kept when coalesced */
+  char topic[MAX_TOPIC_LEN];
+  uint8_t payload[MQTT_QUEUE_PAYLOAD_MAX];
+} qentry_t;
+
+/* Cached "bridge/<node_id>/" for one registry slot */
+typedef struct {
+  os_eui64_t node_addr; /* Owner; guards against slot reuse */
+  bool valid;
+  char text[NODE_PREFIX_LEN];
+} topic_prefix_t;
+
+/* "<capability>/state" */
+typedef struct {
+  uint8_t len;
+  char text[CAP_SUFFIX_MAX];
+} topic_suffix_t;
+
+/* Aggregate document waiting out its merge window, per registry slot */
+typedef struct {
+  bool pending;
+  os_tick_t due;
+} agg_slot_t;
+
+/* Snapshot walk */
+typedef struct {
+  bool active;
+  uint32_t slot; /* Registry slot and capability to try next */
+  uint32_t cap;
+  uint32_t credit; /* Thousandths of a message */
+  os_tick_t started;
+  os_tick_t last_tick;
+  mqtt_snapshot_stats_t stats;
+} snapshot_t;
+
 /* State names */
 static const char *state_names[] = {"DISCONNECTED", "CONNECTING", "CONNECTED",
                                     "ERROR"};
@@ -42,10 +150,764 @@ static struct {
   mqtt_state_t state;
   mqtt_config_t config;
   mqtt_stats_t stats;
+  qentry_t queue[MQTT_QUEUE_SIZE];
+  uint32_t next_seq;
+  topic_prefix_t prefixes[REG_MAX_NODES];
+  topic_suffix_t suffixes[CAP_MAX];
+  agg_slot_t agg[REG_MAX_NODES];
+  uint32_t agg_pending;
+  snapshot_t snapshot;
 } adapter = {0};
 
 /* Forward declarations */
 static void handle_cap_state_changed(const os_event_t *event, void *ctx);
+static void snapshot_stop(bool completed);
+static os_err_t format_state(os_eui64_t node_addr, cap_id_t cap_id,
+                             const cap_value_t *value, os_tick_t ts, char *topic,
+                             size_t topic_size, char *payload,
+                             size_t payload_size, size_t *payload_len);
+static os_err_t format_node_state(const reg_node_t *node, char *topic,
+                                  size_t topic_size, char *payload,
+                                  size_t payload_size, size_t *payload_len);
+
+/* Outbound queue */
+
+static uint32_t topic_hash(const char *topic) {
+  uint32_t hash = 2166136261u;
+  while (*topic) {
+    hash = (hash ^ (uint8_t)*topic++) * 16777619u;
+  }
+  return hash;
+}
+
+static void queue_free(qentry_t *e) {
+  e->state = QENTRY_FREE;
+  adapter.stats.queue_depth--;
+}
+
+/* Slot for a new topic: a free one, else the oldest of the lowest priority
+ * below prio (preferring ones not in flight), which is dropped */
+static qentry_t *queue_slot(mqtt_prio_t prio) {
+  qentry_t *victim = NULL;
+  for (uint32_t i = 0; i < MQTT_QUEUE_SIZE; i++) {
+    qentry_t *e = &adapter.queue[i];
+    if (e->state == QENTRY_FREE) {
+      return e;
+    }
+    if (e->prio >= prio) {
+      continue;
+    }
+    if (!victim || (e->state == QENTRY_QUEUED && victim->state != QENTRY_QUEUED) ||
+        (e->state == victim->state &&
+         (e->prio < victim->prio ||
+          (e->prio == victim->prio && e->seq < victim->seq)))) {
+      victim = e;
+    }
+  }
+  if (victim) {
+    LOG_D(MQTT_MODULE, "Queue full, dropped %s", victim->topic);
+    adapter.stats.dropped++;
+    queue_free(victim);
+  }
+  return victim;
+}
+
+static os_err_t queue_put(const char *topic, const void *payload, size_t len,
+                          const mqtt_pub_opts_t *opts) {
+  uint32_t hash = topic_hash(topic);
+  bool opts_retain = opts->retain;
+  mqtt_prio_t opts_prio = opts->prio;
+
+  /* Only the latest message per topic matters */
+  qentry_t *e = NULL;
+  for (uint32_t i = 0; i < MQTT_QUEUE_SIZE && !e; i++) {
+    qentry_t *q = &adapter.queue[i];
+    if (q->state != QENTRY_FREE && q->topic_hash == hash &&
+        strcmp(q->topic, topic) == 0) {
+      e = q;
+    }
+  }
+  if (e) {
+    /* The newer message stands in for the older: keep its retain and
+     * priority if higher */
+    adapter.stats.coalesced++;
+    if (e->state == QENTRY_QUEUED) {
+      opts_retain = opts_retain || e->retain;
+      opts_prio = e->prio > opts_prio ? e->prio : opts_prio;
+    }
+  } else {
+    e = queue_slot(opts->prio);
+    if (!e) {
+      adapter.stats.dropped++;
+      return OS_ERR_FULL;
+    }
+    strncpy(e->topic, topic, MAX_TOPIC_LEN - 1);
+    e->topic[MAX_TOPIC_LEN - 1] = '\0';
+    e->topic_hash = hash;
+    e->seq = adapter.next_seq++;
+    adapter.stats.queue_depth++;
+    if (adapter.stats.queue_depth > adapter.stats.queue_peak) {
+      adapter.stats.queue_peak = adapter.stats.queue_depth;
+    }
+  }
+
+  e->state = QENTRY_QUEUED;
+  e->qos = opts->qos;
+  e->retain = opts_retain;
+  e->prio = opts_prio;
+  e->len = (uint16_t)len;
+  if (len > 0) {
+    memcpy(e->payload, payload, len);
+  }
+  return OS_OK;
+}
+
+/* Next message to send: highest priority, then oldest */
+static qentry_t *queue_next(void) {
+  qentry_t *best = NULL;
+  for (uint32_t i = 0; i < MQTT_QUEUE_SIZE; i++) {
+    qentry_t *e = &adapter.queue[i];
+    if (e->state == QENTRY_QUEUED &&
+        (!best || e->prio > best->prio ||
+         (e->prio == best->prio && e->seq < best->seq))) {
+      best = e;
+    }
+  }
+  return best;
+}
+
+/* Move queued messages into the transmit buffer until it is full */
+static void queue_drain(void) {
+  while (adapter.state == MQTT_STATE_CONNECTED) {
+    qentry_t *e = queue_next();
+    if (!e) {
+      return;
+    }
+#ifdef OS_PLATFORM_HOST
+    uint16_t packet_id = 0;
+    os_err_t err = mqttc_publish(e->topic, e->payload, e->len, e->qos,
+                                 e->retain, &packet_id);
+#else
+    uint16_t packet_id = 0;
+    os_err_t err = OS_ERR_NOT_READY; /* Real ESP32 MQTT publish would go here */
+#endif
+    if (err == OS_ERR_FULL || err == OS_ERR_NOT_READY) {
+      return; /* Backpressure: the rest waits for the socket */
+    }
+    if (err != OS_OK) {
+      LOG_W(MQTT_MODULE, "PUB %s failed: %d", e->topic, err);
+      adapter.stats.errors++;
+      queue_free(e);
+      continue;
+    }
+
+    LOG_D(MQTT_MODULE, "PUB %s: %.*s", e->topic, (int)e->len,
+          (const char *)e->payload);
+    adapter.stats.messages_published++;
+    if (e->qos > 0) {
+      e->state = QENTRY_INFLIGHT;
+      e->packet_id = packet_id;
+    } else {
+      queue_free(e);
+    }
+  }
+}
+
+#ifdef OS_PLATFORM_HOST
+static void session_connected(void) {
+  adapter.state = MQTT_STATE_CONNECTED;
+  LOG_I(MQTT_MODULE, "Connected to %s", adapter.config.broker_uri);
+
+  mqtt_publish_status(true);
+  mqtt_subscribe_commands();
+  mqtt_snapshot_start();
+  os_event_emit(OS_EVENT_NET_UP, NULL, 0);
+}
+
+static void session_closed(os_err_t reason) {
+  bool was_connected = adapter.state == MQTT_STATE_CONNECTED;
+  adapter.state = MQTT_STATE_DISCONNECTED;
+  snapshot_stop(false);
+  if (reason != OS_OK) {
+    adapter.stats.errors++;
+  }
+
+  /* Unacknowledged QoS 1 messages go again on the next session; after our
+   * own DISCONNECT they have been delivered */
+  for (uint32_t i = 0; i < MQTT_QUEUE_SIZE; i++) {
+    qentry_t *e = &adapter.queue[i];
+    if (e->state != QENTRY_INFLIGHT) {
+      continue;
+    }
+    if (reason == OS_OK) {
+      queue_free(e);
+    } else {
+      e->state = QENTRY_QUEUED;
+      adapter.stats.retries++;
+    }
+  }
+
+  if (was_connected) {
+    os_event_emit(OS_EVENT_NET_DOWN, NULL, 0);
+  }
+}
+
+static void session_acked(uint16_t packet_id) {
+  for (uint32_t i = 0; i < MQTT_QUEUE_SIZE; i++) {
+    qentry_t *e = &adapter.queue[i];
+    if (e->state == QENTRY_INFLIGHT && e->packet_id == packet_id) {
+      queue_free(e);
+      return;
+    }
+  }
+}
+
+static void session_message(const char *topic, size_t topic_len,
+                            const uint8_t *payload, size_t len) {
+  adapter.stats.messages_received++;
+  LOG_D(MQTT_MODULE, "RX %.*s: %.*s", (int)topic_len, topic, (int)len,
+        (const char *)payload);
+  mqtt_handle_message(topic, topic_len, payload, len);
+}
+#endif
+
+/* Inbound commands */
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/* Slice bridge/<16 hex digits>/<capability>/set; nothing is copied */
+static bool match_command_topic(const char *topic, size_t len,
+                                os_eui64_t *node_addr, const char **cap_name,
+                                size_t *cap_len) {
+  static const char prefix[] = TOPIC_BASE "/";
+  static const char suffix[] = "/set";
+  const size_t prefix_len = sizeof(prefix) - 1;
+  const size_t suffix_len = sizeof(suffix) - 1;
+
+  if (len < prefix_len + 16 + 1 + 1 + suffix_len ||
+      memcmp(topic, prefix, prefix_len) != 0 ||
+      memcmp(topic + len - suffix_len, suffix, suffix_len) != 0 ||
+      topic[prefix_len + 16] != '/') {
+    return false;
+  }
+
+  os_eui64_t addr = 0;
+  for (size_t i = 0; i < 16; i++) {
+    int d = hex_digit(topic[prefix_len + i]);
+    if (d < 0) {
+      return false;
+    }
+    addr = (addr << 4) | (os_eui64_t)d;
+  }
+
+  *node_addr = addr;
+  *cap_name = topic + prefix_len + 17;
+  *cap_len = len - prefix_len - 17 - suffix_len;
+  return memchr(*cap_name, '/', *cap_len) == NULL;
+}
+
+/* Command value for the capability's type: true/false, a number, or for
+ * booleans "ON", "OFF" and "TOGGLE" */
+static os_err_t command_value(const cap_info_t *info, const mqtt_json_token_t *v,
+                              cap_command_t *cmd) {
+  cmd->cmd_type = CAP_CMD_SET;
+  switch (info->type) {
+  case CAP_VALUE_BOOL:
+    if (v->type == MQTT_JSON_TRUE || mqtt_json_equals(v, "ON")) {
+      cmd->value.b = true;
+    } else if (v->type == MQTT_JSON_FALSE || mqtt_json_equals(v, "OFF")) {
+      cmd->value.b = false;
+    } else if (mqtt_json_equals(v, "TOGGLE")) {
+      cmd->cmd_type = CAP_CMD_TOGGLE;
+    } else if (v->type == MQTT_JSON_NUMBER) {
+      int32_t n;
+      if (mqtt_json_to_fixed(v, 0, &n) != OS_OK) {
+        return OS_ERR_INVALID_ARG;
+      }
+      cmd->value.b = n != 0;
+    } else {
+      return OS_ERR_INVALID_ARG;
+    }
+    return OS_OK;
+  case CAP_VALUE_INT:
+  case CAP_VALUE_FIXED:
+    return mqtt_json_to_fixed(v, info->decimals, &cmd->value.i);
+  default:
+    return OS_ERR_INVALID_ARG;
+  }
+}
+
+os_err_t mqtt_handle_message(const char *topic, size_t topic_len,
+                             const uint8_t *payload, size_t len) {
+  if (!adapter.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+  if (!topic || (len > 0 && !payload)) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  /* HA came (back) online: it may have lost its entities, or the broker
+   * its retained configs. Discovery republishes on the event */
+  if (topic_len == sizeof(HA_STATUS_TOPIC) - 1 &&
+      memcmp(topic, HA_STATUS_TOPIC, topic_len) == 0) {
+    if (len == 6 && memcmp(payload, "online", 6) == 0) {
+      LOG_I(MQTT_MODULE, "Home Assistant online");
+      os_event_emit(OS_EVENT_HA_ONLINE, NULL, 0);
+    }
+    return OS_OK;
+  }
+
+  cap_command_t cmd = {0};
+  const char *cap_name;
+  size_t cap_len;
+  if (!match_command_topic(topic, topic_len, &cmd.node_addr, &cap_name,
+                           &cap_len)) {
+    return OS_ERR_NOT_FOUND;
+  }
+
+  os_err_t err = OS_ERR_NOT_FOUND;
+  cmd.cap_id = cap_lookup_name(cap_name, cap_len);
+  const cap_info_t *info = cap_get_info(cmd.cap_id);
+  if (cmd.cap_id != CAP_UNKNOWN && info) {
+    /* {"v": ..., "corr_id": ...}, or a bare value */
+    const char *text = (const char *)payload;
+    mqtt_json_token_t value = {0};
+    mqtt_json_iter_t it;
+    if (mqtt_json_object_begin(&it, text, len) == OS_OK) {
+      mqtt_json_token_t key;
+      mqtt_json_token_t member;
+      while ((err = mqtt_json_object_next(&it, &key, &member)) == OS_OK) {
+        if (mqtt_json_equals(&key, "v")) {
+          value = member;
+        } else if (mqtt_json_equals(&key, "corr_id") &&
+                   mqtt_json_to_u32(&member, &cmd.corr_id) != OS_OK) {
+          break;
+        }
+      }
+      err = err == OS_ERR_NOT_FOUND ? OS_OK : OS_ERR_INVALID_ARG;
+    } else {
+      err = mqtt_json_value(text, len, &value);
+    }
+
+    if (err == OS_OK) {
+      err = value.type == MQTT_JSON_NONE ? OS_ERR_INVALID_ARG
+                                         : command_value(info, &value, &cmd);
+    }
+    if (err == OS_OK) {
+      err = cap_execute_command(&cmd);
+    }
+  }
+
+  if (err != OS_OK) {
+    LOG_W(MQTT_MODULE, "Command %.*s rejected: %d", (int)topic_len, topic, err);
+    adapter.stats.commands_rejected++;
+    return err;
+  }
+  adapter.stats.commands++;
+  return OS_OK;
+}
+
+/* State topics */
+
+static void format_prefix(os_eui64_t node_addr, char *out) {
+  static const char hex[] = "0123456789ABCDEF";
+  memcpy(out, TOPIC_BASE "/", sizeof(TOPIC_BASE));
+  char *p = out + sizeof(TOPIC_BASE);
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    *p++ = hex[(node_addr >> shift) & 0xF];
+  }
+  *p = '/';
+}
+
+static void build_suffixes(void) {
+  for (uint32_t id = 0; id < CAP_MAX; id++) {
+    const cap_info_t *info = cap_get_info((cap_id_t)id);
+    topic_suffix_t *sfx = &adapter.suffixes[id];
+    int n = snprintf(sfx->text, sizeof(sfx->text), "%s/state",
+                     info ? info->name : "unknown");
+    sfx->len = n > 0 && n < (int)sizeof(sfx->text) ? (uint8_t)n : 0;
+  }
+}
+
+/* "bridge/<node_id>/" for a node, from the slot cache when registered */
+static const char *node_prefix(os_eui64_t node_addr, char *scratch) {
+  int32_t slot = reg_node_slot(reg_find_node(node_addr));
+  if (slot < 0) {
+    format_prefix(node_addr, scratch);
+    return scratch;
+  }
+  topic_prefix_t *prefix = &adapter.prefixes[slot];
+  if (!prefix->valid || prefix->node_addr != node_addr) {
+    format_prefix(node_addr, prefix->text);
+    prefix->node_addr = node_addr;
+    prefix->valid = true;
+  }
+  return prefix->text;
+}
+
+static void write_value(mqtt_json_writer_t *w, const cap_info_t *info,
+                        const cap_value_t *value) {
+  switch (info->type) {
+  case CAP_VALUE_BOOL:
+    mqtt_json_write_bool(w, value->b);
+    break;
+  case CAP_VALUE_INT:
+    mqtt_json_write_int(w, value->i);
+    break;
+  case CAP_VALUE_FIXED:
+    mqtt_json_write_fixed(w, value->i, info->decimals);
+    break;
+  default:
+    mqtt_json_write_string(w, value->str);
+    break;
+  }
+}
+
+static os_err_t format_state(os_eui64_t node_addr, cap_id_t cap_id,
+                             const cap_value_t *value, os_tick_t ts, char *topic,
+                             size_t topic_size, char *payload,
+                             size_t payload_size, size_t *payload_len) {
+  const cap_info_t *info = cap_get_info(cap_id);
+  if (!info || !value || !topic || !payload) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  /* Topic: bridge/<node_id>/<capability>/state */
+  const topic_suffix_t *sfx = &adapter.suffixes[cap_id];
+  if (sfx->len == 0 || topic_size <= NODE_PREFIX_LEN + sfx->len) {
+    return OS_ERR_NO_MEM;
+  }
+  char scratch[NODE_PREFIX_LEN];
+  memcpy(topic, node_prefix(node_addr, scratch), NODE_PREFIX_LEN);
+  memcpy(topic + NODE_PREFIX_LEN, sfx->text, sfx->len);
+  topic[NODE_PREFIX_LEN + sfx->len] = '\0';
+
+  /* Payload: {"v":<value>,"ts":<ticks>} */
+  mqtt_json_writer_t w;
+  mqtt_json_writer_init(&w, payload, payload_size);
+  mqtt_json_write_object_begin(&w);
+  mqtt_json_write_key(&w, "v");
+  write_value(&w, info, value);
+  mqtt_json_write_key(&w, "ts");
+  mqtt_json_write_uint(&w, ts);
+  mqtt_json_write_object_end(&w);
+
+  int n = mqtt_json_writer_finish(&w);
+  if (n < 0) {
+    return OS_ERR_NO_MEM;
+  }
+  if (payload_len) {
+    *payload_len = (size_t)n;
+  }
+  return OS_OK;
+}
+
+os_err_t mqtt_format_state(os_eui64_t node_addr, cap_id_t cap_id,
+                           const cap_value_t *value, char *topic,
+                           size_t topic_size, char *payload,
+                           size_t payload_size, size_t *payload_len) {
+  if (!adapter.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+  return format_state(node_addr, cap_id, value, os_now_ticks(), topic,
+                      topic_size, payload, payload_size, payload_len);
+}
+
+/* Aggregate state */
+
+static os_err_t format_node_state(const reg_node_t *node, char *topic,
+                                  size_t topic_size, char *payload,
+                                  size_t payload_size, size_t *payload_len) {
+  /* Topic: bridge/<node_id>/state */
+  if (topic_size < NODE_PREFIX_LEN + sizeof("state")) {
+    return OS_ERR_NO_MEM;
+  }
+  char scratch[NODE_PREFIX_LEN];
+  memcpy(topic, node_prefix(node->ieee_addr, scratch), NODE_PREFIX_LEN);
+  memcpy(topic + NODE_PREFIX_LEN, "state", sizeof("state"));
+
+  /* Payload: {"<capability>":<value>,...,"ts":<newest report>} */
+  mqtt_json_writer_t w;
+  mqtt_json_writer_init(&w, payload, payload_size);
+  mqtt_json_write_object_begin(&w);
+  uint32_t mask = cap_get_mask(node);
+  uint32_t count = 0;
+  os_tick_t ts = 0;
+  for (uint32_t id = 0; id < CAP_MAX; id++) {
+    cap_state_t state;
+    if (!(mask & (1UL << id)) ||
+        cap_get_state_by_node(node, (cap_id_t)id, &state) != OS_OK ||
+        !state.valid) {
+      continue;
+    }
+    const cap_info_t *info = cap_get_info((cap_id_t)id);
+    mqtt_json_write_key(&w, info->name);
+    write_value(&w, info, &state.value);
+    if (count++ == 0 || (int32_t)(state.timestamp - ts) > 0) {
+      ts = state.timestamp;
+    }
+  }
+  if (count == 0) {
+    return OS_ERR_NOT_FOUND;
+  }
+  mqtt_json_write_key(&w, "ts");
+  mqtt_json_write_uint(&w, ts);
+  mqtt_json_write_object_end(&w);
+
+  int n = mqtt_json_writer_finish(&w);
+  if (n < 0) {
+    return OS_ERR_NO_MEM;
+  }
+  if (payload_len) {
+    *payload_len = (size_t)n;
+  }
+  return OS_OK;
+}
+
+os_err_t mqtt_format_node_state(os_eui64_t node_addr, char *topic,
+                                size_t topic_size, char *payload,
+                                size_t payload_size, size_t *payload_len) {
+  if (!adapter.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+  if (!topic || !payload) {
+    return OS_ERR_INVALID_ARG;
+  }
+  reg_node_t *node = reg_find_node(node_addr);
+  if (!node) {
+    return OS_ERR_NOT_FOUND;
+  }
+  return format_node_state(node, topic, topic_size, payload, payload_size,
+                           payload_len);
+}
+
+/* Queue a node's document; one too large for a queue slot goes out per
+ * capability instead */
+static os_err_t publish_node_state(const reg_node_t *node) {
+  char topic[MAX_TOPIC_LEN];
+  char payload[MQTT_QUEUE_PAYLOAD_MAX + 1];
+  size_t len;
+  os_err_t err = format_node_state(node, topic, sizeof(topic), payload,
+                                   sizeof(payload), &len);
+  if (err == OS_OK) {
+    return mqtt_publish_ex(topic, payload, len, &state_opts);
+  }
+  if (err != OS_ERR_NO_MEM) {
+    return err;
+  }
+
+  LOG_W(MQTT_MODULE, "State of " OS_EUI64_FMT " too large, sent per capability",
+        OS_EUI64_ARG(node->ieee_addr));
+  uint32_t mask = cap_get_mask(node);
+  for (uint32_t id = 0; id < CAP_MAX; id++) {
+    cap_state_t state;
+    if ((mask & (1UL << id)) &&
+        cap_get_state_by_node(node, (cap_id_t)id, &state) == OS_OK &&
+        state.valid) {
+      mqtt_publish_state(node->ieee_addr, (cap_id_t)id, &state.value);
+    }
+  }
+  return OS_OK;
+}
+
+/* A change to a node: open its merge window, or ride in the open one */
+static bool aggregate_mark(os_eui64_t node_addr) {
+  int32_t slot = reg_node_slot(reg_find_node(node_addr));
+  if (slot < 0) {
+    return false; /* No cached state to build from */
+  }
+  agg_slot_t *agg = &adapter.agg[slot];
+  if (agg->pending) {
+    adapter.stats.merged++;
+    return true;
+  }
+  uint32_t window = adapter.config.merge_window_ms
+                        ? adapter.config.merge_window_ms
+                        : MQTT_MERGE_WINDOW_DEFAULT_MS;
+  agg->pending = true;
+  agg->due = os_now_ticks() + OS_MS_TO_TICKS(window);
+  adapter.agg_pending++;
+  return true;
+}
+
+/* Publish documents whose window has closed (all of them if flush) */
+static void aggregate_step(bool flush) {
+  if (adapter.agg_pending == 0) {
+    return;
+  }
+  os_tick_t now = os_now_ticks();
+  for (uint32_t slot = 0; slot < REG_MAX_NODES && adapter.agg_pending > 0;
+       slot++) {
+    agg_slot_t *agg = &adapter.agg[slot];
+    if (!agg->pending || (!flush && (int32_t)(now - agg->due) < 0)) {
+      continue;
+    }
+    agg->pending = false;
+    adapter.agg_pending--;
+    reg_node_t *node = reg_get_node_by_slot(slot);
+    if (node) {
+      publish_node_state(node);
+    }
+  }
+}
+
+os_err_t mqtt_set_state_mode(mqtt_state_mode_t mode) {
+  if (!adapter.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+  if (mode != MQTT_STATE_MODE_PER_CAP && mode != MQTT_STATE_MODE_AGGREGATE) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (mode == MQTT_STATE_MODE_PER_CAP) {
+    aggregate_step(true);
+  }
+  adapter.config.state_mode = mode;
+  return OS_OK;
+}
+
+mqtt_state_mode_t mqtt_get_state_mode(void) { return adapter.config.state_mode; }
+
+/* State snapshot */
+
+static void snapshot_stop(bool completed) {
+  snapshot_t *snap = &adapter.snapshot;
+  if (!snap->active) {
+    return;
+  }
+  snap->active = false;
+  snap->stats.active = false;
+  snap->stats.elapsed_ms = OS_TICKS_TO_MS(os_now_ticks() - snap->started);
+  if (completed) {
+    snap->stats.completed++;
+    LOG_I(MQTT_MODULE, "Snapshot: %" PRIu32 " states from %" PRIu32
+          " nodes in %" PRIu32 " ms", snap->stats.published,
+          snap->stats.nodes_done, snap->stats.elapsed_ms);
+  } else {
+    snap->stats.aborted++;
+    LOG_W(MQTT_MODULE, "Snapshot aborted after %" PRIu32 " states",
+          snap->stats.published);
+  }
+}
+
+/* Next valid cached state at or after the cursor */
+static reg_node_t *snapshot_peek(cap_state_t *state) {
+  snapshot_t *snap = &adapter.snapshot;
+  for (; snap->slot < REG_MAX_NODES; snap->slot++, snap->cap = 0) {
+    reg_node_t *node = reg_get_node_by_slot(snap->slot);
+    if (!node) {
+      continue;
+    }
+    uint32_t mask = cap_get_mask(node);
+    for (; snap->cap < CAP_MAX; snap->cap++) {
+      if ((mask & (1UL << snap->cap)) &&
+          cap_get_state_by_node(node, (cap_id_t)snap->cap, state) == OS_OK &&
+          state->valid) {
+        return node;
+      }
+    }
+    snap->stats.nodes_done++;
+  }
+  return NULL;
+}
+
+/* Queue as many snapshot messages as the credit and the queue allow */
+static void snapshot_step(void) {
+  snapshot_t *snap = &adapter.snapshot;
+  if (!snap->active || adapter.state != MQTT_STATE_CONNECTED) {
+    return;
+  }
+
+  os_tick_t now = os_now_ticks();
+  uint32_t rate = adapter.config.snapshot_rate ? adapter.config.snapshot_rate
+                                               : MQTT_SNAPSHOT_RATE_DEFAULT;
+  uint64_t credit = snap->credit +
+                    (uint64_t)OS_TICKS_TO_MS(now - snap->last_tick) * rate;
+  snap->credit = credit > MQTT_SNAPSHOT_BURST * 1000u
+                     ? MQTT_SNAPSHOT_BURST * 1000u
+                     : (uint32_t)credit;
+  snap->last_tick = now;
+  snap->stats.elapsed_ms = OS_TICKS_TO_MS(now - snap->started);
+
+  const mqtt_pub_opts_t opts = {.qos = 1, .retain = true, .prio = MQTT_PRIO_LOW};
+  while (snap->credit >= 1000) {
+    if (adapter.stats.queue_depth >= MQTT_SNAPSHOT_QUEUE_LIMIT) {
+      snap->stats.throttled++;
+      return;
+    }
+    cap_state_t state;
+    reg_node_t *node = snapshot_peek(&state);
+    if (!node) {
+      snapshot_stop(true);
+      return;
+    }
+
+    /* One message per state, or per node in aggregate mode */
+    bool aggregate = adapter.config.state_mode == MQTT_STATE_MODE_AGGREGATE;
+    char topic[MAX_TOPIC_LEN];
+    char payload[MQTT_QUEUE_PAYLOAD_MAX + 1];
+    size_t len;
+    os_err_t err =
+        aggregate ? format_node_state(node, topic, sizeof(topic), payload,
+                                      sizeof(payload), &len)
+                  : format_state(node->ieee_addr, (cap_id_t)snap->cap,
+                                 &state.value, state.timestamp, topic,
+                                 sizeof(topic), payload, sizeof(payload), &len);
+    if (err == OS_OK) {
+      err = queue_put(topic, payload, len, &opts);
+      if (err == OS_ERR_FULL) {
+        return; /* Same state again on the next poll */
+      }
+      snap->stats.published++;
+      snap->credit -= 1000;
+    }
+    snap->cap = aggregate ? CAP_MAX : snap->cap + 1;
+  }
+}
+
+os_err_t mqtt_snapshot_start(void) {
+  if (!adapter.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+  if (adapter.state != MQTT_STATE_CONNECTED) {
+    return OS_ERR_NOT_READY;
+  }
+
+  snapshot_t *snap = &adapter.snapshot;
+  snap->active = true;
+  snap->slot = 0;
+  snap->cap = 0;
+  snap->credit = 0;
+  snap->started = os_now_ticks();
+  snap->last_tick = snap->started;
+  snap->stats.active = true;
+  snap->stats.runs++;
+  snap->stats.nodes_total = reg_node_count();
+  snap->stats.nodes_done = 0;
+  snap->stats.published = 0;
+  snap->stats.throttled = 0;
+  snap->stats.elapsed_ms = 0;
+  return OS_OK;
+}
+
+os_err_t mqtt_get_snapshot_stats(mqtt_snapshot_stats_t *stats) {
+  if (!adapter.initialized || !stats) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  *stats = adapter.snapshot.stats;
+  return OS_OK;
+}
 
 os_err_t mqtt_init(const mqtt_config_t *config) {
   if (adapter.initialized) {
@@ -64,6 +926,7 @@ os_err_t mqtt_init(const mqtt_config_t *config) {
   }
 
   adapter.state = MQTT_STATE_DISCONNECTED;
+  build_suffixes();
   adapter.initialized = true;
 
   /* Subscribe to capability state changes */
@@ -82,21 +945,40 @@ os_err_t mqtt_connect(void) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
-  if (adapter.state == MQTT_STATE_CONNECTED) {
+  if (adapter.state == MQTT_STATE_CONNECTED ||
+      adapter.state == MQTT_STATE_CONNECTING) {
     return OS_OK;
   }
 
   LOG_I(MQTT_MODULE, "Connecting to %s...", adapter.config.broker_uri);
-  adapter.state = MQTT_STATE_CONNECTING;
 
 #ifdef OS_PLATFORM_HOST
-  /* Simulate connection */
-  adapter.state = MQTT_STATE_CONNECTED;
-  LOG_I(MQTT_MODULE, "Connected (simulated)");
+  mqttc_options_t options = {
+      .client_id = adapter.config.client_id,
+      .username = adapter.config.username,
+      .password = adapter.config.password,
+      .keepalive_sec = adapter.config.keepalive_sec,
+      .will_topic = STATUS_TOPIC,
+      .will_payload = STATUS_OFFLINE,
+      .will_retain = true,
+  };
+  mqttc_callbacks_t callbacks = {
+      .connected = session_connected,
+      .closed = session_closed,
+      .message = session_message,
+      .acked = session_acked,
+  };
 
-  /* Publish online status */
-  mqtt_publish_status(true);
+  /* CONNACK completes the connection in mqtt_poll() */
+  adapter.state = MQTT_STATE_CONNECTING;
+  os_err_t err = mqttc_open(adapter.config.broker_uri, &options, &callbacks);
+  if (err != OS_OK) {
+    adapter.state = MQTT_STATE_DISCONNECTED;
+    adapter.stats.errors++;
+    return err;
+  }
 #else
+  adapter.state = MQTT_STATE_CONNECTING;
   /* Real ESP32 MQTT implementation would go here */
 #endif
 
@@ -109,8 +991,15 @@ os_err_t mqtt_disconnect(void) {
   }
 
   /* Publish offline status before disconnect */
-  mqtt_publish_status(false);
+  snapshot_stop(false);
+  if (adapter.state == MQTT_STATE_CONNECTED) {
+    mqtt_publish_status(false);
+    queue_drain();
+  }
 
+#ifdef OS_PLATFORM_HOST
+  mqttc_close(true);
+#endif
   adapter.state = MQTT_STATE_DISCONNECTED;
   LOG_I(MQTT_MODULE, "Disconnected");
 
@@ -121,64 +1010,53 @@ mqtt_state_t mqtt_get_state(void) { return adapter.state; }
 
 os_err_t mqtt_publish_state(os_eui64_t node_addr, cap_id_t cap_id,
                             const cap_value_t *value) {
-  if (!adapter.initialized || adapter.state != MQTT_STATE_CONNECTED) {
-    return OS_ERR_NOT_INITIALIZED;
-  }
-
-  const cap_info_t *info = cap_get_info(cap_id);
-  if (!info) {
-    return OS_ERR_INVALID_ARG;
-  }
-
-  /* Build topic: bridge/<node_id>/<capability>/state */
   char topic[MAX_TOPIC_LEN];
-  snprintf(topic, sizeof(topic), TOPIC_BASE "/" OS_EUI64_FMT "/%s/state",
-           OS_EUI64_ARG(node_addr), info->name);
-
-  /* Build payload */
   char payload[MAX_PAYLOAD_LEN];
-  switch (info->type) {
-  case CAP_VALUE_BOOL:
-    snprintf(payload, sizeof(payload), "{\"v\":%s,\"ts\":%" PRIu32 "}",
-             value->b ? "true" : "false", os_now_ticks());
-    break;
-  case CAP_VALUE_INT:
-    snprintf(payload, sizeof(payload), "{\"v\":%" PRId32 ",\"ts\":%" PRIu32 "}",
-             value->i, os_now_ticks());
-    break;
-  case CAP_VALUE_FLOAT:
-    snprintf(payload, sizeof(payload), "{\"v\":%.2f,\"ts\":%" PRIu32 "}",
-             (double)value->f, os_now_ticks());
-    break;
-  default:
-    snprintf(payload, sizeof(payload), "{\"v\":\"%s\",\"ts\":%" PRIu32 "}",
-             value->str, os_now_ticks());
-    break;
+  size_t len;
+  os_err_t err = mqtt_format_state(node_addr, cap_id, value, topic,
+                                   sizeof(topic), payload, sizeof(payload),
+                                   &len);
+  if (err != OS_OK) {
+    return err;
   }
 
-  return mqtt_publish(topic, payload, strlen(payload));
+  return mqtt_publish_ex(topic, payload, len, &state_opts);
 }
 
 os_err_t mqtt_publish_meta(os_eui64_t node_addr, const char *manufacturer,
                            const char *model) {
-  if (!adapter.initialized || adapter.state != MQTT_STATE_CONNECTED) {
+  if (!adapter.initialized) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
-  /* Build topic: bridge/<node_id>/meta */
+  /* Topic: bridge/<node_id>/meta */
   char topic[MAX_TOPIC_LEN];
-  snprintf(topic, sizeof(topic), TOPIC_BASE "/" OS_EUI64_FMT "/meta",
-           OS_EUI64_ARG(node_addr));
+  char scratch[NODE_PREFIX_LEN];
+  memcpy(topic, node_prefix(node_addr, scratch), NODE_PREFIX_LEN);
+  memcpy(topic + NODE_PREFIX_LEN, "meta", sizeof("meta"));
 
-  /* Build payload */
+  /* Payload: {"ieee":"<node_id>","manufacturer":...,"model":...} */
+  char ieee[17];
+  memcpy(ieee, topic + sizeof(TOPIC_BASE), 16);
+  ieee[16] = '\0';
   char payload[MAX_PAYLOAD_LEN];
-  snprintf(payload, sizeof(payload),
-           "{\"ieee\":\"" OS_EUI64_FMT
-           "\",\"manufacturer\":\"%s\",\"model\":\"%s\"}",
-           OS_EUI64_ARG(node_addr), manufacturer ? manufacturer : "",
-           model ? model : "");
+  mqtt_json_writer_t w;
+  mqtt_json_writer_init(&w, payload, sizeof(payload));
+  mqtt_json_write_object_begin(&w);
+  mqtt_json_write_key(&w, "ieee");
+  mqtt_json_write_string(&w, ieee);
+  mqtt_json_write_key(&w, "manufacturer");
+  mqtt_json_write_string(&w, manufacturer);
+  mqtt_json_write_key(&w, "model");
+  mqtt_json_write_string(&w, model);
+  mqtt_json_write_object_end(&w);
+  int len = mqtt_json_writer_finish(&w);
+  if (len < 0) {
+    return OS_ERR_NO_MEM;
+  }
 
-  return mqtt_publish(topic, payload, strlen(payload));
+  const mqtt_pub_opts_t opts = {.qos = 1, .prio = MQTT_PRIO_LOW};
+  return mqtt_publish_ex(topic, payload, (size_t)len, &opts);
 }
 
 os_err_t mqtt_publish_status(bool online) {
@@ -186,29 +1064,45 @@ os_err_t mqtt_publish_status(bool online) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
-  char topic[MAX_TOPIC_LEN];
-  snprintf(topic, sizeof(topic), TOPIC_BASE "/status");
-
-  char payload[64];
-  snprintf(payload, sizeof(payload), "{\"v\":\"%s\"}",
-           online ? "online" : "offline");
-
-  return mqtt_publish(topic, payload, strlen(payload));
+  const char *payload = online ? STATUS_ONLINE : STATUS_OFFLINE;
+  const mqtt_pub_opts_t opts = {.qos = 1, .retain = true, .prio = MQTT_PRIO_HIGH};
+  return mqtt_publish_ex(STATUS_TOPIC, payload, strlen(payload), &opts);
 }
 
 os_err_t mqtt_publish(const char *topic, const void *payload, size_t len) {
+  const mqtt_pub_opts_t opts = {.prio = MQTT_PRIO_NORMAL};
+  return mqtt_publish_ex(topic, payload, len, &opts);
+}
+
+os_err_t mqtt_publish_ex(const char *topic, const void *payload, size_t len,
+                         const mqtt_pub_opts_t *opts) {
   if (!adapter.initialized) {
     return OS_ERR_NOT_INITIALIZED;
   }
+  if (!topic || !opts || (len > 0 && !payload) || opts->qos > 1 ||
+      strlen(topic) >= MAX_TOPIC_LEN) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  if (len <= MQTT_QUEUE_PAYLOAD_MAX) {
+    return queue_put(topic, payload, len, opts);
+  }
 
+  /* Too large to queue: straight to the transmit buffer */
   if (adapter.state != MQTT_STATE_CONNECTED) {
     LOG_W(MQTT_MODULE, "Not connected, cannot publish");
     return OS_ERR_BUSY;
   }
 
 #ifdef OS_PLATFORM_HOST
-  /* Simulate publish - just log */
-  LOG_I(MQTT_MODULE, "PUB %s: %.*s", topic, (int)len, (const char *)payload);
+  os_err_t err = mqttc_publish(topic, payload, len, 0, opts->retain, NULL);
+  if (err != OS_OK) {
+    LOG_W(MQTT_MODULE, "PUB %s failed: %d", topic, err);
+    adapter.stats.errors++;
+    return err;
+  }
+  mqttc_flush();
+  LOG_D(MQTT_MODULE, "PUB %s: %.*s", topic, (int)len, (const char *)payload);
 #else
   /* Real ESP32 MQTT publish would go here */
 #endif
@@ -217,6 +1111,57 @@ os_err_t mqtt_publish(const char *topic, const void *payload, size_t len) {
   return OS_OK;
 }
 
+os_err_t mqtt_publish_begin(const char *topic, const mqtt_pub_opts_t *opts,
+                            char **payload, size_t *room) {
+  if (!adapter.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+  if (!topic || !opts || !payload || !room ||
+      strlen(topic) >= MAX_TOPIC_LEN) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (adapter.state != MQTT_STATE_CONNECTED) {
+    return OS_ERR_BUSY;
+  }
+
+#ifdef OS_PLATFORM_HOST
+  /* QoS 0 like any publish too large to queue: nothing keeps it for a
+   * resend */
+  os_err_t err = mqttc_publish_begin(topic, 0, opts->retain, payload, room);
+  if (err != OS_OK) {
+    LOG_W(MQTT_MODULE, "PUB %s failed: %d", topic, err);
+    adapter.stats.errors++;
+  }
+  return err;
+#else
+  /* Real ESP32 MQTT client would lend its outbox buffer here */
+  (void)opts;
+  return OS_ERR_NOT_READY;
+#endif
+}
+
+os_err_t mqtt_publish_end(size_t len) {
+#ifdef OS_PLATFORM_HOST
+  os_err_t err = mqttc_publish_end(len, NULL);
+  if (err != OS_OK) {
+    adapter.stats.errors++;
+    return err;
+  }
+  mqttc_flush();
+#else
+  (void)len;
+#endif
+
+  adapter.stats.messages_published++;
+  return OS_OK;
+}
+
+void mqtt_publish_abort(void) {
+#ifdef OS_PLATFORM_HOST
+  mqttc_publish_abort();
+#endif
+}
+
 os_err_t mqtt_subscribe_commands(void) {
   if (!adapter.initialized || adapter.state != MQTT_STATE_CONNECTED) {
     return OS_ERR_NOT_INITIALIZED;
@@ -229,8 +1174,14 @@ os_err_t mqtt_subscribe_commands(void) {
   LOG_I(MQTT_MODULE, "Subscribing to %s", topic);
 
 #ifdef OS_PLATFORM_HOST
-  /* Simulate subscribe */
-  LOG_D(MQTT_MODULE, "Subscribed (simulated)");
+  os_err_t err = mqttc_subscribe(HA_STATUS_TOPIC, 1);
+  if (err == OS_OK) {
+    err = mqttc_subscribe(topic, 1);
+  }
+  if (err != OS_OK) {
+    adapter.stats.errors++;
+    return err;
+  }
 #else
   /* Real ESP32 MQTT subscribe would go here */
 #endif
@@ -244,28 +1195,59 @@ os_err_t mqtt_get_stats(mqtt_stats_t *stats) {
   }
 
   *stats = adapter.stats;
+#ifdef OS_PLATFORM_HOST
+  mqttc_stats_t transport;
+  mqttc_get_stats(&transport);
+  stats->bytes_sent = transport.bytes_sent;
+  stats->bytes_received = transport.bytes_received;
+  stats->writes = transport.writes;
+  stats->partial_writes = transport.partial_writes;
+  stats->tx_backlog = transport.tx_backlog;
+  stats->tx_backlog_peak = transport.tx_backlog_peak;
+#endif
   return OS_OK;
 }
 
+void mqtt_poll(void) {
+  if (!adapter.initialized) {
+    return;
+  }
+#ifdef OS_PLATFORM_HOST
+  mqttc_poll();
+  aggregate_step(false);
+  snapshot_step();
+  queue_drain();
+  mqttc_flush();
+#else
+  aggregate_step(false);
+  snapshot_step();
+  queue_drain();
+#endif
+}
+
 void mqtt_task(void *arg) {
   (void)arg;
 
   LOG_I(MQTT_MODULE, "MQTT task started");
 
-  /* Initial connect */
+  /* Initial connect; commands are subscribed once the broker accepts */
   os_sleep(1000); /* Wait for system to stabilize */
   mqtt_connect();
-  mqtt_subscribe_commands();
+  os_tick_t last_attempt = os_now_ticks();
 
   while (1) {
     /* Check connection and reconnect if needed */
-    if (adapter.state == MQTT_STATE_DISCONNECTED) {
+    if (adapter.state == MQTT_STATE_DISCONNECTED &&
+        os_now_ticks() - last_attempt >=
+            OS_MS_TO_TICKS(MQTT_RECONNECT_INTERVAL_MS)) {
       LOG_I(MQTT_MODULE, "Reconnecting...");
       adapter.stats.reconnects++;
+      last_attempt = os_now_ticks();
       mqtt_connect();
     }
 
-    os_sleep(5000);
+    mqtt_poll();
+    os_sleep(MQTT_POLL_INTERVAL_MS);
   }
 }
 
@@ -280,17 +1262,25 @@ const char *mqtt_state_name(mqtt_state_t state) {
 static void handle_cap_state_changed(const os_event_t *event, void *ctx) {
   (void)ctx;
 
-  if (event->type != OS_EVENT_CAP_STATE_CHANGED) {
+  /* State is published retained, so a malformed event would leave a
+   * bogus message on the broker */
+  cap_state_event_t ev;
+  if (event->type != OS_EVENT_CAP_STATE_CHANGED ||
+      event->payload_len < sizeof(ev)) {
+    return;
+  }
+  memcpy(&ev, event->payload, sizeof(ev));
+  if (ev.cap_id == CAP_UNKNOWN || ev.cap_id >= CAP_MAX) {
     return;
   }
 
-  /* Extract payload */
-  struct {
-    os_eui64_t node_addr;
-    cap_id_t cap_id;
-    cap_value_t value;
-  } *payload = (void *)event->payload;
-
-  /* Publish to MQTT */
-  mqtt_publish_state(payload->node_addr, payload->cap_id, &payload->value);
+  /* Publish to MQTT; in aggregate mode the node's document follows once
+   * the merge window closes */
+  if (adapter.config.state_mode == MQTT_STATE_MODE_AGGREGATE &&
+      aggregate_mark(ev.node_addr)) {
+    return;
+  }
+  cap_value_t value = {0};
+  memcpy(&value, &ev.value, sizeof(ev.value));
+  mqtt_publish_state(ev.node_addr, ev.cap_id, &value);
 }
@@ -5,10 +5,16 @@
  * ESP32-C6 Zigbee Bridge OS - MQTT northbound adapter
  * 
  * Topic scheme:
- * - State:   bridge/<node_id>/<capability>/state
+ * - State:   bridge/<node_id>/<capability>/state, or in aggregate mode
+ *            bridge/<node_id>/state holding every capability of the node
+ *            (retained)
  * - Command: bridge/<node_id>/<capability>/set
  * - Meta:    bridge/<node_id>/meta
- * - Status:  bridge/status
+ * - Status:  bridge/status (retained; also the will, so a lost
+ *            connection reads "offline")
+ *
+ * After every connect a snapshot republishes the cached state of every
+ * capability, retained, paced to a messages-per-second budget.
  */
 
 #ifndef MQTT_ADAPTER_H
@@ -29,6 +35,41 @@ typedef enum {
     MQTT_STATE_ERROR,
 } mqtt_state_t;
 
+/* Outbound queue: distinct topics held, and the largest payload queued
+ * (larger ones are written directly and need a connection) */
+#define MQTT_QUEUE_SIZE         32
+#define MQTT_QUEUE_PAYLOAD_MAX  256
+
+/* Drain priority; after a reconnect higher priorities go first */
+typedef enum {
+    MQTT_PRIO_LOW = 0,
+    MQTT_PRIO_NORMAL,
+    MQTT_PRIO_HIGH,
+} mqtt_prio_t;
+
+/* State topic layout */
+typedef enum {
+    MQTT_STATE_MODE_PER_CAP = 0,    /* One topic per capability */
+    MQTT_STATE_MODE_AGGREGATE,      /* One document per node */
+} mqtt_state_mode_t;
+
+/* Aggregate mode: how long changes to one node are collected before its
+ * document goes out */
+#define MQTT_MERGE_WINDOW_DEFAULT_MS 50
+
+/* Snapshot after connect: default pace, the most messages one poll may
+ * catch up, and the queue depth it waits at so live changes keep room */
+#define MQTT_SNAPSHOT_RATE_DEFAULT  50
+#define MQTT_SNAPSHOT_BURST         8
+#define MQTT_SNAPSHOT_QUEUE_LIMIT   (MQTT_QUEUE_SIZE / 2)
+
+/* Publish options */
+typedef struct {
+    uint8_t qos;                    /* 0 or 1 */
+    bool retain;
+    mqtt_prio_t prio;
+} mqtt_pub_opts_t;
+
 /* MQTT configuration */
 typedef struct {
     const char *broker_uri;
@@ -36,6 +77,9 @@ typedef struct {
     const char *username;
     const char *password;
     uint16_t keepalive_sec;
+    uint16_t snapshot_rate;         /* Messages/s; 0: MQTT_SNAPSHOT_RATE_DEFAULT */
+    mqtt_state_mode_t state_mode;
+    uint16_t merge_window_ms;       /* 0: MQTT_MERGE_WINDOW_DEFAULT_MS */
 } mqtt_config_t;
 
 /* MQTT statistics */
@@ -44,8 +88,35 @@ typedef struct {
     uint32_t messages_received;
     uint32_t reconnects;
     uint32_t errors;
+    uint32_t queue_depth;           /* Messages queued or awaiting PUBACK */
+    uint32_t queue_peak;
+    uint32_t coalesced;             /* Replaced by a newer message on the topic */
+    uint32_t dropped;               /* Evicted or refused by a full queue */
+    uint32_t retries;               /* QoS 1 messages resent after a reconnect */
+    uint32_t merged;                /* Aggregate: changes folded into a pending document */
+    uint32_t commands;              /* Set messages passed to cap_execute_command */
+    uint32_t commands_rejected;     /* Set messages with a bad node, capability or value */
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+    uint32_t writes;                /* Socket writes (each may carry many packets) */
+    uint32_t partial_writes;        /* Socket writes that took part of the buffer */
+    uint32_t tx_backlog;            /* Bytes waiting for the socket */
+    uint32_t tx_backlog_peak;
 } mqtt_stats_t;
 
+/* Snapshot progress; the per-run counts describe the current or last run */
+typedef struct {
+    bool active;
+    uint32_t runs;                  /* Started */
+    uint32_t completed;
+    uint32_t aborted;               /* Cut short by a disconnect */
+    uint32_t nodes_total;           /* Registered when the run started */
+    uint32_t nodes_done;            /* Walked so far */
+    uint32_t published;             /* State messages queued */
+    uint32_t throttled;             /* Polls that stopped at the queue limit */
+    uint32_t elapsed_ms;            /* Running time, or duration once done */
+} mqtt_snapshot_stats_t;
+
 /**
  * @brief Initialize MQTT adapter
  * @param config Configuration
@@ -80,6 +151,64 @@ mqtt_state_t mqtt_get_state(void);
  */
 os_err_t mqtt_publish_state(os_eui64_t node_addr, cap_id_t cap_id, const cap_value_t *value);
 
+/**
+ * @brief Format a capability state message
+ *
+ * Topic bridge/<node_id>/<capability>/state, payload {"v":...,"ts":...};
+ * built without printf. This is what mqtt_publish_state() queues.
+ *
+ * @param node_addr Node IEEE address
+ * @param cap_id Capability ID
+ * @param value Capability value
+ * @param topic Output topic
+ * @param topic_size Topic buffer size
+ * @param payload Output payload
+ * @param payload_size Payload buffer size
+ * @param payload_len Output payload length (optional)
+ * @return OS_OK on success, OS_ERR_NO_MEM if a buffer is too small
+ */
+os_err_t mqtt_format_state(os_eui64_t node_addr, cap_id_t cap_id,
+                           const cap_value_t *value, char *topic,
+                           size_t topic_size, char *payload,
+                           size_t payload_size, size_t *payload_len);
+
+/**
+ * @brief Format a node's aggregate state document
+ *
+ * Topic bridge/<node_id>/state, payload {"<capability>":<value>,...,
+ * "ts":...} with every valid cached capability value; "ts" is the newest
+ * report among them.
+ *
+ * @param node_addr Node IEEE address
+ * @param topic Output topic
+ * @param topic_size Topic buffer size
+ * @param payload Output payload
+ * @param payload_size Payload buffer size
+ * @param payload_len Output payload length (optional)
+ * @return OS_OK on success, OS_ERR_NOT_FOUND if the node is unknown or has
+ *         no valid state, OS_ERR_NO_MEM if a buffer is too small
+ */
+os_err_t mqtt_format_node_state(os_eui64_t node_addr, char *topic,
+                                size_t topic_size, char *payload,
+                                size_t payload_size, size_t *payload_len);
+
+/**
+ * @brief Select the state topic layout
+ *
+ * Leaving aggregate mode publishes any documents still in their merge
+ * window.
+ *
+ * @param mode State mode
+ * @return OS_OK on success
+ */
+os_err_t mqtt_set_state_mode(mqtt_state_mode_t mode);
+
+/**
+ * @brief Get the state topic layout
+ * @return State mode
+ */
+mqtt_state_mode_t mqtt_get_state_mode(void);
+
 /**
  * @brief Publish device metadata
  * @param node_addr Node IEEE address
@@ -97,20 +226,91 @@ os_err_t mqtt_publish_meta(os_eui64_t node_addr, const char *manufacturer, const
 os_err_t mqtt_publish_status(bool online);
 
 /**
- * @brief Publish arbitrary message
+ * @brief Publish arbitrary message (QoS 0, normal priority)
  * @param topic Topic string
  * @param payload Payload data
  * @param len Payload length
- * @return OS_OK on success
+ * @return OS_OK on success (see mqtt_publish_ex())
  */
 os_err_t mqtt_publish(const char *topic, const void *payload, size_t len);
 
 /**
- * @brief Subscribe to command topics
+ * @brief Publish with QoS, retain and priority
+ *
+ * Messages up to MQTT_QUEUE_PAYLOAD_MAX are queued, connected or not, and
+ * replace any queued message on the same topic. A full queue drops its
+ * oldest message of the lowest priority below this one, or refuses this
+ * one if there is none.
+ *
+ * @param topic Topic string
+ * @param payload Payload data
+ * @param len Payload length
+ * @param opts Publish options
+ * @return OS_OK if queued or written, OS_ERR_FULL if the queue has no
+ *         room at this priority, OS_ERR_BUSY if a large message finds no
+ *         connection
+ */
+os_err_t mqtt_publish_ex(const char *topic, const void *payload, size_t len,
+                         const mqtt_pub_opts_t *opts);
+
+/**
+ * @brief Start a publish whose payload is written straight into the
+ *        transport's send buffer
+ *
+ * For large documents that would otherwise be built on the stack and
+ * copied. Bypasses the queue like other large messages and goes at QoS 0;
+ * opts supplies the retain flag. Write at most room bytes at payload, then
+ * call mqtt_publish_end() or mqtt_publish_abort() without yielding.
+ *
+ * @param topic Topic string
+ * @param opts Publish options
+ * @param payload Output: where the payload goes
+ * @param room Output: bytes available there
+ * @return OS_OK, OS_ERR_BUSY without a connection, OS_ERR_FULL if the send
+ *         buffer has no room
+ */
+os_err_t mqtt_publish_begin(const char *topic, const mqtt_pub_opts_t *opts,
+                            char **payload, size_t *room);
+
+/**
+ * @brief Send the publish started by mqtt_publish_begin()
+ * @param len Payload length written
+ * @return OS_OK on success
+ */
+os_err_t mqtt_publish_end(size_t len);
+
+/**
+ * @brief Drop the publish started by mqtt_publish_begin()
+ */
+void mqtt_publish_abort(void);
+
+/**
+ * @brief Subscribe to command topics and homeassistant/status
  * @return OS_OK on success
  */
 os_err_t mqtt_subscribe_commands(void);
 
+/**
+ * @brief Handle an inbound message
+ *
+ * Routes bridge/<node_id>/<capability>/set to cap_execute_command(). The
+ * payload is {"v": value, "corr_id": n} (corr_id optional) or a bare
+ * value; booleans also take "ON", "OFF" and "TOGGLE", numbers are scaled
+ * to the capability's decimals. An "online" on homeassistant/status emits
+ * OS_EVENT_HA_ONLINE. Called from the receive path.
+ *
+ * @param topic Topic (need not be NUL-terminated)
+ * @param topic_len Topic length
+ * @param payload Payload
+ * @param len Payload length
+ * @return OS_OK if the command was accepted or the message was HA status,
+ *         OS_ERR_NOT_FOUND for another topic or an unknown node or
+ *         capability, OS_ERR_INVALID_ARG for a malformed payload, or the
+ *         scheduler's error
+ */
+os_err_t mqtt_handle_message(const char *topic, size_t topic_len,
+                             const uint8_t *payload, size_t len);
+
 /**
  * @brief Get MQTT statistics
  * @param stats Output statistics
@@ -118,6 +318,34 @@ os_err_t mqtt_subscribe_commands(void);
  */
 os_err_t mqtt_get_stats(mqtt_stats_t *stats);
 
+/**
+ * @brief Start a state snapshot
+ *
+ * Walks every node's capability cache and queues each valid value as a
+ * retained state message, a few per mqtt_poll() within the configured
+ * rate. Called on every connect; a run in progress starts over.
+ *
+ * @return OS_OK on success, OS_ERR_NOT_READY if not connected
+ */
+os_err_t mqtt_snapshot_start(void);
+
+/**
+ * @brief Get snapshot progress and timing
+ * @param stats Output statistics
+ * @return OS_OK on success
+ */
+os_err_t mqtt_get_snapshot_stats(mqtt_snapshot_stats_t *stats);
+
+/**
+ * @brief Service the broker connection once
+ *
+ * Completes a pending connect, handles incoming packets, moves the
+ * outbound queue into the transmit buffer and writes it, and keeps the
+ * session alive. Never blocks; mqtt_task calls it
+ * every MQTT_POLL_INTERVAL_MS.
+ */
+void mqtt_poll(void);
+
 /**
  * @brief MQTT task entry (run as fibre)
  * @param arg Unused
@@ -0,0 +1,723 @@
+/**
+ * @file mqtt_client.c
+ * @brief MQTT 3.1.1 client transport (host)
+ *
+ * ESP32-C6 Zigbee Bridge OS - MQTT northbound adapter
+ *
+ * Single session, no allocation. The transmit buffer holds encoded packets
+ * from tx_head for tx_len bytes; it is written by mqttc_flush() and
+ * mqttc_poll(), and compacted only when an append would run off the end.
+ */
+
+#include "mqtt_client.h"
+#include "os.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MQTTC_MODULE "MQTTC"
+
+/* Packet types (fixed header byte, flags included where fixed) */
+#define PKT_CONNECT     0x10
+#define PKT_CONNACK     0x20
+#define PKT_PUBLISH     0x30
+#define PKT_PUBACK      0x40
+#define PKT_SUBSCRIBE   0x82
+#define PKT_SUBACK      0x90
+#define PKT_PINGREQ     0xC0
+#define PKT_PINGRESP    0xD0
+#define PKT_DISCONNECT  0xE0
+
+/* CONNECT flags */
+#define CONNECT_CLEAN_SESSION 0x02
+#define CONNECT_WILL          0x04
+#define CONNECT_WILL_RETAIN   0x20
+#define CONNECT_PASSWORD      0x40
+#define CONNECT_USERNAME      0x80
+
+#define MQTT_DEFAULT_PORT "1883"
+#define MQTT_MAX_REMAINING 268435455u
+#define MQTTC_HOST_MAX 64
+
+/* Socket send buffer, about lwIP's TCP_SND_BUF on the device, so a slow
+ * broker pushes back on host the way it would there */
+#define MQTTC_SOCK_SNDBUF 8192
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+typedef enum {
+  CONN_CLOSED = 0,
+  CONN_TCP,    /* TCP connect in progress */
+  CONN_MQTT,   /* CONNECT queued, waiting for CONNACK */
+  CONN_UP,
+} conn_state_t;
+
+/* Client state */
+static struct {
+  conn_state_t state;
+  int fd;
+  mqttc_options_t options;
+  mqttc_callbacks_t callbacks;
+  uint8_t tx[MQTTC_TX_BUF_SIZE];
+  size_t tx_head;
+  size_t tx_len;
+  bool stream_open;       /* mqttc_publish_begin() awaiting end or abort */
+  size_t stream_start;    /* Offset of that packet in tx */
+  size_t stream_payload;  /* Offset of its payload in tx */
+  uint8_t rx[MQTTC_RX_BUF_SIZE];
+  size_t rx_len;
+  uint16_t next_packet_id;
+  os_tick_t opened_tick;
+  os_tick_t last_tx_tick;
+  os_tick_t last_rx_tick;
+  mqttc_stats_t stats;
+} client = {.fd = -1};
+
+/* Encoding */
+
+static size_t varint_len(uint32_t v) {
+  return v < 128 ? 1 : v < 16384 ? 2 : v < 2097152 ? 3 : 4;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t v) {
+  do {
+    uint8_t b = v & 0x7F;
+    v >>= 7;
+    *p++ = v ? (b | 0x80) : b;
+  } while (v);
+  return p;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v) {
+  *p++ = (uint8_t)(v >> 8);
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static uint8_t *put_str(uint8_t *p, const char *s, size_t len) {
+  p = put_u16(p, (uint16_t)len);
+  memcpy(p, s, len);
+  return p + len;
+}
+
+/* Room for a packet with this remaining length at the end of the buffer;
+ * returns where the variable header goes, or NULL. Commit with tx_commit(). */
+static uint8_t *tx_begin(uint8_t header, uint32_t remaining, size_t *total) {
+  size_t need = 1 + varint_len(remaining) + remaining;
+  if (client.stream_open || remaining > MQTT_MAX_REMAINING ||
+      need > MQTTC_TX_BUF_SIZE - client.tx_len) {
+    return NULL;
+  }
+  if (client.tx_head + client.tx_len + need > MQTTC_TX_BUF_SIZE) {
+    memmove(client.tx, client.tx + client.tx_head, client.tx_len);
+    client.tx_head = 0;
+  }
+  uint8_t *p = client.tx + client.tx_head + client.tx_len;
+  *p++ = header;
+  *total = need;
+  return put_varint(p, remaining);
+}
+
+static void tx_commit(size_t total) {
+  client.tx_len += total;
+  client.stats.tx_backlog = (uint32_t)client.tx_len;
+  if (client.stats.tx_backlog > client.stats.tx_backlog_peak) {
+    client.stats.tx_backlog_peak = client.stats.tx_backlog;
+  }
+}
+
+static uint16_t next_packet_id(void) {
+  if (++client.next_packet_id == 0) {
+    client.next_packet_id = 1;
+  }
+  return client.next_packet_id;
+}
+
+static os_err_t queue_connect(void) {
+  const mqttc_options_t *o = &client.options;
+  size_t id_len = o->client_id ? strlen(o->client_id) : 0;
+  uint8_t flags = CONNECT_CLEAN_SESSION;
+  uint32_t remaining = 10 + 2 + (uint32_t)id_len;
+
+  if (o->will_topic) {
+    flags |= CONNECT_WILL | (o->will_retain ? CONNECT_WILL_RETAIN : 0);
+    remaining += 2 + (uint32_t)strlen(o->will_topic) + 2 +
+                 (uint32_t)(o->will_payload ? strlen(o->will_payload) : 0);
+  }
+  if (o->username) {
+    flags |= CONNECT_USERNAME;
+    remaining += 2 + (uint32_t)strlen(o->username);
+    /* 3.1.1 allows a password only with a user name */
+    if (o->password) {
+      flags |= CONNECT_PASSWORD;
+      remaining += 2 + (uint32_t)strlen(o->password);
+    }
+  }
+
+  size_t total;
+  uint8_t *p = tx_begin(PKT_CONNECT, remaining, &total);
+  if (!p) {
+    return OS_ERR_FULL;
+  }
+  p = put_str(p, "MQTT", 4);
+  *p++ = 4; /* Protocol level 3.1.1 */
+  *p++ = flags;
+  p = put_u16(p, o->keepalive_sec);
+  p = put_str(p, o->client_id ? o->client_id : "", id_len);
+  if (flags & CONNECT_WILL) {
+    p = put_str(p, o->will_topic, strlen(o->will_topic));
+    p = put_str(p, o->will_payload ? o->will_payload : "",
+                o->will_payload ? strlen(o->will_payload) : 0);
+  }
+  if (flags & CONNECT_USERNAME) {
+    p = put_str(p, o->username, strlen(o->username));
+  }
+  if (flags & CONNECT_PASSWORD) {
+    p = put_str(p, o->password, strlen(o->password));
+  }
+  tx_commit(total);
+  return OS_OK;
+}
+
+static void queue_short(uint8_t header) {
+  size_t total;
+  if (tx_begin(header, 0, &total)) {
+    tx_commit(total);
+  }
+}
+
+static void queue_puback(uint16_t packet_id) {
+  size_t total;
+  uint8_t *p = tx_begin(PKT_PUBACK, 2, &total);
+  if (p) {
+    put_u16(p, packet_id);
+    tx_commit(total);
+  }
+}
+
+/* Connection */
+
+static void reset_session(void) {
+  if (client.fd >= 0) {
+    close(client.fd);
+  }
+  client.fd = -1;
+  client.state = CONN_CLOSED;
+  client.tx_head = 0;
+  client.tx_len = 0;
+  client.stream_open = false;
+  client.rx_len = 0;
+  client.stats.tx_backlog = 0;
+}
+
+static void fail(os_err_t reason, const char *what) {
+  LOG_W(MQTTC_MODULE, "Connection lost: %s", what);
+  reset_session();
+  if (client.callbacks.closed) {
+    client.callbacks.closed(reason);
+  }
+}
+
+/* Split "mqtt://host:port" into host and port */
+static bool parse_uri(const char *uri, char *host, size_t host_size,
+                      const char **port) {
+  const char *p = strstr(uri, "://");
+  if (p) {
+    if (strncmp(uri, "mqtt://", 7) != 0 && strncmp(uri, "tcp://", 6) != 0) {
+      return false; /* TLS and websockets are not supported here */
+    }
+    uri = p + 3;
+  }
+  const char *colon = strchr(uri, ':');
+  size_t len = colon ? (size_t)(colon - uri) : strlen(uri);
+  if (len == 0 || len >= host_size) {
+    return false;
+  }
+  memcpy(host, uri, len);
+  host[len] = '\0';
+  *port = (colon && colon[1]) ? colon + 1 : MQTT_DEFAULT_PORT;
+  return true;
+}
+
+static int start_connect(const struct addrinfo *ai, bool *connected) {
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (fd < 0) {
+    return -1;
+  }
+
+  int one = 1;
+  int sndbuf = MQTTC_SOCK_SNDBUF;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+  if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+    *connected = true;
+    return fd;
+  }
+  if (errno == EINPROGRESS) {
+    *connected = false;
+    return fd;
+  }
+  close(fd);
+  return -1;
+}
+
+os_err_t mqttc_open(const char *broker_uri, const mqttc_options_t *options,
+                    const mqttc_callbacks_t *callbacks) {
+  if (!broker_uri || !options || !callbacks) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (client.state != CONN_CLOSED) {
+    return OS_ERR_BUSY;
+  }
+
+  char host[MQTTC_HOST_MAX];
+  const char *port;
+  if (!parse_uri(broker_uri, host, sizeof(host), &port)) {
+    LOG_E(MQTTC_MODULE, "Unsupported broker URI: %s", broker_uri);
+    return OS_ERR_INVALID_ARG;
+  }
+
+  /* Resolution blocks; brokers are normally given by address on host */
+  struct addrinfo hints = {0};
+  struct addrinfo *res = NULL;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  if (getaddrinfo(host, port, &hints, &res) != 0 || !res) {
+    LOG_W(MQTTC_MODULE, "Cannot resolve %s", host);
+    return OS_ERR_NOT_FOUND;
+  }
+
+  bool connected = false;
+  int fd = -1;
+  for (const struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+    fd = start_connect(ai, &connected);
+  }
+  freeaddrinfo(res);
+  if (fd < 0) {
+    LOG_W(MQTTC_MODULE, "Connect to %s:%s failed: %s", host, port,
+          strerror(errno));
+    return OS_ERR_NOT_READY;
+  }
+
+  client.options = *options;
+  client.callbacks = *callbacks;
+  client.fd = fd;
+  client.tx_head = 0;
+  client.tx_len = 0;
+  client.rx_len = 0;
+  client.opened_tick = os_now_ticks();
+  client.last_tx_tick = client.opened_tick;
+  client.last_rx_tick = client.opened_tick;
+  client.state = connected ? CONN_MQTT : CONN_TCP;
+
+  if (queue_connect() != OS_OK) {
+    reset_session();
+    return OS_ERR_INVALID_ARG;
+  }
+  if (client.state == CONN_MQTT) {
+    mqttc_flush();
+  }
+  return OS_OK;
+}
+
+void mqttc_close(bool graceful) {
+  if (client.state == CONN_CLOSED) {
+    return;
+  }
+  if (graceful && client.state == CONN_UP) {
+    queue_short(PKT_DISCONNECT);
+    mqttc_flush();
+    if (client.tx_len > 0) {
+      LOG_W(MQTTC_MODULE, "Closing with %u bytes unsent", (unsigned)client.tx_len);
+    }
+  }
+  reset_session();
+  if (client.callbacks.closed) {
+    client.callbacks.closed(OS_OK);
+  }
+}
+
+bool mqttc_is_open(void) { return client.state != CONN_CLOSED; }
+
+/* Outbound */
+
+os_err_t mqttc_publish(const char *topic, const void *payload, size_t len,
+                       uint8_t qos, bool retain, uint16_t *packet_id) {
+  if (!topic || (len > 0 && !payload) || qos > 1) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (client.state != CONN_UP) {
+    return OS_ERR_NOT_READY;
+  }
+
+  size_t topic_len = strlen(topic);
+  if (topic_len == 0 || topic_len > UINT16_MAX ||
+      len > MQTT_MAX_REMAINING - topic_len - 4) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  uint8_t header = PKT_PUBLISH | (uint8_t)(qos << 1) | (retain ? 1 : 0);
+  size_t total;
+  uint8_t *p = tx_begin(header, (uint32_t)(2 + topic_len + (qos ? 2 : 0) + len),
+                        &total);
+  if (!p) {
+    return OS_ERR_FULL;
+  }
+  p = put_str(p, topic, topic_len);
+  if (qos) {
+    uint16_t id = next_packet_id();
+    p = put_u16(p, id);
+    if (packet_id) {
+      *packet_id = id;
+    }
+  }
+  if (len > 0) {
+    memcpy(p, payload, len);
+  }
+  tx_commit(total);
+  return OS_OK;
+}
+
+/* A streamed publish reserves the longest remaining length the buffer can
+ * hold; mqttc_publish_end() closes the gap if the packet turns out shorter */
+#define STREAM_FIXED_HEADER (1 + (MQTTC_TX_BUF_SIZE < 16384 ? 2 : 3))
+
+os_err_t mqttc_publish_begin(const char *topic, uint8_t qos, bool retain,
+                             char **payload, size_t *room) {
+  if (!topic || !payload || !room || qos > 1) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (client.state != CONN_UP) {
+    return OS_ERR_NOT_READY;
+  }
+  if (client.stream_open) {
+    return OS_ERR_BUSY;
+  }
+
+  size_t topic_len = strlen(topic);
+  if (topic_len == 0 || topic_len > UINT16_MAX) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  /* The payload gets all the free space, in one piece */
+  if (client.tx_head > 0) {
+    memmove(client.tx, client.tx + client.tx_head, client.tx_len);
+    client.tx_head = 0;
+  }
+  size_t head = STREAM_FIXED_HEADER + 2 + topic_len + (qos ? 2 : 0);
+  if (head >= MQTTC_TX_BUF_SIZE - client.tx_len) {
+    return OS_ERR_FULL;
+  }
+
+  uint8_t *p = client.tx + client.tx_len;
+  *p = PKT_PUBLISH | (uint8_t)(qos << 1) | (retain ? 1 : 0);
+  put_str(p + STREAM_FIXED_HEADER, topic, topic_len);
+  /* A QoS 1 packet id is filled in by mqttc_publish_end() */
+
+  client.stream_open = true;
+  client.stream_start = client.tx_len;
+  client.stream_payload = client.tx_len + head;
+  *payload = (char *)client.tx + client.stream_payload;
+  *room = MQTTC_TX_BUF_SIZE - client.stream_payload;
+  return OS_OK;
+}
+
+os_err_t mqttc_publish_end(size_t len, uint16_t *packet_id) {
+  if (!client.stream_open) {
+    return OS_ERR_INVALID_ARG;
+  }
+  client.stream_open = false;
+  if (len > MQTTC_TX_BUF_SIZE - client.stream_payload) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  uint8_t *pkt = client.tx + client.stream_start;
+  if (pkt[0] & 0x02) {
+    uint16_t id = next_packet_id();
+    put_u16(client.tx + client.stream_payload - 2, id);
+    if (packet_id) {
+      *packet_id = id;
+    }
+  }
+
+  uint32_t remaining =
+      (uint32_t)(client.stream_payload - client.stream_start -
+                 STREAM_FIXED_HEADER + len);
+  uint8_t *body = put_varint(pkt + 1, remaining);
+  if (body != pkt + STREAM_FIXED_HEADER) {
+    memmove(body, pkt + STREAM_FIXED_HEADER, remaining);
+  }
+  tx_commit((size_t)(body - pkt) + remaining);
+  return OS_OK;
+}
+
+void mqttc_publish_abort(void) { client.stream_open = false; }
+
+os_err_t mqttc_subscribe(const char *filter, uint8_t qos) {
+  if (!filter || qos > 1) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (client.state != CONN_UP) {
+    return OS_ERR_NOT_READY;
+  }
+
+  size_t filter_len = strlen(filter);
+  if (filter_len == 0 || filter_len > UINT16_MAX) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  size_t total;
+  uint8_t *p = tx_begin(PKT_SUBSCRIBE, (uint32_t)(2 + 2 + filter_len + 1), &total);
+  if (!p) {
+    return OS_ERR_FULL;
+  }
+  p = put_u16(p, next_packet_id());
+  p = put_str(p, filter, filter_len);
+  *p = qos;
+  tx_commit(total);
+  return OS_OK;
+}
+
+/* Write what the socket takes; the remainder waits for the next flush */
+void mqttc_flush(void) {
+  while (client.tx_len > 0 && client.state >= CONN_MQTT) {
+    ssize_t n = send(client.fd, client.tx + client.tx_head, client.tx_len,
+                     SEND_FLAGS);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        fail(OS_ERR_NOT_READY, strerror(errno));
+      }
+      break;
+    }
+    client.stats.writes++;
+    if ((size_t)n < client.tx_len) {
+      client.stats.partial_writes++;
+    }
+    client.tx_head += (size_t)n;
+    client.tx_len -= (size_t)n;
+    client.stats.bytes_sent += (uint32_t)n;
+    client.last_tx_tick = os_now_ticks();
+  }
+  if (client.tx_len == 0) {
+    client.tx_head = 0;
+  }
+  client.stats.tx_backlog = (uint32_t)client.tx_len;
+}
+
+/* Inbound */
+
+static uint16_t get_u16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void handle_publish(uint8_t header, const uint8_t *body, size_t len) {
+  uint8_t qos = (header >> 1) & 0x03;
+  if (len < 2) {
+    return;
+  }
+  size_t topic_len = get_u16(body);
+  size_t offset = 2 + topic_len + (qos ? 2 : 0);
+  if (offset > len || qos > 1) {
+    LOG_W(MQTTC_MODULE, "Dropped malformed or QoS %u PUBLISH", qos);
+    return;
+  }
+  if (qos == 1) {
+    queue_puback(get_u16(body + 2 + topic_len));
+  }
+  if (client.callbacks.message) {
+    client.callbacks.message((const char *)body + 2, topic_len, body + offset,
+                             len - offset);
+  }
+}
+
+static void handle_packet(uint8_t header, const uint8_t *body, size_t len) {
+  switch (header & 0xF0) {
+  case PKT_CONNACK:
+    if (client.state != CONN_MQTT || len < 2) {
+      break;
+    }
+    if (body[1] != 0) {
+      LOG_W(MQTTC_MODULE, "Broker refused connection (code %u)", body[1]);
+      fail(OS_ERR_NOT_READY, "CONNACK refused");
+      return;
+    }
+    client.state = CONN_UP;
+    if (client.callbacks.connected) {
+      client.callbacks.connected();
+    }
+    break;
+  case PKT_PUBLISH:
+    if (client.state == CONN_UP) {
+      handle_publish(header, body, len);
+    }
+    break;
+  case PKT_SUBACK:
+    for (size_t i = 2; i < len; i++) {
+      if (body[i] == 0x80) {
+        LOG_W(MQTTC_MODULE, "Subscription %u refused", get_u16(body));
+      }
+    }
+    break;
+  case PKT_PUBACK:
+    if (len >= 2 && client.callbacks.acked) {
+      client.callbacks.acked(get_u16(body));
+    }
+    break;
+  default:
+    /* PINGRESP: nothing to do beyond the receive time */
+    break;
+  }
+}
+
+/* Fixed header length and remaining length: 1 complete, 0 need more,
+ * -1 malformed */
+static int decode_header(const uint8_t *p, size_t avail, size_t *header_len,
+                         uint32_t *remaining) {
+  *remaining = 0;
+  for (size_t i = 1; i <= 4; i++) {
+    if (i >= avail) {
+      return 0;
+    }
+    *remaining |= (uint32_t)(p[i] & 0x7F) << (7 * (i - 1));
+    if (!(p[i] & 0x80)) {
+      *header_len = i + 1;
+      return 1;
+    }
+  }
+  return -1;
+}
+
+/* Parse complete packets from the receive buffer */
+static void parse_rx(void) {
+  size_t offset = 0;
+  while (client.state != CONN_CLOSED && client.rx_len - offset >= 2) {
+    const uint8_t *p = client.rx + offset;
+    size_t avail = client.rx_len - offset;
+    size_t header_len;
+    uint32_t remaining;
+    int rc = decode_header(p, avail, &header_len, &remaining);
+    if (rc < 0) {
+      fail(OS_ERR_INVALID_ARG, "bad remaining length");
+      return;
+    }
+    if (rc == 0) {
+      break;
+    }
+    size_t total = header_len + remaining;
+    if (total > MQTTC_RX_BUF_SIZE) {
+      fail(OS_ERR_NO_MEM, "inbound packet too large");
+      return;
+    }
+    if (avail < total) {
+      break;
+    }
+    handle_packet(p[0], p + header_len, remaining);
+    offset += total;
+  }
+  if (client.state != CONN_CLOSED && offset > 0) {
+    memmove(client.rx, client.rx + offset, client.rx_len - offset);
+    client.rx_len -= offset;
+  }
+}
+
+static void receive(void) {
+  while (client.state != CONN_CLOSED) {
+    ssize_t n = recv(client.fd, client.rx + client.rx_len,
+                     MQTTC_RX_BUF_SIZE - client.rx_len, 0);
+    if (n == 0) {
+      fail(OS_ERR_NOT_READY, "closed by broker");
+      return;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        fail(OS_ERR_NOT_READY, strerror(errno));
+      }
+      return;
+    }
+    client.rx_len += (size_t)n;
+    client.stats.bytes_received += (uint32_t)n;
+    client.last_rx_tick = os_now_ticks();
+    parse_rx();
+  }
+}
+
+/* TCP connect finished? */
+static bool tcp_connected(void) {
+  struct pollfd pfd = {.fd = client.fd, .events = POLLOUT};
+  if (poll(&pfd, 1, 0) <= 0) {
+    return false;
+  }
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+  getsockopt(client.fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+  if (err != 0) {
+    fail(OS_ERR_NOT_READY, strerror(err));
+    return false;
+  }
+  client.state = CONN_MQTT;
+  return true;
+}
+
+void mqttc_poll(void) {
+  if (client.state == CONN_CLOSED) {
+    return;
+  }
+
+  os_tick_t now = os_now_ticks();
+  if (client.state != CONN_UP &&
+      now - client.opened_tick > OS_MS_TO_TICKS(MQTTC_CONNECT_TIMEOUT_MS)) {
+    fail(OS_ERR_TIMEOUT, "no CONNACK");
+    return;
+  }
+  if (client.state == CONN_TCP && !tcp_connected()) {
+    return;
+  }
+
+  mqttc_flush();
+  receive();
+
+  /* Keepalive: something must go out every period, and a broker silent
+   * for one and a half periods is gone */
+  uint32_t keepalive_ms = (uint32_t)client.options.keepalive_sec * 1000;
+  if (client.state == CONN_UP && keepalive_ms > 0) {
+    if (now - client.last_rx_tick > OS_MS_TO_TICKS(keepalive_ms + keepalive_ms / 2)) {
+      fail(OS_ERR_TIMEOUT, "keepalive expired");
+      return;
+    }
+    if (now - client.last_tx_tick >= OS_MS_TO_TICKS(keepalive_ms)) {
+      queue_short(PKT_PINGREQ);
+      client.last_tx_tick = now;
+    }
+  }
+
+  mqttc_flush();
+}
+
+void mqttc_get_stats(mqttc_stats_t *stats) {
+  if (stats) {
+    *stats = client.stats;
+  }
+}
@@ -0,0 +1,178 @@
+/**
+ * @file mqtt_client.h
+ * @brief MQTT 3.1.1 client transport (host)
+ *
+ * ESP32-C6 Zigbee Bridge OS - MQTT northbound adapter
+ *
+ * Minimal MQTT 3.1.1 client over a non-blocking POSIX TCP socket, used by
+ * the adapter on host builds. Nothing blocks: mqttc_open() starts the TCP
+ * connect and queues CONNECT, and mqttc_poll() (called from mqtt_task)
+ * completes the connect, writes whatever the socket accepts, reads and
+ * parses incoming packets and keeps the session alive. Packets are encoded
+ * straight into one transmit buffer and written together by mqttc_flush(),
+ * so a batch of publishes costs one TCP write; a write the socket only
+ * partly takes leaves the rest there for the next flush.
+ *
+ * Supported: CONNECT (with will), PUBLISH QoS 0/1 out, PUBLISH QoS 0/1 in
+ * (acknowledged), SUBSCRIBE, PINGREQ and DISCONNECT.
+ */
+
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include "os_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Transmit buffer; a publish that does not fit is refused */
+#define MQTTC_TX_BUF_SIZE 4096
+
+/* Receive buffer; bounds the largest inbound packet */
+#define MQTTC_RX_BUF_SIZE 1024
+
+/* CONNECT to CONNACK deadline */
+#define MQTTC_CONNECT_TIMEOUT_MS 5000
+
+/* Session options */
+typedef struct {
+    const char *client_id;
+    const char *username;           /* NULL: none */
+    const char *password;           /* NULL: none */
+    uint16_t keepalive_sec;         /* 0 disables keepalive */
+    const char *will_topic;         /* NULL: no will */
+    const char *will_payload;
+    bool will_retain;
+} mqttc_options_t;
+
+/* Adapter callbacks, called from mqttc_poll() */
+typedef struct {
+    void (*connected)(void);
+    void (*closed)(os_err_t reason);  /* OS_OK when closed by mqttc_close() */
+    void (*message)(const char *topic, size_t topic_len, const uint8_t *payload,
+                    size_t len);
+    void (*acked)(uint16_t packet_id);  /* PUBACK for a QoS 1 publish */
+} mqttc_callbacks_t;
+
+/* Transport counters */
+typedef struct {
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+    uint32_t writes;                /* Socket writes that sent data */
+    uint32_t partial_writes;        /* Writes the socket only partly accepted */
+    uint32_t tx_backlog;            /* Bytes waiting to be written */
+    uint32_t tx_backlog_peak;
+} mqttc_stats_t;
+
+/**
+ * @brief Start connecting to a broker
+ *
+ * Resolves the URI ("mqtt://host:port", "tcp://host:port" or "host:port";
+ * port 1883 if omitted), starts a non-blocking connect and queues CONNECT.
+ * The connected callback fires once CONNACK accepts the session.
+ *
+ * @param broker_uri Broker URI
+ * @param options Session options (strings must outlive the session)
+ * @param callbacks Adapter callbacks (copied)
+ * @return OS_OK if the connect is under way, OS_ERR_BUSY if a session is
+ *         open, OS_ERR_INVALID_ARG for a bad URI, OS_ERR_NOT_FOUND if the
+ *         host does not resolve, OS_ERR_NOT_READY if the socket fails
+ */
+os_err_t mqttc_open(const char *broker_uri, const mqttc_options_t *options,
+                    const mqttc_callbacks_t *callbacks);
+
+/**
+ * @brief Close the session
+ * @param graceful Send DISCONNECT and write out the buffer first
+ */
+void mqttc_close(bool graceful);
+
+/**
+ * @brief Check for an open session (connecting or connected)
+ * @return true if open
+ */
+bool mqttc_is_open(void);
+
+/**
+ * @brief Encode a PUBLISH into the transmit buffer
+ *
+ * Nothing is written until mqttc_flush() or mqttc_poll().
+ *
+ * @param topic Topic name
+ * @param payload Payload (may be NULL if len is 0)
+ * @param len Payload length
+ * @param qos 0 or 1
+ * @param retain Retain flag
+ * @param packet_id Output: packet id for QoS 1 (may be NULL for QoS 0)
+ * @return OS_OK if buffered, OS_ERR_NOT_READY without a session,
+ *         OS_ERR_FULL if the transmit buffer has no room
+ */
+os_err_t mqttc_publish(const char *topic, const void *payload, size_t len,
+                       uint8_t qos, bool retain, uint16_t *packet_id);
+
+/**
+ * @brief Start a PUBLISH whose payload the caller writes in place
+ *
+ * Encodes the header and topic into the transmit buffer and lends the
+ * caller the rest of it for the payload, which saves building the payload
+ * elsewhere and copying it in. Finish with mqttc_publish_end() or
+ * mqttc_publish_abort() before any other client call.
+ *
+ * @param topic Topic name
+ * @param qos 0 or 1
+ * @param retain Retain flag
+ * @param payload Output: where the payload goes
+ * @param room Output: bytes available there
+ * @return OS_OK, OS_ERR_NOT_READY without a session, OS_ERR_BUSY if a
+ *         streamed publish is already open, OS_ERR_FULL if the transmit
+ *         buffer has no room
+ */
+os_err_t mqttc_publish_begin(const char *topic, uint8_t qos, bool retain,
+                             char **payload, size_t *room);
+
+/**
+ * @brief Commit the publish opened by mqttc_publish_begin()
+ * @param len Payload length written (at most the room given)
+ * @param packet_id Output: packet id for QoS 1 (may be NULL)
+ * @return OS_OK if buffered, OS_ERR_INVALID_ARG if none is open or len is
+ *         too large
+ */
+os_err_t mqttc_publish_end(size_t len, uint16_t *packet_id);
+
+/**
+ * @brief Drop the publish opened by mqttc_publish_begin()
+ */
+void mqttc_publish_abort(void);
+
+/**
+ * @brief Queue a SUBSCRIBE for one topic filter
+ * @param filter Topic filter
+ * @param qos Requested QoS
+ * @return OS_OK if queued
+ */
+os_err_t mqttc_subscribe(const char *filter, uint8_t qos);
+
+/**
+ * @brief Write as much of the transmit buffer as the socket takes
+ */
+void mqttc_flush(void);
+
+/**
+ * @brief Service the socket: connect, write, read, keepalive
+ *
+ * Never blocks. Callbacks run from here.
+ */
+void mqttc_poll(void);
+
+/**
+ * @brief Get transport counters
+ * @param stats Output counters
+ */
+void mqttc_get_stats(mqttc_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_CLIENT_H */
@@ -0,0 +1,536 @@
+/**
+ * @file mqtt_json.c
+ * @brief Zero-copy JSON scanner and writer for MQTT payloads
+ *
+ * ESP32-C6 Zigbee Bridge OS - MQTT northbound adapter
+ *
+ * The scanner is a single forward pass with no recursion: nested
+ * containers are skipped with a bit stack, so the stack use is fixed
+ * whatever the payload holds. The writer formats numbers from a two-digit
+ * table instead of going through printf.
+ */
+
+#include "mqtt_json.h"
+#include <string.h>
+
+/* Deepest nesting skipped inside a value */
+#define JSON_MAX_DEPTH 32
+
+static const char *skip_ws(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+    p++;
+  }
+  return p;
+}
+
+/* p at the opening quote; returns past the closing quote, or NULL */
+static const char *scan_string(const char *p, const char *end) {
+  for (p++; p < end; p++) {
+    if (*p == '"') {
+      return p + 1;
+    }
+    if (*p == '\\') {
+      if (++p >= end) {
+        return NULL;
+      }
+    } else if ((uint8_t)*p < 0x20) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+static const char *scan_digits(const char *p, const char *end) {
+  const char *start = p;
+  while (p < end && *p >= '0' && *p <= '9') {
+    p++;
+  }
+  return p > start ? p : NULL;
+}
+
+static const char *scan_number(const char *p, const char *end) {
+  if (*p == '-') {
+    p++;
+  }
+  p = scan_digits(p, end);
+  if (p && p < end && *p == '.') {
+    p = scan_digits(p + 1, end);
+  }
+  if (p && p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < end && (*p == '+' || *p == '-')) {
+      p++;
+    }
+    p = scan_digits(p, end);
+  }
+  return p;
+}
+
+static const char *scan_literal(const char *p, const char *end, const char *word) {
+  size_t n = strlen(word);
+  if ((size_t)(end - p) < n || memcmp(p, word, n) != 0) {
+    return NULL;
+  }
+  return p + n;
+}
+
+/* p at '{' or '['; returns past the matching close, or NULL */
+static const char *scan_container(const char *p, const char *end) {
+  uint32_t objects = 0; /* Bit per level: 1 = object */
+  uint32_t depth = 0;
+  while (p < end) {
+    switch (*p) {
+    case '{':
+    case '[':
+      if (depth == JSON_MAX_DEPTH) {
+        return NULL;
+      }
+      objects = (objects << 1) | (*p == '{');
+      depth++;
+      p++;
+      break;
+    case '}':
+    case ']':
+      if ((objects & 1) != (uint32_t)(*p == '}')) {
+        return NULL;
+      }
+      objects >>= 1;
+      p++;
+      if (--depth == 0) {
+        return p;
+      }
+      break;
+    case '"':
+      p = scan_string(p, end);
+      if (!p) {
+        return NULL;
+      }
+      break;
+    default:
+      p++;
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* Scan one value at p (whitespace skipped); returns past it, or NULL */
+static const char *scan_value(const char *p, const char *end,
+                              mqtt_json_token_t *out) {
+  p = skip_ws(p, end);
+  if (p >= end) {
+    return NULL;
+  }
+
+  const char *start = p;
+  const char *next;
+  mqtt_json_type_t type;
+  switch (*p) {
+  case '"':
+    type = MQTT_JSON_STRING;
+    next = scan_string(p, end);
+    break;
+  case '{':
+    type = MQTT_JSON_OBJECT;
+    next = scan_container(p, end);
+    break;
+  case '[':
+    type = MQTT_JSON_ARRAY;
+    next = scan_container(p, end);
+    break;
+  case 't':
+    type = MQTT_JSON_TRUE;
+    next = scan_literal(p, end, "true");
+    break;
+  case 'f':
+    type = MQTT_JSON_FALSE;
+    next = scan_literal(p, end, "false");
+    break;
+  case 'n':
+    type = MQTT_JSON_NULL;
+    next = scan_literal(p, end, "null");
+    break;
+  default:
+    type = MQTT_JSON_NUMBER;
+    next = scan_number(p, end);
+    break;
+  }
+  if (!next) {
+    return NULL;
+  }
+
+  out->type = type;
+  if (type == MQTT_JSON_STRING) {
+    out->ptr = start + 1;
+    out->len = (size_t)(next - start) - 2;
+  } else {
+    out->ptr = start;
+    out->len = (size_t)(next - start);
+  }
+  return next;
+}
+
+os_err_t mqtt_json_object_begin(mqtt_json_iter_t *it, const char *json, size_t len) {
+  if (!it || !json) {
+    return OS_ERR_INVALID_ARG;
+  }
+  const char *end = json + len;
+  const char *p = skip_ws(json, end);
+  if (p >= end || *p != '{') {
+    return OS_ERR_INVALID_ARG;
+  }
+  it->pos = p + 1;
+  it->end = end;
+  it->first = true;
+  return OS_OK;
+}
+
+os_err_t mqtt_json_object_next(mqtt_json_iter_t *it, mqtt_json_token_t *key,
+                               mqtt_json_token_t *value) {
+  if (!it || !it->pos || !key || !value) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  const char *p = skip_ws(it->pos, it->end);
+  if (p < it->end && *p == '}') {
+    it->pos = NULL;
+    return OS_ERR_NOT_FOUND;
+  }
+  if (!it->first) {
+    if (p >= it->end || *p != ',') {
+      return OS_ERR_INVALID_ARG;
+    }
+    p = skip_ws(p + 1, it->end);
+  }
+  if (p >= it->end || *p != '"') {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  p = scan_value(p, it->end, key);
+  if (!p) {
+    return OS_ERR_INVALID_ARG;
+  }
+  p = skip_ws(p, it->end);
+  if (p >= it->end || *p != ':') {
+    return OS_ERR_INVALID_ARG;
+  }
+  p = scan_value(p + 1, it->end, value);
+  if (!p) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  it->pos = p;
+  it->first = false;
+  return OS_OK;
+}
+
+os_err_t mqtt_json_value(const char *json, size_t len, mqtt_json_token_t *value) {
+  if (!json || !value) {
+    return OS_ERR_INVALID_ARG;
+  }
+  const char *end = json + len;
+  const char *p = scan_value(json, end, value);
+  if (!p || skip_ws(p, end) != end) {
+    return OS_ERR_INVALID_ARG;
+  }
+  return OS_OK;
+}
+
+bool mqtt_json_equals(const mqtt_json_token_t *token, const char *str) {
+  return token && token->type == MQTT_JSON_STRING && str &&
+         strncmp(token->ptr, str, token->len) == 0 && str[token->len] == '\0';
+}
+
+os_err_t mqtt_json_to_fixed(const mqtt_json_token_t *token, uint8_t decimals,
+                            int32_t *out) {
+  if (!token || token->type != MQTT_JSON_NUMBER || decimals > 9 || !out) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  const char *p = token->ptr;
+  const char *end = p + token->len;
+  bool negative = *p == '-';
+  if (negative) {
+    p++;
+  }
+
+  /* Accumulate in 64 bits; anything past INT32 range is rejected */
+  int64_t v = 0;
+  for (; p < end && *p != '.'; p++) {
+    if (*p < '0' || *p > '9') {
+      return OS_ERR_INVALID_ARG;
+    }
+    v = v * 10 + (*p - '0');
+    if (v > INT32_MAX) {
+      return OS_ERR_INVALID_ARG;
+    }
+  }
+  if (p < end) {
+    p++; /* '.' */
+  }
+  for (uint8_t d = 0; d < decimals; d++) {
+    int digit = 0;
+    if (p < end) {
+      if (*p < '0' || *p > '9') {
+        return OS_ERR_INVALID_ARG;
+      }
+      digit = *p++ - '0';
+    }
+    v = v * 10 + digit;
+    if (v > INT32_MAX) {
+      return OS_ERR_INVALID_ARG;
+    }
+  }
+  for (; p < end; p++) {
+    if (*p < '0' || *p > '9') {
+      return OS_ERR_INVALID_ARG; /* Exponent */
+    }
+  }
+
+  *out = (int32_t)(negative ? -v : v);
+  return OS_OK;
+}
+
+os_err_t mqtt_json_to_u32(const mqtt_json_token_t *token, uint32_t *out) {
+  if (!token || token->type != MQTT_JSON_NUMBER || !out) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  uint64_t v = 0;
+  for (size_t i = 0; i < token->len; i++) {
+    char c = token->ptr[i];
+    if (c < '0' || c > '9') {
+      return OS_ERR_INVALID_ARG;
+    }
+    v = v * 10 + (uint64_t)(c - '0');
+    if (v > UINT32_MAX) {
+      return OS_ERR_INVALID_ARG;
+    }
+  }
+
+  *out = (uint32_t)v;
+  return OS_OK;
+}
+
+/* Writer */
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536"
+    "37383940414243444546474849505152535455565758596061626364656667686970717273"
+    "7475767778798081828384858687888990919293949596979899";
+
+/* Decimal digits of v ending at end; returns the first digit */
+static char *format_u32(uint32_t v, char *end) {
+  while (v >= 100) {
+    uint32_t pair = (v % 100) * 2;
+    v /= 100;
+    *--end = digit_pairs[pair + 1];
+    *--end = digit_pairs[pair];
+  }
+  if (v >= 10) {
+    *--end = digit_pairs[v * 2 + 1];
+    *--end = digit_pairs[v * 2];
+  } else {
+    *--end = (char)('0' + v);
+  }
+  return end;
+}
+
+static void put(mqtt_json_writer_t *w, const char *s, size_t n) {
+  if (w->overflow || w->size - w->len <= n) {
+    w->overflow = true;
+    return;
+  }
+  memcpy(w->buf + w->len, s, n);
+  w->len += n;
+}
+
+static void put_char(mqtt_json_writer_t *w, char c) {
+  put(w, &c, 1);
+}
+
+/* Separator before a value or a member name */
+static void begin_item(mqtt_json_writer_t *w) {
+  if (w->after_key) {
+    w->after_key = false;
+    return;
+  }
+  if (w->depth == 0) {
+    return;
+  }
+  uint8_t bit = (uint8_t)(1u << (w->depth - 1));
+  if (w->has_items & bit) {
+    put_char(w, ',');
+  }
+  w->has_items |= bit;
+}
+
+static void open_level(mqtt_json_writer_t *w, char c) {
+  begin_item(w);
+  put_char(w, c);
+  if (w->depth == MQTT_JSON_WRITER_DEPTH) {
+    w->overflow = true;
+    return;
+  }
+  w->depth++;
+  w->has_items &= (uint8_t)~(1u << (w->depth - 1));
+}
+
+static void close_level(mqtt_json_writer_t *w, char c) {
+  if (w->depth > 0) {
+    w->depth--;
+  }
+  put_char(w, c);
+}
+
+void mqtt_json_writer_init(mqtt_json_writer_t *w, char *buf, size_t size) {
+  memset(w, 0, sizeof(*w));
+  w->buf = buf;
+  w->size = size;
+  w->overflow = !buf || size == 0;
+}
+
+void mqtt_json_write_object_begin(mqtt_json_writer_t *w) {
+  open_level(w, '{');
+}
+
+void mqtt_json_write_object_end(mqtt_json_writer_t *w) {
+  close_level(w, '}');
+}
+
+void mqtt_json_write_array_begin(mqtt_json_writer_t *w) {
+  open_level(w, '[');
+}
+
+void mqtt_json_write_array_end(mqtt_json_writer_t *w) {
+  close_level(w, ']');
+}
+
+void mqtt_json_write_key(mqtt_json_writer_t *w, const char *key) {
+  begin_item(w);
+  put_char(w, '"');
+  put(w, key, strlen(key));
+  put(w, "\":", 2);
+  w->after_key = true;
+}
+
+void mqtt_json_write_bool(mqtt_json_writer_t *w, bool v) {
+  begin_item(w);
+  if (v) {
+    put(w, "true", 4);
+  } else {
+    put(w, "false", 5);
+  }
+}
+
+void mqtt_json_write_uint(mqtt_json_writer_t *w, uint32_t v) {
+  char tmp[10];
+  char *end = tmp + sizeof(tmp);
+  char *p = format_u32(v, end);
+  begin_item(w);
+  put(w, p, (size_t)(end - p));
+}
+
+void mqtt_json_write_int(mqtt_json_writer_t *w, int32_t v) {
+  mqtt_json_write_fixed(w, v, 0);
+}
+
+void mqtt_json_write_fixed(mqtt_json_writer_t *w, int32_t v, uint8_t decimals) {
+  /* Widened so that INT32_MIN negates cleanly */
+  uint32_t mag = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+  if (decimals > 9) {
+    decimals = 9;
+  }
+
+  char tmp[24];
+  char *end = tmp + sizeof(tmp);
+  char *p = end;
+  if (decimals) {
+    static const uint32_t pow10[10] = {1,      10,      100,      1000,      10000,
+                                       100000, 1000000, 10000000, 100000000,
+                                       1000000000};
+    uint32_t frac = mag % pow10[decimals];
+    mag /= pow10[decimals];
+    char *digits = format_u32(frac, end);
+    p = end - decimals;
+    memset(p, '0', (size_t)(digits - p)); /* Leading zeros of the fraction */
+    *--p = '.';
+  }
+  p = format_u32(mag, p);
+  if (v < 0) {
+    *--p = '-';
+  }
+
+  begin_item(w);
+  put(w, p, (size_t)(end - p));
+}
+
+/* Append text, escaping quotes, backslashes and control characters */
+static void put_escaped(mqtt_json_writer_t *w, const char *str) {
+  static const char hex[] = "0123456789abcdef";
+
+  const char *run = str ? str : "";
+  const char *p = run;
+  for (; *p; p++) {
+    uint8_t c = (uint8_t)*p;
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    /* Flush the plain run, then the escape */
+    put(w, run, (size_t)(p - run));
+    run = p + 1;
+    switch (c) {
+    case '"':
+      put(w, "\\\"", 2);
+      break;
+    case '\\':
+      put(w, "\\\\", 2);
+      break;
+    case '\n':
+      put(w, "\\n", 2);
+      break;
+    case '\r':
+      put(w, "\\r", 2);
+      break;
+    case '\t':
+      put(w, "\\t", 2);
+      break;
+    default: {
+      char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+      put(w, esc, sizeof(esc));
+      break;
+    }
+    }
+  }
+  put(w, run, (size_t)(p - run));
+}
+
+void mqtt_json_write_string(mqtt_json_writer_t *w, const char *str) {
+  mqtt_json_write_string_begin(w);
+  put_escaped(w, str);
+  mqtt_json_write_string_end(w);
+}
+
+void mqtt_json_write_string_begin(mqtt_json_writer_t *w) {
+  begin_item(w);
+  put_char(w, '"');
+}
+
+void mqtt_json_write_string_part(mqtt_json_writer_t *w, const char *str) {
+  put_escaped(w, str);
+}
+
+void mqtt_json_write_string_end(mqtt_json_writer_t *w) {
+  put_char(w, '"');
+}
+
+int mqtt_json_writer_finish(mqtt_json_writer_t *w) {
+  if (w->overflow || w->len >= w->size) {
+    if (w->buf && w->size) {
+      w->buf[0] = '\0';
+    }
+    return -1;
+  }
+  w->buf[w->len] = '\0';
+  return (int)w->len;
+}
@@ -0,0 +1,243 @@
+/**
+ * @file mqtt_json.h
+ * @brief Zero-copy JSON scanner and writer for MQTT payloads
+ *
+ * ESP32-C6 Zigbee Bridge OS - MQTT northbound adapter
+ *
+ * The scanner walks the members of a flat JSON object in place: keys and
+ * values come back as pointers into the payload, nothing is copied or
+ * allocated, and nested objects and arrays are skipped as whole values.
+ * Numbers convert to scaled integers, so no floating point is involved.
+ * String escapes are validated but not decoded.
+ *
+ * The writer appends to a caller's buffer without printf: integers and
+ * fixed-point values are formatted two digits at a time, separators are
+ * inserted automatically and strings are escaped. Overflow is sticky and
+ * reported once by mqtt_json_writer_finish().
+ */
+
+#ifndef MQTT_JSON_H
+#define MQTT_JSON_H
+
+#include "os_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Token types */
+typedef enum {
+    MQTT_JSON_NONE = 0,
+    MQTT_JSON_STRING,       /* ptr/len exclude the quotes */
+    MQTT_JSON_NUMBER,
+    MQTT_JSON_TRUE,
+    MQTT_JSON_FALSE,
+    MQTT_JSON_NULL,
+    MQTT_JSON_OBJECT,       /* ptr/len cover the braces */
+    MQTT_JSON_ARRAY,
+} mqtt_json_type_t;
+
+/* Slice of the input */
+typedef struct {
+    mqtt_json_type_t type;
+    const char *ptr;
+    size_t len;
+} mqtt_json_token_t;
+
+/* Deepest nesting the writer tracks */
+#define MQTT_JSON_WRITER_DEPTH 8
+
+/* Writer state */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    uint8_t depth;
+    uint8_t has_items;          /* Bit per open level: holds a value already */
+    bool after_key;
+    bool overflow;
+} mqtt_json_writer_t;
+
+/* Object member iterator */
+typedef struct {
+    const char *pos;
+    const char *end;
+    bool first;
+} mqtt_json_iter_t;
+
+/**
+ * @brief Start iterating the members of an object
+ * @param it Iterator
+ * @param json Text (need not be NUL-terminated)
+ * @param len Text length
+ * @return OS_OK, or OS_ERR_INVALID_ARG if the text does not open an object
+ */
+os_err_t mqtt_json_object_begin(mqtt_json_iter_t *it, const char *json, size_t len);
+
+/**
+ * @brief Get the next member
+ * @param it Iterator
+ * @param key Output key (a string token)
+ * @param value Output value
+ * @return OS_OK, OS_ERR_NOT_FOUND after the closing brace, or
+ *         OS_ERR_INVALID_ARG for malformed or truncated text
+ */
+os_err_t mqtt_json_object_next(mqtt_json_iter_t *it, mqtt_json_token_t *key,
+                               mqtt_json_token_t *value);
+
+/**
+ * @brief Scan text holding a single value
+ *
+ * For payloads that are a bare value ("true", "42", "\"ON\"").
+ *
+ * @param json Text
+ * @param len Text length
+ * @param value Output value
+ * @return OS_OK, or OS_ERR_INVALID_ARG unless the text is exactly one value
+ */
+os_err_t mqtt_json_value(const char *json, size_t len, mqtt_json_token_t *value);
+
+/**
+ * @brief Compare a string token with a NUL-terminated string
+ * @param token Token
+ * @param str String
+ * @return true if the token is a string equal to str
+ */
+bool mqtt_json_equals(const mqtt_json_token_t *token, const char *str);
+
+/**
+ * @brief Convert a number token to a scaled integer
+ *
+ * 21.5 with 2 decimals is 2150; digits past the scale are truncated.
+ * Exponents are not accepted.
+ *
+ * @param token Number token
+ * @param decimals Digits after the decimal point to keep (at most 9)
+ * @param out Output value
+ * @return OS_OK, or OS_ERR_INVALID_ARG if not a number or out of range
+ */
+os_err_t mqtt_json_to_fixed(const mqtt_json_token_t *token, uint8_t decimals,
+                            int32_t *out);
+
+/**
+ * @brief Convert a number token to an unsigned 32-bit integer
+ * @param token Number token (no sign, fraction or exponent)
+ * @param out Output value
+ * @return OS_OK, or OS_ERR_INVALID_ARG if not such a number or out of range
+ */
+os_err_t mqtt_json_to_u32(const mqtt_json_token_t *token, uint32_t *out);
+
+/**
+ * @brief Start writing into a buffer
+ * @param w Writer
+ * @param buf Output buffer
+ * @param size Buffer size, including room for the terminator
+ */
+void mqtt_json_writer_init(mqtt_json_writer_t *w, char *buf, size_t size);
+
+/**
+ * @brief Open an object
+ * @param w Writer
+ */
+void mqtt_json_write_object_begin(mqtt_json_writer_t *w);
+
+/**
+ * @brief Close the innermost object
+ * @param w Writer
+ */
+void mqtt_json_write_object_end(mqtt_json_writer_t *w);
+
+/**
+ * @brief Open an array
+ * @param w Writer
+ */
+void mqtt_json_write_array_begin(mqtt_json_writer_t *w);
+
+/**
+ * @brief Close the innermost array
+ * @param w Writer
+ */
+void mqtt_json_write_array_end(mqtt_json_writer_t *w);
+
+/**
+ * @brief Write a member name; the next write is its value
+ * @param w Writer
+ * @param key Name (written as is, so it must need no escaping)
+ */
+void mqtt_json_write_key(mqtt_json_writer_t *w, const char *key);
+
+/**
+ * @brief Write a boolean
+ * @param w Writer
+ * @param v Value
+ */
+void mqtt_json_write_bool(mqtt_json_writer_t *w, bool v);
+
+/**
+ * @brief Write a signed integer
+ * @param w Writer
+ * @param v Value
+ */
+void mqtt_json_write_int(mqtt_json_writer_t *w, int32_t v);
+
+/**
+ * @brief Write an unsigned integer
+ * @param w Writer
+ * @param v Value
+ */
+void mqtt_json_write_uint(mqtt_json_writer_t *w, uint32_t v);
+
+/**
+ * @brief Write a scaled integer as an exact decimal
+ *
+ * 2134 with 2 decimals is 21.34, -5 is -0.05.
+ *
+ * @param w Writer
+ * @param v Scaled value
+ * @param decimals Digits after the decimal point (at most 9)
+ */
+void mqtt_json_write_fixed(mqtt_json_writer_t *w, int32_t v, uint8_t decimals);
+
+/**
+ * @brief Write a string, escaping quotes, backslashes and control characters
+ * @param w Writer
+ * @param str String (NULL writes "")
+ */
+void mqtt_json_write_string(mqtt_json_writer_t *w, const char *str);
+
+/**
+ * @brief Open a string written in parts
+ *
+ * For strings assembled from several pieces: each part is escaped as it
+ * is appended, so no joined copy is needed.
+ *
+ * @param w Writer
+ */
+void mqtt_json_write_string_begin(mqtt_json_writer_t *w);
+
+/**
+ * @brief Append to the open string, escaping as mqtt_json_write_string()
+ * @param w Writer
+ * @param str Text (NULL appends nothing)
+ */
+void mqtt_json_write_string_part(mqtt_json_writer_t *w, const char *str);
+
+/**
+ * @brief Close the open string
+ * @param w Writer
+ */
+void mqtt_json_write_string_end(mqtt_json_writer_t *w);
+
+/**
+ * @brief Terminate the output
+ * @param w Writer
+ * @return Length written (excluding the terminator), or -1 if the buffer
+ *         was too small or the nesting too deep
+ */
+int mqtt_json_writer_finish(mqtt_json_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_JSON_H */
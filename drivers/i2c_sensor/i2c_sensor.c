@@ -8,8 +8,8 @@
 
 /* Simulation parameters for temperature cycling */
 #define TEMP_CYCLE_MS      10000   /* Period of simulated temperature variation in milliseconds */
-#define TEMP_BASE_C        20.0f   /* Base temperature in Celsius */
-#define TEMP_VARIATION_C   5.0f    /* Temperature variation range in Celsius */
+#define TEMP_BASE_CENTI    2000    /* Base temperature in 0.01 degC */
+#define TEMP_VARIATION_CENTI 500   /* Temperature variation range in 0.01 degC */
 
 static bool initialized = false;
 
@@ -18,12 +18,13 @@ os_err_t i2c_sensor_init(void) {
     return OS_OK;
 }
 
-float i2c_sensor_read_temperature_c(void) {
+int16_t i2c_sensor_read_temperature_centi(void) {
     if (!initialized) {
-        return 0.0f;
+        return 0;
     }
 
     os_tick_t ticks = os_now_ticks();
-    float phase = (float)(ticks % OS_MS_TO_TICKS(TEMP_CYCLE_MS)) / (float)OS_MS_TO_TICKS(TEMP_CYCLE_MS);
-    return TEMP_BASE_C + (TEMP_VARIATION_C * phase);
+    uint32_t phase = ticks % OS_MS_TO_TICKS(TEMP_CYCLE_MS);
+    return (int16_t)(TEMP_BASE_CENTI +
+                     (TEMP_VARIATION_CENTI * phase) / OS_MS_TO_TICKS(TEMP_CYCLE_MS));
 }
@@ -9,6 +9,7 @@
 #include "os_types.h"
 
 os_err_t i2c_sensor_init(void);
-float i2c_sensor_read_temperature_c(void);
+/* Temperature in 0.01 degC, the ZCL MeasuredValue unit */
+int16_t i2c_sensor_read_temperature_centi(void);
 
 #endif /* I2C_SENSOR_H */
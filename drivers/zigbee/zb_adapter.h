@@ -32,6 +32,115 @@ typedef struct {
   uint8_t status;
 } zba_cmd_error_t;
 
+/* OS_EVENT_ZB_ANNOUNCE: Device_annce */
+#define ZBA_MAC_CAP_ROUTER 0x02     /* Full-function device */
+#define ZBA_MAC_CAP_MAINS 0x04      /* Mains powered */
+#define ZBA_MAC_CAP_RX_ON_IDLE 0x08 /* Receiver on when idle */
+
+typedef struct {
+  zba_node_id_t node_id;
+  uint16_t nwk_addr;
+  uint8_t capability; /* MAC capability flags, ZBA_MAC_CAP_* */
+} zba_announce_t;
+
+/* Discovery responses. Each event carries the corr_id of its request. */
+
+/* OS_EVENT_ZB_DESC_ENDPOINTS: Active_EP_rsp */
+#define ZBA_MAX_ACTIVE_EP 16
+
+typedef struct {
+  zba_node_id_t node_id;
+  uint8_t status; /* ZDP status, 0 = success */
+  uint8_t count;
+  uint8_t endpoints[ZBA_MAX_ACTIVE_EP];
+} zba_active_ep_t;
+
+/* OS_EVENT_ZB_DESC_CLUSTERS: Simple_Desc_rsp. A descriptor with more
+ * clusters than fit in one event is split; `more` is set on all but the
+ * last part. */
+#define ZBA_DESC_CLUSTERS 7
+
+typedef struct {
+  zba_node_id_t node_id;
+  uint16_t profile_id;
+  uint16_t device_id;
+  uint8_t endpoint;
+  uint8_t status; /* ZDP status, 0 = success */
+  uint8_t count;
+  uint8_t client_mask; /* Bit i set: clusters[i] is a client (output) cluster */
+  uint16_t clusters[ZBA_DESC_CLUSTERS];
+  bool more;
+} zba_simple_desc_t;
+
+/* ZCL data types and statuses used in zba_attr_read_t and zba_report_cfg_t */
+#define ZBA_ZCL_TYPE_BOOL 0x10
+#define ZBA_ZCL_TYPE_BITMAP8 0x18
+#define ZBA_ZCL_TYPE_BITMAP16 0x19
+#define ZBA_ZCL_TYPE_UINT8 0x20
+#define ZBA_ZCL_TYPE_UINT16 0x21
+#define ZBA_ZCL_TYPE_UINT32 0x23
+#define ZBA_ZCL_TYPE_UINT48 0x25
+#define ZBA_ZCL_TYPE_INT16 0x29
+#define ZBA_ZCL_TYPE_INT24 0x2A
+#define ZBA_ZCL_TYPE_ENUM8 0x30
+#define ZBA_ZCL_TYPE_CHAR_STR 0x42
+#define ZBA_ZCL_STATUS_SUCCESS 0x00
+#define ZBA_ZCL_STATUS_UNSUPPORTED_ATTRIB 0x86
+#define ZBA_ZCL_STATUS_UNREPORTABLE_ATTRIB 0x8C
+#define ZBA_ZCL_STATUS_UNSUPPORTED_CLUSTER 0xC3
+
+/* OS_EVENT_ZB_ATTR_READ: one event per attribute of a Read Attributes
+ * response. Values longer than ZBA_ATTR_DATA bytes (strings) arrive in
+ * consecutive parts at increasing offsets; the value is complete when
+ * offset + len == total. Numbers are little-endian. A request rejected as
+ * a whole (ZCL Default Response, e.g. no such cluster on the endpoint) is
+ * reported as a single event with attr_id ZBA_ATTR_ID_NONE. */
+#define ZBA_ATTR_DATA 14
+#define ZBA_ATTR_ID_NONE 0xFFFF
+
+typedef struct {
+  zba_node_id_t node_id;
+  uint16_t cluster_id;
+  uint16_t attr_id;
+  uint8_t endpoint;
+  uint8_t status; /* ZCL status, 0 = success */
+  uint8_t type;   /* ZCL data type */
+  uint8_t offset;
+  uint8_t len;
+  uint8_t total;
+  uint8_t data[ZBA_ATTR_DATA];
+} zba_attr_read_t;
+
+/* OS_EVENT_ZB_BIND_RSP (Bind_rsp, ZDP status) and OS_EVENT_ZB_REPORT_CFG_RSP
+ * (Configure Reporting response, ZCL status of the first failed record or
+ * success) */
+typedef struct {
+  zba_node_id_t node_id;
+  uint16_t cluster_id;
+  uint8_t endpoint;
+  uint8_t status;
+} zba_setup_rsp_t;
+
+/* One attribute reporting record of a Configure Reporting request. The
+ * reportable change is in raw attribute units and ignored for discrete
+ * types (booleans, bitmaps). */
+typedef struct {
+  uint16_t attr_id;
+  uint8_t type; /* ZCL data type */
+  uint16_t min_s;
+  uint16_t max_s;
+  uint32_t change;
+} zba_report_cfg_t;
+
+_Static_assert(sizeof(zba_active_ep_t) <= OS_EVENT_PAYLOAD_SIZE,
+               "zba_active_ep_t must fit an event");
+_Static_assert(sizeof(zba_simple_desc_t) <= OS_EVENT_PAYLOAD_SIZE,
+               "zba_simple_desc_t must fit an event");
+_Static_assert(sizeof(zba_attr_read_t) <= OS_EVENT_PAYLOAD_SIZE,
+               "zba_attr_read_t must fit an event");
+_Static_assert(sizeof(zba_setup_rsp_t) <= OS_EVENT_PAYLOAD_SIZE,
+               "zba_setup_rsp_t must fit an event");
+
 zba_err_t zba_init(void);
 zba_err_t zba_start_coordinator(void);
 zba_err_t zba_set_permit_join(uint16_t seconds);
@@ -42,15 +151,36 @@ zba_err_t zba_send_level(zba_node_id_t node_id, uint8_t endpoint,
                          uint8_t level_0_100, uint16_t transition_ms,
                          os_corr_id_t corr_id);
 
+/* ZDO discovery; answered by OS_EVENT_ZB_DESC_ENDPOINTS and
+ * OS_EVENT_ZB_DESC_CLUSTERS. Requests may be issued back to back. */
+zba_err_t zba_request_active_ep(zba_node_id_t node_id, os_corr_id_t corr_id);
+zba_err_t zba_request_simple_desc(zba_node_id_t node_id, uint8_t endpoint,
+                                  os_corr_id_t corr_id);
+
+/* One Read Attributes request for up to ZBA_MAX_READ_ATTRS attributes of a
+ * cluster; answered by one OS_EVENT_ZB_ATTR_READ per attribute */
+#define ZBA_MAX_READ_ATTRS 8
+
 zba_err_t zba_read_attrs(zba_node_id_t node_id, uint8_t endpoint,
                          uint16_t cluster_id, const uint16_t *attr_ids,
                          size_t attr_count, os_corr_id_t corr_id);
+
+/* One Configure Reporting request for up to ZBA_MAX_REPORT_CFGS attributes
+ * of a cluster; answered by one OS_EVENT_ZB_REPORT_CFG_RSP */
+#define ZBA_MAX_REPORT_CFGS 4
+
 zba_err_t zba_configure_reporting(zba_node_id_t node_id, uint8_t endpoint,
-                                  uint16_t cluster_id, uint16_t attr_id,
-                                  uint16_t min_s, uint16_t max_s,
-                                  uint32_t change);
+                                  uint16_t cluster_id,
+                                  const zba_report_cfg_t *cfgs, size_t count,
+                                  os_corr_id_t corr_id);
+
+/* Bind a cluster of the device to dst (an IEEE address), or to the
+ * coordinator for ZBA_BIND_DST_COORDINATOR; answered by one
+ * OS_EVENT_ZB_BIND_RSP */
+#define ZBA_BIND_DST_COORDINATOR 0
+
 zba_err_t zba_bind(zba_node_id_t node_id, uint8_t endpoint, uint16_t cluster_id,
-                   uint64_t dst);
+                   uint64_t dst, os_corr_id_t corr_id);
 
 #if defined(CONFIG_IDF_TARGET_ESP32C6)
 /* Shell commands (only available on ESP32-C6 target) */
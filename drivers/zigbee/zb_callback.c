@@ -127,10 +127,7 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal) {
       os_eui64_t eui64 = 0;
       memcpy(&eui64, a->ieee_addr, sizeof(eui64));
       nwk_cache_insert(eui64, a->device_short_addr);
-      struct {
-        os_eui64_t eui64;
-        uint16_t nwk;
-      } p = {eui64, a->device_short_addr};
+      zba_announce_t p = {eui64, a->device_short_addr, a->capability};
       emit_event(OS_EVENT_ZB_ANNOUNCE, &p, sizeof(p));
       /* SC-002: Log device join detection */
       LOG_I(ZB_MODULE, "PERF_SC002: Device announce: " OS_EUI64_FMT " @ 0x%04x",
@@ -7,6 +7,8 @@
  * Implements command functions from zb_adapter.h:
  * - zba_send_onoff
  * - zba_send_level
+ * - zba_request_active_ep
+ * - zba_request_simple_desc
  * - zba_read_attrs
  * - zba_configure_reporting
  * - zba_bind
@@ -19,8 +21,101 @@
 #include "esp_zigbee_core.h"
 #include "freertos/FreeRTOS.h"
 
+#include <string.h>
+
 #define ZB_MODULE "ZB_CMD"
 
+/* Outstanding ZDO discovery and bind requests (interviews pipeline them) */
+#define ZB_MAX_ZDO_REQS 16
+
+/* ZDP status for an endpoint the device does not have */
+#define ZB_ZDP_STATUS_NOT_ACTIVE 0x83
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * ZDO Request Context (passed to the stack as user_ctx)
+ * ─────────────────────────────────────────────────────────────────────────────
+ */
+
+typedef struct {
+  zba_node_id_t node_id;
+  os_corr_id_t corr_id;
+  uint16_t cluster_id; /* Bind requests */
+  uint8_t endpoint;
+  bool in_use;
+} zb_zdo_req_t;
+
+static zb_zdo_req_t s_zdo_reqs[ZB_MAX_ZDO_REQS];
+
+/* Called with the stack lock held; callbacks run in the Zigbee task */
+static zb_zdo_req_t *zdo_req_alloc(zba_node_id_t node_id, uint8_t endpoint,
+                                   os_corr_id_t corr_id) {
+  for (uint8_t i = 0; i < ZB_MAX_ZDO_REQS; i++) {
+    if (!s_zdo_reqs[i].in_use) {
+      s_zdo_reqs[i].node_id = node_id;
+      s_zdo_reqs[i].endpoint = endpoint;
+      s_zdo_reqs[i].corr_id = corr_id;
+      s_zdo_reqs[i].in_use = true;
+      return &s_zdo_reqs[i];
+    }
+  }
+  LOG_W(ZB_MODULE, "ZDO request slots full");
+  return NULL;
+}
+
+static void active_ep_cb(esp_zb_zdp_status_t zdo_status, uint8_t ep_count,
+                         uint8_t *ep_id_list, void *user_ctx) {
+  zb_zdo_req_t *req = user_ctx;
+  zba_active_ep_t rsp = {
+      .node_id = req->node_id,
+      .status = (uint8_t)zdo_status,
+  };
+  if (zdo_status == ESP_ZB_ZDP_STATUS_SUCCESS) {
+    rsp.count = ep_count > ZBA_MAX_ACTIVE_EP ? ZBA_MAX_ACTIVE_EP : ep_count;
+    memcpy(rsp.endpoints, ep_id_list, rsp.count);
+  }
+  zb_publish(OS_EVENT_ZB_DESC_ENDPOINTS, req->corr_id, &rsp, sizeof(rsp));
+  req->in_use = false;
+}
+
+static void simple_desc_cb(esp_zb_zdp_status_t zdo_status,
+                           esp_zb_af_simple_desc_1_1_t *desc, void *user_ctx) {
+  zb_zdo_req_t *req = user_ctx;
+  zba_simple_desc_t rsp = {
+      .node_id = req->node_id,
+      .endpoint = req->endpoint,
+      .status = (uint8_t)zdo_status,
+  };
+  if (zdo_status != ESP_ZB_ZDP_STATUS_SUCCESS || !desc) {
+    if (rsp.status == 0) {
+      rsp.status = ZB_ZDP_STATUS_NOT_ACTIVE;
+    }
+    zb_publish(OS_EVENT_ZB_DESC_CLUSTERS, req->corr_id, &rsp, sizeof(rsp));
+    req->in_use = false;
+    return;
+  }
+
+  /* app_cluster_list holds the input (server) clusters, then the output
+   * (client) clusters; split it into event-sized parts */
+  uint8_t servers = desc->app_input_cluster_count;
+  uint8_t total = servers + desc->app_output_cluster_count;
+  uint8_t i = 0;
+  do {
+    rsp.profile_id = desc->app_profile_id;
+    rsp.device_id = desc->app_device_id;
+    rsp.count = 0;
+    rsp.client_mask = 0;
+    while (i < total && rsp.count < ZBA_DESC_CLUSTERS) {
+      if (i >= servers) {
+        rsp.client_mask |= (uint8_t)(1u << rsp.count);
+      }
+      rsp.clusters[rsp.count++] = desc->app_cluster_list[i++];
+    }
+    rsp.more = i < total;
+    zb_publish(OS_EVENT_ZB_DESC_CLUSTERS, req->corr_id, &rsp, sizeof(rsp));
+  } while (i < total);
+  req->in_use = false;
+}
+
 /* ─────────────────────────────────────────────────────────────────────────────
  * Command Functions
  * ─────────────────────────────────────────────────────────────────────────────
@@ -142,46 +237,237 @@ zba_err_t zba_send_level(zba_node_id_t node_id, uint8_t endpoint,
   return OS_OK;
 }
 
+zba_err_t zba_request_active_ep(zba_node_id_t node_id, os_corr_id_t corr_id) {
+  if (!zb_is_ready()) {
+    return OS_ERR_NOT_READY;
+  }
+
+  uint16_t nwk = zb_lookup_nwk(node_id);
+  if (nwk == 0xFFFF) {
+    LOG_W(ZB_MODULE, "Node " OS_EUI64_FMT " not in cache",
+          OS_EUI64_ARG(node_id));
+    return OS_ERR_NOT_FOUND;
+  }
+
+  esp_zb_lock_acquire(portMAX_DELAY);
+  zb_zdo_req_t *req = zdo_req_alloc(node_id, 0, corr_id);
+  if (req) {
+    esp_zb_zdo_active_ep_req_param_t cmd = {.addr_of_interest = nwk};
+    esp_zb_zdo_active_ep_req(&cmd, active_ep_cb, req);
+  }
+  esp_zb_lock_release();
+
+  if (!req) {
+    return OS_ERR_NO_MEM;
+  }
+  LOG_D(ZB_MODULE, "Active EP request to " OS_EUI64_FMT " (NWK 0x%04X)",
+        OS_EUI64_ARG(node_id), nwk);
+  return OS_OK;
+}
+
+zba_err_t zba_request_simple_desc(zba_node_id_t node_id, uint8_t endpoint,
+                                  os_corr_id_t corr_id) {
+  if (!zb_is_ready()) {
+    return OS_ERR_NOT_READY;
+  }
+
+  uint16_t nwk = zb_lookup_nwk(node_id);
+  if (nwk == 0xFFFF) {
+    LOG_W(ZB_MODULE, "Node " OS_EUI64_FMT " not in cache",
+          OS_EUI64_ARG(node_id));
+    return OS_ERR_NOT_FOUND;
+  }
+
+  esp_zb_lock_acquire(portMAX_DELAY);
+  zb_zdo_req_t *req = zdo_req_alloc(node_id, endpoint, corr_id);
+  if (req) {
+    esp_zb_zdo_simple_desc_req_param_t cmd = {
+        .addr_of_interest = nwk,
+        .endpoint = endpoint,
+    };
+    esp_zb_zdo_simple_desc_req(&cmd, simple_desc_cb, req);
+  }
+  esp_zb_lock_release();
+
+  if (!req) {
+    return OS_ERR_NO_MEM;
+  }
+  LOG_D(ZB_MODULE, "Simple desc request to " OS_EUI64_FMT " ep=%u",
+        OS_EUI64_ARG(node_id), endpoint);
+  return OS_OK;
+}
+
 zba_err_t zba_read_attrs(zba_node_id_t node_id, uint8_t endpoint,
                          uint16_t cluster_id, const uint16_t *attr_ids,
                          size_t attr_count, os_corr_id_t corr_id) {
-  (void)node_id;
-  (void)endpoint;
-  (void)cluster_id;
-  (void)attr_ids;
-  (void)attr_count;
-  (void)corr_id;
-
-  LOG_I(ZB_MODULE, "zba_read_attrs (not implemented)");
-  /* TODO: Implement in Phase 6 */
-  return OS_ERR_NOT_READY;
+  if (!attr_ids || attr_count == 0 || attr_count > ZBA_MAX_READ_ATTRS) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (!zb_is_ready()) {
+    return OS_ERR_NOT_READY;
+  }
+
+  uint16_t nwk = zb_lookup_nwk(node_id);
+  if (nwk == 0xFFFF) {
+    LOG_W(ZB_MODULE, "Node " OS_EUI64_FMT " not in cache",
+          OS_EUI64_ARG(node_id));
+    return OS_ERR_NOT_FOUND;
+  }
+
+  /* The Read Attributes response is matched to corr_id by TSN */
+  zb_pending_handle_t slot = zb_pending_alloc(corr_id);
+  if (!slot) {
+    return OS_ERR_NO_MEM;
+  }
+  zb_pending_expect_response(slot);
+
+  uint16_t attrs[ZBA_MAX_READ_ATTRS];
+  memcpy(attrs, attr_ids, attr_count * sizeof(attrs[0]));
+
+  esp_zb_lock_acquire(portMAX_DELAY);
+
+  esp_zb_zcl_read_attr_cmd_t cmd = {
+      .zcl_basic_cmd =
+          {
+              .dst_addr_u.addr_short = nwk,
+              .dst_endpoint = endpoint,
+              .src_endpoint = 1,
+          },
+      .address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT,
+      .clusterID = cluster_id,
+      .attr_number = (uint8_t)attr_count,
+      .attr_field = attrs,
+  };
+
+  /* The stack copies the attribute list into the frame before returning */
+  uint8_t tsn = esp_zb_zcl_read_attr_cmd_req(&cmd);
+  zb_pending_set_tsn(slot, tsn);
+  esp_zb_lock_release();
+
+  LOG_D(ZB_MODULE, "Read %u attrs of 0x%04X from " OS_EUI64_FMT " ep=%u tsn=%u",
+        (unsigned)attr_count, cluster_id, OS_EUI64_ARG(node_id), endpoint, tsn);
+  return OS_OK;
 }
 
 zba_err_t zba_configure_reporting(zba_node_id_t node_id, uint8_t endpoint,
-                                  uint16_t cluster_id, uint16_t attr_id,
-                                  uint16_t min_s, uint16_t max_s,
-                                  uint32_t change) {
-  (void)node_id;
-  (void)endpoint;
-  (void)cluster_id;
-  (void)attr_id;
-  (void)min_s;
-  (void)max_s;
-  (void)change;
-
-  LOG_I(ZB_MODULE, "zba_configure_reporting (not implemented)");
-  /* TODO: Implement in Phase 6 */
-  return OS_ERR_NOT_READY;
+                                  uint16_t cluster_id,
+                                  const zba_report_cfg_t *cfgs, size_t count,
+                                  os_corr_id_t corr_id) {
+  if (!cfgs || count == 0 || count > ZBA_MAX_REPORT_CFGS) {
+    return OS_ERR_INVALID_ARG;
+  }
+  if (!zb_is_ready()) {
+    return OS_ERR_NOT_READY;
+  }
+
+  uint16_t nwk = zb_lookup_nwk(node_id);
+  if (nwk == 0xFFFF) {
+    LOG_W(ZB_MODULE, "Node " OS_EUI64_FMT " not in cache",
+          OS_EUI64_ARG(node_id));
+    return OS_ERR_NOT_FOUND;
+  }
+
+  /* The Configure Reporting response is matched to corr_id by TSN */
+  zb_pending_handle_t slot = zb_pending_alloc(corr_id);
+  if (!slot) {
+    return OS_ERR_NO_MEM;
+  }
+  zb_pending_expect_response(slot);
+
+  /* Reportable changes are passed by pointer in the attribute's own size;
+   * little-endian storage zero-extended to 64 bits suits every type */
+  esp_zb_zcl_config_report_record_t records[ZBA_MAX_REPORT_CFGS];
+  uint64_t changes[ZBA_MAX_REPORT_CFGS];
+  for (size_t i = 0; i < count; i++) {
+    changes[i] = cfgs[i].change;
+    records[i] = (esp_zb_zcl_config_report_record_t){
+        .direction = ESP_ZB_ZCL_REPORT_DIRECTION_SEND,
+        .attributeID = cfgs[i].attr_id,
+        .attrType = cfgs[i].type,
+        .min_interval = cfgs[i].min_s,
+        .max_interval = cfgs[i].max_s,
+        .reportable_change = &changes[i],
+    };
+  }
+
+  esp_zb_lock_acquire(portMAX_DELAY);
+
+  esp_zb_zcl_config_report_cmd_t cmd = {
+      .zcl_basic_cmd =
+          {
+              .dst_addr_u.addr_short = nwk,
+              .dst_endpoint = endpoint,
+              .src_endpoint = 1,
+          },
+      .address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT,
+      .clusterID = cluster_id,
+      .record_number = (uint8_t)count,
+      .record_field = records,
+  };
+
+  /* The stack copies the records into the frame before returning */
+  uint8_t tsn = esp_zb_zcl_config_report_cmd_req(&cmd);
+  zb_pending_set_tsn(slot, tsn);
+  esp_zb_lock_release();
+
+  LOG_D(ZB_MODULE, "Configure %u reports of 0x%04X on " OS_EUI64_FMT
+        " ep=%u tsn=%u", (unsigned)count, cluster_id, OS_EUI64_ARG(node_id),
+        endpoint, tsn);
+  return OS_OK;
+}
+
+static void bind_cb(esp_zb_zdp_status_t zdo_status, void *user_ctx) {
+  zb_zdo_req_t *req = user_ctx;
+  zba_setup_rsp_t rsp = {
+      .node_id = req->node_id,
+      .cluster_id = req->cluster_id,
+      .endpoint = req->endpoint,
+      .status = (uint8_t)zdo_status,
+  };
+  zb_publish(OS_EVENT_ZB_BIND_RSP, req->corr_id, &rsp, sizeof(rsp));
+  req->in_use = false;
 }
 
 zba_err_t zba_bind(zba_node_id_t node_id, uint8_t endpoint, uint16_t cluster_id,
-                   uint64_t dst) {
-  (void)node_id;
-  (void)endpoint;
-  (void)cluster_id;
-  (void)dst;
-
-  LOG_I(ZB_MODULE, "zba_bind (not implemented)");
-  /* TODO: Implement in Phase 6 */
-  return OS_ERR_NOT_READY;
+                   uint64_t dst, os_corr_id_t corr_id) {
+  if (!zb_is_ready()) {
+    return OS_ERR_NOT_READY;
+  }
+
+  uint16_t nwk = zb_lookup_nwk(node_id);
+  if (nwk == 0xFFFF) {
+    LOG_W(ZB_MODULE, "Node " OS_EUI64_FMT " not in cache",
+          OS_EUI64_ARG(node_id));
+    return OS_ERR_NOT_FOUND;
+  }
+
+  esp_zb_lock_acquire(portMAX_DELAY);
+  zb_zdo_req_t *req = zdo_req_alloc(node_id, endpoint, corr_id);
+  if (req) {
+    req->cluster_id = cluster_id;
+    esp_zb_zdo_bind_req_param_t cmd = {
+        .src_endp = endpoint,
+        .cluster_id = cluster_id,
+        .dst_addr_mode = ESP_ZB_ZDO_BIND_DST_ADDR_MODE_64_BIT_EXTENDED,
+        .dst_endp = 1,
+        .req_dst_addr = nwk,
+    };
+    /* IEEE addresses are little-endian on the air, as os_eui64_t is here */
+    memcpy(cmd.src_address, &node_id, sizeof(cmd.src_address));
+    if (dst == ZBA_BIND_DST_COORDINATOR) {
+      esp_zb_get_long_address(cmd.dst_address_u.addr_long);
+    } else {
+      memcpy(cmd.dst_address_u.addr_long, &dst,
+             sizeof(cmd.dst_address_u.addr_long));
+    }
+    esp_zb_zdo_device_bind_req(&cmd, bind_cb, req);
+  }
+  esp_zb_lock_release();
+
+  if (!req) {
+    return OS_ERR_NO_MEM;
+  }
+  LOG_D(ZB_MODULE, "Bind 0x%04X of " OS_EUI64_FMT " ep=%u", cluster_id,
+        OS_EUI64_ARG(node_id), endpoint);
+  return OS_OK;
 }
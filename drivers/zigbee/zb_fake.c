@@ -3,6 +3,7 @@
  * @brief Host-only Zigbee adapter simulation
  */
 
+#include "zb_fake.h"
 #include "os_fibre.h"
 #include "os_log.h"
 #include "zb_adapter.h"
@@ -11,6 +12,27 @@
 
 #define ZB_MODULE "ZB_FAKE"
 
+/* Answer for nodes that are not in the device table: an On/Off light with
+ * level control on endpoint 1 and a temperature sensor on endpoint 2 */
+static const zb_fake_device_t default_device = {
+    .manufacturer = "Test Manufacturer",
+    .model = "Test Model",
+    .sw_build = "1",
+    .power_source = 0x01,
+    .endpoint_count = 2,
+    .endpoints =
+        {
+            {1, 0x0104, 0x0100, 3, 0, {0x0000, 0x0006, 0x0008}},
+            {2, 0x0104, 0x0302, 2, 0, {0x0000, 0x0402}},
+        },
+};
+
+static struct {
+  zb_fake_device_t devices[ZB_FAKE_MAX_DEVICES];
+  uint32_t device_count;
+  zb_fake_stats_t stats;
+} fake = {0};
+
 static os_corr_id_t ensure_corr_id(os_corr_id_t corr_id) {
   if (corr_id == 0) {
     return os_event_new_corr_id();
@@ -18,6 +40,48 @@ static os_corr_id_t ensure_corr_id(os_corr_id_t corr_id) {
   return corr_id;
 }
 
+static zba_err_t publish(os_event_type_t type, os_corr_id_t corr_id,
+                         const void *payload, uint8_t len) {
+  os_event_t event = {0};
+  event.type = type;
+  event.timestamp = os_now_ticks();
+  event.corr_id = corr_id;
+  event.payload_len = len;
+  memcpy(event.payload, payload, len);
+  return os_event_publish(&event);
+}
+
+static const zb_fake_device_t *find_device(zba_node_id_t node_id) {
+  for (uint32_t i = 0; i < fake.device_count; i++) {
+    if (fake.devices[i].node_id == node_id) {
+      return &fake.devices[i];
+    }
+  }
+  return &default_device;
+}
+
+os_err_t zb_fake_add_device(const zb_fake_device_t *device) {
+  for (uint32_t i = 0; i < fake.device_count; i++) {
+    if (fake.devices[i].node_id == device->node_id) {
+      fake.devices[i] = *device;
+      return OS_OK;
+    }
+  }
+  if (fake.device_count >= ZB_FAKE_MAX_DEVICES) {
+    return OS_ERR_FULL;
+  }
+  fake.devices[fake.device_count++] = *device;
+  return OS_OK;
+}
+
+void zb_fake_reset(void) { memset(&fake, 0, sizeof(fake)); }
+
+void zb_fake_get_stats(zb_fake_stats_t *stats) {
+  if (stats) {
+    *stats = fake.stats;
+  }
+}
+
 zba_err_t zba_init(void) {
   LOG_I(ZB_MODULE, "Zigbee adapter initialized (fake)");
   return OS_OK;
@@ -76,49 +140,223 @@ zba_err_t zba_send_level(zba_node_id_t node_id, uint8_t endpoint,
   return os_event_publish(&event);
 }
 
+zba_err_t zba_request_active_ep(zba_node_id_t node_id, os_corr_id_t corr_id) {
+  const zb_fake_device_t *dev = find_device(node_id);
+  fake.stats.active_ep_reqs++;
+  if (dev->silent) {
+    return OS_OK;
+  }
+
+  zba_active_ep_t rsp = {.node_id = node_id, .count = dev->endpoint_count};
+  for (uint8_t i = 0; i < dev->endpoint_count; i++) {
+    rsp.endpoints[i] = dev->endpoints[i].endpoint;
+  }
+  return publish(OS_EVENT_ZB_DESC_ENDPOINTS, ensure_corr_id(corr_id), &rsp,
+                 sizeof(rsp));
+}
+
+zba_err_t zba_request_simple_desc(zba_node_id_t node_id, uint8_t endpoint,
+                                  os_corr_id_t corr_id) {
+  const zb_fake_device_t *dev = find_device(node_id);
+  fake.stats.simple_desc_reqs++;
+  if (dev->silent) {
+    return OS_OK;
+  }
+  corr_id = ensure_corr_id(corr_id);
+
+  const zb_fake_endpoint_t *ep = NULL;
+  for (uint8_t i = 0; i < dev->endpoint_count; i++) {
+    if (dev->endpoints[i].endpoint == endpoint) {
+      ep = &dev->endpoints[i];
+    }
+  }
+
+  zba_simple_desc_t rsp = {.node_id = node_id, .endpoint = endpoint};
+  if (!ep) {
+    rsp.status = 0x83; /* ZDP NOT_ACTIVE */
+    return publish(OS_EVENT_ZB_DESC_CLUSTERS, corr_id, &rsp, sizeof(rsp));
+  }
+
+  /* Split the cluster list as the real adapter does */
+  uint8_t total = ep->server_count + ep->client_count;
+  uint8_t i = 0;
+  do {
+    rsp.profile_id = ep->profile_id;
+    rsp.device_id = ep->device_id;
+    rsp.count = 0;
+    rsp.client_mask = 0;
+    while (i < total && rsp.count < ZBA_DESC_CLUSTERS) {
+      if (i >= ep->server_count) {
+        rsp.client_mask |= (uint8_t)(1u << rsp.count);
+      }
+      rsp.clusters[rsp.count++] = ep->clusters[i++];
+    }
+    rsp.more = i < total;
+    zba_err_t err =
+        publish(OS_EVENT_ZB_DESC_CLUSTERS, corr_id, &rsp, sizeof(rsp));
+    if (err != OS_OK) {
+      return err;
+    }
+  } while (i < total);
+  return OS_OK;
+}
+
+static bool has_server_cluster(const zb_fake_device_t *dev, uint8_t endpoint,
+                               uint16_t cluster_id) {
+  for (uint8_t i = 0; i < dev->endpoint_count; i++) {
+    const zb_fake_endpoint_t *ep = &dev->endpoints[i];
+    if (ep->endpoint != endpoint) {
+      continue;
+    }
+    for (uint8_t c = 0; c < ep->server_count; c++) {
+      if (ep->clusters[c] == cluster_id) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* Basic cluster values of a simulated device */
+static void read_basic(const zb_fake_device_t *dev, zba_attr_read_t *rsp,
+                       const char **str) {
+  *str = NULL;
+  switch (rsp->attr_id) {
+  case 0x0004:
+    *str = dev->manufacturer;
+    break;
+  case 0x0005:
+    *str = dev->model;
+    break;
+  case 0x4000:
+    *str = dev->sw_build;
+    break;
+  case 0x0007:
+    rsp->type = ZBA_ZCL_TYPE_ENUM8;
+    rsp->data[0] = dev->power_source;
+    rsp->len = rsp->total = 1;
+    return;
+  default:
+    rsp->status = ZBA_ZCL_STATUS_UNSUPPORTED_ATTRIB;
+    return;
+  }
+  if (!*str) {
+    rsp->status = ZBA_ZCL_STATUS_UNSUPPORTED_ATTRIB;
+    return;
+  }
+  rsp->type = ZBA_ZCL_TYPE_CHAR_STR;
+  size_t len = strlen(*str);
+  rsp->total = (uint8_t)(len > 255 ? 255 : len);
+}
+
 zba_err_t zba_read_attrs(zba_node_id_t node_id, uint8_t endpoint,
                          uint16_t cluster_id, const uint16_t *attr_ids,
                          size_t attr_count, os_corr_id_t corr_id) {
-  (void)attr_ids;
-  (void)attr_count;
-  zba_cmd_confirm_t payload = {
-      .node_id = node_id,
-      .endpoint = endpoint,
-      .cluster_id = cluster_id,
-      .status = 0,
-  };
+  if (!attr_ids || attr_count == 0 || attr_count > ZBA_MAX_READ_ATTRS) {
+    return OS_ERR_INVALID_ARG;
+  }
 
-  os_event_t event = {0};
-  event.type = OS_EVENT_ZB_CMD_CONFIRM;
-  event.timestamp = os_now_ticks();
-  event.corr_id = ensure_corr_id(corr_id);
-  event.payload_len = sizeof(payload);
-  memcpy(event.payload, &payload, sizeof(payload));
+  const zb_fake_device_t *dev = find_device(node_id);
+  fake.stats.read_reqs++;
+  fake.stats.attrs_read += (uint32_t)attr_count;
+  if (dev->silent) {
+    return OS_OK;
+  }
+  corr_id = ensure_corr_id(corr_id);
 
-  return os_event_publish(&event);
+  /* Like a device, reject the request when the endpoint has no such server
+   * cluster */
+  if (!has_server_cluster(dev, endpoint, cluster_id)) {
+    zba_attr_read_t rsp = {
+        .node_id = node_id,
+        .cluster_id = cluster_id,
+        .attr_id = ZBA_ATTR_ID_NONE,
+        .endpoint = endpoint,
+        .status = ZBA_ZCL_STATUS_UNSUPPORTED_CLUSTER,
+    };
+    return publish(OS_EVENT_ZB_ATTR_READ, corr_id, &rsp, sizeof(rsp));
+  }
+
+  for (size_t a = 0; a < attr_count; a++) {
+    zba_attr_read_t rsp = {
+        .node_id = node_id,
+        .cluster_id = cluster_id,
+        .attr_id = attr_ids[a],
+        .endpoint = endpoint,
+    };
+    const char *str = NULL;
+    if (cluster_id == 0x0000) {
+      read_basic(dev, &rsp, &str);
+    } else {
+      rsp.status = ZBA_ZCL_STATUS_UNSUPPORTED_ATTRIB;
+    }
+
+    /* Strings go out in ZBA_ATTR_DATA-sized parts */
+    do {
+      if (str) {
+        rsp.len = (uint8_t)(rsp.total - rsp.offset > ZBA_ATTR_DATA
+                                ? ZBA_ATTR_DATA
+                                : rsp.total - rsp.offset);
+        memcpy(rsp.data, str + rsp.offset, rsp.len);
+      }
+      zba_err_t err =
+          publish(OS_EVENT_ZB_ATTR_READ, corr_id, &rsp, sizeof(rsp));
+      if (err != OS_OK) {
+        return err;
+      }
+      rsp.offset = (uint8_t)(rsp.offset + rsp.len);
+    } while (str && rsp.offset < rsp.total);
+  }
+  return OS_OK;
 }
 
 zba_err_t zba_configure_reporting(zba_node_id_t node_id, uint8_t endpoint,
-                                  uint16_t cluster_id, uint16_t attr_id,
-                                  uint16_t min_s, uint16_t max_s,
-                                  uint32_t change) {
-  (void)node_id;
-  (void)endpoint;
-  (void)cluster_id;
-  (void)attr_id;
-  (void)min_s;
-  (void)max_s;
-  (void)change;
-  LOG_I(ZB_MODULE, "Configure reporting (fake)");
-  return OS_OK;
+                                  uint16_t cluster_id,
+                                  const zba_report_cfg_t *cfgs, size_t count,
+                                  os_corr_id_t corr_id) {
+  if (!cfgs || count == 0 || count > ZBA_MAX_REPORT_CFGS) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  const zb_fake_device_t *dev = find_device(node_id);
+  fake.stats.report_cfg_reqs++;
+  fake.stats.report_cfgs += (uint32_t)count;
+  if (dev->silent) {
+    return OS_OK;
+  }
+
+  zba_setup_rsp_t rsp = {
+      .node_id = node_id,
+      .cluster_id = cluster_id,
+      .endpoint = endpoint,
+      .status = ZBA_ZCL_STATUS_SUCCESS,
+  };
+  if (!has_server_cluster(dev, endpoint, cluster_id)) {
+    rsp.status = ZBA_ZCL_STATUS_UNSUPPORTED_CLUSTER;
+  } else if (dev->no_reporting) {
+    rsp.status = ZBA_ZCL_STATUS_UNREPORTABLE_ATTRIB;
+  }
+  return publish(OS_EVENT_ZB_REPORT_CFG_RSP, ensure_corr_id(corr_id), &rsp,
+                 sizeof(rsp));
 }
 
 zba_err_t zba_bind(zba_node_id_t node_id, uint8_t endpoint, uint16_t cluster_id,
-                   uint64_t dst) {
-  (void)node_id;
-  (void)endpoint;
-  (void)cluster_id;
+                   uint64_t dst, os_corr_id_t corr_id) {
   (void)dst;
-  LOG_I(ZB_MODULE, "Bind request (fake)");
-  return OS_OK;
+  const zb_fake_device_t *dev = find_device(node_id);
+  fake.stats.bind_reqs++;
+  if (dev->silent) {
+    return OS_OK;
+  }
+
+  zba_setup_rsp_t rsp = {
+      .node_id = node_id,
+      .cluster_id = cluster_id,
+      .endpoint = endpoint,
+      .status = has_server_cluster(dev, endpoint, cluster_id)
+                    ? 0
+                    : 0x84, /* ZDP NOT_SUPPORTED */
+  };
+  return publish(OS_EVENT_ZB_BIND_RSP, ensure_corr_id(corr_id), &rsp,
+                 sizeof(rsp));
 }
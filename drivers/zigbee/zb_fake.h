@@ -0,0 +1,79 @@
+/**
+ * @file zb_fake.h
+ * @brief Host-only Zigbee adapter simulation controls
+ *
+ * The fake adapter answers discovery requests from a table of simulated
+ * devices. Nodes that are not in the table answer as a default two-endpoint
+ * light/temperature device.
+ */
+
+#ifndef ZB_FAKE_H
+#define ZB_FAKE_H
+
+#include "zb_adapter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZB_FAKE_MAX_DEVICES 32
+#define ZB_FAKE_MAX_ENDPOINTS 4
+#define ZB_FAKE_MAX_CLUSTERS 10
+
+/* Simulated endpoint; clusters lists the servers, then the clients */
+typedef struct {
+  uint8_t endpoint;
+  uint16_t profile_id;
+  uint16_t device_id;
+  uint8_t server_count;
+  uint8_t client_count;
+  uint16_t clusters[ZB_FAKE_MAX_CLUSTERS];
+} zb_fake_endpoint_t;
+
+/* Simulated device. Strings are not copied and must outlive the entry. */
+typedef struct {
+  zba_node_id_t node_id;
+  const char *manufacturer;
+  const char *model;
+  const char *sw_build; /* Basic SWBuildID */
+  uint8_t power_source; /* ZCL PowerSource, 0x01 mains, 0x03 battery */
+  uint8_t endpoint_count;
+  zb_fake_endpoint_t endpoints[ZB_FAKE_MAX_ENDPOINTS];
+  bool silent;       /* Accepts requests but never answers */
+  bool no_reporting; /* Refuses Configure Reporting */
+} zb_fake_device_t;
+
+/* Requests seen since the last reset */
+typedef struct {
+  uint32_t active_ep_reqs;
+  uint32_t simple_desc_reqs;
+  uint32_t read_reqs;
+  uint32_t attrs_read;
+  uint32_t bind_reqs;
+  uint32_t report_cfg_reqs;
+  uint32_t report_cfgs; /* Attribute records in those requests */
+} zb_fake_stats_t;
+
+/**
+ * @brief Add or replace a simulated device
+ * @param device Device description (copied)
+ * @return OS_OK, OS_ERR_FULL if the table is full
+ */
+os_err_t zb_fake_add_device(const zb_fake_device_t *device);
+
+/**
+ * @brief Forget all simulated devices and clear the statistics
+ */
+void zb_fake_reset(void);
+
+/**
+ * @brief Get request statistics
+ * @param stats Output statistics
+ */
+void zb_fake_get_stats(zb_fake_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZB_FAKE_H */
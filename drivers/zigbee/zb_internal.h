@@ -8,7 +8,9 @@
 #ifndef ZB_INTERNAL_H
 #define ZB_INTERNAL_H
 
+#include "os_event.h"
 #include "os_types.h"
+#include "zb_adapter.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -28,6 +30,13 @@ zb_pending_handle_t zb_pending_alloc(os_corr_id_t corr_id);
 void zb_pending_set_tsn(zb_pending_handle_t slot, uint8_t tsn);
 void zb_pending_free(zb_pending_handle_t slot);
 
+/* Keep the slot after the send confirmation; the response frees it */
+void zb_pending_expect_response(zb_pending_handle_t slot);
+
+/* Publish an adapter response event tagged with its request's corr_id */
+zba_err_t zb_publish(os_event_type_t type, os_corr_id_t corr_id,
+                     const void *payload, uint8_t len);
+
 #ifdef __cplusplus
 }
 #endif
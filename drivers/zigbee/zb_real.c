@@ -8,6 +8,8 @@
  * - Coordinator network formation
  * - Device join/leave handling
  * - Event emission to OS bus
+ * - Read Attributes responses (OS_EVENT_ZB_ATTR_READ)
+ * - Configure Reporting responses (OS_EVENT_ZB_REPORT_CFG_RSP)
  */
 
 #include "os_event.h"
@@ -35,6 +37,36 @@
 /* Forward declarations - internal helpers */
 static void zb_task(void *arg);
 static void zb_send_status_cb(esp_zb_zcl_command_send_status_message_t message);
+/* Configure Reporting response: success, or the first failed record */
+static void
+handle_config_report_resp(const esp_zb_zcl_cmd_config_report_resp_message_t *msg) {
+  zb_pending_cmd_t *slot = pending_cmd_lookup_by_tsn(msg->info.header.tsn);
+  if (!slot) {
+    LOG_W(ZB_MODULE, "No pending report config for TSN %u",
+          msg->info.header.tsn);
+    return;
+  }
+  os_corr_id_t corr_id = slot->corr_id;
+  pending_cmd_free(slot);
+
+  zb_nwk_entry_t *entry =
+      nwk_cache_lookup_by_nwk(msg->info.src_address.u.short_addr);
+  if (!entry) {
+    return;
+  }
+  zba_setup_rsp_t rsp = {
+      .node_id = entry->eui64,
+      .cluster_id = msg->info.cluster,
+      .endpoint = msg->info.src_endpoint,
+      .status = (uint8_t)msg->info.status,
+  };
+  for (esp_zb_zcl_config_report_resp_variable_t *var = msg->variables;
+       var && rsp.status == ESP_ZB_ZCL_STATUS_SUCCESS; var = var->next) {
+    rsp.status = (uint8_t)var->status;
+  }
+  zb_publish(OS_EVENT_ZB_REPORT_CFG_RSP, corr_id, &rsp, sizeof(rsp));
+}
+
 static esp_err_t zb_core_action_cb(esp_zb_core_action_callback_id_t callback_id,
                                    const void *message);
 
@@ -145,6 +177,15 @@ static zb_nwk_entry_t *nwk_cache_lookup_by_eui64(os_eui64_t eui64) {
   return NULL;
 }
 
+static zb_nwk_entry_t *nwk_cache_lookup_by_nwk(uint16_t nwk_addr) {
+  for (uint8_t i = 0; i < s_nwk_count; i++) {
+    if (s_nwk_cache[i].nwk_addr == nwk_addr) {
+      return &s_nwk_cache[i];
+    }
+  }
+  return NULL;
+}
+
 static bool nwk_cache_remove(os_eui64_t eui64) {
   for (uint8_t i = 0; i < s_nwk_count; i++) {
     if (s_nwk_cache[i].eui64 == eui64) {
@@ -170,6 +211,7 @@ typedef struct {
   bool tsn_valid;
   os_corr_id_t corr_id;
   uint32_t timestamp_ms;
+  bool expects_response; /* Freed by the response, not the send status */
   bool in_use;
 } zb_pending_cmd_t;
 
@@ -185,6 +227,7 @@ static zb_pending_cmd_t *pending_cmd_alloc(os_corr_id_t corr_id) {
           false; /* Set true via pending_cmd_set_tsn */
       s_pending_cmds[i].timestamp_ms =
           (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
+      s_pending_cmds[i].expects_response = false;
       s_pending_cmds[i].in_use = true;
       return &s_pending_cmds[i];
     }
@@ -286,8 +329,9 @@ zba_err_t zba_set_permit_join(uint16_t seconds) {
  * ─────────────────────────────────────────────────────────────────────────────
  */
 
-/* Note: zb_send_onoff, zb_send_level, zb_read_attrs, zb_configure_reporting,
- * zb_bind are implemented in zb_cmd.c */
+/* Note: zb_send_onoff, zb_send_level, zb_request_active_ep,
+ * zb_request_simple_desc, zb_read_attrs, zb_configure_reporting, zb_bind are
+ * implemented in zb_cmd.c */
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * Internal - Zigbee Task (T022)
@@ -316,6 +360,16 @@ zb_send_status_cb(esp_zb_zcl_command_send_status_message_t message) {
     LOG_W(ZB_MODULE, "No pending cmd for TSN %u", message.tsn);
     return;
   }
+  /* Requests answered by a ZCL response stay pending until it arrives;
+   * a failed send never gets one */
+  if (slot->expects_response) {
+    if (message.status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+      LOG_W(ZB_MODULE, "Request failed, corr_id=%" PRIu32 " status=%d",
+            slot->corr_id, message.status);
+      pending_cmd_free(slot);
+    }
+    return;
+  }
   /* Emit appropriate event */
   if (message.status == ESP_ZB_ZCL_STATUS_SUCCESS) {
     os_event_emit(OS_EVENT_ZB_CMD_CONFIRM, &slot->corr_id,
@@ -329,10 +383,120 @@ zb_send_status_cb(esp_zb_zcl_command_send_status_message_t message) {
   pending_cmd_free(slot);
 }
 
+/* Publish one attribute of a Read Attributes response, in ZBA_ATTR_DATA
+ * sized parts for strings */
+static void emit_attr_read(zba_attr_read_t *rsp, os_corr_id_t corr_id,
+                           const esp_zb_zcl_attribute_data_t *data) {
+  const uint8_t *value = data->value;
+  uint16_t size = value ? data->size : 0;
+
+  rsp->type = (uint8_t)data->type;
+  if (value && (data->type == ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING ||
+                data->type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING)) {
+    /* ZCL strings carry their length in the first byte */
+    size = value[0] == 0xFF ? 0 : value[0];
+    value++;
+  }
+  rsp->total = (uint8_t)(size > 255 ? 255 : size);
+
+  do {
+    rsp->len = (uint8_t)(rsp->total - rsp->offset > ZBA_ATTR_DATA
+                             ? ZBA_ATTR_DATA
+                             : rsp->total - rsp->offset);
+    memcpy(rsp->data, value + rsp->offset, rsp->len);
+    zb_publish(OS_EVENT_ZB_ATTR_READ, corr_id, rsp, sizeof(*rsp));
+    rsp->offset = (uint8_t)(rsp->offset + rsp->len);
+  } while (rsp->offset < rsp->total);
+}
+
+static void handle_read_attr_resp(const esp_zb_zcl_cmd_read_attr_resp_message_t *msg) {
+  zb_pending_cmd_t *slot = pending_cmd_lookup_by_tsn(msg->info.header.tsn);
+  if (!slot) {
+    LOG_W(ZB_MODULE, "No pending read for TSN %u", msg->info.header.tsn);
+    return;
+  }
+  os_corr_id_t corr_id = slot->corr_id;
+  pending_cmd_free(slot);
+
+  zb_nwk_entry_t *entry =
+      nwk_cache_lookup_by_nwk(msg->info.src_address.u.short_addr);
+  if (!entry) {
+    LOG_W(ZB_MODULE, "Read response from unknown NWK 0x%04X",
+          msg->info.src_address.u.short_addr);
+    return;
+  }
+
+  for (esp_zb_zcl_read_attr_resp_variable_t *var = msg->variables; var;
+       var = var->next) {
+    zba_attr_read_t rsp = {
+        .node_id = entry->eui64,
+        .cluster_id = msg->info.cluster,
+        .attr_id = var->attribute.id,
+        .endpoint = msg->info.src_endpoint,
+        .status = (uint8_t)var->status,
+    };
+    if (var->status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+      zb_publish(OS_EVENT_ZB_ATTR_READ, corr_id, &rsp, sizeof(rsp));
+      continue;
+    }
+    emit_attr_read(&rsp, corr_id, &var->attribute.data);
+  }
+}
+
+/* A request rejected with a Default Response never gets its own response:
+ * report a read as one attribute-less ATTR_READ event and a reporting
+ * configuration as a failed REPORT_CFG_RSP */
+static void handle_default_resp(const esp_zb_zcl_cmd_default_resp_message_t *msg) {
+  zb_pending_cmd_t *slot = pending_cmd_lookup_by_tsn(msg->info.header.tsn);
+  if (!slot || !slot->expects_response ||
+      msg->status_code == ESP_ZB_ZCL_STATUS_SUCCESS) {
+    return;
+  }
+  os_corr_id_t corr_id = slot->corr_id;
+  pending_cmd_free(slot);
+
+  zb_nwk_entry_t *entry =
+      nwk_cache_lookup_by_nwk(msg->info.src_address.u.short_addr);
+  if (!entry) {
+    return;
+  }
+  if (msg->resp_to_cmd == ESP_ZB_ZCL_CMD_CONFIG_REPORTING) {
+    zba_setup_rsp_t cfg = {
+        .node_id = entry->eui64,
+        .cluster_id = msg->info.cluster,
+        .endpoint = msg->info.src_endpoint,
+        .status = (uint8_t)msg->status_code,
+    };
+    zb_publish(OS_EVENT_ZB_REPORT_CFG_RSP, corr_id, &cfg, sizeof(cfg));
+    return;
+  }
+  zba_attr_read_t rsp = {
+      .node_id = entry->eui64,
+      .cluster_id = msg->info.cluster,
+      .attr_id = ZBA_ATTR_ID_NONE,
+      .endpoint = msg->info.src_endpoint,
+      .status = (uint8_t)msg->status_code,
+  };
+  zb_publish(OS_EVENT_ZB_ATTR_READ, corr_id, &rsp, sizeof(rsp));
+}
+
 static esp_err_t zb_core_action_cb(esp_zb_core_action_callback_id_t callback_id,
                                    const void *message) {
   LOG_D(ZB_MODULE, "core action cb called: %d", callback_id);
-  /* TODO: Implement in Phase 6 */
+  switch (callback_id) {
+  case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID:
+    handle_read_attr_resp(message);
+    break;
+  case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID:
+    handle_config_report_resp(message);
+    break;
+  case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID:
+    handle_default_resp(message);
+    break;
+  default:
+    /* TODO: Implement in Phase 6 */
+    break;
+  }
   return ESP_OK;
 }
 
@@ -394,11 +558,8 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal) {
     LOG_I(ZB_MODULE, "Device joined: " OS_EUI64_FMT ", NWK: 0x%04X",
           OS_EUI64_ARG(eui64), dev->device_short_addr);
     nwk_cache_insert(eui64, dev->device_short_addr);
-    /* Emit device announce event with EUI64 + NWK addr */
-    struct {
-      os_eui64_t eui64;
-      uint16_t nwk_addr;
-    } payload = {eui64, dev->device_short_addr};
+    /* Emit device announce event with EUI64, NWK addr and capabilities */
+    zba_announce_t payload = {eui64, dev->device_short_addr, dev->capability};
     os_event_emit(OS_EVENT_ZB_ANNOUNCE, &payload, sizeof(payload));
     break;
   }
@@ -432,3 +593,21 @@ void zb_pending_set_tsn(zb_pending_handle_t slot, uint8_t tsn) {
 void zb_pending_free(zb_pending_handle_t slot) {
   pending_cmd_free((zb_pending_cmd_t *)slot);
 }
+
+void zb_pending_expect_response(zb_pending_handle_t slot) {
+  zb_pending_cmd_t *cmd = (zb_pending_cmd_t *)slot;
+  if (cmd && cmd->in_use) {
+    cmd->expects_response = true;
+  }
+}
+
+zba_err_t zb_publish(os_event_type_t type, os_corr_id_t corr_id,
+                     const void *payload, uint8_t len) {
+  os_event_t event = {0};
+  event.type = type;
+  event.timestamp = os_now_ticks();
+  event.corr_id = corr_id;
+  event.payload_len = len;
+  memcpy(event.payload, payload, len);
+  return os_event_publish(&event);
+}
@@ -11,10 +11,13 @@
 
 // #include "app_blink.h" // Disabled - blink task not used
 #include "capability.h"
+#include "cmd_sched.h"
 #include "ha_disc.h"
 #include "interview.h"
+#include "liveness.h"
 #include "local_node.h"
 #include "mqtt_adapter.h"
+#include "quirks.h"
 #include "os.h"
 #include "registry.h"
 #include "zb_adapter.h"
@@ -93,12 +96,35 @@ static int bridge_main(void) {
     LOG_E(MAIN_MODULE, "Interview init failed: %d", err);
   }
 
+  /* Initialize quirks index, replaced by a compiled database if present */
+  err = quirks_init();
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Quirks init failed: %d", err);
+  }
+  err = quirks_load_file(QUIRKS_DB_PATH);
+  if (err != OS_OK && err != OS_ERR_NOT_FOUND) {
+    LOG_W(MAIN_MODULE, "Quirk database %s rejected (%d), using built-in table",
+          QUIRKS_DB_PATH, err);
+  }
+
   /* Initialize capability service */
   err = cap_init();
   if (err != OS_OK) {
     LOG_E(MAIN_MODULE, "Capability init failed: %d", err);
   }
 
+  /* Initialize command scheduler */
+  err = cmd_sched_init();
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Command scheduler init failed: %d", err);
+  }
+
+  /* Initialize liveness service */
+  err = liveness_init();
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Liveness init failed: %d", err);
+  }
+
   /* Initialize MQTT adapter */
   err = mqtt_init(NULL);
   if (err != OS_OK) {
@@ -162,6 +188,21 @@ static int bridge_main(void) {
     LOG_E(MAIN_MODULE, "Failed to create interview task: %d", err);
   }
 
+  err = os_fibre_create(cap_task, NULL, "cap", 2048, NULL);
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Failed to create capability task: %d", err);
+  }
+
+  err = os_fibre_create(cmd_sched_task, NULL, "cmd", 2048, NULL);
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Failed to create command scheduler task: %d", err);
+  }
+
+  err = os_fibre_create(liveness_task, NULL, "liveness", 2048, NULL);
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Failed to create liveness task: %d", err);
+  }
+
   err = os_fibre_create(mqtt_task, NULL, "mqtt", 2048, NULL);
   if (err != OS_OK) {
     LOG_E(MAIN_MODULE, "Failed to create mqtt task: %d", err);
@@ -38,16 +38,26 @@ typedef enum {
     OS_EVENT_ZB_DESC_ENDPOINTS,
     OS_EVENT_ZB_DESC_CLUSTERS,
     OS_EVENT_ZB_ATTR_REPORT,
+    OS_EVENT_ZB_ATTR_READ,
+    OS_EVENT_ZB_BIND_RSP,
+    OS_EVENT_ZB_REPORT_CFG_RSP,
     OS_EVENT_ZB_CMD_CONFIRM,
     OS_EVENT_ZB_CMD_ERROR,
     
     /* Capability events */
     OS_EVENT_CAP_STATE_CHANGED,
     OS_EVENT_CAP_COMMAND,
+    OS_EVENT_CAP_SET_CHANGED,           /* cap_set_event_t */
     
     /* Persistence events */
     OS_EVENT_PERSIST_FLUSH,
     
+    /* Registry events */
+    OS_EVENT_REG_NODE_STATE_CHANGED,
+    
+    /* Northbound events */
+    OS_EVENT_HA_ONLINE,                 /* Home Assistant birth message */
+    
     /* User/test events */
     OS_EVENT_USER_BASE = 100,
     
@@ -156,7 +166,7 @@ os_corr_id_t os_event_new_corr_id(void);
 /* Helper macros for common event types */
 #define OS_EVENT_FILTER_ALL     {0, OS_EVENT_TYPE_MAX}
 #define OS_EVENT_FILTER_ZB      {OS_EVENT_ZB_STACK_UP, OS_EVENT_ZB_CMD_ERROR}
-#define OS_EVENT_FILTER_CAP     {OS_EVENT_CAP_STATE_CHANGED, OS_EVENT_CAP_COMMAND}
+#define OS_EVENT_FILTER_CAP     {OS_EVENT_CAP_STATE_CHANGED, OS_EVENT_CAP_SET_CHANGED}
 
 #ifdef __cplusplus
 }
@@ -127,6 +127,16 @@ os_err_t os_fibre_get_stats(os_sched_stats_t *stats);
  */
 os_fibre_handle_t os_fibre_current(void);
 
+/**
+ * @brief End a fibre's sleep early
+ *
+ * For event handlers that hand work to a fibre sleeping until needed.
+ * No effect if the fibre is not sleeping.
+ *
+ * @param fibre Fibre handle
+ */
+void os_fibre_wake(os_fibre_handle_t fibre);
+
 /**
  * @brief Called by platform timer ISR to advance ticks
  * @note Must be safe to call from ISR context
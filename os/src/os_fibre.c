@@ -140,7 +140,8 @@ void os_fibre_start(void) {
   sched.running = true;
 
   while (1) {
-    os_fibre_t *next = find_next_ready();
+    /* volatile: live across setjmp(), which optimised builds may clobber */
+    os_fibre_t *volatile next = find_next_ready();
 
     if (next == NULL) {
       next = sched.idle;
@@ -273,6 +274,12 @@ os_err_t os_fibre_get_info(uint32_t index, os_fibre_info_t *info) {
 
 os_fibre_handle_t os_fibre_current(void) { return sched.current; }
 
+void os_fibre_wake(os_fibre_handle_t fibre) {
+  if (fibre && fibre->state == OS_FIBRE_STATE_SLEEPING) {
+    fibre->state = OS_FIBRE_STATE_READY;
+  }
+}
+
 os_err_t os_fibre_get_stats(os_sched_stats_t *stats) {
   if (!sched.initialized || stats == NULL) {
     return OS_ERR_INVALID_ARG;
@@ -556,6 +563,12 @@ os_fibre_handle_t os_fibre_current(void) {
   return NULL;
 }
 
+void os_fibre_wake(os_fibre_handle_t fibre) {
+  if (fibre && fibre->task_handle) {
+    xTaskAbortDelay(fibre->task_handle);
+  }
+}
+
 os_err_t os_fibre_get_stats(os_sched_stats_t *stats) {
   if (!sched.initialized || stats == NULL) {
     return OS_ERR_INVALID_ARG;
@@ -321,5 +321,13 @@ static int cmd_mqtt(int argc, char *argv[]) {
   printf("  Reconnects:   %" PRIu32 "\n", stats.reconnects);
   printf("  Errors:       %" PRIu32 "\n", stats.errors);
 
+  mqtt_snapshot_stats_t snap;
+  if (mqtt_get_snapshot_stats(&snap) == OS_OK && snap.runs > 0) {
+    printf("  Snapshot:     %s, %" PRIu32 "/%" PRIu32 " nodes, %" PRIu32
+           " states, %" PRIu32 " ms\n",
+           snap.active ? "running" : "done", snap.nodes_done, snap.nodes_total,
+           snap.published, snap.elapsed_ms);
+  }
+
   return 0;
 }
@@ -5,11 +5,28 @@
  * ESP32-C6 Zigbee Bridge OS - HA Discovery service (T080)
  *
  * Generates and publishes Home Assistant MQTT discovery messages.
+ * Entities read the per-capability state topics, or in the MQTT adapter's
+ * aggregate mode their member of the node's state document.
+ *
+ * What each capability becomes in HA (component, device class, units,
+ * template, or which entity it is merged into) is one table, entity_map;
+ * a node is published in a single pass over it against the node's
+ * capability mask.
+ *
+ * Configs are published retained and remembered per registry slot: a
+ * hash of each entity's last payload, and the inputs it was built from
+ * (registry generation, capability mask, state mode). Republishing a node
+ * whose inputs are unchanged builds nothing; one whose inputs changed
+ * publishes only the entities whose bytes differ, and removes entities it
+ * no longer has. Reconnects therefore cost next to nothing; configs still
+ * in the send buffer when a session drops are forgotten, so the reconnect
+ * sends them again.
  */
 
 #include "ha_disc.h"
 #include "capability.h"
 #include "mqtt_adapter.h"
+#include "mqtt_json.h"
 #include "os.h"
 #include "registry.h"
 #include <inttypes.h>
@@ -30,95 +47,143 @@
 /* Topic base for state/commands */
 #define TOPIC_BASE "bridge"
 
-/* Maximum payload size for discovery config JSON */
-#define HA_MAX_PAYLOAD_SIZE 1024
+/* Largest discovery topic, homeassistant/<component>/<unique_id>/config */
+#define HA_MAX_TOPIC_LEN 128
 
-/* Timing constants */
-#define HA_DISC_STARTUP_DELAY_MS 2000
-#define HA_DISC_POLLING_INTERVAL_MS 5000
+/* Task timing: events wake the task, so these only bound the wait */
+#define HA_DISC_IDLE_MS 60000
+#define HA_DISC_RETRY_MS 10
 
 /* Component names */
 static const char *component_names[] = {"light", "switch", "sensor",
                                         "binary_sensor"};
 
-/* Pending publish tracking */
-#define HA_MAX_PENDING 32
+/* Device name when the node has neither friendly name nor model */
+static const char *fallback_names[] = {"Zigbee Light", "Zigbee Switch",
+                                       "Zigbee Sensor", "Zigbee Sensor"};
 
+/* How a capability appears in HA. Each is an entity of its own or part of
+ * another capability's entity, as light.level is the light's brightness */
 typedef struct {
-  os_eui64_t node_addr;
-  bool pending;
-} ha_pending_t;
+  cap_id_t cap_id;
+  ha_component_t component; /* HA_COMPONENT_MAX: not exposed */
+  cap_id_t merge_into;      /* Entity it is part of; CAP_UNKNOWN: its own */
+  const char *key;          /* Member prefix in that entity's config */
+  uint16_t scale;           /* <key>_scale if non-zero */
+  const char *object_id;    /* Id suffix; NULL: the capability name */
+  const char *device_class; /* NULL: none */
+  const char *state_class;  /* NULL: none */
+  const char *unit;         /* NULL: the capability's own */
+  const char *pre;          /* Around the value in value_template */
+  const char *post;
+} ha_entity_map_t;
+
+/* One entry per capability, in cap_id_t order */
+static const ha_entity_map_t entity_map[] = {
+    {.cap_id = CAP_UNKNOWN, .component = HA_COMPONENT_MAX},
+    {.cap_id = CAP_SWITCH_ON,
+     .component = HA_COMPONENT_SWITCH,
+     .pre = "'ON' if ",
+     .post = " else 'OFF'"},
+    {.cap_id = CAP_LIGHT_ON,
+     .component = HA_COMPONENT_LIGHT,
+     .object_id = "light"},
+    {.cap_id = CAP_LIGHT_LEVEL,
+     .component = HA_COMPONENT_LIGHT,
+     .merge_into = CAP_LIGHT_ON,
+     .key = "brightness",
+     .scale = 255,
+     .pre = "(",
+     .post = " | float * 2.55) | int"},
+    {.cap_id = CAP_LIGHT_COLOR_TEMP,
+     .component = HA_COMPONENT_LIGHT,
+     .merge_into = CAP_LIGHT_ON,
+     .key = "color_temp"},
+    {.cap_id = CAP_SENSOR_TEMPERATURE,
+     .component = HA_COMPONENT_SENSOR,
+     .device_class = "temperature",
+     .state_class = "measurement"},
+    {.cap_id = CAP_SENSOR_HUMIDITY,
+     .component = HA_COMPONENT_SENSOR,
+     .device_class = "humidity",
+     .state_class = "measurement"},
+    {.cap_id = CAP_SENSOR_CONTACT,
+     .component = HA_COMPONENT_BINARY_SENSOR,
+     .device_class = "door",
+     .pre = "'ON' if ",
+     .post = " else 'OFF'"},
+    {.cap_id = CAP_SENSOR_MOTION,
+     .component = HA_COMPONENT_BINARY_SENSOR,
+     .device_class = "motion",
+     .pre = "'ON' if ",
+     .post = " else 'OFF'"},
+    {.cap_id = CAP_SENSOR_ILLUMINANCE,
+     .component = HA_COMPONENT_SENSOR,
+     .device_class = "illuminance",
+     .state_class = "measurement",
+     .unit = "lx"},
+    {.cap_id = CAP_POWER_WATTS,
+     .component = HA_COMPONENT_SENSOR,
+     .device_class = "power",
+     .state_class = "measurement"},
+    {.cap_id = CAP_ENERGY_KWH,
+     .component = HA_COMPONENT_SENSOR,
+     .device_class = "energy",
+     .state_class = "total_increasing"},
+};
+
+_Static_assert(sizeof(entity_map) / sizeof(entity_map[0]) == CAP_MAX,
+               "one entity_map entry per capability");
+
+/* What was last published for one node, by registry slot */
+typedef struct {
+  os_eui64_t node_addr; /* Owner; guards against slot reuse */
+  bool dirty;           /* Waiting for the task to publish it */
+  bool valid;           /* Stamp below matches what was published */
+  uint32_t generation;
+  uint32_t cap_mask;
+  uint8_t state_mode;
+  uint32_t hash[CAP_MAX]; /* Payload hash per entity, keyed by its main
+                             capability; 0 if not published */
+  uint32_t unflushed;     /* Entities whose config may still be in the
+                             send buffer */
+} ha_disc_cache_t;
+
+/* Configs are retained so HA finds them after its own restart */
+static const mqtt_pub_opts_t config_opts = {.retain = true,
+                                            .prio = MQTT_PRIO_NORMAL};
 
 /* Service state */
 static struct {
   bool initialized;
-  ha_pending_t pending[HA_MAX_PENDING];
-  uint32_t pending_count;
+  os_fibre_handle_t task;
+  os_tick_t due; /* Tick of the task's next pass */
+  uint32_t dirty_count;
+  bool unflushed; /* Some cache has unflushed entities */
+  ha_disc_cache_t cache[REG_MAX_NODES];
+  ha_disc_stats_t stats;
 } service = {0};
 
 /* Forward declarations */
-static os_err_t publish_light_discovery(os_eui64_t node_addr, bool has_level);
-static os_err_t publish_sensor_discovery(os_eui64_t node_addr, cap_id_t cap_id);
-static void handle_reg_node_ready(const os_event_t *event, void *ctx);
+static os_err_t publish_entity(ha_disc_cache_t *cache, const reg_node_t *node,
+                               const char *eui, cap_id_t cap_id,
+                               uint32_t cap_mask);
+static bool is_entity(cap_id_t cap_id);
+static void eui_hex(os_eui64_t addr, char out[17]);
+static void entity_topic(os_eui64_t node_addr, cap_id_t cap_id, char *topic,
+                         size_t topic_size);
+static void handle_node_state(const os_event_t *event, void *ctx);
+static void handle_cap_set(const os_event_t *event, void *ctx);
 static void handle_mqtt_connected(const os_event_t *event, void *ctx);
+static void handle_mqtt_down(const os_event_t *event, void *ctx);
+static void handle_ha_online(const os_event_t *event, void *ctx);
 static void handle_node_removed(const os_event_t *event, void *ctx);
-static void add_pending(os_eui64_t node_addr);
-static bool check_node_has_cap(os_eui64_t node_addr, cap_id_t cap_id);
-
-/**
- * @brief Escape a string for JSON encoding
- * @param dest Destination buffer
- * @param dest_size Size of destination buffer
- * @param src Source string
- * @return Number of characters written (excluding null terminator)
- */
-static size_t json_escape_string(char *dest, size_t dest_size,
-                                 const char *src) {
-  if (!dest || dest_size == 0 || !src) {
-    return 0;
-  }
-
-  size_t written = 0;
-  const char *p = src;
-
-  while (*p && written < dest_size - 1) {
-    switch (*p) {
-    case '"':
-    case '\\':
-      if (written + 2 >= dest_size)
-        goto done;
-      dest[written++] = '\\';
-      dest[written++] = *p;
-      break;
-    case '\n':
-      if (written + 2 >= dest_size)
-        goto done;
-      dest[written++] = '\\';
-      dest[written++] = 'n';
-      break;
-    case '\r':
-      if (written + 2 >= dest_size)
-        goto done;
-      dest[written++] = '\\';
-      dest[written++] = 'r';
-      break;
-    case '\t':
-      if (written + 2 >= dest_size)
-        goto done;
-      dest[written++] = '\\';
-      dest[written++] = 't';
-      break;
-    default:
-      dest[written++] = *p;
-      break;
-    }
-    p++;
-  }
-
-done:
-  dest[written] = '\0';
-  return written;
-}
+static void mark_dirty(os_eui64_t node_addr);
+static void mark_all(void);
+static void wake_task(void);
+static void state_source(os_eui64_t node_addr, const char *cap_name,
+                         char *topic, size_t topic_size, char *expr,
+                         size_t expr_size);
 
 os_err_t ha_disc_init(void) {
   if (service.initialized) {
@@ -129,13 +194,23 @@ os_err_t ha_disc_init(void) {
   service.initialized = true;
 
   /* Subscribe to relevant events */
-  os_event_filter_t filter_cap = {OS_EVENT_CAP_STATE_CHANGED,
-                                  OS_EVENT_CAP_STATE_CHANGED};
-  os_event_subscribe(&filter_cap, handle_reg_node_ready, NULL);
+  os_event_filter_t filter_state = {OS_EVENT_REG_NODE_STATE_CHANGED,
+                                    OS_EVENT_REG_NODE_STATE_CHANGED};
+  os_event_subscribe(&filter_state, handle_node_state, NULL);
+
+  os_event_filter_t filter_cap = {OS_EVENT_CAP_SET_CHANGED,
+                                  OS_EVENT_CAP_SET_CHANGED};
+  os_event_subscribe(&filter_cap, handle_cap_set, NULL);
 
   os_event_filter_t filter_net = {OS_EVENT_NET_UP, OS_EVENT_NET_UP};
   os_event_subscribe(&filter_net, handle_mqtt_connected, NULL);
 
+  os_event_filter_t filter_down = {OS_EVENT_NET_DOWN, OS_EVENT_NET_DOWN};
+  os_event_subscribe(&filter_down, handle_mqtt_down, NULL);
+
+  os_event_filter_t filter_ha = {OS_EVENT_HA_ONLINE, OS_EVENT_HA_ONLINE};
+  os_event_subscribe(&filter_ha, handle_ha_online, NULL);
+
   os_event_filter_t filter_left = {OS_EVENT_ZB_DEVICE_LEFT,
                                    OS_EVENT_ZB_DEVICE_LEFT};
   os_event_subscribe(&filter_left, handle_node_removed, NULL);
@@ -145,6 +220,96 @@ os_err_t ha_disc_init(void) {
   return OS_OK;
 }
 
+/* FNV-1a over a payload; never 0, which marks "not published" */
+static uint32_t payload_hash(const char *payload, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)payload[i]) * 16777619u;
+  }
+  return hash ? hash : 1;
+}
+
+/* Cache entry for a registered node, reset if the slot changed owner */
+static ha_disc_cache_t *cache_for_node(const reg_node_t *node) {
+  int32_t slot = reg_node_slot(node);
+  if (slot < 0) {
+    return NULL;
+  }
+  ha_disc_cache_t *cache = &service.cache[slot];
+  if (cache->node_addr != node->ieee_addr) {
+    if (cache->dirty) {
+      service.dirty_count--;
+    }
+    memset(cache, 0, sizeof(*cache));
+    cache->node_addr = node->ieee_addr;
+  }
+  return cache;
+}
+
+/* Forget which configs were unflushed once the send buffer has drained */
+static void clear_unflushed(void) {
+  if (!service.unflushed) {
+    return;
+  }
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    service.cache[i].unflushed = 0;
+  }
+  service.unflushed = false;
+}
+
+/* A config was appended to the send buffer. The session drops unsent
+ * bytes when it closes, so until the buffer drains the config may never
+ * reach the broker. */
+static void note_sent(ha_disc_cache_t *cache, cap_id_t cap_id) {
+  mqtt_stats_t stats;
+  if (mqtt_get_stats(&stats) == OS_OK && stats.tx_backlog == 0) {
+    clear_unflushed();
+  } else if (cache) {
+    cache->unflushed |= 1UL << cap_id;
+    service.unflushed = true;
+  }
+}
+
+/* Publish one entity's config (retained) unless its bytes are unchanged;
+ * w wrote it in place after mqtt_publish_begin() */
+static os_err_t publish_config(ha_disc_cache_t *cache, cap_id_t cap_id,
+                               mqtt_json_writer_t *w) {
+  int n = mqtt_json_writer_finish(w);
+  if (n < 0) {
+    mqtt_publish_abort();
+    return OS_ERR_NO_MEM;
+  }
+
+  uint32_t hash = payload_hash(w->buf, (size_t)n);
+  if (cache && cache->hash[cap_id] == hash) {
+    mqtt_publish_abort();
+    service.stats.unchanged++;
+    return OS_OK;
+  }
+
+  os_err_t err = mqtt_publish_end((size_t)n);
+  if (err != OS_OK) {
+    return err;
+  }
+  if (cache) {
+    cache->hash[cap_id] = hash;
+  }
+  note_sent(cache, cap_id);
+  service.stats.published++;
+  return OS_OK;
+}
+
+/* Clear a retained config */
+static os_err_t remove_config(os_eui64_t node_addr, cap_id_t cap_id) {
+  char topic[HA_MAX_TOPIC_LEN];
+  entity_topic(node_addr, cap_id, topic, sizeof(topic));
+  os_err_t err = mqtt_publish_ex(topic, "", 0, &config_opts);
+  if (err == OS_OK) {
+    service.stats.removed++;
+  }
+  return err;
+}
+
 os_err_t ha_disc_publish_node(os_eui64_t node_addr) {
   if (!service.initialized) {
     return OS_ERR_NOT_INITIALIZED;
@@ -154,7 +319,7 @@ os_err_t ha_disc_publish_node(os_eui64_t node_addr) {
   if (mqtt_get_state() != MQTT_STATE_CONNECTED) {
     LOG_D(HA_MODULE, "MQTT not connected, queuing publish for " OS_EUI64_FMT,
           OS_EUI64_ARG(node_addr));
-    add_pending(node_addr);
+    mark_dirty(node_addr);
     return OS_OK;
   }
 
@@ -163,72 +328,60 @@ os_err_t ha_disc_publish_node(os_eui64_t node_addr) {
     return OS_ERR_NOT_FOUND;
   }
 
+  /* Same inputs, same bytes: nothing to build */
+  ha_disc_cache_t *cache = cache_for_node(node);
+  uint32_t generation = reg_generation();
+  uint32_t cap_mask = cap_get_mask(node);
+  uint8_t state_mode = (uint8_t)mqtt_get_state_mode();
+  if (cache && cache->valid && cache->generation == generation &&
+      cache->cap_mask == cap_mask && cache->state_mode == state_mode) {
+    service.stats.skipped++;
+    return OS_OK;
+  }
+
   LOG_I(HA_MODULE, "Publishing discovery for node " OS_EUI64_FMT,
         OS_EUI64_ARG(node_addr));
 
   os_err_t result = OS_OK;
-
-  /* Check for light capabilities and merge if both present */
-  bool has_light_on = check_node_has_cap(node_addr, CAP_LIGHT_ON);
-  bool has_light_level = check_node_has_cap(node_addr, CAP_LIGHT_LEVEL);
-
-  if (has_light_on) {
-    /* Publish merged light discovery (with or without brightness) */
-    os_err_t err = publish_light_discovery(node_addr, has_light_level);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish light discovery for node " OS_EUI64_FMT
-            " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
+  char eui[17];
+  eui_hex(node_addr, eui);
+
+  /* One pass over the table against the mask read above: publish the
+   * entities the node has, remove those published before that it lost */
+  for (uint32_t id = 0; id < CAP_MAX; id++) {
+    cap_id_t cap_id = (cap_id_t)id;
+    if (!is_entity(cap_id)) {
+      continue;
     }
-  }
 
-  /* Publish sensor discoveries */
-  if (check_node_has_cap(node_addr, CAP_SENSOR_TEMPERATURE)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_TEMPERATURE);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish temperature sensor discovery for "
-            "node " OS_EUI64_FMT " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
-    }
-  }
-  if (check_node_has_cap(node_addr, CAP_SENSOR_HUMIDITY)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_HUMIDITY);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish humidity sensor discovery for node " OS_EUI64_FMT
-            " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
+    os_err_t err;
+    if (cap_mask & (1UL << cap_id)) {
+      err = publish_entity(cache, node, eui, cap_id, cap_mask);
+    } else if (cache && cache->hash[cap_id] != 0) {
+      err = remove_config(node_addr, cap_id);
+      if (err == OS_OK) {
+        cache->hash[cap_id] = 0;
+      }
+    } else {
+      continue;
     }
-  }
-  if (check_node_has_cap(node_addr, CAP_SENSOR_CONTACT)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_CONTACT);
+
     if (err != OS_OK) {
       LOG_E(HA_MODULE,
-            "Failed to publish contact sensor discovery for node " OS_EUI64_FMT
+            "Failed to update %s discovery for node " OS_EUI64_FMT
             " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
+            cap_get_info(cap_id)->name, OS_EUI64_ARG(node_addr), err);
       if (result == OS_OK)
         result = err;
     }
   }
-  if (check_node_has_cap(node_addr, CAP_SENSOR_MOTION)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_MOTION);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish motion sensor discovery for node " OS_EUI64_FMT
-            " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
-    }
+
+  /* Only a complete publish is remembered; a failed one runs again */
+  if (cache) {
+    cache->valid = result == OS_OK;
+    cache->generation = generation;
+    cache->cap_mask = cap_mask;
+    cache->state_mode = state_mode;
   }
 
   return result;
@@ -246,76 +399,77 @@ os_err_t ha_disc_unpublish_node(os_eui64_t node_addr) {
   LOG_I(HA_MODULE, "Unpublishing discovery for node " OS_EUI64_FMT,
         OS_EUI64_ARG(node_addr));
 
+  /* Publish empty retained payloads to remove entities */
   os_err_t result = OS_OK;
+  for (uint32_t id = 0; id < CAP_MAX; id++) {
+    cap_id_t cap_id = (cap_id_t)id;
+    if (!is_entity(cap_id)) {
+      continue;
+    }
+    os_err_t err = remove_config(node_addr, cap_id);
+    if (err != OS_OK) {
+      LOG_E(HA_MODULE,
+            "Failed to unpublish %s for node " OS_EUI64_FMT " (err=%d)",
+            cap_get_info(cap_id)->name, OS_EUI64_ARG(node_addr), err);
+      if (result == OS_OK)
+        result = err;
+    }
+  }
 
-  /* Publish empty payloads to remove entities (with retain) */
-  char topic[256];
-
-  /* Remove light entity */
-  snprintf(topic, sizeof(topic), "%s/light/%s_" OS_EUI64_FMT "_light/config",
-           HA_DISCOVERY_PREFIX, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr));
-  os_err_t err = mqtt_publish(topic, "", 0);
-  if (err != OS_OK) {
-    LOG_E(HA_MODULE,
-          "Failed to unpublish light for node " OS_EUI64_FMT " (err=%d)",
-          OS_EUI64_ARG(node_addr), err);
-    if (result == OS_OK)
-      result = err;
-  }
-
-  /* Remove sensor entities */
-  const cap_id_t sensors[] = {CAP_SENSOR_TEMPERATURE, CAP_SENSOR_HUMIDITY,
-                              CAP_SENSOR_CONTACT, CAP_SENSOR_MOTION};
-
-  for (size_t i = 0; i < sizeof(sensors) / sizeof(sensors[0]); i++) {
-    const cap_info_t *info = cap_get_info(sensors[i]);
-    if (info) {
-      /* Sanitize capability name: replace '.' with '_' */
-      char cap_sanitized[32];
-      strncpy(cap_sanitized, info->name, sizeof(cap_sanitized) - 1);
-      cap_sanitized[sizeof(cap_sanitized) - 1] = '\0';
-      for (char *p = cap_sanitized; *p; p++) {
-        if (*p == '.')
-          *p = '_';
-      }
-
-      snprintf(topic, sizeof(topic), "%s/sensor/%s_" OS_EUI64_FMT "_%s/config",
-               HA_DISCOVERY_PREFIX, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
-               cap_sanitized);
-      err = mqtt_publish(topic, "", 0);
-      if (err != OS_OK) {
-        LOG_E(HA_MODULE,
-              "Failed to unpublish sensor %s for node " OS_EUI64_FMT
-              " (err=%d)",
-              info->name, OS_EUI64_ARG(node_addr), err);
-        if (result == OS_OK)
-          result = err;
+  /* Forget it, whichever slot it held */
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    if (service.cache[i].node_addr == node_addr) {
+      if (service.cache[i].dirty) {
+        service.dirty_count--;
       }
+      memset(&service.cache[i], 0, sizeof(service.cache[i]));
     }
   }
 
   return result;
 }
 
+void ha_disc_invalidate_all(void) {
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    service.cache[i].valid = false;
+    memset(service.cache[i].hash, 0, sizeof(service.cache[i].hash));
+  }
+}
+
+os_err_t ha_disc_get_stats(ha_disc_stats_t *stats) {
+  if (!service.initialized || !stats) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  *stats = service.stats;
+  stats->pending = service.dirty_count;
+  return OS_OK;
+}
+
 uint32_t ha_disc_publish_all(void) {
   if (!service.initialized) {
     return 0;
   }
 
   uint32_t count = 0;
-  uint32_t node_count = reg_node_count();
-
-  for (uint32_t i = 0; i < node_count; i++) {
-    reg_node_info_t info;
-    if (reg_get_node_info(i, &info) == OS_OK) {
-      if (info.state == REG_STATE_READY) {
-        if (ha_disc_publish_node(info.ieee_addr) == OS_OK) {
-          count++;
-        }
+
+  /* Walk a snapshot so publishing may yield without the node table
+   * shifting underneath the loop */
+  const reg_snapshot_t *snap = reg_snapshot_acquire();
+  if (!snap) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < snap->count; i++) {
+    if (snap->entries[i].state == REG_STATE_READY) {
+      if (ha_disc_publish_node(snap->entries[i].ieee_addr) == OS_OK) {
+        count++;
       }
     }
   }
 
+  reg_snapshot_release(snap);
+
   LOG_I(HA_MODULE, "Published discovery for %" PRIu32 " nodes", count);
   return count;
 }
@@ -326,14 +480,29 @@ uint32_t ha_disc_flush_pending(void) {
   }
 
   uint32_t flushed = 0;
+  bool connected = mqtt_get_state() == MQTT_STATE_CONNECTED;
+  mqtt_stats_t mqtt_stats;
+  if (connected && mqtt_get_stats(&mqtt_stats) == OS_OK &&
+      mqtt_stats.tx_backlog == 0) {
+    clear_unflushed();
+  }
 
-  for (uint32_t i = 0; i < HA_MAX_PENDING; i++) {
-    if (service.pending[i].pending) {
-      if (ha_disc_publish_node(service.pending[i].node_addr) == OS_OK) {
-        service.pending[i].pending = false;
-        service.pending_count--;
-        flushed++;
-      }
+  for (uint32_t i = 0;
+       connected && i < REG_MAX_NODES && service.dirty_count > 0; i++) {
+    ha_disc_cache_t *cache = &service.cache[i];
+    if (!cache->dirty) {
+      continue;
+    }
+    cache->dirty = false;
+    service.dirty_count--;
+
+    os_err_t err = ha_disc_publish_node(cache->node_addr);
+    if (err == OS_OK) {
+      flushed++;
+    } else if (err != OS_ERR_NOT_FOUND) {
+      /* Likely a full send buffer: leave the rest for the next pass */
+      mark_dirty(cache->node_addr);
+      break;
     }
   }
 
@@ -342,9 +511,20 @@ uint32_t ha_disc_flush_pending(void) {
           flushed);
   }
 
+  /* Retry a full send buffer soon; otherwise sleep until an event wakes
+   * the task */
+  bool retry = service.dirty_count > 0 && connected;
+  os_time_ms_t wait_ms = retry ? HA_DISC_RETRY_MS : HA_DISC_IDLE_MS;
+  service.due = os_now_ticks() + OS_MS_TO_TICKS(wait_ms);
+
   return flushed;
 }
 
+os_time_ms_t ha_disc_next_due_ms(void) {
+  int32_t diff = (int32_t)(service.due - os_now_ticks());
+  return diff > 0 ? OS_TICKS_TO_MS((os_tick_t)diff) : 0;
+}
+
 const char *ha_disc_component_name(ha_component_t component) {
   if (component < HA_COMPONENT_MAX) {
     return component_names[component];
@@ -359,29 +539,15 @@ os_err_t ha_disc_generate_config(os_eui64_t node_addr, cap_id_t cap_id,
   }
 
   const cap_info_t *cap_info = cap_get_info(cap_id);
-  if (!cap_info) {
+  if (!cap_info || cap_id >= CAP_MAX ||
+      entity_map[cap_id].component >= HA_COMPONENT_MAX) {
     return OS_ERR_INVALID_ARG;
   }
 
   memset(out_config, 0, sizeof(*out_config));
 
-  /* Determine component type */
-  switch (cap_id) {
-  case CAP_LIGHT_ON:
-  case CAP_LIGHT_LEVEL:
-    out_config->component = HA_COMPONENT_LIGHT;
-    break;
-  case CAP_SWITCH_ON:
-    out_config->component = HA_COMPONENT_SWITCH;
-    break;
-  case CAP_SENSOR_CONTACT:
-  case CAP_SENSOR_MOTION:
-    out_config->component = HA_COMPONENT_BINARY_SENSOR;
-    break;
-  default:
-    out_config->component = HA_COMPONENT_SENSOR;
-    break;
-  }
+  /* Merged capabilities report the component they are part of */
+  out_config->component = entity_map[cap_id].component;
 
   /* Generate unique_id */
   snprintf(out_config->unique_id, sizeof(out_config->unique_id),
@@ -409,9 +575,11 @@ os_err_t ha_disc_generate_config(os_eui64_t node_addr, cap_id_t cap_id,
   }
 
   /* Generate topics */
-  snprintf(out_config->state_topic, sizeof(out_config->state_topic),
-           TOPIC_BASE "/" OS_EUI64_FMT "/%s/state", OS_EUI64_ARG(node_addr),
-           cap_info->name);
+  char expr[48];
+  state_source(node_addr, cap_info->name, out_config->state_topic,
+               sizeof(out_config->state_topic), expr, sizeof(expr));
+  snprintf(out_config->value_template, sizeof(out_config->value_template),
+           "{{ %s }}", expr);
 
   snprintf(out_config->command_topic, sizeof(out_config->command_topic),
            TOPIC_BASE "/" OS_EUI64_FMT "/%s/set", OS_EUI64_ARG(node_addr),
@@ -430,240 +598,363 @@ void ha_disc_task(void *arg) {
 
   LOG_I(HA_MODULE, "HA Discovery task started");
 
-  /* Wait for initial setup */
-  os_sleep(HA_DISC_STARTUP_DELAY_MS);
+  /* Events mark nodes and wake the task, which publishes them in its next
+   * pass; it sleeps otherwise */
+  service.task = os_fibre_current();
 
   while (1) {
-    /* Check for pending publishes when MQTT is connected */
-    if (mqtt_get_state() == MQTT_STATE_CONNECTED && service.pending_count > 0) {
-      ha_disc_flush_pending();
-    }
+    ha_disc_flush_pending();
 
-    os_sleep(HA_DISC_POLLING_INTERVAL_MS);
+    os_time_ms_t sleep_ms = ha_disc_next_due_ms();
+    os_sleep(sleep_ms > 0 ? sleep_ms : 1);
   }
 }
 
 /* Internal functions */
 
-static os_err_t publish_light_discovery(os_eui64_t node_addr, bool has_level) {
-  char topic[256];
-  char payload[HA_MAX_PAYLOAD_SIZE];
+/*
+ * Discovery documents are written straight into the MQTT send buffer with
+ * the JSON writer: strings are escaped as they are appended, and no
+ * payload is assembled on the stack.
+ */
 
-  reg_node_t *node = reg_find_node(node_addr);
+/* EUI-64 as the 16 hex digits used in topics and ids */
+static void eui_hex(os_eui64_t addr, char out[17]) {
+  static const char hex[] = "0123456789ABCDEF";
+  for (int i = 15; i >= 0; i--) {
+    out[i] = hex[addr & 0xF];
+    addr >>= 4;
+  }
+  out[16] = '\0';
+}
+
+/* Capability name with dots replaced, as used in ids */
+static void cap_slug(const char *name, char *out, size_t size) {
+  strncpy(out, name, size - 1);
+  out[size - 1] = '\0';
+  for (char *p = out; *p; p++) {
+    if (*p == '.')
+      *p = '_';
+  }
+}
 
-  /* Get device info and escape for JSON */
-  char name_escaped[64];
-  char manufacturer_escaped[64];
-  char model_escaped[64];
-
-  const char *name_raw = (node && node->friendly_name[0]) ? node->friendly_name
-                         : (node && node->model[0])       ? node->model
-                                                          : "Zigbee Light";
-  const char *manufacturer_raw =
-      (node && node->manufacturer[0]) ? node->manufacturer : "";
-  const char *model_raw = (node && node->model[0]) ? node->model : "";
-
-  json_escape_string(name_escaped, sizeof(name_escaped), name_raw);
-  json_escape_string(manufacturer_escaped, sizeof(manufacturer_escaped),
-                     manufacturer_raw);
-  json_escape_string(model_escaped, sizeof(model_escaped), model_raw);
-
-  /* Build discovery topic */
-  snprintf(topic, sizeof(topic), "%s/light/%s_" OS_EUI64_FMT "_light/config",
-           HA_DISCOVERY_PREFIX, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr));
-
-  /* Build discovery payload JSON */
-  if (has_level) {
-    /* Merged light with brightness */
-    snprintf(
-        payload, sizeof(payload),
-        "{"
-        "\"name\":\"%s\","
-        "\"unique_id\":\"%s_" OS_EUI64_FMT "_light\","
-        "\"availability_topic\":\"%s\","
-        "\"payload_available\":\"online\","
-        "\"payload_not_available\":\"offline\","
-        "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/state\","
-        "\"command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/set\","
-        "\"value_template\":\"{{ value_json.v }}\","
-        "\"state_value_template\":\"{{ 'ON' if value_json.v else 'OFF' }}\","
-        "\"payload_on\":\"{\\\"v\\\":true}\","
-        "\"payload_off\":\"{\\\"v\\\":false}\","
-        "\"brightness_state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT
-        "/light.level/state\","
-        "\"brightness_command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT
-        "/light.level/set\","
-        "\"brightness_value_template\":\"{{ (value_json.v | float * 2.55) | "
-        "int }}\","
-        "\"brightness_scale\":255,"
-        "\"device\":{"
-        "\"identifiers\":[\"%s_" OS_EUI64_FMT "\"],"
-        "\"name\":\"%s\","
-        "\"manufacturer\":\"%s\","
-        "\"model\":\"%s\""
-        "}"
-        "}",
-        name_escaped, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
-        HA_AVAILABILITY_TOPIC, OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr),
-        OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr), HA_BRIDGE_ID,
-        OS_EUI64_ARG(node_addr), name_escaped, manufacturer_escaped,
-        model_escaped);
+/* "<bridge>_<eui><suffix>" */
+static void write_id(mqtt_json_writer_t *w, const char *eui,
+                     const char *suffix) {
+  mqtt_json_write_string_begin(w);
+  mqtt_json_write_string_part(w, HA_BRIDGE_ID "_");
+  mqtt_json_write_string_part(w, eui);
+  mqtt_json_write_string_part(w, suffix);
+  mqtt_json_write_string_end(w);
+}
+
+/* bridge/<eui>/<cap>/<leaf>, or bridge/<eui>/<leaf> without a cap */
+static void write_node_topic(mqtt_json_writer_t *w, const char *eui,
+                             const char *cap_name, const char *leaf) {
+  mqtt_json_write_string_begin(w);
+  mqtt_json_write_string_part(w, TOPIC_BASE "/");
+  mqtt_json_write_string_part(w, eui);
+  mqtt_json_write_string_part(w, "/");
+  if (cap_name) {
+    mqtt_json_write_string_part(w, cap_name);
+    mqtt_json_write_string_part(w, "/");
+  }
+  mqtt_json_write_string_part(w, leaf);
+  mqtt_json_write_string_end(w);
+}
+
+/* Where a capability's state is published, as state_source() */
+static void write_state_topic(mqtt_json_writer_t *w, const char *eui,
+                              const char *cap_name) {
+  bool aggregate = mqtt_get_state_mode() == MQTT_STATE_MODE_AGGREGATE;
+  write_node_topic(w, eui, aggregate ? NULL : cap_name, "state");
+}
+
+/* "{{ <pre><value><post> }}", the value read as state_source() does */
+static void write_template(mqtt_json_writer_t *w, const char *cap_name,
+                           const char *pre, const char *post) {
+  mqtt_json_write_string_begin(w);
+  mqtt_json_write_string_part(w, "{{ ");
+  mqtt_json_write_string_part(w, pre);
+  if (mqtt_get_state_mode() == MQTT_STATE_MODE_AGGREGATE) {
+    mqtt_json_write_string_part(w, "value_json['");
+    mqtt_json_write_string_part(w, cap_name);
+    mqtt_json_write_string_part(w, "']");
   } else {
-    /* Simple on/off light */
-    snprintf(
-        payload, sizeof(payload),
-        "{"
-        "\"name\":\"%s\","
-        "\"unique_id\":\"%s_" OS_EUI64_FMT "_light\","
-        "\"availability_topic\":\"%s\","
-        "\"payload_available\":\"online\","
-        "\"payload_not_available\":\"offline\","
-        "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/state\","
-        "\"command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/set\","
-        "\"value_template\":\"{{ value_json.v }}\","
-        "\"state_value_template\":\"{{ 'ON' if value_json.v else 'OFF' }}\","
-        "\"payload_on\":\"{\\\"v\\\":true}\","
-        "\"payload_off\":\"{\\\"v\\\":false}\","
-        "\"device\":{"
-        "\"identifiers\":[\"%s_" OS_EUI64_FMT "\"],"
-        "\"name\":\"%s\","
-        "\"manufacturer\":\"%s\","
-        "\"model\":\"%s\""
-        "}"
-        "}",
-        name_escaped, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
-        HA_AVAILABILITY_TOPIC, OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr),
-        HA_BRIDGE_ID, OS_EUI64_ARG(node_addr), name_escaped,
-        manufacturer_escaped, model_escaped);
-  }
-
-  return mqtt_publish(topic, payload, strlen(payload));
-}
-
-static os_err_t publish_sensor_discovery(os_eui64_t node_addr,
-                                         cap_id_t cap_id) {
-  char topic[256];
-  char payload[HA_MAX_PAYLOAD_SIZE];
+    mqtt_json_write_string_part(w, "value_json.v");
+  }
+  mqtt_json_write_string_part(w, post);
+  mqtt_json_write_string_part(w, " }}");
+  mqtt_json_write_string_end(w);
+}
+
+/* The bridge status is {"v":"online"} like any other value; the template
+ * reduces it to the plain payloads compared below */
+static void write_availability(mqtt_json_writer_t *w) {
+  mqtt_json_write_key(w, "availability_topic");
+  mqtt_json_write_string(w, HA_AVAILABILITY_TOPIC);
+  mqtt_json_write_key(w, "availability_template");
+  mqtt_json_write_string(w, "{{ value_json.v }}");
+  mqtt_json_write_key(w, "payload_available");
+  mqtt_json_write_string(w, "online");
+  mqtt_json_write_key(w, "payload_not_available");
+  mqtt_json_write_string(w, "offline");
+}
+
+static void write_device(mqtt_json_writer_t *w, const char *eui,
+                         const reg_node_t *node, const char *name) {
+  mqtt_json_write_key(w, "device");
+  mqtt_json_write_object_begin(w);
+  mqtt_json_write_key(w, "identifiers");
+  mqtt_json_write_array_begin(w);
+  write_id(w, eui, "");
+  mqtt_json_write_array_end(w);
+  mqtt_json_write_key(w, "name");
+  mqtt_json_write_string(w, name);
+  mqtt_json_write_key(w, "manufacturer");
+  mqtt_json_write_string(w, node ? node->manufacturer : "");
+  mqtt_json_write_key(w, "model");
+  mqtt_json_write_string(w, node ? node->model : "");
+  mqtt_json_write_object_end(w);
+}
+
+/* Device name shown in HA */
+static const char *device_name(const reg_node_t *node, const char *fallback) {
+  if (node && node->friendly_name[0]) {
+    return node->friendly_name;
+  }
+  if (node && node->model[0]) {
+    return node->model;
+  }
+  return fallback;
+}
+
+/* True if the capability is exposed as an entity of its own */
+static bool is_entity(cap_id_t cap_id) {
+  return cap_id < CAP_MAX &&
+         entity_map[cap_id].component < HA_COMPONENT_MAX &&
+         entity_map[cap_id].merge_into == CAP_UNKNOWN;
+}
+
+/* "_<object id>", the end of an entity's unique_id */
+static void entity_suffix(cap_id_t cap_id, char *out, size_t size) {
+  const char *object_id = entity_map[cap_id].object_id;
+  if (!object_id) {
+    const cap_info_t *cap_info = cap_get_info(cap_id);
+    object_id = cap_info ? cap_info->name : "unknown";
+  }
+  out[0] = '_';
+  cap_slug(object_id, out + 1, size - 1);
+}
 
+/* "<prefix>_<leaf>" as a member name */
+static void write_member_key(mqtt_json_writer_t *w, const char *prefix,
+                             const char *leaf) {
+  char key[48];
+  snprintf(key, sizeof(key), "%s_%s", prefix, leaf);
+  mqtt_json_write_key(w, key);
+}
+
+/* Light members, then those of each capability merged into it */
+static void write_light(mqtt_json_writer_t *w, const char *eui,
+                        const char *name, const char *suffix, cap_id_t cap_id,
+                        uint32_t cap_mask) {
+  const char *cap_name = cap_get_info(cap_id)->name;
+
+  mqtt_json_write_key(w, "name");
+  mqtt_json_write_string(w, name);
+  mqtt_json_write_key(w, "unique_id");
+  write_id(w, eui, suffix);
+  write_availability(w);
+  mqtt_json_write_key(w, "state_topic");
+  write_state_topic(w, eui, cap_name);
+  mqtt_json_write_key(w, "command_topic");
+  write_node_topic(w, eui, cap_name, "set");
+  mqtt_json_write_key(w, "value_template");
+  write_template(w, cap_name, NULL, NULL);
+  mqtt_json_write_key(w, "state_value_template");
+  write_template(w, cap_name, "'ON' if ", " else 'OFF'");
+  mqtt_json_write_key(w, "payload_on");
+  mqtt_json_write_string(w, "{\"v\":true}");
+  mqtt_json_write_key(w, "payload_off");
+  mqtt_json_write_string(w, "{\"v\":false}");
+
+  for (uint32_t id = 0; id < CAP_MAX; id++) {
+    const ha_entity_map_t *part = &entity_map[id];
+    if (part->merge_into != cap_id || !(cap_mask & (1UL << id))) {
+      continue;
+    }
+    const char *part_name = cap_get_info(part->cap_id)->name;
+    write_member_key(w, part->key, "state_topic");
+    write_state_topic(w, eui, part_name);
+    write_member_key(w, part->key, "command_topic");
+    write_node_topic(w, eui, part_name, "set");
+    write_member_key(w, part->key, "value_template");
+    write_template(w, part_name, part->pre, part->post);
+    if (part->scale) {
+      write_member_key(w, part->key, "scale");
+      mqtt_json_write_uint(w, part->scale);
+    }
+  }
+}
+
+/* Sensor, binary sensor and switch members */
+static void write_entity(mqtt_json_writer_t *w, const char *eui,
+                         const char *name, const char *suffix,
+                         cap_id_t cap_id) {
+  const ha_entity_map_t *map = &entity_map[cap_id];
   const cap_info_t *cap_info = cap_get_info(cap_id);
-  if (!cap_info) {
-    return OS_ERR_INVALID_ARG;
+  const char *unit = map->unit ? map->unit : cap_info->unit;
+
+  mqtt_json_write_key(w, "name");
+  mqtt_json_write_string_begin(w);
+  mqtt_json_write_string_part(w, name);
+  mqtt_json_write_string_part(w, " ");
+  mqtt_json_write_string_part(w, cap_info->name);
+  mqtt_json_write_string_end(w);
+  mqtt_json_write_key(w, "unique_id");
+  write_id(w, eui, suffix);
+  if (map->device_class) {
+    mqtt_json_write_key(w, "device_class");
+    mqtt_json_write_string(w, map->device_class);
+  }
+  mqtt_json_write_key(w, "state_topic");
+  write_state_topic(w, eui, cap_info->name);
+  mqtt_json_write_key(w, "value_template");
+  write_template(w, cap_info->name, map->pre, map->post);
+  if (unit[0]) {
+    mqtt_json_write_key(w, "unit_of_measurement");
+    mqtt_json_write_string(w, unit);
   }
+  if (map->state_class) {
+    mqtt_json_write_key(w, "state_class");
+    mqtt_json_write_string(w, map->state_class);
+  }
+  if (map->component == HA_COMPONENT_SWITCH) {
+    /* Commands carry the value as the adapter decodes it; the template
+     * turns the state back into ON/OFF */
+    mqtt_json_write_key(w, "command_topic");
+    write_node_topic(w, eui, cap_info->name, "set");
+    mqtt_json_write_key(w, "payload_on");
+    mqtt_json_write_string(w, "{\"v\":true}");
+    mqtt_json_write_key(w, "payload_off");
+    mqtt_json_write_string(w, "{\"v\":false}");
+    mqtt_json_write_key(w, "state_on");
+    mqtt_json_write_string(w, "ON");
+    mqtt_json_write_key(w, "state_off");
+    mqtt_json_write_string(w, "OFF");
+  }
+  write_availability(w);
+}
 
-  reg_node_t *node = reg_find_node(node_addr);
+/* Build one entity's config in place and publish it */
+static os_err_t publish_entity(ha_disc_cache_t *cache, const reg_node_t *node,
+                               const char *eui, cap_id_t cap_id,
+                               uint32_t cap_mask) {
+  const ha_entity_map_t *map = &entity_map[cap_id];
 
-  /* Get device info and escape for JSON */
-  char device_name_escaped[64];
-  char manufacturer_escaped[64];
-  char model_escaped[64];
-  char unit_escaped[16];
-
-  const char *device_name_raw = (node && node->friendly_name[0])
-                                    ? node->friendly_name
-                                : (node && node->model[0]) ? node->model
-                                                           : "Zigbee Sensor";
-  const char *manufacturer_raw =
-      (node && node->manufacturer[0]) ? node->manufacturer : "";
-  const char *model_raw = (node && node->model[0]) ? node->model : "";
-
-  json_escape_string(device_name_escaped, sizeof(device_name_escaped),
-                     device_name_raw);
-  json_escape_string(manufacturer_escaped, sizeof(manufacturer_escaped),
-                     manufacturer_raw);
-  json_escape_string(model_escaped, sizeof(model_escaped), model_raw);
-  json_escape_string(unit_escaped, sizeof(unit_escaped), cap_info->unit);
-
-  /* Sanitize capability name */
-  char cap_sanitized[32];
-  strncpy(cap_sanitized, cap_info->name, sizeof(cap_sanitized) - 1);
-  cap_sanitized[sizeof(cap_sanitized) - 1] = '\0';
-  for (char *p = cap_sanitized; *p; p++) {
-    if (*p == '.')
-      *p = '_';
+  char topic[HA_MAX_TOPIC_LEN];
+  entity_topic(node->ieee_addr, cap_id, topic, sizeof(topic));
+
+  char *buf;
+  size_t room;
+  os_err_t err = mqtt_publish_begin(topic, &config_opts, &buf, &room);
+  if (err != OS_OK) {
+    return err;
+  }
+
+  const char *name = device_name(node, fallback_names[map->component]);
+  char suffix[32];
+  entity_suffix(cap_id, suffix, sizeof(suffix));
+
+  mqtt_json_writer_t w;
+  mqtt_json_writer_init(&w, buf, room);
+  mqtt_json_write_object_begin(&w);
+  if (map->component == HA_COMPONENT_LIGHT) {
+    write_light(&w, eui, name, suffix, cap_id, cap_mask);
+  } else {
+    write_entity(&w, eui, name, suffix, cap_id);
+  }
+  write_device(&w, eui, node, name);
+  mqtt_json_write_object_end(&w);
+
+  return publish_config(cache, cap_id, &w);
+}
+
+static void handle_node_state(const os_event_t *event, void *ctx) {
+  (void)ctx;
+
+  reg_state_event_t ev;
+  if (event->payload_len < sizeof(ev)) {
+    return;
+  }
+  memcpy(&ev, event->payload, sizeof(ev));
+  if (ev.new_state == REG_STATE_READY) {
+    mark_dirty(ev.ieee_addr);
   }
+}
 
-  /* Determine HA component and device class */
-  const char *component = "sensor";
-  const char *device_class = "";
-
-  switch (cap_id) {
-  case CAP_SENSOR_TEMPERATURE:
-    device_class = "temperature";
-    break;
-  case CAP_SENSOR_HUMIDITY:
-    device_class = "humidity";
-    break;
-  case CAP_SENSOR_CONTACT:
-    component = "binary_sensor";
-    device_class = "door";
-    break;
-  case CAP_SENSOR_MOTION:
-    component = "binary_sensor";
-    device_class = "motion";
-    break;
-  default:
-    break;
-  }
-
-  /* Build discovery topic */
-  snprintf(topic, sizeof(topic), "%s/%s/%s_" OS_EUI64_FMT "_%s/config",
-           HA_DISCOVERY_PREFIX, component, HA_BRIDGE_ID,
-           OS_EUI64_ARG(node_addr), cap_sanitized);
-
-  /* Build discovery payload JSON */
-  snprintf(payload, sizeof(payload),
-           "{"
-           "\"name\":\"%s %s\","
-           "\"unique_id\":\"%s_" OS_EUI64_FMT "_%s\","
-           "\"device_class\":\"%s\","
-           "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/%s/state\","
-           "\"value_template\":\"{{ value_json.v }}\","
-           "\"unit_of_measurement\":\"%s\","
-           "\"availability_topic\":\"%s\","
-           "\"payload_available\":\"online\","
-           "\"payload_not_available\":\"offline\","
-           "\"device\":{"
-           "\"identifiers\":[\"%s_" OS_EUI64_FMT "\"],"
-           "\"name\":\"%s\","
-           "\"manufacturer\":\"%s\","
-           "\"model\":\"%s\""
-           "}"
-           "}",
-           device_name_escaped, cap_info->name, HA_BRIDGE_ID,
-           OS_EUI64_ARG(node_addr), cap_sanitized, device_class,
-           OS_EUI64_ARG(node_addr), cap_info->name, unit_escaped,
-           HA_AVAILABILITY_TOPIC, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
-           device_name_escaped, manufacturer_escaped, model_escaped);
-
-  return mqtt_publish(topic, payload, strlen(payload));
-}
-
-static void handle_reg_node_ready(const os_event_t *event, void *ctx) {
+static void handle_cap_set(const os_event_t *event, void *ctx) {
   (void)ctx;
-  (void)event;
 
-  /*
-   * This handler is subscribed to OS_EVENT_CAP_STATE_CHANGED.
-   * In the current implementation, ha_disc_publish_node() is called explicitly
-   * when nodes transition to READY state (typically from the interview
-   * service).
-   *
-   * In a full implementation, this handler would:
-   * 1. Track which nodes have had discovery published
-   * 2. Detect capability additions/changes
-   * 3. Republish discovery when capabilities change
-   *
-   * For now, discovery is triggered explicitly via ha_disc_publish_node()
-   * and ha_disc_publish_all() calls from other services.
-   */
+  cap_set_event_t ev;
+  if (event->payload_len < sizeof(ev)) {
+    return;
+  }
+  memcpy(&ev, event->payload, sizeof(ev));
+  mark_dirty(ev.node_addr);
 }
 
 static void handle_mqtt_connected(const os_event_t *event, void *ctx) {
   (void)ctx;
   (void)event;
 
-  LOG_D(HA_MODULE, "MQTT connected, flushing pending discovery");
-  ha_disc_flush_pending();
+  /* Every ready node, in case configs were lost or never sent (nodes
+   * restored at boot); the cache makes unchanged ones cheap */
+  LOG_D(HA_MODULE, "MQTT connected, checking discovery for all nodes");
+  mark_all();
+
+  /* Nodes marked while MQTT was down did not wake the task again, and it
+   * went back to its idle sleep on seeing the connection down */
+  if (service.dirty_count > 0) {
+    wake_task();
+  }
+}
+
+static void handle_mqtt_down(const os_event_t *event, void *ctx) {
+  (void)ctx;
+  (void)event;
+
+  /* Configs still in the send buffer were discarded with the session:
+   * forget them, so the reconnect publishes them again */
+  for (uint32_t i = 0; service.unflushed && i < REG_MAX_NODES; i++) {
+    ha_disc_cache_t *cache = &service.cache[i];
+    if (!cache->unflushed) {
+      continue;
+    }
+    for (uint32_t id = 0; id < CAP_MAX; id++) {
+      if (cache->unflushed & (1UL << id)) {
+        cache->hash[id] = 0;
+      }
+    }
+    cache->unflushed = 0;
+    cache->valid = false;
+  }
+  service.unflushed = false;
+}
+
+static void handle_ha_online(const os_event_t *event, void *ctx) {
+  (void)ctx;
+  (void)event;
+
+  /* HA restarted, or the broker it uses lost its retained configs: the
+   * cache no longer says what HA has, so send everything again */
+  LOG_I(HA_MODULE, "Home Assistant online, republishing discovery");
+  ha_disc_invalidate_all();
+  mark_all();
+  if (service.dirty_count > 0) {
+    wake_task();
+  }
 }
 
 static void handle_node_removed(const os_event_t *event, void *ctx) {
@@ -676,30 +967,60 @@ static void handle_node_removed(const os_event_t *event, void *ctx) {
   }
 }
 
-static void add_pending(os_eui64_t node_addr) {
-  /* Check if already pending */
-  for (uint32_t i = 0; i < HA_MAX_PENDING; i++) {
-    if (service.pending[i].pending &&
-        service.pending[i].node_addr == node_addr) {
-      return;
-    }
+/* Queue a ready node for the task, once however many events arrive */
+static void mark_dirty(os_eui64_t node_addr) {
+  reg_node_t *node = reg_find_node(node_addr);
+  if (!node || node->state != REG_STATE_READY) {
+    return;
   }
 
-  /* Find free slot */
-  for (uint32_t i = 0; i < HA_MAX_PENDING; i++) {
-    if (!service.pending[i].pending) {
-      service.pending[i].node_addr = node_addr;
-      service.pending[i].pending = true;
-      service.pending_count++;
-      return;
+  ha_disc_cache_t *cache = cache_for_node(node);
+  if (!cache || cache->dirty) {
+    return;
+  }
+  cache->dirty = true;
+  service.dirty_count++;
+  wake_task();
+}
+
+/* Bring the task's next pass forward to now */
+static void wake_task(void) {
+  service.due = os_now_ticks();
+  os_fibre_wake(service.task);
+}
+
+/* Every registered node; mark_dirty() skips those not READY */
+static void mark_all(void) {
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    reg_node_t *node = reg_get_node_by_slot(i);
+    if (node) {
+      mark_dirty(node->ieee_addr);
     }
   }
+}
 
-  LOG_W(HA_MODULE, "Pending queue full, cannot add node " OS_EUI64_FMT,
-        OS_EUI64_ARG(node_addr));
+/* State topic and template expression for one capability of a node */
+static void state_source(os_eui64_t node_addr, const char *cap_name,
+                         char *topic, size_t topic_size, char *expr,
+                         size_t expr_size) {
+  if (mqtt_get_state_mode() == MQTT_STATE_MODE_AGGREGATE) {
+    snprintf(topic, topic_size, TOPIC_BASE "/" OS_EUI64_FMT "/state",
+             OS_EUI64_ARG(node_addr));
+    snprintf(expr, expr_size, "value_json['%s']", cap_name);
+  } else {
+    snprintf(topic, topic_size, TOPIC_BASE "/" OS_EUI64_FMT "/%s/state",
+             OS_EUI64_ARG(node_addr), cap_name);
+    snprintf(expr, expr_size, "value_json.v");
+  }
 }
 
-static bool check_node_has_cap(os_eui64_t node_addr, cap_id_t cap_id) {
-  cap_state_t state;
-  return cap_get_state(node_addr, cap_id, &state) == OS_OK;
+/* homeassistant/<component>/<unique_id>/config for an entity */
+static void entity_topic(os_eui64_t node_addr, cap_id_t cap_id, char *topic,
+                         size_t topic_size) {
+  char suffix[32];
+  entity_suffix(cap_id, suffix, sizeof(suffix));
+  snprintf(topic, topic_size, "%s/%s/%s_" OS_EUI64_FMT "%s/config",
+           HA_DISCOVERY_PREFIX,
+           ha_disc_component_name(entity_map[cap_id].component), HA_BRIDGE_ID,
+           OS_EUI64_ARG(node_addr), suffix);
 }
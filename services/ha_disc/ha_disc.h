@@ -8,6 +8,19 @@
  * Follows HA MQTT discovery protocol.
  * 
  * Topic format: homeassistant/<component>/<unique_id>/config
+ *
+ * Every capability has a fixed mapping to an HA component, device class,
+ * unit and state class; light.level and light.color_temp are members of
+ * the light entity rather than entities of their own.
+ *
+ * Configs are retained. Republishing a node whose registry entry and
+ * capabilities are unchanged sends nothing; when they did change, only
+ * entities whose config bytes differ are sent.
+ *
+ * Publishing is event driven: a node becoming READY, a change in its
+ * capability set and the MQTT connection coming up each mark the node,
+ * and ha_disc_task publishes marked nodes in its next pass. Home
+ * Assistant coming online marks every node after forgetting the cache.
  */
 
 #ifndef HA_DISC_H
@@ -35,6 +48,7 @@ typedef struct {
     char unique_id[64];
     char name[32];
     char state_topic[128];
+    char value_template[64];        /* Extracts the value from state_topic */
     char command_topic[128];
     char availability_topic[32];
     bool has_brightness;
@@ -42,6 +56,15 @@ typedef struct {
     char brightness_command_topic[128];
 } ha_disc_config_t;
 
+/* Discovery counters */
+typedef struct {
+    uint32_t published;             /* Entity configs sent */
+    uint32_t unchanged;             /* Built but identical to the last sent */
+    uint32_t skipped;               /* Node publishes with unchanged inputs */
+    uint32_t removed;               /* Empty configs sent to remove entities */
+    uint32_t pending;               /* Nodes marked, not yet published */
+} ha_disc_stats_t;
+
 /**
  * @brief Initialize HA discovery service
  * @return OS_OK on success
@@ -50,6 +73,11 @@ os_err_t ha_disc_init(void);
 
 /**
  * @brief Publish discovery config for a node
+ *
+ * Skipped when nothing the configs are built from changed since the last
+ * complete publish; otherwise sends the entities whose configs differ and
+ * removes those the node no longer has.
+ *
  * @param node_addr Node IEEE address
  * @return OS_OK on success
  */
@@ -69,11 +97,41 @@ os_err_t ha_disc_unpublish_node(os_eui64_t node_addr);
 uint32_t ha_disc_publish_all(void);
 
 /**
- * @brief Flush pending discovery publishes (after MQTT reconnect)
- * @return Number of pending publishes flushed
+ * @brief Publish every node marked since the last pass
+ *
+ * One pass of ha_disc_task. Does nothing while MQTT is down; a node whose
+ * publish fails stays marked.
+ *
+ * @return Number of nodes published
  */
 uint32_t ha_disc_flush_pending(void);
 
+/**
+ * @brief Get time until ha_disc_task's next pass
+ *
+ * A marked node, the MQTT connection coming up with nodes still marked,
+ * or Home Assistant coming online brings the pass forward to now.
+ *
+ * @return Milliseconds until the next pass, 0 if due
+ */
+os_time_ms_t ha_disc_next_due_ms(void);
+
+/**
+ * @brief Forget what was published, so the next publishes send everything
+ *
+ * For when the broker's retained configs may have been lost. Called, and
+ * every node marked, when Home Assistant's birth message arrives
+ * (OS_EVENT_HA_ONLINE).
+ */
+void ha_disc_invalidate_all(void);
+
+/**
+ * @brief Get discovery counters
+ * @param stats Output counters
+ * @return OS_OK, or OS_ERR_INVALID_ARG if not initialized or stats is NULL
+ */
+os_err_t ha_disc_get_stats(ha_disc_stats_t *stats);
+
 /**
  * @brief Get component name string
  * @param component Component type
@@ -86,13 +144,17 @@ const char *ha_disc_component_name(ha_component_t component);
  * @param node_addr Node IEEE address
  * @param cap_id Capability ID
  * @param out_config Output configuration
- * @return OS_OK on success
+ * @return OS_OK on success, OS_ERR_INVALID_ARG for a capability HA does
+ *         not expose
  */
 os_err_t ha_disc_generate_config(os_eui64_t node_addr, cap_id_t cap_id,
                                   ha_disc_config_t *out_config);
 
 /**
  * @brief HA discovery task entry (run as fibre)
+ *
+ * Sleeps until an event marks a node, then flushes in one pass.
+ *
  * @param arg Unused
  */
 void ha_disc_task(void *arg);
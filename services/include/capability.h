@@ -28,15 +28,15 @@ typedef enum {
     CAP_LIGHT_COLOR_TEMP,/* int (mireds) */
     
     /* Sensors */
-    CAP_SENSOR_TEMPERATURE,  /* float degC */
-    CAP_SENSOR_HUMIDITY,     /* float % */
+    CAP_SENSOR_TEMPERATURE,  /* fixed, 0.01 degC */
+    CAP_SENSOR_HUMIDITY,     /* fixed, 0.01 % */
     CAP_SENSOR_CONTACT,      /* bool */
     CAP_SENSOR_MOTION,       /* bool */
     CAP_SENSOR_ILLUMINANCE,  /* int lux */
     
     /* Power */
-    CAP_POWER_WATTS,     /* float W */
-    CAP_ENERGY_KWH,      /* float kWh */
+    CAP_POWER_WATTS,     /* fixed, 0.1 W */
+    CAP_ENERGY_KWH,      /* fixed, 0.001 kWh */
     
     CAP_MAX
 } cap_id_t;
@@ -45,18 +45,23 @@ typedef enum {
 typedef enum {
     CAP_VALUE_BOOL = 0,
     CAP_VALUE_INT,
-    CAP_VALUE_FLOAT,
+    CAP_VALUE_FIXED,     /* Scaled integer in i: i / 10^decimals */
     CAP_VALUE_STRING,
 } cap_value_type_t;
 
-/* Capability value union */
+/* Capability value union.
+ * Fractional quantities are fixed-point (CAP_VALUE_FIXED) so that nothing
+ * between the ZCL value and the MQTT payload needs floating point; the
+ * ESP32-C6 has no FPU. */
 typedef union {
     bool b;
     int32_t i;
-    float f;
     char str[32];
 } cap_value_t;
 
+/* Longest string cap_format_value() produces, including the terminator */
+#define CAP_VALUE_TEXT_MAX 16
+
 /* Capability state structure */
 typedef struct {
     cap_id_t id;
@@ -72,6 +77,7 @@ typedef struct {
     const char *name;
     cap_value_type_t type;
     const char *unit;
+    uint8_t decimals;           /* CAP_VALUE_FIXED: digits after the point */
 } cap_info_t;
 
 /* Command types */
@@ -82,6 +88,24 @@ typedef enum {
     CAP_CMD_DECREMENT,   /* Decrement by amount */
 } cap_cmd_type_t;
 
+/* Payload of OS_EVENT_CAP_STATE_CHANGED. Sized to fit an event, so the
+ * value carries only the kinds state can have. */
+typedef struct {
+    os_eui64_t node_addr;
+    cap_id_t cap_id;
+    union {
+        bool b;
+        int32_t i;
+    } value;
+} cap_state_event_t;
+
+/* Payload of OS_EVENT_CAP_SET_CHANGED */
+typedef struct {
+    os_eui64_t node_addr;
+    uint32_t old_mask;          /* Bit (1 << cap_id) per capability */
+    uint32_t new_mask;
+} cap_set_event_t;
+
 /* Capability command structure */
 typedef struct {
     os_eui64_t node_addr;
@@ -92,6 +116,31 @@ typedef struct {
     os_corr_id_t corr_id;
 } cap_command_t;
 
+/* State publication policy
+ *
+ * A report always updates the cached state, but OS_EVENT_CAP_STATE_CHANGED
+ * is only emitted when the value moved by at least `deadband` (any change if
+ * 0) or when `max_staleness_ms` has passed since the last event (heartbeat).
+ * A significant change inside `min_interval_ms` of the previous event is
+ * held back and emitted by cap_process() once the interval has elapsed.
+ * Zero disables min_interval_ms / max_staleness_ms.
+ */
+typedef struct {
+    int32_t deadband;           /* In value units (0.01 degC for temperature, ...) */
+    uint32_t min_interval_ms;
+    uint32_t max_staleness_ms;
+} cap_policy_t;
+
+/* Capability statistics */
+typedef struct {
+    uint32_t reports;           /* Mapped attribute reports received */
+    uint32_t published;         /* State change events emitted */
+    uint32_t suppressed;        /* Reports inside the deadband */
+    uint32_t deferred;          /* Changes held back by min_interval */
+    uint32_t heartbeats;        /* Events emitted only for staleness */
+    uint32_t spurious;          /* Repeated reports dropped by a quirk */
+} cap_stats_t;
+
 /**
  * @brief Initialize capability service
  * @return OS_OK on success
@@ -100,11 +149,22 @@ os_err_t cap_init(void);
 
 /**
  * @brief Compute capabilities for a node from its clusters
+ *
+ * Emits OS_EVENT_CAP_SET_CHANGED when the set differs from the last one
+ * computed for the node.
+ *
  * @param node Node pointer
  * @return Number of capabilities found
  */
 uint32_t cap_compute_for_node(reg_node_t *node);
 
+/**
+ * @brief Get the set of capabilities computed for a node
+ * @param node Node pointer
+ * @return Bit mask with bit (1 << cap_id) set per capability
+ */
+uint32_t cap_get_mask(const reg_node_t *node);
+
 /**
  * @brief Get capability state for a node
  * @param node_addr Node IEEE address
@@ -114,6 +174,24 @@ uint32_t cap_compute_for_node(reg_node_t *node);
  */
 os_err_t cap_get_state(os_eui64_t node_addr, cap_id_t cap_id, cap_state_t *out_state);
 
+/**
+ * @brief Get capability state for an already-resolved node
+ * @param node Node pointer
+ * @param cap_id Capability ID
+ * @param out_state Output state
+ * @return OS_OK on success
+ */
+os_err_t cap_get_state_by_node(const reg_node_t *node, cap_id_t cap_id,
+                               cap_state_t *out_state);
+
+/**
+ * @brief Get the endpoint providing a capability on a node
+ * @param node Node pointer
+ * @param cap_id Capability ID
+ * @return Endpoint ID, or 0 if the node does not have the capability
+ */
+uint8_t cap_get_endpoint(const reg_node_t *node, cap_id_t cap_id);
+
 /**
  * @brief Update capability state from Zigbee attribute report
  * @param node_addr Node IEEE address
@@ -127,13 +205,59 @@ os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
                                       uint16_t cluster_id, uint16_t attr_id,
                                       const reg_attr_value_t *value);
 
+/**
+ * @brief Update capability state for an already-resolved node
+ *
+ * Fast path for callers that hold the registry node: capability state is
+ * stored by registry slot, so no further lookup is needed.
+ *
+ * @param node Node pointer
+ * @param endpoint_id Endpoint ID
+ * @param cluster_id Cluster ID
+ * @param attr_id Attribute ID
+ * @param value Attribute value
+ * @return OS_OK on success
+ */
+os_err_t cap_handle_attribute_report_by_node(reg_node_t *node, uint8_t endpoint_id,
+                                             uint16_t cluster_id, uint16_t attr_id,
+                                             const reg_attr_value_t *value);
+
 /**
  * @brief Execute a capability command
+ *
+ * Hands the command to the command scheduler, which coalesces it with
+ * pending commands for the same node/endpoint/capability.
+ *
  * @param cmd Command to execute
  * @return OS_OK on success
  */
 os_err_t cap_execute_command(const cap_command_t *cmd);
 
+/**
+ * @brief Set and publish the state a command is expected to produce
+ *
+ * Used for optimistic state: the cached value changes and
+ * OS_EVENT_CAP_STATE_CHANGED is emitted immediately, bypassing the
+ * publication policy. A later attribute report overwrites it as usual.
+ *
+ * @param node Node pointer
+ * @param cap_id Capability ID
+ * @param value Commanded value
+ * @param out_prev Previous state, for rollback (optional)
+ * @return OS_OK on success, OS_ERR_NOT_FOUND if the node lacks the capability
+ */
+os_err_t cap_apply_commanded(reg_node_t *node, cap_id_t cap_id,
+                             const cap_value_t *value, cap_state_t *out_prev);
+
+/**
+ * @brief Get the ZCL attribute that reports a capability
+ * @param cap_id Capability ID
+ * @param cluster_id Output cluster ID
+ * @param attr_id Output attribute ID
+ * @return OS_OK on success, OS_ERR_NOT_FOUND if the capability has no mapping
+ */
+os_err_t cap_get_attribute(cap_id_t cap_id, uint16_t *cluster_id, uint16_t *attr_id);
+
 /**
  * @brief Get capability info
  * @param id Capability ID
@@ -141,6 +265,34 @@ os_err_t cap_execute_command(const cap_command_t *cmd);
  */
 const cap_info_t *cap_get_info(cap_id_t id);
 
+/**
+ * @brief Format a fixed-point number as exact decimal text
+ *
+ * Integer-only: 2134 with 2 decimals is "21.34", -5 is "-0.05".
+ *
+ * @param value Scaled value
+ * @param decimals Digits after the decimal point (at most 9)
+ * @param buf Output buffer (CAP_VALUE_TEXT_MAX is always enough)
+ * @param len Buffer size
+ * @return Length written, or -1 if the buffer is too small
+ */
+int cap_format_fixed(int32_t value, uint8_t decimals, char *buf, size_t len);
+
+/**
+ * @brief Format a capability value as a JSON number
+ *
+ * Booleans format as 0/1, CAP_VALUE_FIXED values with the capability's
+ * decimals. Strings are not handled.
+ *
+ * @param cap_id Capability ID
+ * @param value Value
+ * @param buf Output buffer
+ * @param len Buffer size
+ * @return Length written, or -1 on error
+ */
+int cap_format_value(cap_id_t cap_id, const cap_value_t *value,
+                     char *buf, size_t len);
+
 /**
  * @brief Get capability ID from name
  * @param name Capability name
@@ -148,6 +300,51 @@ const cap_info_t *cap_get_info(cap_id_t id);
  */
 cap_id_t cap_parse_name(const char *name);
 
+/**
+ * @brief Get capability ID from a name that is not NUL-terminated
+ *
+ * Hashed lookup, for names sliced out of MQTT topics without copying.
+ *
+ * @param name Capability name
+ * @param len Name length
+ * @return Capability ID, or CAP_UNKNOWN if not found
+ */
+cap_id_t cap_lookup_name(const char *name, size_t len);
+
+/**
+ * @brief Set the default publication policy for a capability
+ *
+ * Applies to nodes without a quirk override for this capability.
+ *
+ * @param cap_id Capability ID
+ * @param policy New policy
+ * @return OS_OK on success
+ */
+os_err_t cap_set_policy(cap_id_t cap_id, const cap_policy_t *policy);
+
+/**
+ * @brief Get the policy in effect for a capability on a node
+ * @param node Node pointer, or NULL for the default policy
+ * @param cap_id Capability ID
+ * @param out_policy Output policy
+ * @return OS_OK on success
+ */
+os_err_t cap_get_policy(const reg_node_t *node, cap_id_t cap_id,
+                        cap_policy_t *out_policy);
+
+/**
+ * @brief Emit state changes held back by min_interval (call from fibre)
+ * @return Number of events emitted
+ */
+uint32_t cap_process(void);
+
+/**
+ * @brief Get capability statistics
+ * @param stats Output statistics
+ * @return OS_OK on success
+ */
+os_err_t cap_get_stats(cap_stats_t *stats);
+
 /**
  * @brief Capability task entry (run as fibre)
  * @param arg Unused
@@ -0,0 +1,171 @@
+/**
+ * @file cmd_sched.h
+ * @brief Capability command scheduler API
+ *
+ * ESP32-C6 Zigbee Bridge OS - Command coalescing and pacing
+ *
+ * Sits between cap_execute_command() and the Zigbee adapter. Pending
+ * commands are held per (node, endpoint, capability) and a newer command
+ * replaces the queued value rather than adding another frame. Each node has
+ * at most one command in flight and a minimum gap between frames, so a burst
+ * from a UI slider collapses to the first and the last value.
+ *
+ * Commands for cached capabilities are published optimistically on submit
+ * and tracked by corr_id until the device confirms them: an adapter error
+ * rolls the state back, and a confirm without a following attribute report
+ * (or no confirm at all) triggers a read of the attribute.
+ */
+
+#ifndef CMD_SCHED_H
+#define CMD_SCHED_H
+
+#include "os_types.h"
+#include "capability.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum distinct (node, endpoint, capability) commands waiting to be sent */
+#define CMD_SCHED_MAX_PENDING 32
+
+/* Default minimum spacing between frames to the same node */
+#define CMD_SCHED_MIN_GAP_MS 50
+
+/* In-flight command is abandoned if no confirm arrives within this time */
+#define CMD_SCHED_CONFIRM_TIMEOUT_MS 2000
+
+/* After confirm, read the attribute back if no report arrives within this */
+#define CMD_SCHED_RECONCILE_MS 3000
+
+/* Upper bound on the scheduler sleep */
+#define CMD_SCHED_MAX_SLEEP_MS 100
+
+/* OS_EVENT_CAP_COMMAND payload, emitted for capabilities the Zigbee adapter
+ * has no send primitive for. Sized to fit an event; corr_id travels in
+ * event.corr_id. */
+typedef struct {
+    os_eui64_t node_addr;
+    uint8_t endpoint_id;
+    cap_id_t cap_id;
+    union {
+        bool b;
+        int32_t i;
+    } value;
+} cap_cmd_event_t;
+
+/* Scheduler statistics */
+typedef struct {
+    uint32_t submitted;         /* Commands accepted */
+    uint32_t coalesced;         /* Commands merged into a queued one */
+    uint32_t superseded;        /* Commands queued behind an in-flight one for the same key */
+    uint32_t sent;              /* Frames handed to the adapter */
+    uint32_t confirmed;         /* In-flight commands confirmed */
+    uint32_t failed;            /* In-flight commands reported as errors */
+    uint32_t timeouts;          /* In-flight commands abandoned without confirm */
+    uint32_t dropped;           /* Queued commands discarded (node gone, send error) */
+    uint32_t optimistic;        /* Commands published before confirmation */
+    uint32_t reconciled;        /* Optimistic states confirmed by a report */
+    uint32_t rolled_back;       /* Optimistic states reverted after an error */
+    uint32_t reads;             /* Attribute reads issued to reconcile */
+} cmd_sched_stats_t;
+
+/**
+ * @brief Initialize command scheduler
+ * @return OS_OK on success
+ */
+os_err_t cmd_sched_init(void);
+
+/**
+ * @brief Queue a capability command
+ *
+ * TOGGLE, INCREMENT and DECREMENT are resolved against the queued value for
+ * the same key, else the newer of the last value sent and the cached
+ * capability state, so they coalesce like SET.
+ * The command is sent immediately when the node is idle. When it replaces a
+ * queued command, the earlier corr_id will not be confirmed.
+ *
+ * @param cmd Command (endpoint_id 0 uses the endpoint providing the capability)
+ * @return OS_OK on success, OS_ERR_NOT_FOUND for an unknown node,
+ *         OS_ERR_FULL if the pending table is full
+ */
+os_err_t cmd_sched_submit(const cap_command_t *cmd);
+
+/**
+ * @brief Queue the same command for a set of nodes
+ *
+ * Nodes are paced independently, so every idle node is sent its frame in the
+ * same pass instead of waiting behind the others.
+ *
+ * @param nodes Node IEEE addresses
+ * @param count Number of nodes
+ * @param cmd Command template (node_addr and corr_id are ignored)
+ * @return OS_OK if every node was queued, otherwise the last error
+ */
+os_err_t cmd_sched_submit_group(const os_eui64_t *nodes, uint32_t count,
+                                const cap_command_t *cmd);
+
+/**
+ * @brief Get the value queued for a key
+ * @param node_addr Node IEEE address
+ * @param endpoint_id Endpoint ID
+ * @param cap_id Capability ID
+ * @param out_value Output value
+ * @return OS_OK if a command is queued, OS_ERR_NOT_FOUND otherwise
+ */
+os_err_t cmd_sched_get_pending(os_eui64_t node_addr, uint8_t endpoint_id,
+                               cap_id_t cap_id, cap_value_t *out_value);
+
+/**
+ * @brief Tell the scheduler an attribute report updated a capability
+ *
+ * Called by the capability service; completes tracking of confirmed
+ * commands for the capability.
+ *
+ * @param node Node pointer
+ * @param cap_id Capability ID
+ */
+void cmd_sched_note_report(const reg_node_t *node, cap_id_t cap_id);
+
+/**
+ * @brief Set the minimum spacing between frames to the same node
+ * @param gap_ms Gap in ms (0 disables pacing)
+ */
+void cmd_sched_set_min_gap(os_time_ms_t gap_ms);
+
+/**
+ * @brief Send queued commands whose node is ready and expire stale in-flight ones
+ * @return Number of frames sent
+ */
+uint32_t cmd_sched_process(void);
+
+/**
+ * @brief Get time until queued work may become sendable
+ * @return Milliseconds, capped at CMD_SCHED_MAX_SLEEP_MS
+ */
+os_time_ms_t cmd_sched_next_due_ms(void);
+
+/**
+ * @brief Get number of queued commands
+ * @return Commands waiting to be sent
+ */
+uint32_t cmd_sched_pending_count(void);
+
+/**
+ * @brief Get scheduler statistics
+ * @param stats Output statistics
+ * @return OS_OK on success
+ */
+os_err_t cmd_sched_get_stats(cmd_sched_stats_t *stats);
+
+/**
+ * @brief Command scheduler task entry (run as fibre)
+ * @param arg Unused
+ */
+void cmd_sched_task(void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CMD_SCHED_H */
@@ -8,7 +8,28 @@
  * - Query endpoints (simple descriptor)
  * - Query clusters per endpoint
  * - Read Basic cluster attributes (manufacturer/model/SW build)
+ * - Bind clusters and configure attribute reporting
  * - Persist and resume interview progress
+ *
+ * Interviews are driven by adapter response events (matched on the
+ * interview's correlation ID), not by polling: device announcements start
+ * them, simple descriptors for all endpoints are requested back to back and
+ * the Basic attributes are read in a single request. The task only handles
+ * step timeouts and retries.
+ *
+ * The Basic read comes first: when the (manufacturer, model, sw_build) has
+ * been interviewed before, the endpoint tree is copied from the descriptor
+ * cache and discovery is skipped.
+ *
+ * Finally the device's reportable clusters are bound to the coordinator
+ * and their attribute reporting configured (see report_plan.h), so state
+ * is pushed by the device instead of polled.
+ *
+ * Devices beyond the concurrent interview limit wait in a queue. Mains
+ * powered devices (routers) are admitted first; battery devices only while
+ * they are awake, i.e. recently heard from. A global budget caps the
+ * interview requests on the air so that a network-wide rejoin does not
+ * crowd out commands.
  */
 
 #ifndef INTERVIEW_H
@@ -32,6 +53,28 @@ typedef enum {
     INTERVIEW_STAGE_FAILED,         /* Interview failed */
 } interview_stage_t;
 
+/* Interview statistics */
+typedef struct {
+    uint32_t started;
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t retries;               /* Steps re-sent after a timeout */
+    uint32_t requests;              /* ZDO/ZCL requests sent */
+    uint32_t active;                /* Interviews in progress */
+    uint32_t queued;                /* Devices waiting for a slot */
+    uint32_t queue_peak;
+    uint32_t dropped;               /* Turned away with the queue full */
+    uint32_t admitted;              /* Taken from the queue */
+    uint32_t wait_ms_total;         /* Queue wait over all admitted devices */
+    uint32_t wait_ms_max;
+    uint32_t inflight;              /* Requests awaiting a response */
+    uint32_t inflight_peak;
+    uint32_t cache_hits;            /* Endpoints taken from the descriptor cache */
+    uint32_t bindings;              /* Clusters bound to the coordinator */
+    uint32_t reports_configured;    /* Attributes set up to report */
+    uint32_t setup_refused;         /* Binds/configurations the device refused */
+} interview_stats_t;
+
 /**
  * @brief Initialize interview service
  * @return OS_OK on success
@@ -40,8 +83,14 @@ os_err_t interview_init(void);
 
 /**
  * @brief Start interview for a node
+ *
+ * Queues the node; it is interviewed as soon as a slot is free and no
+ * device of higher priority is waiting. Queued nodes report
+ * INTERVIEW_STAGE_INIT.
+ *
  * @param ieee_addr Node IEEE address
- * @return OS_OK on success
+ * @return OS_OK on success (or already pending), OS_ERR_NOT_FOUND if the
+ *         node is not registered, OS_ERR_FULL if the queue is full
  */
 os_err_t interview_start(os_eui64_t ieee_addr);
 
@@ -59,7 +108,14 @@ void interview_process(void);
 interview_stage_t interview_get_stage(os_eui64_t ieee_addr);
 
 /**
- * @brief Cancel interview for a node
+ * @brief Get interview statistics
+ * @param stats Output statistics
+ * @return OS_OK on success
+ */
+os_err_t interview_get_stats(interview_stats_t *stats);
+
+/**
+ * @brief Cancel interview (or queued interview) for a node
  * @param ieee_addr Node IEEE address
  * @return OS_OK on success
  */
@@ -0,0 +1,81 @@
+/**
+ * @file interview_cache.h
+ * @brief Interview result (descriptor) cache API
+ *
+ * ESP32-C6 Zigbee Bridge OS - Device interview service
+ *
+ * Remembers the endpoint/cluster tree discovered for a device type, keyed
+ * by (manufacturer, model, sw_build). Further devices of the same type are
+ * given a copy of the tree after their Basic cluster read, skipping the
+ * Active_EP and Simple_Desc exchanges.
+ *
+ * Entries are written through to os_persist under "icache/<hash>" and a
+ * small RAM table holds the recently used ones; a type missing from RAM is
+ * loaded from storage on lookup.
+ */
+
+#ifndef INTERVIEW_CACHE_H
+#define INTERVIEW_CACHE_H
+
+#include "os_types.h"
+#include "reg_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Cache statistics */
+typedef struct {
+    uint32_t entries;               /* Entries in RAM */
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t stores;
+    uint32_t loads;                 /* Hits served from storage */
+} icache_stats_t;
+
+/**
+ * @brief Initialize the interview cache
+ * @return OS_OK on success, OS_ERR_ALREADY_EXISTS if already initialized
+ */
+os_err_t icache_init(void);
+
+/**
+ * @brief Record the endpoint/cluster tree of an interviewed node
+ *
+ * Keyed by the node's manufacturer, model and sw_build, which must have
+ * been read. Replaces an existing entry for the same type.
+ *
+ * @param node Node whose discovery completed
+ * @return OS_OK on success, OS_ERR_INVALID_ARG if the node has no
+ *         manufacturer/model or no endpoints
+ */
+os_err_t icache_store(const reg_node_t *node);
+
+/**
+ * @brief Give a node the cached tree of its device type
+ *
+ * Adds the cached endpoints and clusters to the registry node.
+ *
+ * @param node Node with manufacturer, model and sw_build set
+ * @return true if the type was cached and the tree applied
+ */
+bool icache_apply(reg_node_t *node);
+
+/**
+ * @brief Drop all RAM entries (persisted entries are kept and reloaded
+ *        on demand)
+ */
+void icache_evict_all(void);
+
+/**
+ * @brief Get cache statistics
+ * @param stats Output statistics
+ * @return OS_OK on success
+ */
+os_err_t icache_get_stats(icache_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INTERVIEW_CACHE_H */
@@ -0,0 +1,94 @@
+/**
+ * @file liveness.h
+ * @brief Device liveness service API
+ *
+ * ESP32-C6 Zigbee Bridge OS - Liveness sweeper
+ *
+ * Marks READY nodes OFFLINE once they have been silent for longer than the
+ * timeout for their power source. Deadlines live in a min-heap keyed by
+ * expiry tick, so each sweep only looks at nodes that are actually due.
+ */
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include "os_types.h"
+#include "reg_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default silence timeouts in ms */
+#define LIVENESS_TIMEOUT_MAINS_MS   (2UL * 60 * 60 * 1000)   /* 2 h: routers */
+#define LIVENESS_TIMEOUT_BATTERY_MS (25UL * 60 * 60 * 1000)  /* 25 h: sleepy end devices */
+
+/* Upper bound on the sweeper sleep so newly armed nodes are picked up */
+#define LIVENESS_MAX_SLEEP_MS 1000
+
+/* Liveness statistics */
+typedef struct {
+    uint32_t tracked;           /* Nodes currently armed */
+    uint32_t expired;           /* Nodes marked OFFLINE */
+    uint32_t rearmed;           /* Popped deadlines that had been refreshed */
+} liveness_stats_t;
+
+/**
+ * @brief Initialize liveness service
+ *
+ * Arms every node that is already READY.
+ *
+ * @return OS_OK on success
+ */
+os_err_t liveness_init(void);
+
+/**
+ * @brief Set the silence timeout for a power source
+ *
+ * MAINS and DC share a timeout, as do BATTERY and UNKNOWN.
+ *
+ * @param power_source Power source
+ * @param timeout_ms Timeout in ms (must be non-zero)
+ * @return OS_OK on success
+ */
+os_err_t liveness_set_timeout(reg_power_source_t power_source,
+                              os_time_ms_t timeout_ms);
+
+/**
+ * @brief Get the silence timeout for a power source
+ * @param power_source Power source
+ * @return Timeout in ms
+ */
+os_time_ms_t liveness_get_timeout(reg_power_source_t power_source);
+
+/**
+ * @brief Expire all nodes whose deadline has passed
+ * @return Number of nodes marked OFFLINE
+ */
+uint32_t liveness_process(void);
+
+/**
+ * @brief Get time until the next deadline
+ * @return Milliseconds until the earliest deadline, capped at
+ *         LIVENESS_MAX_SLEEP_MS
+ */
+os_time_ms_t liveness_next_due_ms(void);
+
+/**
+ * @brief Get liveness statistics
+ * @param stats Output statistics
+ * @return OS_OK on success
+ */
+os_err_t liveness_get_stats(liveness_stats_t *stats);
+
+/**
+ * @brief Liveness task entry (run as fibre)
+ * @param arg Unused
+ */
+void liveness_task(void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIVENESS_H */
@@ -27,6 +27,7 @@ typedef enum {
     QUIRK_ACTION_REMAP_ATTRIBUTE,   /* Map to different attribute */
     QUIRK_ACTION_OVERRIDE_REPORTING,/* Override reporting config */
     QUIRK_ACTION_IGNORE_SPURIOUS,   /* Ignore spurious reports */
+    QUIRK_ACTION_STATE_POLICY,      /* Override deadband/interval policy */
 } quirk_action_type_t;
 
 /* Parameters for different action types */
@@ -39,16 +40,43 @@ typedef struct {
     bool enabled;
 } quirk_invert_params_t;
 
+/* value * multiplier / divisor + offset, in the capability's value units
+ * (e.g. 0.01 degC), rounded to nearest. A rational scale keeps decimal
+ * factors such as 0.1 exact without floating point. */
 typedef struct {
-    float multiplier;
-    float offset;
+    int32_t multiplier;
+    int32_t divisor;                /* 0 is treated as 1 */
+    int32_t offset;
 } quirk_scale_params_t;
 
+/* Vendor attribute that reports target_cap; it is decoded as the
+ * capability's standard attribute */
+typedef struct {
+    uint16_t cluster_id;
+    uint16_t attr_id;
+} quirk_remap_params_t;
+
+/* Reporting configuration pushed for target_cap during interview */
+typedef struct {
+    uint16_t min_interval_s;
+    uint16_t max_interval_s;
+    uint32_t reportable_change;     /* Raw attribute units */
+} quirk_reporting_params_t;
+
+/* Repeats of the last reported value within window_ms are dropped */
+typedef struct {
+    uint32_t window_ms;
+} quirk_spurious_params_t;
+
 /* Union of all action parameters */
 typedef union {
     quirk_clamp_params_t clamp;
     quirk_invert_params_t invert;
     quirk_scale_params_t scale;
+    quirk_remap_params_t remap;
+    quirk_reporting_params_t reporting;
+    quirk_spurious_params_t spurious;
+    cap_policy_t policy;
 } quirk_action_params_t;
 
 /* Single quirk action */
@@ -62,7 +90,7 @@ typedef struct {
 #define QUIRK_MAX_ACTIONS 4
 
 /* Quirk entry for a specific manufacturer/model */
-typedef struct {
+typedef struct quirk_entry {
     const char *manufacturer;
     const char *model;
     bool prefix_match;              /* If true, match model prefix only */
@@ -70,6 +98,21 @@ typedef struct {
     uint8_t action_count;
 } quirk_entry_t;
 
+/* Index capacity; quirks_find() falls back to a table scan if exceeded */
+#define QUIRKS_MFR_BUCKETS      64      /* Power of two */
+#define QUIRKS_TRIE_MAX_NODES   512
+
+/* Database entries kept decoded at once (one per distinct matched device) */
+#define QUIRKS_DB_CACHE_ENTRIES (REG_MAX_NODES + 4)
+
+/* Where quirks_load_file() looks for the database at boot: a file built by
+ * `make quirks-db` on host, the "quirks" data partition on ESP32 */
+#ifdef OS_PLATFORM_HOST
+#define QUIRKS_DB_PATH "build/quirks.qdb"
+#else
+#define QUIRKS_DB_PATH "quirks"
+#endif
+
 /* Result of applying quirks */
 typedef struct {
     bool applied;
@@ -78,10 +121,45 @@ typedef struct {
 
 /**
  * @brief Initialize quirks service
+ *
+ * Builds the manufacturer/model index. Before this, quirks_find() scans
+ * the table.
+ *
  * @return OS_OK on success
  */
 os_err_t quirks_init(void);
 
+/**
+ * @brief Use a compiled quirk database instead of the built-in table
+ *
+ * The image (see quirks_db.h) is validated and then used in place, so it
+ * must stay mapped until another source is loaded. On error the current
+ * source is kept.
+ *
+ * @param data Database image (4-byte aligned)
+ * @param len Image length; trailing bytes (e.g. erased flash) are ignored
+ * @return OS_OK on success, OS_ERR_NOT_FOUND if there is no database
+ *         header, OS_ERR_INVALID_ARG if the image is corrupt
+ */
+os_err_t quirks_load_db(const void *data, size_t len);
+
+/**
+ * @brief Map and load a compiled quirk database
+ *
+ * On host, path is a file that is mmap'd; on ESP32 it is the label of a
+ * data partition that is mapped into the flash cache.
+ *
+ * @param path File path or partition label (QUIRKS_DB_PATH at boot)
+ * @return OS_OK on success, OS_ERR_NOT_FOUND if absent or blank,
+ *         OS_ERR_INVALID_ARG if corrupt, OS_ERR_NO_MEM if mapping failed
+ */
+os_err_t quirks_load_file(const char *path);
+
+/**
+ * @brief Switch back to the built-in table, releasing any loaded database
+ */
+void quirks_load_builtin(void);
+
 /**
  * @brief Find quirk entry for a device
  * @param manufacturer Device manufacturer string
@@ -90,6 +168,18 @@ os_err_t quirks_init(void);
  */
 const quirk_entry_t *quirks_find(const char *manufacturer, const char *model);
 
+/**
+ * @brief Get the quirk entry for a node, cached on the node
+ *
+ * The result is stored on the node and reused until reg_mark_changed() is
+ * called for it (e.g. the interview fills in manufacturer/model) or the
+ * quirk source changes.
+ *
+ * @param node Node pointer
+ * @return Pointer to quirk entry, or NULL if none
+ */
+const quirk_entry_t *quirks_for_node(reg_node_t *node);
+
 /**
  * @brief Apply quirks to a capability value
  * @param manufacturer Device manufacturer
@@ -103,6 +193,17 @@ os_err_t quirks_apply_value(const char *manufacturer, const char *model,
                              cap_id_t cap_id, cap_value_t *value,
                              quirk_result_t *result);
 
+/**
+ * @brief Apply an already-resolved quirk entry to a capability value
+ * @param entry Quirk entry (NULL leaves the value unchanged)
+ * @param cap_id Capability ID
+ * @param value In/out value pointer
+ * @param result Output result (optional)
+ * @return OS_OK on success
+ */
+os_err_t quirks_entry_apply_value(const quirk_entry_t *entry, cap_id_t cap_id,
+                                  cap_value_t *value, quirk_result_t *result);
+
 /**
  * @brief Apply quirks to a command value before encoding
  * @param manufacturer Device manufacturer
@@ -117,13 +218,66 @@ os_err_t quirks_apply_command(const char *manufacturer, const char *model,
                                quirk_result_t *result);
 
 /**
- * @brief Get the number of quirk entries in the table
+ * @brief Apply an already-resolved quirk entry to a command value
+ * @param entry Quirk entry (NULL leaves the value unchanged)
+ * @param cap_id Capability ID
+ * @param value In/out value pointer
+ * @param result Output result (optional)
+ * @return OS_OK on success
+ */
+os_err_t quirks_entry_apply_command(const quirk_entry_t *entry, cap_id_t cap_id,
+                                    cap_value_t *value, quirk_result_t *result);
+
+/**
+ * @brief Get a state publication policy override
+ * @param manufacturer Device manufacturer
+ * @param model Device model
+ * @param cap_id Capability ID
+ * @return Policy from a QUIRK_ACTION_STATE_POLICY action, or NULL if none
+ */
+const cap_policy_t *quirks_get_policy(const char *manufacturer,
+                                      const char *model, cap_id_t cap_id);
+
+/**
+ * @brief Get a state publication policy override from a resolved entry
+ * @param entry Quirk entry (may be NULL)
+ * @param cap_id Capability ID
+ * @return Policy, or NULL if none
+ */
+const cap_policy_t *quirks_entry_get_policy(const quirk_entry_t *entry,
+                                            cap_id_t cap_id);
+
+/**
+ * @brief Look up a vendor attribute remap
+ * @param entry Quirk entry (may be NULL)
+ * @param cluster_id Reported cluster ID
+ * @param attr_id Reported attribute ID
+ * @return Capability the attribute reports, or CAP_UNKNOWN if not remapped
+ */
+cap_id_t quirks_entry_remap_attribute(const quirk_entry_t *entry,
+                                      uint16_t cluster_id, uint16_t attr_id);
+
+/**
+ * @brief Get the duplicate report window for a capability
+ * @param entry Quirk entry (may be NULL)
+ * @param cap_id Capability ID
+ * @return Window in ms from a QUIRK_ACTION_IGNORE_SPURIOUS action, 0 if none
+ */
+uint32_t quirks_entry_get_spurious_window(const quirk_entry_t *entry,
+                                          cap_id_t cap_id);
+
+/**
+ * @brief Get the number of quirk entries in the active table or database
  * @return Number of entries
  */
 uint32_t quirks_count(void);
 
 /**
  * @brief Get quirk entry by index
+ *
+ * Database entries are decoded into a small cache; do not hold the pointer
+ * across other quirk lookups.
+ *
  * @param index Entry index
  * @return Pointer to entry, or NULL if invalid index
  */
@@ -0,0 +1,111 @@
+/**
+ * @file quirks_db.h
+ * @brief Binary quirk database format
+ *
+ * ESP32-C6 Zigbee Bridge OS - Device quirks system
+ *
+ * A quirk database is produced on the host by tools/quirks_compile.py and
+ * used in place (mmap'd file or flash partition): the lookup index is part
+ * of the image, so loading it costs no RAM beyond the entries that match
+ * devices on the network.
+ *
+ * Layout (little-endian, each section 4-byte aligned):
+ *
+ *   qdb_header_t
+ *   qdb_bucket_t     buckets[bucket_count]   manufacturer hash table
+ *   qdb_trie_node_t  trie[trie_count]        per-manufacturer model tries
+ *   qdb_entry_t      entries[entry_count]
+ *   qdb_action_t     actions[action_count]
+ *   char             strings[strings_len]    NUL-terminated, shared
+ *
+ * Buckets use linear probing on the FNV-1a hash of the manufacturer. Each
+ * occupied bucket points at the root of its manufacturer's model trie
+ * (children are first-child/next-sibling links). A trie node records the
+ * lowest entry index that matches exactly at that node and the lowest that
+ * matches as a prefix, so the first entry in source order wins. All links
+ * point to a higher node index, which makes every walk terminate.
+ */
+
+#ifndef QUIRKS_DB_H
+#define QUIRKS_DB_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QDB_MAGIC   0x31424451U     /* "QDB1" */
+#define QDB_VERSION 2
+
+/* Null index for 16-bit links */
+#define QDB_NONE 0xFFFF
+
+/* qdb_entry_t flags */
+#define QDB_ENTRY_PREFIX 0x01
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bucket_count;          /* Power of two */
+    uint16_t trie_count;
+    uint16_t entry_count;
+    uint16_t action_count;
+    uint16_t reserved;
+    uint32_t strings_len;
+    uint32_t crc32;                 /* CRC-32 (IEEE) of everything after the header */
+} qdb_header_t;
+
+typedef struct {
+    uint32_t hash;                  /* FNV-1a of the manufacturer */
+    uint16_t root;                  /* Trie root, QDB_NONE if the bucket is empty */
+    uint16_t first;                 /* An entry with this manufacturer */
+} qdb_bucket_t;
+
+typedef struct {
+    uint16_t child;
+    uint16_t sibling;
+    uint16_t exact;                 /* Lowest exact-match entry ending here */
+    uint16_t prefix;                /* Lowest prefix-match entry ending here */
+    uint8_t c;
+    uint8_t reserved;
+} qdb_trie_node_t;
+
+typedef struct {
+    uint32_t manufacturer;          /* Offsets into the string pool */
+    uint32_t model;
+    uint16_t first_action;
+    uint8_t action_count;
+    uint8_t flags;
+} qdb_entry_t;
+
+/* Action parameters are raw 32-bit words, by action type:
+ *   clamp_range     [0] int32 min, [1] int32 max
+ *   invert_boolean  [0] enabled (0/1)
+ *   scale_numeric   [0] int32 multiplier, [1] int32 divisor, [2] int32 offset
+ *   remap_attribute [0] cluster_id, [1] attr_id
+ *   override_reporting [0] min_interval_s, [1] max_interval_s, [2] reportable_change
+ *   ignore_spurious_reports [0] window_ms
+ *   state_policy    [0] int32 deadband, [1] min_interval_ms, [2] max_staleness_ms
+ *
+ * Offsets and deadbands are in the capability's fixed-point value units
+ * (cap_info_t.decimals); the compiler converts from the YAML's decimal units.
+ */
+typedef struct {
+    uint8_t type;                   /* quirk_action_type_t */
+    uint8_t target_cap;             /* cap_id_t */
+    uint16_t reserved;
+    uint32_t params[3];
+} qdb_action_t;
+
+_Static_assert(sizeof(qdb_header_t) == 24, "qdb_header_t layout");
+_Static_assert(sizeof(qdb_bucket_t) == 8, "qdb_bucket_t layout");
+_Static_assert(sizeof(qdb_trie_node_t) == 10, "qdb_trie_node_t layout");
+_Static_assert(sizeof(qdb_entry_t) == 12, "qdb_entry_t layout");
+_Static_assert(sizeof(qdb_action_t) == 16, "qdb_action_t layout");
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUIRKS_DB_H */
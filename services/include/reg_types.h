@@ -26,8 +26,12 @@ extern "C" {
 #define REG_MAX_CLUSTERS 8
 #define REG_MAX_ATTRIBUTES 8
 #else
-/* Host: Full limits for comprehensive testing */
+/* Host: Full limits for comprehensive testing
+ * REG_MAX_NODES may be overridden on the command line (benchmarks)
+ */
+#ifndef REG_MAX_NODES
 #define REG_MAX_NODES 32
+#endif
 #define REG_MAX_ENDPOINTS 8
 #define REG_MAX_CLUSTERS 16
 #define REG_MAX_ATTRIBUTES 32
@@ -86,6 +90,7 @@ typedef union {
   int8_t s8;
   int16_t s16;
   int32_t s32;
+  uint8_t bytes[8]; /* Wider types (uint48), little-endian as on the air */
   char str[32];
 } reg_attr_value_t;
 
@@ -117,6 +122,8 @@ typedef struct {
   bool valid;
 } reg_endpoint_t;
 
+struct quirk_entry; /* quirks.h */
+
 /* Node (device) structure */
 typedef struct {
   /* Identity */
@@ -148,6 +155,10 @@ typedef struct {
   /* Interview progress */
   uint8_t interview_stage;
 
+  /* Cached quirk match (runtime only, see quirks_for_node) */
+  const struct quirk_entry *quirk;
+  uint32_t quirk_gen;
+
   /* Slot management */
   bool valid;
 } reg_node_t;
@@ -164,6 +175,32 @@ typedef struct {
   uint8_t endpoint_count;
 } reg_node_info_t;
 
+/* Cursor over occupied registry slots (see reg_iter_next) */
+typedef struct {
+  uint32_t slot; /* Next slot to examine */
+} reg_iter_t;
+
+/* Hot, read-mostly subset of a node, copied by value into snapshots */
+typedef struct {
+  os_eui64_t ieee_addr;
+  uint16_t nwk_addr;
+  reg_state_t state;
+  reg_power_source_t power_source;
+  char manufacturer[REG_MANUFACTURER_LEN];
+  char model[REG_MODEL_LEN];
+  char friendly_name[REG_NAME_MAX_LEN];
+  uint8_t lqi;
+  uint8_t endpoint_count;
+} reg_snapshot_entry_t;
+
+/* Immutable view of the registry at one generation */
+typedef struct {
+  uint32_t generation;
+  uint32_t count;
+  uint32_t refs; /* Readers holding this buffer */
+  reg_snapshot_entry_t entries[REG_MAX_NODES];
+} reg_snapshot_t;
+
 #ifdef __cplusplus
 }
 #endif
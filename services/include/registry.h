@@ -16,6 +16,21 @@
 extern "C" {
 #endif
 
+/* Payload of OS_EVENT_REG_NODE_STATE_CHANGED */
+typedef struct {
+  os_eui64_t ieee_addr;
+  uint8_t old_state; /* reg_state_t */
+  uint8_t new_state; /* reg_state_t */
+} reg_state_event_t;
+
+/* Payload of OS_EVENT_ZB_DEVICE_LEFT from reg_remove_node(). The slot lets
+ * listeners find per-slot state after the node is gone; a leave reported
+ * by the Zigbee driver carries the address only */
+typedef struct {
+  os_eui64_t ieee_addr;
+  uint16_t slot;
+} reg_left_event_t;
+
 /**
  * @brief Initialize the registry
  * @return OS_OK on success
@@ -53,6 +68,9 @@ os_err_t reg_remove_node(os_eui64_t ieee_addr);
 
 /**
  * @brief Set node state
+ *
+ * Emits OS_EVENT_REG_NODE_STATE_CHANGED when the state actually changes.
+ *
  * @param node Node pointer
  * @param state New state
  * @return OS_OK on success
@@ -61,10 +79,27 @@ os_err_t reg_set_state(reg_node_t *node, reg_state_t state);
 
 /**
  * @brief Update node last seen time
+ *
+ * A node that was marked OFFLINE for silence is returned to READY.
+ *
  * @param node Node pointer
  */
 void reg_touch_node(reg_node_t *node);
 
+/**
+ * @brief Get the storage slot of a node
+ * @param node Node pointer
+ * @return Slot index in [0, REG_MAX_NODES), or -1 if not a registry node
+ */
+int32_t reg_node_slot(const reg_node_t *node);
+
+/**
+ * @brief Get a node by storage slot
+ * @param slot Slot index
+ * @return Pointer to node, or NULL if the slot is empty or out of range
+ */
+reg_node_t *reg_get_node_by_slot(uint32_t slot);
+
 /**
  * @brief Get total node count
  * @return Number of valid nodes
@@ -73,12 +108,72 @@ uint32_t reg_node_count(void);
 
 /**
  * @brief Get node info by index
+ *
+ * Counts valid slots from the start on every call, so looping over all
+ * indices is O(n^2). Use reg_iter_next() or a snapshot to enumerate.
+ *
  * @param index Node index
  * @param info Output info structure
  * @return OS_OK on success
  */
 os_err_t reg_get_node_info(uint32_t index, reg_node_info_t *info);
 
+/**
+ * @brief Start an enumeration of valid nodes
+ * @param iter Iterator to initialize
+ */
+void reg_iter_init(reg_iter_t *iter);
+
+/**
+ * @brief Get the next valid node
+ *
+ * Walks an occupancy bitmap, so a full enumeration is O(n) in the number of
+ * nodes plus O(REG_MAX_NODES / 32) words. Do not hold the returned pointer
+ * across a yield; use reg_snapshot_acquire() for that.
+ *
+ * @param iter Iterator
+ * @return Next node, or NULL when the enumeration is done
+ */
+reg_node_t *reg_iter_next(reg_iter_t *iter);
+
+/**
+ * @brief Note that a node's metadata was modified in place
+ *
+ * Call after writing node fields directly (manufacturer, model, power
+ * source, ...) so snapshots taken afterwards pick the change up.
+ *
+ * @param node Node pointer
+ */
+void reg_mark_changed(reg_node_t *node);
+
+/**
+ * @brief Get the registry generation
+ *
+ * Incremented on every structural or metadata change.
+ *
+ * @return Current generation
+ */
+uint32_t reg_generation(void);
+
+/**
+ * @brief Acquire a consistent snapshot of the registry
+ *
+ * The snapshot is an immutable copy of the hot node fields that stays valid
+ * across yields until released. Two buffers are kept: an unchanged registry
+ * shares the current buffer, a changed one is copied into whichever buffer
+ * no reader holds. If both are held, the newest existing snapshot is
+ * returned even if it is behind reg_generation().
+ *
+ * @return Snapshot (never NULL once the registry is initialized)
+ */
+const reg_snapshot_t *reg_snapshot_acquire(void);
+
+/**
+ * @brief Release a snapshot obtained from reg_snapshot_acquire()
+ * @param snap Snapshot
+ */
+void reg_snapshot_release(const reg_snapshot_t *snap);
+
 /**
  * @brief Add endpoint to a node
  * @param node Node pointer
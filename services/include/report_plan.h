@@ -0,0 +1,67 @@
+/**
+ * @file report_plan.h
+ * @brief Binding and attribute reporting planner API
+ *
+ * ESP32-C6 Zigbee Bridge OS - Device interview service
+ *
+ * Works out how an interviewed device should push its state: which server
+ * clusters to bind to the coordinator and, per cluster, the attribute
+ * reporting records (min/max interval, reportable change) to configure.
+ * The interview issues the plan in its BINDINGS stage.
+ *
+ * Intervals follow the capability's publication policy (reports faster
+ * than min_interval would only be held back by the bridge; one report per
+ * max_staleness keeps the heartbeat going), a quirk override_reporting
+ * action replaces them, and a vendor attribute named by remap_attribute is
+ * configured instead of the standard one.
+ */
+
+#ifndef REPORT_PLAN_H
+#define REPORT_PLAN_H
+
+#include "os_types.h"
+#include "reg_types.h"
+#include "zb_adapter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Clusters planned per node; each is one Bind and one Configure Reporting */
+#define RPLAN_MAX_STEPS 8
+
+/* Battery devices report analogue values at most this often */
+#define RPLAN_BATTERY_MIN_S 30
+
+/* Bind and reporting configuration of one cluster */
+typedef struct {
+    uint8_t endpoint_id;
+    uint16_t cluster_id;
+    uint8_t cfg_count;
+    zba_report_cfg_t cfgs[ZBA_MAX_REPORT_CFGS];
+} rplan_step_t;
+
+/* Plan for a node */
+typedef struct {
+    uint8_t count;
+    rplan_step_t steps[RPLAN_MAX_STEPS];
+} rplan_t;
+
+/**
+ * @brief Plan bindings and reporting for a node
+ *
+ * Uses the node's computed capabilities (cap_compute_for_node()) and its
+ * quirks. Capabilities without a reportable attribute (IAS zones notify on
+ * their own) are left out.
+ *
+ * @param node Node pointer
+ * @param plan Output plan
+ * @return Number of attribute reporting records planned
+ */
+uint32_t rplan_build(reg_node_t *node, rplan_t *plan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REPORT_PLAN_H */
@@ -0,0 +1,51 @@
+/**
+ * @file zcl_ids.h
+ * @brief Zigbee Cluster Library identifiers
+ *
+ * ESP32-C6 Zigbee Bridge OS - Well-known ZCL cluster and attribute IDs
+ *
+ * Shared by the capability, interview and local node services so each does
+ * not keep its own copy.
+ */
+
+#ifndef ZCL_IDS_H
+#define ZCL_IDS_H
+
+/* Cluster IDs */
+#define ZCL_CLUSTER_BASIC         0x0000
+#define ZCL_CLUSTER_POWER_CONFIG  0x0001
+#define ZCL_CLUSTER_IDENTIFY      0x0003
+#define ZCL_CLUSTER_ONOFF         0x0006
+#define ZCL_CLUSTER_LEVEL         0x0008
+#define ZCL_CLUSTER_COLOR         0x0300
+#define ZCL_CLUSTER_ILLUMINANCE   0x0400
+#define ZCL_CLUSTER_TEMPERATURE   0x0402
+#define ZCL_CLUSTER_HUMIDITY      0x0405
+#define ZCL_CLUSTER_OCCUPANCY     0x0406
+#define ZCL_CLUSTER_IAS_ZONE      0x0500
+#define ZCL_CLUSTER_METERING      0x0702
+#define ZCL_CLUSTER_ELEC_MEASURE  0x0B04
+
+/* Basic cluster attributes */
+#define ZCL_ATTR_BASIC_MANUFACTURER  0x0004
+#define ZCL_ATTR_BASIC_MODEL         0x0005
+#define ZCL_ATTR_BASIC_SW_BUILD      0x4000
+#define ZCL_ATTR_BASIC_POWER_SOURCE  0x0007
+
+/* Measurement / state attributes */
+#define ZCL_ATTR_ONOFF               0x0000
+#define ZCL_ATTR_LEVEL               0x0000
+#define ZCL_ATTR_COLOR_TEMP          0x0007
+#define ZCL_ATTR_ILLUMINANCE         0x0000  /* 10000*log10(lux)+1 */
+#define ZCL_ATTR_TEMPERATURE         0x0000  /* int16, 0.01 degC */
+#define ZCL_ATTR_HUMIDITY            0x0000  /* uint16, 0.01 % */
+#define ZCL_ATTR_OCCUPANCY           0x0000  /* bitmap8, bit 0 occupied */
+#define ZCL_ATTR_IAS_ZONE_STATUS     0x0002  /* bitmap16, bit 0 alarm1 */
+#define ZCL_ATTR_METERING_SUMMATION  0x0000  /* uint48, Wh by default */
+#define ZCL_ATTR_METERING_DEMAND     0x0400  /* int24, W */
+#define ZCL_ATTR_ACTIVE_POWER        0x050B  /* int16, W */
+
+/* Zigbee level control range */
+#define ZCL_LEVEL_MAX                254
+
+#endif /* ZCL_IDS_H */
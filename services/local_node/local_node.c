@@ -9,6 +9,7 @@
 #include "i2c_sensor.h"
 #include "os.h"
 #include "registry.h"
+#include "zcl_ids.h"
 #include <string.h>
 
 #define LOCAL_NODE_MODULE "LOCAL_NODE"
@@ -17,11 +18,6 @@
  * This should be unique in a real deployment. */
 #define LOCAL_NODE_EUI64 0xABCDEF0000000001ULL
 
-#define ZCL_CLUSTER_ONOFF        0x0006
-#define ZCL_CLUSTER_TEMPERATURE  0x0402
-#define ZCL_ATTR_ONOFF           0x0000
-#define ZCL_ATTR_TEMPERATURE     0x0000
-
 #define LOCAL_NODE_POLL_MS 1000
 
 static struct {
@@ -36,9 +32,9 @@ static void publish_button_state(bool pressed) {
     cap_handle_attribute_report(LOCAL_NODE_EUI64, 1, ZCL_CLUSTER_ONOFF, ZCL_ATTR_ONOFF, &value);
 }
 
-static void publish_temperature(float temp_c) {
+static void publish_temperature(int16_t temp_centi) {
     reg_attr_value_t value = {0};
-    value.s16 = (int16_t)(temp_c * 100.0f);
+    value.s16 = temp_centi;
     cap_handle_attribute_report(LOCAL_NODE_EUI64, 1, ZCL_CLUSTER_TEMPERATURE, ZCL_ATTR_TEMPERATURE, &value);
 }
 
@@ -79,10 +75,10 @@ os_err_t local_node_init(void) {
 
     local_node.initialized = true;
     local_node.last_button = gpio_button_read();
-    local_node.last_temperature = (int16_t)(i2c_sensor_read_temperature_c() * 100.0f);
+    local_node.last_temperature = i2c_sensor_read_temperature_centi();
 
     publish_button_state(local_node.last_button);
-    publish_temperature(local_node.last_temperature / 100.0f);
+    publish_temperature(local_node.last_temperature);
 
     LOG_I(LOCAL_NODE_MODULE, "Local node initialized");
 
@@ -101,11 +97,10 @@ void local_node_task(void *arg) {
             publish_button_state(button);
         }
 
-        float temp_c = i2c_sensor_read_temperature_c();
-        int16_t temp_c_scaled = (int16_t)(temp_c * 100.0f);
-        if (temp_c_scaled != local_node.last_temperature) {
-            local_node.last_temperature = temp_c_scaled;
-            publish_temperature(temp_c);
+        int16_t temp_centi = i2c_sensor_read_temperature_centi();
+        if (temp_centi != local_node.last_temperature) {
+            local_node.last_temperature = temp_centi;
+            publish_temperature(temp_centi);
         }
 
         os_sleep(LOCAL_NODE_POLL_MS);
@@ -8,86 +8,296 @@
  */
 
 #include "capability.h"
+#include "cmd_sched.h"
 #include "registry.h"
+#include "quirks.h"
 #include "os.h"
+#include "zcl_ids.h"
 #include <string.h>
 
 #define CAP_MODULE "CAP"
 
-/* Well-known Zigbee cluster IDs */
-#define ZCL_CLUSTER_BASIC        0x0000
-#define ZCL_CLUSTER_ONOFF        0x0006
-#define ZCL_CLUSTER_LEVEL        0x0008
-#define ZCL_CLUSTER_COLOR        0x0300
-#define ZCL_CLUSTER_TEMPERATURE  0x0402
-#define ZCL_CLUSTER_HUMIDITY     0x0405
-#define ZCL_CLUSTER_METERING     0x0702
-#define ZCL_CLUSTER_ELEC_MEASURE 0x0B04
-
-/* Well-known attribute IDs */
-#define ZCL_ATTR_ONOFF           0x0000
-#define ZCL_ATTR_LEVEL           0x0000
-#define ZCL_ATTR_COLOR_TEMP      0x0007
-
-/* Zigbee level control range */
-#define ZCL_LEVEL_MAX            254
-#define ZCL_ATTR_TEMPERATURE     0x0000
-#define ZCL_ATTR_HUMIDITY        0x0000
-
 /* Capability info table */
 static const cap_info_t cap_info_table[] = {
-    {CAP_UNKNOWN,           "unknown",              CAP_VALUE_INT,   ""},
-    {CAP_SWITCH_ON,         "switch.on",            CAP_VALUE_BOOL,  ""},
-    {CAP_LIGHT_ON,          "light.on",             CAP_VALUE_BOOL,  ""},
-    {CAP_LIGHT_LEVEL,       "light.level",          CAP_VALUE_INT,   "%"},
-    {CAP_LIGHT_COLOR_TEMP,  "light.color_temp",     CAP_VALUE_INT,   "mireds"},
-    {CAP_SENSOR_TEMPERATURE,"sensor.temperature",   CAP_VALUE_FLOAT, "°C"},
-    {CAP_SENSOR_HUMIDITY,   "sensor.humidity",      CAP_VALUE_FLOAT, "%"},
-    {CAP_SENSOR_CONTACT,    "sensor.contact",       CAP_VALUE_BOOL,  ""},
-    {CAP_SENSOR_MOTION,     "sensor.motion",        CAP_VALUE_BOOL,  ""},
-    {CAP_SENSOR_ILLUMINANCE,"sensor.illuminance",   CAP_VALUE_INT,   "lux"},
-    {CAP_POWER_WATTS,       "power.watts",          CAP_VALUE_FLOAT, "W"},
-    {CAP_ENERGY_KWH,        "energy.kwh",           CAP_VALUE_FLOAT, "kWh"},
+    {CAP_UNKNOWN,           "unknown",              CAP_VALUE_INT,   "",       0},
+    {CAP_SWITCH_ON,         "switch.on",            CAP_VALUE_BOOL,  "",       0},
+    {CAP_LIGHT_ON,          "light.on",             CAP_VALUE_BOOL,  "",       0},
+    {CAP_LIGHT_LEVEL,       "light.level",          CAP_VALUE_INT,   "%",      0},
+    {CAP_LIGHT_COLOR_TEMP,  "light.color_temp",     CAP_VALUE_INT,   "mireds", 0},
+    {CAP_SENSOR_TEMPERATURE,"sensor.temperature",   CAP_VALUE_FIXED, "°C",     2},
+    {CAP_SENSOR_HUMIDITY,   "sensor.humidity",      CAP_VALUE_FIXED, "%",      2},
+    {CAP_SENSOR_CONTACT,    "sensor.contact",       CAP_VALUE_BOOL,  "",       0},
+    {CAP_SENSOR_MOTION,     "sensor.motion",        CAP_VALUE_BOOL,  "",       0},
+    {CAP_SENSOR_ILLUMINANCE,"sensor.illuminance",   CAP_VALUE_INT,   "lux",    0},
+    {CAP_POWER_WATTS,       "power.watts",          CAP_VALUE_FIXED, "W",      1},
+    {CAP_ENERGY_KWH,        "energy.kwh",           CAP_VALUE_FIXED, "kWh",    3},
 };
 
-/* Cluster to capability mapping */
+/* Attribute value converter: raw ZCL value -> capability value.
+ * scale is an integer multiplier from raw units to the capability's
+ * fixed-point units (cap_info_t.decimals). */
+typedef void (*cap_convert_fn)(const reg_attr_value_t *raw, int32_t scale,
+                               cap_value_t *out);
+
+/* Attribute to capability mapping entry */
 typedef struct {
-    uint16_t cluster_id;
-    uint16_t attr_id;
+    uint32_t key;               /* (cluster_id << 16) | attr_id */
     cap_id_t cap_id;
-} cluster_cap_map_t;
-
-static const cluster_cap_map_t cluster_map[] = {
-    {ZCL_CLUSTER_ONOFF,       ZCL_ATTR_ONOFF,       CAP_LIGHT_ON},
-    {ZCL_CLUSTER_LEVEL,       ZCL_ATTR_LEVEL,       CAP_LIGHT_LEVEL},
-    {ZCL_CLUSTER_COLOR,       ZCL_ATTR_COLOR_TEMP,  CAP_LIGHT_COLOR_TEMP},
-    {ZCL_CLUSTER_TEMPERATURE, ZCL_ATTR_TEMPERATURE, CAP_SENSOR_TEMPERATURE},
-    {ZCL_CLUSTER_HUMIDITY,    ZCL_ATTR_HUMIDITY,    CAP_SENSOR_HUMIDITY},
+    cap_convert_fn convert;
+    int32_t scale;
+} attr_cap_map_t;
+
+#define ATTR_KEY(cluster, attr) (((uint32_t)(cluster) << 16) | (uint16_t)(attr))
+
+static void conv_bool(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    (void)scale;
+    out->b = raw->b;
+}
+
+static void conv_bit0_u8(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    (void)scale;
+    out->b = (raw->u8 & 0x01) != 0;
+}
+
+static void conv_level_pct(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    (void)scale;
+    /* Scale 0-ZCL_LEVEL_MAX to 0-100 */
+    out->i = (raw->u8 * 100) / ZCL_LEVEL_MAX;
+}
+
+static void conv_u16(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    (void)scale;
+    out->i = raw->u16;
+}
+
+/* Fixed-point results saturate at the int32_t range */
+static int32_t sat_i32(int64_t v) {
+    if (v > INT32_MAX) return INT32_MAX;
+    if (v < INT32_MIN) return INT32_MIN;
+    return (int32_t)v;
+}
+
+static void conv_s16_scaled(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    out->i = (int32_t)raw->s16 * scale;
+}
+
+static void conv_u16_scaled(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    out->i = (int32_t)raw->u16 * scale;
+}
+
+/* int24 in the low three bytes of u32; bit 23 is the sign, whatever the
+ * producer left in the top byte */
+static void conv_s24_scaled(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    int32_t v = (int32_t)(raw->u32 & 0x00FFFFFFu);
+    if (v & 0x00800000) {
+        v -= 0x01000000;
+    }
+    out->i = sat_i32((int64_t)v * scale);
+}
+
+/* uint48 from its six little-endian bytes */
+static void conv_u48_scaled(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    uint64_t v = 0;
+    for (int i = 5; i >= 0; i--) {
+        v = (v << 8) | raw->bytes[i];
+    }
+    /* Saturate before scaling; 2^48 * scale can overflow int64_t */
+    if (v > (uint64_t)INT32_MAX) {
+        out->i = INT32_MAX;
+        return;
+    }
+    out->i = sat_i32((int64_t)v * scale);
+}
+
+/* 10^(i/20) * 1000 for i = 0..20, for the illuminance log scale */
+static const uint16_t pow10_20ths[21] = {
+    1000, 1122, 1259, 1413, 1585, 1778, 1995, 2239, 2512, 2818, 3162,
+    3548, 3981, 4467, 5012, 5623, 6310, 7079, 7943, 8913, 10000,
 };
 
-/* Maximum capabilities per node */
-#define MAX_NODE_CAPS 8
+static void conv_illuminance(const reg_attr_value_t *raw, int32_t scale, cap_value_t *out) {
+    (void)scale;
+    /* MeasuredValue = 10000 * log10(lux) + 1; 0 means too low to measure
+     * and 0xFFFF is invalid */
+    uint16_t v = raw->u16;
+    if (v == 0 || v == 0xFFFF) {
+        out->i = 0;
+        return;
+    }
+
+    uint32_t m = (uint32_t)v - 1;
+    uint32_t decade = m / 10000;
+    uint32_t rem = m % 10000;
+    uint32_t idx = rem / 500;
+    uint32_t t = rem % 500;
+
+    /* Mantissa in 1/1000ths, interpolated between twentieth-decade steps */
+    uint32_t mant = pow10_20ths[idx] +
+                    ((pow10_20ths[idx + 1] - pow10_20ths[idx]) * t) / 500;
+    uint64_t lux = mant;
+    for (uint32_t d = 0; d < decade; d++) {
+        lux *= 10;
+    }
+    out->i = (int32_t)((lux + 500) / 1000);
+}
+
+/* Attribute mapping table, sorted by key for binary search.
+ * Adding a device class is a new row here; cap_init() rejects an unsorted
+ * table. */
+static const attr_cap_map_t attr_map[] = {
+    {ATTR_KEY(ZCL_CLUSTER_ONOFF,        ZCL_ATTR_ONOFF),              CAP_LIGHT_ON,           conv_bool,        1},
+    {ATTR_KEY(ZCL_CLUSTER_LEVEL,        ZCL_ATTR_LEVEL),              CAP_LIGHT_LEVEL,        conv_level_pct,   1},
+    {ATTR_KEY(ZCL_CLUSTER_COLOR,        ZCL_ATTR_COLOR_TEMP),         CAP_LIGHT_COLOR_TEMP,   conv_u16,         1},
+    {ATTR_KEY(ZCL_CLUSTER_ILLUMINANCE,  ZCL_ATTR_ILLUMINANCE),        CAP_SENSOR_ILLUMINANCE, conv_illuminance, 1},
+    /* ZCL temperature and humidity are already in 1/100ths */
+    {ATTR_KEY(ZCL_CLUSTER_TEMPERATURE,  ZCL_ATTR_TEMPERATURE),        CAP_SENSOR_TEMPERATURE, conv_s16_scaled,  1},
+    {ATTR_KEY(ZCL_CLUSTER_HUMIDITY,     ZCL_ATTR_HUMIDITY),           CAP_SENSOR_HUMIDITY,    conv_u16_scaled,  1},
+    {ATTR_KEY(ZCL_CLUSTER_OCCUPANCY,    ZCL_ATTR_OCCUPANCY),          CAP_SENSOR_MOTION,      conv_bit0_u8,     1},
+    /* IAS zones stay unmapped: alarm1 means contact, motion, smoke... by
+     * ZoneType (0x0001), which the interview does not read yet */
+    /* Summation assumes the common 1/1000 kWh divisor; quirks can rescale */
+    {ATTR_KEY(ZCL_CLUSTER_METERING,     ZCL_ATTR_METERING_SUMMATION), CAP_ENERGY_KWH,         conv_u48_scaled,  1},
+    {ATTR_KEY(ZCL_CLUSTER_METERING,     ZCL_ATTR_METERING_DEMAND),    CAP_POWER_WATTS,        conv_s24_scaled,  10},
+    {ATTR_KEY(ZCL_CLUSTER_ELEC_MEASURE, ZCL_ATTR_ACTIVE_POWER),       CAP_POWER_WATTS,        conv_s16_scaled,  10},
+};
+
+#define ATTR_MAP_COUNT (sizeof(attr_map) / sizeof(attr_map[0]))
+
+/* Reverse index: capability -> cluster used for commands (0 = none) and the
+ * attribute that reports its state */
+static uint16_t cap_cmd_cluster[CAP_MAX];
+static uint16_t cap_cmd_attr[CAP_MAX];
+
+/* Name -> capability hash index for command topics; linear probing,
+ * CAP_UNKNOWN marks an empty bucket. Built on first use. */
+#define CAP_NAME_BUCKETS 32
+_Static_assert(CAP_NAME_BUCKETS >= 2 * CAP_MAX, "name index at most half full");
+static uint8_t cap_name_index[CAP_NAME_BUCKETS];
+static bool cap_name_index_built;
+
+static uint32_t name_hash(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void name_index_build(void) {
+    memset(cap_name_index, CAP_UNKNOWN, sizeof(cap_name_index));
+    for (uint32_t id = CAP_UNKNOWN + 1; id < CAP_MAX; id++) {
+        const char *name = cap_info_table[id].name;
+        uint32_t b = name_hash(name, strlen(name)) % CAP_NAME_BUCKETS;
+        while (cap_name_index[b] != CAP_UNKNOWN) {
+            b = (b + 1) % CAP_NAME_BUCKETS;
+        }
+        cap_name_index[b] = (uint8_t)id;
+    }
+    cap_name_index_built = true;
+}
+
+/* Binary search for the first entry with key >= target */
+static size_t attr_map_lower_bound(uint32_t key) {
+    size_t lo = 0;
+    size_t hi = ATTR_MAP_COUNT;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (attr_map[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const attr_cap_map_t *attr_map_find(uint16_t cluster_id, uint16_t attr_id) {
+    uint32_t key = ATTR_KEY(cluster_id, attr_id);
+    size_t i = attr_map_lower_bound(key);
+    if (i < ATTR_MAP_COUNT && attr_map[i].key == key) {
+        return &attr_map[i];
+    }
+    return NULL;
+}
+
+/* Default publication policies, indexed by cap_id.
+ * Actuators and binary sensors publish every change; analogue sensors get a
+ * deadband near their useful resolution, a floor on event rate and an
+ * hourly-ish heartbeat. */
+static cap_policy_t default_policy[CAP_MAX] = {
+    [CAP_SENSOR_TEMPERATURE] = {  10, 10000, 900000 },    /* 0.1 degC */
+    [CAP_SENSOR_HUMIDITY]    = { 100, 10000, 900000 },    /* 1 % */
+    [CAP_SENSOR_ILLUMINANCE] = {   5,  5000, 900000 },    /* 5 lux */
+    [CAP_POWER_WATTS]        = {  10,  2000, 300000 },    /* 1 W */
+    [CAP_ENERGY_KWH]         = {  10, 30000, 900000 },    /* 0.01 kWh */
+};
+
+/* Last value emitted on the bus for one capability */
+typedef struct {
+    union {
+        bool b;
+        int32_t i;
+    } value;
+    os_tick_t at;
+    bool valid;                 /* Something has been emitted */
+    bool pending;               /* Change held back by min_interval */
+} cap_published_t;
+
+/* Last report accepted for one capability, before quirks are applied.
+ * Only tracked for capabilities with an ignore_spurious_reports quirk. */
+typedef struct {
+    union {
+        bool b;
+        int32_t i;
+    } value;
+    os_tick_t at;
+    bool valid;
+} cap_reported_t;
 
-/* Node capability cache */
+/* Per-node capability state, indexed by registry slot.
+ * States are indexed directly by cap_id, so there is no per-node limit on
+ * the number of capabilities. */
 typedef struct {
-    os_eui64_t node_addr;
-    cap_state_t caps[MAX_NODE_CAPS];
-    uint8_t cap_count;
+    os_eui64_t node_addr;           /* Owner; guards against slot reuse */
+    uint32_t cap_mask;              /* Bit per cap_id present on the node */
+    uint8_t endpoint[CAP_MAX];      /* Endpoint providing each capability */
+    cap_state_t caps[CAP_MAX];
+    cap_published_t published[CAP_MAX];
+    cap_reported_t reported[CAP_MAX];
+    /* Quirk overrides, copied: quirk entries live in a decode pool that
+     * reuses its slots. Capabilities without one use default_policy. */
+    cap_policy_t policy[CAP_MAX];
+    uint32_t policy_mask;           /* Bit per cap_id with an override */
     bool valid;
 } node_cap_cache_t;
 
-#define MAX_CAP_CACHE 32
+_Static_assert(CAP_MAX <= 32, "cap_mask holds one bit per capability");
+_Static_assert(sizeof(cap_state_event_t) <= OS_EVENT_PAYLOAD_SIZE,
+               "state event must fit in an event payload");
+
+#define CAP_BIT(id) (1UL << (id))
+
+/* Interval at which cap_task flushes deferred changes */
+#define CAP_PROCESS_MS 100
 
 /* Service state */
 static struct {
     bool initialized;
-    node_cap_cache_t cache[MAX_CAP_CACHE];
+    node_cap_cache_t cache[REG_MAX_NODES];
+    uint32_t pending_count;
+    cap_stats_t stats;
 } service = {0};
 
 /* Internal functions */
-static node_cap_cache_t *find_cache(os_eui64_t node_addr);
-static node_cap_cache_t *alloc_cache(os_eui64_t node_addr);
-static cap_state_t *find_cap_in_cache(node_cap_cache_t *cache, cap_id_t cap_id);
+static node_cap_cache_t *cache_for_node(const reg_node_t *node);
+static const cap_policy_t *policy_for(const node_cap_cache_t *cache, cap_id_t id);
+static void cache_add_cap(node_cap_cache_t *cache, const quirk_entry_t *quirk,
+                          cap_id_t id, uint8_t endpoint_id);
+static bool is_repeat(const cap_reported_t *last, cap_value_type_t type,
+                      const cap_value_t *value);
+static bool is_significant(const cap_state_t *cap, const cap_published_t *pub,
+                           const cap_policy_t *policy);
+static void publish_cap(node_cap_cache_t *cache, cap_id_t cap_id, os_tick_t now);
 static void emit_state_changed(os_eui64_t node_addr, cap_id_t cap_id, const cap_value_t *value);
 
 os_err_t cap_init(void) {
@@ -95,10 +305,30 @@ os_err_t cap_init(void) {
         return OS_ERR_ALREADY_EXISTS;
     }
     
+    for (size_t m = 1; m < ATTR_MAP_COUNT; m++) {
+        if (attr_map[m - 1].key >= attr_map[m].key) {
+            LOG_E(CAP_MODULE, "Attribute map not sorted at row %u", (unsigned)m);
+            return OS_ERR_INVALID_ARG;
+        }
+    }
+    
+    /* Build the command reverse index from the first row for each cap */
+    memset(cap_cmd_cluster, 0, sizeof(cap_cmd_cluster));
+    memset(cap_cmd_attr, 0, sizeof(cap_cmd_attr));
+    for (size_t m = 0; m < ATTR_MAP_COUNT; m++) {
+        cap_id_t id = attr_map[m].cap_id;
+        if (cap_cmd_cluster[id] == 0) {
+            cap_cmd_cluster[id] = (uint16_t)(attr_map[m].key >> 16);
+            cap_cmd_attr[id] = (uint16_t)attr_map[m].key;
+        }
+    }
+    name_index_build();
+    
     memset(&service, 0, sizeof(service));
     service.initialized = true;
     
-    LOG_I(CAP_MODULE, "Capability service initialized");
+    LOG_I(CAP_MODULE, "Capability service initialized (%u attribute mappings)",
+          (unsigned)ATTR_MAP_COUNT);
     
     return OS_OK;
 }
@@ -108,17 +338,25 @@ uint32_t cap_compute_for_node(reg_node_t *node) {
         return 0;
     }
     
-    node_cap_cache_t *cache = find_cache(node->ieee_addr);
-    if (!cache) {
-        cache = alloc_cache(node->ieee_addr);
-    }
-    if (!cache) {
-        LOG_E(CAP_MODULE, "Failed to allocate capability cache");
+    int32_t slot = reg_node_slot(node);
+    if (slot < 0) {
         return 0;
     }
     
-    /* Clear existing caps */
-    cache->cap_count = 0;
+    /* Reset this slot's caps */
+    node_cap_cache_t *cache = &service.cache[slot];
+    uint32_t old_mask = (cache->valid && cache->node_addr == node->ieee_addr)
+                            ? cache->cap_mask : 0;
+    for (uint32_t id = 0; id < CAP_MAX; id++) {
+        if (cache->published[id].pending) {
+            service.pending_count--;
+        }
+    }
+    memset(cache, 0, sizeof(*cache));
+    cache->node_addr = node->ieee_addr;
+    cache->valid = true;
+    const quirk_entry_t *quirk = quirks_for_node(node);
+    uint32_t cap_count = 0;
     
     /* Scan all endpoints/clusters */
     for (uint8_t ep_idx = 0; ep_idx < REG_MAX_ENDPOINTS; ep_idx++) {
@@ -129,36 +367,52 @@ uint32_t cap_compute_for_node(reg_node_t *node) {
             reg_cluster_t *cl = &ep->clusters[cl_idx];
             if (!cl->valid) continue;
             
-            /* Check cluster mapping */
-            for (size_t m = 0; m < sizeof(cluster_map) / sizeof(cluster_map[0]); m++) {
-                if (cluster_map[m].cluster_id == cl->cluster_id) {
-                    /* Found a match - add capability */
-                    if (cache->cap_count < MAX_NODE_CAPS) {
-                        cap_state_t *cap = &cache->caps[cache->cap_count];
-                        cap->id = cluster_map[m].cap_id;
-                        cap->type = cap_info_table[cap->id].type;
-                        cap->valid = false;  /* No value yet */
-                        cap->timestamp = 0;
-                        
-                        /* Initialize default value */
-                        memset(&cap->value, 0, sizeof(cap->value));
-                        
-                        cache->cap_count++;
-                        
-                        LOG_D(CAP_MODULE, "Node " OS_EUI64_FMT " ep%d: added %s",
-                              OS_EUI64_ARG(node->ieee_addr), ep->endpoint_id,
-                              cap_info_table[cap->id].name);
-                    }
-                    break;
+            /* All mapped attributes of this cluster are adjacent */
+            size_t m = attr_map_lower_bound(ATTR_KEY(cl->cluster_id, 0));
+            for (; m < ATTR_MAP_COUNT &&
+                   (attr_map[m].key >> 16) == cl->cluster_id; m++) {
+                cap_id_t id = attr_map[m].cap_id;
+                if (!(cache->cap_mask & CAP_BIT(id))) {
+                    cache_add_cap(cache, quirk, id, ep->endpoint_id);
+                    cap_count++;
                 }
             }
         }
     }
     
-    LOG_I(CAP_MODULE, "Node " OS_EUI64_FMT ": computed %d capabilities",
-          OS_EUI64_ARG(node->ieee_addr), cache->cap_count);
+    /* Capabilities a quirk maps to a vendor attribute, on the endpoint
+     * that has the vendor cluster */
+    for (uint8_t a = 0; quirk && a < quirk->action_count && a < QUIRK_MAX_ACTIONS; a++) {
+        const quirk_action_t *action = &quirk->actions[a];
+        cap_id_t id = action->target_cap;
+        if (action->type != QUIRK_ACTION_REMAP_ATTRIBUTE || id >= CAP_MAX ||
+            (cache->cap_mask & CAP_BIT(id))) {
+            continue;
+        }
+        for (uint8_t ep_idx = 0; ep_idx < REG_MAX_ENDPOINTS; ep_idx++) {
+            reg_endpoint_t *ep = &node->endpoints[ep_idx];
+            if (ep->valid && reg_find_cluster(ep, action->params.remap.cluster_id)) {
+                cache_add_cap(cache, quirk, id, ep->endpoint_id);
+                cap_count++;
+                break;
+            }
+        }
+    }
     
-    return cache->cap_count;
+    LOG_I(CAP_MODULE, "Node " OS_EUI64_FMT ": computed %lu capabilities",
+          OS_EUI64_ARG(node->ieee_addr), (unsigned long)cap_count);
+    
+    if (cache->cap_mask != old_mask) {
+        cap_set_event_t ev = {node->ieee_addr, old_mask, cache->cap_mask};
+        os_event_emit(OS_EVENT_CAP_SET_CHANGED, &ev, sizeof(ev));
+    }
+    
+    return cap_count;
+}
+
+uint32_t cap_get_mask(const reg_node_t *node) {
+    node_cap_cache_t *cache = cache_for_node(node);
+    return cache ? cache->cap_mask : 0;
 }
 
 os_err_t cap_get_state(os_eui64_t node_addr, cap_id_t cap_id, cap_state_t *out_state) {
@@ -166,20 +420,42 @@ os_err_t cap_get_state(os_eui64_t node_addr, cap_id_t cap_id, cap_state_t *out_s
         return OS_ERR_INVALID_ARG;
     }
     
-    node_cap_cache_t *cache = find_cache(node_addr);
-    if (!cache) {
+    reg_node_t *node = reg_find_node(node_addr);
+    if (!node) {
         return OS_ERR_NOT_FOUND;
     }
     
-    cap_state_t *cap = find_cap_in_cache(cache, cap_id);
-    if (!cap) {
+    return cap_get_state_by_node(node, cap_id, out_state);
+}
+
+os_err_t cap_get_state_by_node(const reg_node_t *node, cap_id_t cap_id,
+                               cap_state_t *out_state) {
+    if (!service.initialized || !out_state || cap_id >= CAP_MAX) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    node_cap_cache_t *cache = cache_for_node(node);
+    if (!cache || !(cache->cap_mask & CAP_BIT(cap_id))) {
         return OS_ERR_NOT_FOUND;
     }
     
-    *out_state = *cap;
+    *out_state = cache->caps[cap_id];
     return OS_OK;
 }
 
+uint8_t cap_get_endpoint(const reg_node_t *node, cap_id_t cap_id) {
+    if (cap_id >= CAP_MAX) {
+        return 0;
+    }
+    
+    node_cap_cache_t *cache = cache_for_node(node);
+    if (!cache || !(cache->cap_mask & CAP_BIT(cap_id))) {
+        return 0;
+    }
+    
+    return cache->endpoint[cap_id];
+}
+
 os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
                                       uint16_t cluster_id, uint16_t attr_id,
                                       const reg_attr_value_t *value) {
@@ -187,73 +463,109 @@ os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
         return OS_ERR_INVALID_ARG;
     }
     
-    (void)endpoint_id;  /* For future use */
-    
-    /* Find matching capability */
-    cap_id_t cap_id = CAP_UNKNOWN;
-    for (size_t m = 0; m < sizeof(cluster_map) / sizeof(cluster_map[0]); m++) {
-        if (cluster_map[m].cluster_id == cluster_id &&
-            cluster_map[m].attr_id == attr_id) {
-            cap_id = cluster_map[m].cap_id;
-            break;
-        }
+    reg_node_t *node = reg_find_node(node_addr);
+    if (!node) {
+        /* Unmapped attributes are not an error even for unknown nodes */
+        return attr_map_find(cluster_id, attr_id) ? OS_ERR_NOT_FOUND : OS_OK;
     }
     
-    if (cap_id == CAP_UNKNOWN) {
-        return OS_OK;  /* Not a mapped attribute */
+    return cap_handle_attribute_report_by_node(node, endpoint_id, cluster_id,
+                                               attr_id, value);
+}
+
+os_err_t cap_handle_attribute_report_by_node(reg_node_t *node, uint8_t endpoint_id,
+                                             uint16_t cluster_id, uint16_t attr_id,
+                                             const reg_attr_value_t *value) {
+    if (!service.initialized || !node || !value) {
+        return OS_ERR_INVALID_ARG;
     }
     
-    /* Find cache */
-    node_cap_cache_t *cache = find_cache(node_addr);
-    if (!cache) {
-        return OS_ERR_NOT_FOUND;
+    (void)endpoint_id;  /* For future use */
+    
+    /* Any report, mapped or not, shows the node is alive */
+    reg_touch_node(node);
+    
+    /* Find matching capability. A vendor attribute remapped by a quirk is
+     * decoded like the capability's standard attribute. */
+    const quirk_entry_t *quirk = quirks_for_node(node);
+    const attr_cap_map_t *map;
+    cap_id_t remapped = quirks_entry_remap_attribute(quirk, cluster_id, attr_id);
+    if (remapped != CAP_UNKNOWN && remapped < CAP_MAX) {
+        map = attr_map_find(cap_cmd_cluster[remapped], cap_cmd_attr[remapped]);
+    } else {
+        map = attr_map_find(cluster_id, attr_id);
     }
+    if (!map) {
+        return OS_OK;  /* Not a mapped attribute */
+    }
+    cap_id_t cap_id = map->cap_id;
     
-    /* Find capability */
-    cap_state_t *cap = find_cap_in_cache(cache, cap_id);
-    if (!cap) {
+    node_cap_cache_t *cache = cache_for_node(node);
+    if (!cache || !(cache->cap_mask & CAP_BIT(cap_id))) {
         return OS_ERR_NOT_FOUND;
     }
     
-    /* Update value based on type */
+    cap_state_t *cap = &cache->caps[cap_id];
     cap_value_t new_value = {0};
-    
-    switch (cap_id) {
-        case CAP_LIGHT_ON:
-        case CAP_SWITCH_ON:
-            new_value.b = value->b;
-            break;
-            
-        case CAP_LIGHT_LEVEL:
-            /* Scale 0-ZCL_LEVEL_MAX to 0-100 */
-            new_value.i = (value->u8 * 100) / ZCL_LEVEL_MAX;
-            break;
-            
-        case CAP_SENSOR_TEMPERATURE:
-            /* Zigbee temperature is in 0.01°C units */
-            new_value.f = (float)value->s16 / 100.0f;
-            break;
-            
-        case CAP_SENSOR_HUMIDITY:
-            /* Zigbee humidity is in 0.01% units */
-            new_value.f = (float)value->u16 / 100.0f;
-            break;
-            
-        default:
-            new_value.i = value->u32;
-            break;
+    map->convert(value, map->scale, &new_value);
+    os_tick_t now = os_now_ticks();
+    
+    /* Devices that repeat frames: drop a repeat of the last accepted report
+     * before it touches state, command tracking or policy */
+    uint32_t window_ms = quirks_entry_get_spurious_window(quirk, cap_id);
+    if (window_ms) {
+        cap_reported_t *last = &cache->reported[cap_id];
+        if (last->valid && now - last->at < OS_MS_TO_TICKS(window_ms) &&
+            is_repeat(last, cap->type, &new_value)) {
+            service.stats.spurious++;
+            return OS_OK;
+        }
+        memcpy(&last->value, &new_value, sizeof(last->value));
+        last->at = now;
+        last->valid = true;
     }
     
+    quirks_entry_apply_value(quirk, cap_id, &new_value, NULL);
+    
     /* Update state */
     cap->value = new_value;
-    cap->timestamp = os_now_ticks();
+    cap->timestamp = now;
     cap->valid = true;
-    
-    /* Emit event */
-    emit_state_changed(node_addr, cap_id, &new_value);
+    service.stats.reports++;
+    cmd_sched_note_report(node, cap_id);
     
     LOG_D(CAP_MODULE, "Node " OS_EUI64_FMT " %s updated",
-          OS_EUI64_ARG(node_addr), cap_info_table[cap_id].name);
+          OS_EUI64_ARG(node->ieee_addr), cap_info_table[cap_id].name);
+    
+    /* Decide whether the change is worth an event */
+    cap_published_t *pub = &cache->published[cap_id];
+    const cap_policy_t *policy = policy_for(cache, cap_id);
+    os_tick_t since = now - pub->at;
+    
+    bool heartbeat = false;
+    if (!is_significant(cap, pub, policy)) {
+        heartbeat = pub->valid && policy->max_staleness_ms &&
+                    since >= OS_MS_TO_TICKS(policy->max_staleness_ms);
+        if (!heartbeat) {
+            service.stats.suppressed++;
+            return OS_OK;
+        }
+    }
+    
+    if (pub->valid && policy->min_interval_ms &&
+        since < OS_MS_TO_TICKS(policy->min_interval_ms)) {
+        if (!pub->pending) {
+            pub->pending = true;
+            service.pending_count++;
+            service.stats.deferred++;
+        }
+        return OS_OK;
+    }
+    
+    if (heartbeat) {
+        service.stats.heartbeats++;
+    }
+    publish_cap(cache, cap_id, now);
     
     return OS_OK;
 }
@@ -263,27 +575,62 @@ os_err_t cap_execute_command(const cap_command_t *cmd) {
         return OS_ERR_INVALID_ARG;
     }
     
-    LOG_I(CAP_MODULE, "Execute command: node=" OS_EUI64_FMT " cap=%s cmd=%d",
+    if (cmd->cap_id >= CAP_MAX) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    LOG_D(CAP_MODULE, "Execute command: node=" OS_EUI64_FMT " cap=%s cmd=%d",
           OS_EUI64_ARG(cmd->node_addr), cap_info_table[cmd->cap_id].name, cmd->cmd_type);
     
     /* Find the cluster mapping */
-    uint16_t cluster_id = 0;
-    for (size_t m = 0; m < sizeof(cluster_map) / sizeof(cluster_map[0]); m++) {
-        if (cluster_map[m].cap_id == cmd->cap_id) {
-            cluster_id = cluster_map[m].cluster_id;
-            break;
-        }
-    }
+    uint16_t cluster_id = cap_cmd_cluster[cmd->cap_id];
     
     if (cluster_id == 0) {
         LOG_E(CAP_MODULE, "No cluster mapping for capability %d", cmd->cap_id);
         return OS_ERR_NOT_FOUND;
     }
     
-    /* In real implementation, this would send Zigbee command */
-    /* For now, emit a CAP_COMMAND event for the Zigbee adapter to handle */
-    os_event_emit(OS_EVENT_CAP_COMMAND, cmd, sizeof(*cmd));
+    /* Coalesced and paced per node by the command scheduler */
+    return cmd_sched_submit(cmd);
+}
+
+os_err_t cap_apply_commanded(reg_node_t *node, cap_id_t cap_id,
+                             const cap_value_t *value, cap_state_t *out_prev) {
+    if (!service.initialized || !node || !value || cap_id >= CAP_MAX) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    node_cap_cache_t *cache = cache_for_node(node);
+    if (!cache || !(cache->cap_mask & CAP_BIT(cap_id))) {
+        return OS_ERR_NOT_FOUND;
+    }
+    
+    cap_state_t *cap = &cache->caps[cap_id];
+    if (out_prev) {
+        *out_prev = *cap;
+    }
+    
+    /* User-driven change: publish now, ignoring deadband and min_interval */
+    os_tick_t now = os_now_ticks();
+    cap->value = *value;
+    cap->timestamp = now;
+    cap->valid = true;
+    publish_cap(cache, cap_id, now);
+    
+    return OS_OK;
+}
+
+os_err_t cap_get_attribute(cap_id_t cap_id, uint16_t *cluster_id, uint16_t *attr_id) {
+    if (cap_id >= CAP_MAX || !cluster_id || !attr_id) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    if (cap_cmd_cluster[cap_id] == 0) {
+        return OS_ERR_NOT_FOUND;
+    }
     
+    *cluster_id = cap_cmd_cluster[cap_id];
+    *attr_id = cap_cmd_attr[cap_id];
     return OS_OK;
 }
 
@@ -294,70 +641,275 @@ const cap_info_t *cap_get_info(cap_id_t id) {
     return NULL;
 }
 
+int cap_format_fixed(int32_t value, uint8_t decimals, char *buf, size_t len) {
+    char tmp[CAP_VALUE_TEXT_MAX];
+    size_t n = 0;
+    
+    /* Digits are produced in reverse; the magnitude is widened so that
+     * INT32_MIN negates cleanly */
+    uint32_t mag = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    if (decimals > 9) {
+        decimals = 9;
+    }
+    for (uint8_t d = 0; d < decimals; d++) {
+        tmp[n++] = (char)('0' + mag % 10);
+        mag /= 10;
+    }
+    if (decimals) {
+        tmp[n++] = '.';
+    }
+    do {
+        tmp[n++] = (char)('0' + mag % 10);
+        mag /= 10;
+    } while (mag);
+    if (value < 0) {
+        tmp[n++] = '-';
+    }
+    
+    if (!buf || len <= n) {
+        if (buf && len) {
+            buf[0] = '\0';
+        }
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = tmp[n - 1 - i];
+    }
+    buf[n] = '\0';
+    return (int)n;
+}
+
+int cap_format_value(cap_id_t cap_id, const cap_value_t *value,
+                     char *buf, size_t len) {
+    if (cap_id >= CAP_MAX || !value || !buf || len == 0) {
+        return -1;
+    }
+    
+    const cap_info_t *info = &cap_info_table[cap_id];
+    switch (info->type) {
+        case CAP_VALUE_BOOL:
+            return cap_format_fixed(value->b ? 1 : 0, 0, buf, len);
+        case CAP_VALUE_INT:
+            return cap_format_fixed(value->i, 0, buf, len);
+        case CAP_VALUE_FIXED:
+            return cap_format_fixed(value->i, info->decimals, buf, len);
+        default:
+            buf[0] = '\0';
+            return -1;
+    }
+}
+
 cap_id_t cap_parse_name(const char *name) {
     if (!name) return CAP_UNKNOWN;
     
-    for (uint32_t i = 0; i < CAP_MAX; i++) {
-        if (strcmp(name, cap_info_table[i].name) == 0) {
-            return (cap_id_t)i;
+    return cap_lookup_name(name, strlen(name));
+}
+
+cap_id_t cap_lookup_name(const char *name, size_t len) {
+    if (!name) return CAP_UNKNOWN;
+    
+    if (!cap_name_index_built) {
+        name_index_build();
+    }
+    
+    for (uint32_t b = name_hash(name, len) % CAP_NAME_BUCKETS;
+         cap_name_index[b] != CAP_UNKNOWN; b = (b + 1) % CAP_NAME_BUCKETS) {
+        const char *candidate = cap_info_table[cap_name_index[b]].name;
+        if (strncmp(candidate, name, len) == 0 && candidate[len] == '\0') {
+            return (cap_id_t)cap_name_index[b];
         }
     }
     return CAP_UNKNOWN;
 }
 
+os_err_t cap_set_policy(cap_id_t cap_id, const cap_policy_t *policy) {
+    if (cap_id >= CAP_MAX || !policy || policy->deadband < 0) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    default_policy[cap_id] = *policy;
+    return OS_OK;
+}
+
+os_err_t cap_get_policy(const reg_node_t *node, cap_id_t cap_id,
+                        cap_policy_t *out_policy) {
+    if (cap_id >= CAP_MAX || !out_policy) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    if (!node) {
+        *out_policy = default_policy[cap_id];
+        return OS_OK;
+    }
+    
+    node_cap_cache_t *cache = cache_for_node(node);
+    if (!cache || !(cache->cap_mask & CAP_BIT(cap_id))) {
+        return OS_ERR_NOT_FOUND;
+    }
+    
+    *out_policy = *policy_for(cache, cap_id);
+    return OS_OK;
+}
+
+uint32_t cap_process(void) {
+    if (!service.initialized || service.pending_count == 0) {
+        return 0;
+    }
+    
+    os_tick_t now = os_now_ticks();
+    uint32_t emitted = 0;
+    
+    for (uint32_t slot = 0; slot < REG_MAX_NODES && service.pending_count > 0; slot++) {
+        node_cap_cache_t *cache = &service.cache[slot];
+        if (!cache->valid) continue;
+        
+        for (uint32_t id = 0; id < CAP_MAX; id++) {
+            cap_published_t *pub = &cache->published[id];
+            if (!pub->pending) continue;
+            
+            const cap_policy_t *policy = policy_for(cache, (cap_id_t)id);
+            if (now - pub->at < OS_MS_TO_TICKS(policy->min_interval_ms)) {
+                continue;
+            }
+            
+            pub->pending = false;
+            service.pending_count--;
+            
+            /* The value may have drifted back inside the deadband */
+            if (is_significant(&cache->caps[id], pub, policy)) {
+                publish_cap(cache, (cap_id_t)id, now);
+                emitted++;
+            }
+        }
+    }
+    
+    return emitted;
+}
+
+os_err_t cap_get_stats(cap_stats_t *stats) {
+    if (!stats) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    *stats = service.stats;
+    return OS_OK;
+}
+
 void cap_task(void *arg) {
     (void)arg;
     
     LOG_I(CAP_MODULE, "Capability task started");
     
     while (1) {
-        /* Process capability events */
-        /* In real implementation, this would handle reconciliation */
-        os_sleep(1000);
+        /* Flush changes held back by min_interval */
+        cap_process();
+        os_sleep(CAP_PROCESS_MS);
     }
 }
 
 /* Internal functions */
 
-static node_cap_cache_t *find_cache(os_eui64_t node_addr) {
-    for (uint32_t i = 0; i < MAX_CAP_CACHE; i++) {
-        if (service.cache[i].valid && service.cache[i].node_addr == node_addr) {
-            return &service.cache[i];
+static bool is_significant(const cap_state_t *cap, const cap_published_t *pub,
+                           const cap_policy_t *policy) {
+    if (!pub->valid) {
+        return true;
+    }
+    
+    switch (cap->type) {
+        case CAP_VALUE_BOOL:
+            return cap->value.b != pub->value.b;
+            
+        case CAP_VALUE_INT:
+        case CAP_VALUE_FIXED: {
+            if (policy->deadband <= 0) {
+                return cap->value.i != pub->value.i;
+            }
+            int64_t diff = (int64_t)cap->value.i - pub->value.i;
+            return (diff < 0 ? -diff : diff) >= policy->deadband;
         }
+            
+        default:
+            return true;
     }
-    return NULL;
 }
 
-static node_cap_cache_t *alloc_cache(os_eui64_t node_addr) {
-    for (uint32_t i = 0; i < MAX_CAP_CACHE; i++) {
-        if (!service.cache[i].valid) {
-            service.cache[i].node_addr = node_addr;
-            service.cache[i].cap_count = 0;
-            service.cache[i].valid = true;
-            return &service.cache[i];
-        }
+static void publish_cap(node_cap_cache_t *cache, cap_id_t cap_id, os_tick_t now) {
+    cap_published_t *pub = &cache->published[cap_id];
+    const cap_state_t *cap = &cache->caps[cap_id];
+    
+    switch (cap->type) {
+        case CAP_VALUE_BOOL:  pub->value.b = cap->value.b; break;
+        case CAP_VALUE_INT:
+        case CAP_VALUE_FIXED: pub->value.i = cap->value.i; break;
+        default: break;
     }
-    return NULL;
+    pub->at = now;
+    pub->valid = true;
+    if (pub->pending) {
+        pub->pending = false;
+        service.pending_count--;
+    }
+    
+    service.stats.published++;
+    emit_state_changed(cache->node_addr, cap_id, &cap->value);
 }
 
-static cap_state_t *find_cap_in_cache(node_cap_cache_t *cache, cap_id_t cap_id) {
-    if (!cache) return NULL;
+static void cache_add_cap(node_cap_cache_t *cache, const quirk_entry_t *quirk,
+                          cap_id_t id, uint8_t endpoint_id) {
+    cap_state_t *cap = &cache->caps[id];
+    cap->id = id;
+    cap->type = cap_info_table[id].type;
+    cap->valid = false;  /* No value yet */
+    cache->cap_mask |= CAP_BIT(id);
+    cache->endpoint[id] = endpoint_id;
+    const cap_policy_t *policy = quirks_entry_get_policy(quirk, id);
+    if (policy) {
+        cache->policy[id] = *policy;
+        cache->policy_mask |= CAP_BIT(id);
+    }
     
-    for (uint8_t i = 0; i < cache->cap_count; i++) {
-        if (cache->caps[i].id == cap_id) {
-            return &cache->caps[i];
-        }
+    LOG_D(CAP_MODULE, "Node " OS_EUI64_FMT " ep%d: added %s",
+          OS_EUI64_ARG(cache->node_addr), endpoint_id, cap_info_table[id].name);
+}
+
+/* The node's override, else the default, which cap_set_policy() may
+ * change at any time */
+static const cap_policy_t *policy_for(const node_cap_cache_t *cache, cap_id_t id) {
+    if (cache->policy_mask & CAP_BIT(id)) {
+        return &cache->policy[id];
     }
-    return NULL;
+    return &default_policy[id];
+}
+
+static bool is_repeat(const cap_reported_t *last, cap_value_type_t type,
+                      const cap_value_t *value) {
+    switch (type) {
+        case CAP_VALUE_BOOL:
+            return last->value.b == value->b;
+        case CAP_VALUE_INT:
+        case CAP_VALUE_FIXED:
+            return last->value.i == value->i;
+        default:
+            return false;
+    }
+}
+
+static node_cap_cache_t *cache_for_node(const reg_node_t *node) {
+    int32_t slot = reg_node_slot(node);
+    if (slot < 0) {
+        return NULL;
+    }
+    
+    node_cap_cache_t *cache = &service.cache[slot];
+    if (!cache->valid || cache->node_addr != node->ieee_addr) {
+        return NULL;
+    }
+    return cache;
 }
 
 static void emit_state_changed(os_eui64_t node_addr, cap_id_t cap_id, const cap_value_t *value) {
-    /* Payload for CAP_STATE_CHANGED event */
-    struct {
-        os_eui64_t node_addr;
-        cap_id_t cap_id;
-        cap_value_t value;
-    } payload = {node_addr, cap_id, *value};
+    cap_state_event_t payload = {.node_addr = node_addr, .cap_id = cap_id};
+    memcpy(&payload.value, value, sizeof(payload.value));
     
     os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &payload, sizeof(payload));
 }
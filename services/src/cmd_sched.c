@@ -0,0 +1,749 @@
+/**
+ * @file cmd_sched.c
+ * @brief Capability command scheduler implementation
+ *
+ * ESP32-C6 Zigbee Bridge OS - Command coalescing and pacing
+ *
+ * Queued commands live in a small table keyed by (node, endpoint, cap).
+ * Relative commands are folded into an absolute value on submit, so any
+ * number of commands for one key occupy a single entry. Per-node transmit
+ * state is indexed by registry slot and tracks the one command in flight;
+ * its confirm (or error, or timeout) releases the node and immediately sends
+ * the oldest command queued for it.
+ *
+ * Optimistic state is tracked in an open-addressed table keyed by corr_id.
+ * An entry is created when a command is submitted and holds the state from
+ * before it, so an error can roll back. When a queued command is replaced,
+ * its entry moves to the new corr_id and keeps the original state; when a
+ * command fails with a newer one queued for the same capability, the newer
+ * one inherits its state the same way.
+ */
+
+#include "cmd_sched.h"
+#include "registry.h"
+#include "quirks.h"
+#include "zb_adapter.h"
+#include "os.h"
+#include <string.h>
+
+_Static_assert(sizeof(cap_cmd_event_t) <= OS_EVENT_PAYLOAD_SIZE,
+               "command event must fit in an event payload");
+
+#define CMD_SCHED_MODULE "CMDQ"
+
+/* Queued command */
+typedef struct {
+    os_eui64_t node_addr;
+    uint8_t endpoint;
+    cap_id_t cap_id;
+    cap_value_t value;          /* Absolute value after folding */
+    os_corr_id_t corr_id;       /* Latest submitter's corr_id */
+    uint32_t seq;               /* Submission order of the first command */
+    bool used;
+} sched_cmd_t;
+
+/* Per-node transmit state, indexed by registry slot */
+typedef struct {
+    os_eui64_t node_addr;       /* Owner; guards against slot reuse */
+    os_tick_t last_tx;
+    os_tick_t inflight_at;
+    os_corr_id_t inflight_corr; /* 0 = idle */
+    uint8_t last_endpoint;      /* Key and value of the last frame sent */
+    cap_id_t last_cap;
+    cap_value_t last_value;
+    bool has_sent;
+} node_tx_t;
+
+/* Tracking phase of an optimistic command */
+typedef enum {
+    TRACK_QUEUED = 1,
+    TRACK_IN_FLIGHT,
+    TRACK_AWAIT_REPORT,
+} track_phase_t;
+
+/* Optimistic command tracking entry */
+typedef struct {
+    os_corr_id_t corr_id;       /* 0 = free */
+    os_eui64_t node_addr;
+    uint8_t endpoint;
+    cap_id_t cap_id;
+    track_phase_t phase;
+    os_tick_t deadline;         /* TRACK_AWAIT_REPORT only */
+    cap_state_t prev;           /* State before the first coalesced command */
+} track_t;
+
+#define TRACK_BITS 6
+#define TRACK_SIZE (1U << TRACK_BITS)
+#define TRACK_MASK (TRACK_SIZE - 1)
+#define TRACK_MAX_LOAD (TRACK_SIZE * 3 / 4)
+
+/* Service state */
+static struct {
+    bool initialized;
+    sched_cmd_t pending[CMD_SCHED_MAX_PENDING];
+    uint32_t pending_count;
+    uint32_t next_seq;
+    node_tx_t nodes[REG_MAX_NODES];
+    track_t track[TRACK_SIZE];
+    uint32_t track_count;
+    os_tick_t min_gap;
+    cmd_sched_stats_t stats;
+} service = {0};
+
+/* Wrap-safe tick comparison: true if a is before b */
+static inline bool tick_before(os_tick_t a, os_tick_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static node_tx_t *tx_for_node(const reg_node_t *node) {
+    int32_t slot = reg_node_slot(node);
+    if (slot < 0) {
+        return NULL;
+    }
+
+    node_tx_t *tx = &service.nodes[slot];
+    if (tx->node_addr != node->ieee_addr) {
+        memset(tx, 0, sizeof(*tx));
+        tx->node_addr = node->ieee_addr;
+    }
+    return tx;
+}
+
+static sched_cmd_t *find_pending(os_eui64_t node_addr, uint8_t endpoint,
+                                 cap_id_t cap_id) {
+    for (uint32_t i = 0; i < CMD_SCHED_MAX_PENDING; i++) {
+        sched_cmd_t *c = &service.pending[i];
+        if (c->used && c->node_addr == node_addr && c->endpoint == endpoint &&
+            c->cap_id == cap_id) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static sched_cmd_t *oldest_pending(os_eui64_t node_addr) {
+    sched_cmd_t *oldest = NULL;
+    for (uint32_t i = 0; i < CMD_SCHED_MAX_PENDING; i++) {
+        sched_cmd_t *c = &service.pending[i];
+        if (c->used && c->node_addr == node_addr &&
+            (!oldest || (int32_t)(c->seq - oldest->seq) < 0)) {
+            oldest = c;
+        }
+    }
+    return oldest;
+}
+
+static void release_pending(sched_cmd_t *c) {
+    c->used = false;
+    service.pending_count--;
+}
+
+/* Tracking table */
+
+static uint32_t track_hash(os_corr_id_t corr_id) {
+    return (uint32_t)(corr_id * 2654435761U) >> (32 - TRACK_BITS);
+}
+
+static track_t *track_find(os_corr_id_t corr_id) {
+    if (corr_id == 0) {
+        return NULL;
+    }
+    for (uint32_t i = track_hash(corr_id);; i = (i + 1) & TRACK_MASK) {
+        track_t *t = &service.track[i];
+        if (t->corr_id == corr_id) {
+            return t;
+        }
+        if (t->corr_id == 0) {
+            return NULL;
+        }
+    }
+}
+
+static track_t *track_insert(os_corr_id_t corr_id) {
+    if (service.track_count >= TRACK_MAX_LOAD) {
+        return NULL;
+    }
+    uint32_t i = track_hash(corr_id);
+    while (service.track[i].corr_id != 0) {
+        i = (i + 1) & TRACK_MASK;
+    }
+    track_t *t = &service.track[i];
+    memset(t, 0, sizeof(*t));
+    t->corr_id = corr_id;
+    service.track_count++;
+    return t;
+}
+
+/* Backward-shift deletion keeps probe chains intact without tombstones */
+static void track_remove(track_t *t) {
+    uint32_t hole = (uint32_t)(t - service.track);
+    for (uint32_t j = (hole + 1) & TRACK_MASK; service.track[j].corr_id != 0;
+         j = (j + 1) & TRACK_MASK) {
+        uint32_t home = track_hash(service.track[j].corr_id);
+        if (((j - home) & TRACK_MASK) >= ((j - hole) & TRACK_MASK)) {
+            service.track[hole] = service.track[j];
+            hole = j;
+        }
+    }
+    service.track[hole].corr_id = 0;
+    service.track_count--;
+}
+
+/* Ask the device for the real value */
+static void read_back(const track_t *t) {
+    uint16_t cluster_id;
+    uint16_t attr_id;
+    if (cap_get_attribute(t->cap_id, &cluster_id, &attr_id) != OS_OK) {
+        return;
+    }
+    if (zba_read_attrs(t->node_addr, t->endpoint, cluster_id, &attr_id, 1, 0) == OS_OK) {
+        service.stats.reads++;
+    }
+}
+
+static void rollback(track_t *t) {
+    reg_node_t *node = reg_find_node(t->node_addr);
+    if (node) {
+        if (t->prev.valid) {
+            cap_apply_commanded(node, t->cap_id, &t->prev.value, NULL);
+        } else {
+            read_back(t);
+        }
+        service.stats.rolled_back++;
+    }
+    track_remove(t);
+}
+
+/* Drop a command that failed while a newer one for the same key is queued.
+ * The newer one's prev is this command's optimistic value, which the
+ * device may never have had, so it inherits this one's prev instead. */
+static void track_hand_over(track_t *t, const sched_cmd_t *next) {
+    cap_state_t prev = t->prev;
+    track_remove(t);
+    track_t *n = track_find(next->corr_id);
+    if (n) {
+        n->prev = prev;
+    }
+}
+
+static void await_report(track_t *t, os_tick_t now) {
+    t->phase = TRACK_AWAIT_REPORT;
+    t->deadline = now + OS_MS_TO_TICKS(CMD_SCHED_RECONCILE_MS);
+}
+
+/* Publish the commanded value and start (or carry over) tracking */
+static void track_submit(reg_node_t *node, os_corr_id_t old_corr,
+                         os_corr_id_t corr_id, uint8_t endpoint,
+                         cap_id_t cap_id, const cap_value_t *value) {
+    track_t *old = track_find(old_corr);
+    if (old) {
+        track_t moved = *old;
+        track_remove(old);
+        track_t *t = track_insert(corr_id);
+        if (t) {
+            *t = moved;
+            t->corr_id = corr_id;
+        }
+        cap_apply_commanded(node, cap_id, value, NULL);
+        return;
+    }
+
+    if (service.track_count >= TRACK_MAX_LOAD) {
+        return;     /* Could not roll back, so do not guess */
+    }
+    cap_state_t prev;
+    if (cap_apply_commanded(node, cap_id, value, &prev) != OS_OK) {
+        return;     /* Capability not cached for this node */
+    }
+
+    track_t *t = track_insert(corr_id);
+    t->node_addr = node->ieee_addr;
+    t->endpoint = endpoint;
+    t->cap_id = cap_id;
+    t->phase = TRACK_QUEUED;
+    t->prev = prev;
+    service.stats.optimistic++;
+}
+
+/* Fold a command into an absolute value, starting from `base` */
+static cap_value_t resolve_value(const cap_command_t *cmd, const cap_value_t *base) {
+    cap_value_t v = cmd->value;
+
+    switch (cmd->cmd_type) {
+        case CAP_CMD_TOGGLE:
+            v.b = !base->b;
+            break;
+        case CAP_CMD_INCREMENT:
+            v.i = base->i + cmd->value.i;
+            break;
+        case CAP_CMD_DECREMENT:
+            v.i = base->i - cmd->value.i;
+            break;
+        case CAP_CMD_SET:
+        default:
+            break;
+    }
+
+    if (cmd->cap_id == CAP_LIGHT_LEVEL) {
+        if (v.i < 0) {
+            v.i = 0;
+        } else if (v.i > 100) {
+            v.i = 100;
+        }
+    }
+    return v;
+}
+
+/* Value a relative command applies to: the queued value, else whichever of
+ * the last frame sent and the last report is newer */
+static cap_value_t base_value(const reg_node_t *node, const node_tx_t *tx,
+                              const sched_cmd_t *queued, uint8_t endpoint,
+                              cap_id_t cap_id) {
+    if (queued) {
+        return queued->value;
+    }
+
+    bool sent = tx->has_sent && tx->last_cap == cap_id &&
+                tx->last_endpoint == endpoint;
+    cap_state_t state;
+    if (cap_get_state_by_node(node, cap_id, &state) == OS_OK && state.valid &&
+        (!sent || !tick_before(state.timestamp, tx->last_tx))) {
+        return state.value;
+    }
+    if (sent) {
+        return tx->last_value;
+    }
+
+    cap_value_t v = {0};
+    return v;
+}
+
+static os_err_t send_cmd(reg_node_t *node, node_tx_t *tx,
+                         const sched_cmd_t *c) {
+    cap_value_t v = c->value;
+    quirks_entry_apply_command(quirks_for_node(node), c->cap_id, &v, NULL);
+
+    os_tick_t now = os_now_ticks();
+    bool expects_confirm = true;
+    os_err_t err;
+
+    /* Mark in flight first: the adapter may confirm synchronously */
+    tx->inflight_corr = c->corr_id;
+    tx->inflight_at = now;
+
+    switch (c->cap_id) {
+        case CAP_SWITCH_ON:
+        case CAP_LIGHT_ON:
+            err = zba_send_onoff(c->node_addr, c->endpoint, v.b, c->corr_id);
+            break;
+
+        case CAP_LIGHT_LEVEL:
+            err = zba_send_level(c->node_addr, c->endpoint, (uint8_t)v.i, 0,
+                                 c->corr_id);
+            break;
+
+        default: {
+            /* No adapter primitive yet: hand it on as an event */
+            cap_cmd_event_t out = {
+                .node_addr = c->node_addr,
+                .endpoint_id = c->endpoint,
+                .cap_id = c->cap_id,
+            };
+            memcpy(&out.value, &v, sizeof(out.value));
+
+            os_event_t event = {0};
+            event.type = OS_EVENT_CAP_COMMAND;
+            event.timestamp = now;
+            event.corr_id = c->corr_id;
+            event.payload_len = sizeof(out);
+            memcpy(event.payload, &out, sizeof(out));
+            err = os_event_publish(&event);
+            expects_confirm = false;
+            break;
+        }
+    }
+
+    if (err != OS_OK || !expects_confirm) {
+        tx->inflight_corr = 0;
+    }
+
+    track_t *t = track_find(c->corr_id);
+    if (t) {
+        if (err != OS_OK) {
+            rollback(t);
+        } else if (expects_confirm) {
+            t->phase = TRACK_IN_FLIGHT;
+        } else {
+            await_report(t, now);
+        }
+    }
+    if (err == OS_OK) {
+        tx->last_tx = now;
+        tx->last_endpoint = c->endpoint;
+        tx->last_cap = c->cap_id;
+        tx->last_value = c->value;
+        tx->has_sent = true;
+        service.stats.sent++;
+    }
+    return err;
+}
+
+static bool node_ready(const node_tx_t *tx, os_tick_t now) {
+    if (tx->inflight_corr != 0) {
+        return false;
+    }
+    return !tx->has_sent || service.min_gap == 0 ||
+           !tick_before(now, tx->last_tx + service.min_gap);
+}
+
+/* Send the oldest command for a node if it is ready. Returns frames sent. */
+static uint32_t dispatch_node(os_eui64_t node_addr) {
+    sched_cmd_t *c = oldest_pending(node_addr);
+    if (!c) {
+        return 0;
+    }
+
+    reg_node_t *node = reg_find_node(node_addr);
+    node_tx_t *tx = node ? tx_for_node(node) : NULL;
+    if (!tx) {
+        /* Node left: drop everything queued for it */
+        while ((c = oldest_pending(node_addr)) != NULL) {
+            track_t *t = track_find(c->corr_id);
+            if (t) {
+                track_remove(t);
+            }
+            release_pending(c);
+            service.stats.dropped++;
+        }
+        return 0;
+    }
+
+    if (!node_ready(tx, os_now_ticks())) {
+        return 0;
+    }
+
+    sched_cmd_t cmd = *c;
+    release_pending(c);
+    if (send_cmd(node, tx, &cmd) != OS_OK) {
+        LOG_W(CMD_SCHED_MODULE, "Send to " OS_EUI64_FMT " failed",
+              OS_EUI64_ARG(node_addr));
+        service.stats.dropped++;
+        return 0;
+    }
+    return 1;
+}
+
+static os_err_t enqueue(const cap_command_t *cmd, os_eui64_t node_addr,
+                        os_corr_id_t corr_id) {
+    reg_node_t *node = reg_find_node(node_addr);
+    if (!node) {
+        return OS_ERR_NOT_FOUND;
+    }
+    node_tx_t *tx = tx_for_node(node);
+    if (!tx) {
+        return OS_ERR_NOT_FOUND;
+    }
+
+    uint8_t endpoint = cmd->endpoint_id;
+    if (endpoint == 0) {
+        endpoint = cap_get_endpoint(node, cmd->cap_id);
+    }
+
+    sched_cmd_t *c = find_pending(node_addr, endpoint, cmd->cap_id);
+    cap_value_t base = {0};
+    if (cmd->cmd_type != CAP_CMD_SET) {
+        base = base_value(node, tx, c, endpoint, cmd->cap_id);
+    }
+    cap_value_t value = resolve_value(cmd, &base);
+
+    os_corr_id_t old_corr = 0;
+    if (c) {
+        /* Latest value wins; keep the original queue position */
+        old_corr = c->corr_id;
+        c->value = value;
+        c->corr_id = corr_id;
+        service.stats.coalesced++;
+    } else {
+        if (service.pending_count >= CMD_SCHED_MAX_PENDING) {
+            return OS_ERR_FULL;
+        }
+        for (uint32_t i = 0; i < CMD_SCHED_MAX_PENDING; i++) {
+            if (!service.pending[i].used) {
+                c = &service.pending[i];
+                break;
+            }
+        }
+        c->node_addr = node_addr;
+        c->endpoint = endpoint;
+        c->cap_id = cmd->cap_id;
+        c->value = value;
+        c->corr_id = corr_id;
+        c->seq = service.next_seq++;
+        c->used = true;
+        service.pending_count++;
+
+        if (tx->inflight_corr != 0 && tx->last_cap == cmd->cap_id &&
+            tx->last_endpoint == endpoint) {
+            service.stats.superseded++;
+        }
+    }
+
+    track_submit(node, old_corr, corr_id, endpoint, cmd->cap_id, &value);
+
+    service.stats.submitted++;
+    return OS_OK;
+}
+
+static os_corr_id_t event_corr_id(const os_event_t *event) {
+    /* The host adapter sets event->corr_id; the ESP32 driver puts it first
+     * in the payload */
+    if (event->corr_id != 0) {
+        return event->corr_id;
+    }
+    os_corr_id_t corr_id = 0;
+    if (event->payload_len >= sizeof(corr_id)) {
+        memcpy(&corr_id, event->payload, sizeof(corr_id));
+    }
+    return corr_id;
+}
+
+static void handle_cmd_result(const os_event_t *event, void *ctx) {
+    (void)ctx;
+
+    os_corr_id_t corr_id = event_corr_id(event);
+    if (corr_id == 0) {
+        return;
+    }
+
+    track_t *t = track_find(corr_id);
+    if (t) {
+        sched_cmd_t *next = find_pending(t->node_addr, t->endpoint, t->cap_id);
+        if (event->type == OS_EVENT_ZB_CMD_CONFIRM) {
+            await_report(t, os_now_ticks());
+        } else if (next) {
+            track_hand_over(t, next);   /* A newer command will set the state */
+        } else {
+            rollback(t);
+        }
+    }
+
+    for (uint32_t slot = 0; slot < REG_MAX_NODES; slot++) {
+        node_tx_t *tx = &service.nodes[slot];
+        if (tx->inflight_corr != corr_id) {
+            continue;
+        }
+
+        tx->inflight_corr = 0;
+        if (event->type == OS_EVENT_ZB_CMD_CONFIRM) {
+            /* The device answered; confirms carry only the corr_id */
+            reg_touch_node(reg_find_node(tx->node_addr));
+            service.stats.confirmed++;
+        } else {
+            service.stats.failed++;
+        }
+        dispatch_node(tx->node_addr);
+        return;
+    }
+}
+
+os_err_t cmd_sched_init(void) {
+    if (service.initialized) {
+        return OS_ERR_ALREADY_EXISTS;
+    }
+
+    memset(&service, 0, sizeof(service));
+    service.min_gap = OS_MS_TO_TICKS(CMD_SCHED_MIN_GAP_MS);
+    service.initialized = true;
+
+    os_event_filter_t filter = {OS_EVENT_ZB_CMD_CONFIRM, OS_EVENT_ZB_CMD_ERROR};
+    os_event_subscribe(&filter, handle_cmd_result, NULL);
+
+    LOG_I(CMD_SCHED_MODULE, "Command scheduler initialized");
+
+    return OS_OK;
+}
+
+os_err_t cmd_sched_submit(const cap_command_t *cmd) {
+    if (!service.initialized) {
+        return OS_ERR_NOT_INITIALIZED;
+    }
+    if (!cmd || cmd->cap_id >= CAP_MAX) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    os_corr_id_t corr_id = cmd->corr_id ? cmd->corr_id : os_event_new_corr_id();
+    os_err_t err = enqueue(cmd, cmd->node_addr, corr_id);
+    if (err != OS_OK) {
+        return err;
+    }
+
+    dispatch_node(cmd->node_addr);
+    return OS_OK;
+}
+
+os_err_t cmd_sched_submit_group(const os_eui64_t *nodes, uint32_t count,
+                                const cap_command_t *cmd) {
+    if (!service.initialized) {
+        return OS_ERR_NOT_INITIALIZED;
+    }
+    if (!nodes || !cmd || cmd->cap_id >= CAP_MAX) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    os_err_t result = OS_OK;
+    for (uint32_t i = 0; i < count; i++) {
+        os_err_t err = enqueue(cmd, nodes[i], os_event_new_corr_id());
+        if (err != OS_OK) {
+            result = err;
+        }
+    }
+
+    /* Fan out: every idle node gets its frame now */
+    for (uint32_t i = 0; i < count; i++) {
+        dispatch_node(nodes[i]);
+    }
+
+    return result;
+}
+
+os_err_t cmd_sched_get_pending(os_eui64_t node_addr, uint8_t endpoint_id,
+                               cap_id_t cap_id, cap_value_t *out_value) {
+    if (!out_value) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    const sched_cmd_t *c = find_pending(node_addr, endpoint_id, cap_id);
+    if (!c) {
+        return OS_ERR_NOT_FOUND;
+    }
+
+    *out_value = c->value;
+    return OS_OK;
+}
+
+void cmd_sched_note_report(const reg_node_t *node, cap_id_t cap_id) {
+    if (service.track_count == 0 || !node) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < TRACK_SIZE;) {
+        track_t *t = &service.track[i];
+        if (t->corr_id != 0 && t->phase == TRACK_AWAIT_REPORT &&
+            t->node_addr == node->ieee_addr && t->cap_id == cap_id) {
+            track_remove(t);
+            service.stats.reconciled++;
+            continue;
+        }
+        i++;
+    }
+}
+
+void cmd_sched_set_min_gap(os_time_ms_t gap_ms) {
+    service.min_gap = OS_MS_TO_TICKS(gap_ms);
+}
+
+uint32_t cmd_sched_process(void) {
+    if (!service.initialized) {
+        return 0;
+    }
+
+    os_tick_t now = os_now_ticks();
+    os_tick_t timeout = OS_MS_TO_TICKS(CMD_SCHED_CONFIRM_TIMEOUT_MS);
+
+    /* A lost confirm must not wedge the node */
+    for (uint32_t slot = 0; slot < REG_MAX_NODES; slot++) {
+        node_tx_t *tx = &service.nodes[slot];
+        if (tx->inflight_corr != 0 &&
+            !tick_before(now, tx->inflight_at + timeout)) {
+            LOG_W(CMD_SCHED_MODULE, "No confirm for corr_id %lu",
+                  (unsigned long)tx->inflight_corr);
+            track_t *t = track_find(tx->inflight_corr);
+            if (t) {
+                sched_cmd_t *next = find_pending(t->node_addr, t->endpoint,
+                                                 t->cap_id);
+                read_back(t);
+                if (next) {
+                    track_hand_over(t, next);
+                } else {
+                    track_remove(t);
+                }
+            }
+            tx->inflight_corr = 0;
+            service.stats.timeouts++;
+        }
+    }
+
+    /* Confirmed but never reported: read the attribute back. Removal may
+     * shift a later entry into this bucket, so re-check it. */
+    for (uint32_t i = 0; i < TRACK_SIZE && service.track_count > 0;) {
+        track_t *t = &service.track[i];
+        if (t->corr_id != 0 && t->phase == TRACK_AWAIT_REPORT &&
+            !tick_before(now, t->deadline)) {
+            read_back(t);
+            track_remove(t);
+            continue;
+        }
+        i++;
+    }
+
+    uint32_t sent = 0;
+    for (uint32_t i = 0; i < CMD_SCHED_MAX_PENDING && service.pending_count > 0; i++) {
+        if (service.pending[i].used) {
+            sent += dispatch_node(service.pending[i].node_addr);
+        }
+    }
+
+    return sent;
+}
+
+os_time_ms_t cmd_sched_next_due_ms(void) {
+    os_tick_t now = os_now_ticks();
+    os_tick_t due = OS_MS_TO_TICKS(CMD_SCHED_MAX_SLEEP_MS);
+
+    for (uint32_t slot = 0; slot < REG_MAX_NODES; slot++) {
+        const node_tx_t *tx = &service.nodes[slot];
+        os_tick_t at;
+        if (tx->inflight_corr != 0) {
+            at = tx->inflight_at + OS_MS_TO_TICKS(CMD_SCHED_CONFIRM_TIMEOUT_MS);
+        } else if (tx->has_sent && oldest_pending(tx->node_addr)) {
+            at = tx->last_tx + service.min_gap;
+        } else {
+            continue;
+        }
+
+        if (!tick_before(now, at)) {
+            return 0;
+        }
+        if (at - now < due) {
+            due = at - now;
+        }
+    }
+
+    return OS_TICKS_TO_MS(due);
+}
+
+uint32_t cmd_sched_pending_count(void) {
+    return service.pending_count;
+}
+
+os_err_t cmd_sched_get_stats(cmd_sched_stats_t *stats) {
+    if (!stats) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    *stats = service.stats;
+    return OS_OK;
+}
+
+void cmd_sched_task(void *arg) {
+    (void)arg;
+
+    LOG_I(CMD_SCHED_MODULE, "Command scheduler task started");
+
+    while (1) {
+        cmd_sched_process();
+
+        os_time_ms_t sleep_ms = cmd_sched_next_due_ms();
+        os_sleep(sleep_ms > 0 ? sleep_ms : 1);
+    }
+}
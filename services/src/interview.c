@@ -6,43 +6,116 @@
  */
 
 #include "interview.h"
+#include "interview_cache.h"
+#include "capability.h"
+#include "quirks.h"
 #include "registry.h"
+#include "report_plan.h"
+#include "zb_adapter.h"
+#include "zcl_ids.h"
 #include "os.h"
+#include <inttypes.h>
 #include <string.h>
 
 #define INTERVIEW_MODULE "INTV"
 
-/* Maximum concurrent interviews */
+/* Maximum concurrent interviews; further devices wait in the queue */
 #define MAX_INTERVIEWS 4
 
+/* Devices waiting for an interview slot (each node queues at most once) */
+#define INTERVIEW_QUEUE_SIZE REG_MAX_NODES
+
+/* Interview requests on the air at once, across all interviews. Keeps
+ * room on the radio for commands while a whole network rejoins. */
+#define INTERVIEW_MAX_INFLIGHT 6
+
+/* A battery device heard within this window is assumed to be awake */
+#define INTERVIEW_AWAKE_MS 10000
+
+/* Interviews start with a Basic read on this endpoint; a device type seen
+ * before then needs no endpoint discovery (see interview_cache.h). The
+ * probe is not retried: when it fails the full discovery runs instead. */
+#define INTERVIEW_PROBE_EP 1
+
 /* Interview timeout in ms */
 #define INTERVIEW_TIMEOUT_MS 30000
 
-/* Step timeout in ms */
+/* Time to wait for the responses of one stage before re-sending the
+ * requests that are still unanswered */
 #define STEP_TIMEOUT_MS 5000
 
 /* Maximum retries per step before advancing */
 #define MAX_STEP_RETRIES 3
 
-/* Interview process poll interval in ms */
-#define INTERVIEW_POLL_MS 100
+/* Timeout check interval. Interviews advance on adapter response events;
+ * the task only drives retries and timeouts. */
+#define INTERVIEW_TIMER_MS 250
+
+/* Basic cluster attributes, read in a single request */
+static const uint16_t basic_attrs[] = {
+    ZCL_ATTR_BASIC_MANUFACTURER,
+    ZCL_ATTR_BASIC_MODEL,
+    ZCL_ATTR_BASIC_POWER_SOURCE,
+    ZCL_ATTR_BASIC_SW_BUILD,
+};
+
+#define BASIC_ATTR_COUNT (sizeof(basic_attrs) / sizeof(basic_attrs[0]))
+#define BASIC_ATTRS_ALL  ((uint8_t)((1u << BASIC_ATTR_COUNT) - 1))
+
+/* ZCL PowerSource values (low 7 bits; bit 7 flags a battery backup) */
+#define ZCL_POWER_SOURCE_MAINS_1PH  0x01
+#define ZCL_POWER_SOURCE_MAINS_3PH  0x02
+#define ZCL_POWER_SOURCE_BATTERY    0x03
+#define ZCL_POWER_SOURCE_DC         0x04
 
 /* Interview context */
 typedef struct {
     os_eui64_t ieee_addr;
     interview_stage_t stage;
+    os_corr_id_t corr_id;           /* Tags every request of this interview */
     uint8_t retry_count;
-    uint8_t current_ep_index;
+    uint8_t ep_count;
+    uint8_t endpoints[REG_MAX_ENDPOINTS];
+    uint16_t req_pending;           /* Requests of this stage not yet answered */
+    uint16_t req_sent;              /* ... of which on the air (counted in the budget) */
+    uint8_t inflight;               /* Bits set in req_sent */
+    uint8_t attrs_pending;          /* Bit i: basic_attrs[i] outstanding */
+    uint8_t basic_ep;               /* Endpoint the Basic cluster is read from */
+    bool probing;                   /* BASIC_ATTR is the initial probe */
+    bool basic_done;                /* Basic attributes read */
+    bool tree_complete;             /* Every endpoint descriptor arrived */
+    char sw_build[16];
+    rplan_t plan;                   /* BINDINGS: bind, then configure, per step */
     os_tick_t start_time;
     os_tick_t step_start_time;
     bool active;
 } interview_ctx_t;
 
+/* Device waiting for an interview slot */
+typedef struct {
+    os_eui64_t ieee_addr;
+    os_tick_t enqueued_at;
+    bool valid;
+} interview_wait_t;
+
+/* Admission classes, in order: routers first, then devices of unknown
+ * power, then battery devices while they are awake */
+typedef enum {
+    ADMIT_MAINS = 0,
+    ADMIT_UNKNOWN,
+    ADMIT_BATTERY,
+    ADMIT_ASLEEP,
+} admit_class_t;
+
 /* Service state */
 static struct {
     bool initialized;
     interview_ctx_t interviews[MAX_INTERVIEWS];
     uint32_t active_count;
+    interview_wait_t queue[INTERVIEW_QUEUE_SIZE];
+    uint32_t queue_count;
+    uint32_t inflight;
+    interview_stats_t stats;
 } service = {0};
 
 /* Stage names */
@@ -60,7 +133,13 @@ static const char *stage_names[] = {
 static interview_ctx_t *find_interview(os_eui64_t ieee_addr);
 static interview_ctx_t *alloc_interview(os_eui64_t ieee_addr);
 static void free_interview(interview_ctx_t *ctx);
-static void advance_interview(interview_ctx_t *ctx);
+static void enter_stage(interview_ctx_t *ctx, reg_node_t *node,
+                        interview_stage_t stage);
+static void begin_interview(interview_ctx_t *ctx, reg_node_t *node);
+static void discovery_done(interview_ctx_t *ctx, reg_node_t *node);
+static interview_wait_t *find_waiting(os_eui64_t ieee_addr);
+static void pump(void);
+static void handle_zb_event(const os_event_t *event, void *ctx);
 
 os_err_t interview_init(void) {
     if (service.initialized) {
@@ -70,6 +149,16 @@ os_err_t interview_init(void) {
     memset(&service, 0, sizeof(service));
     service.initialized = true;
     
+    os_err_t err = icache_init();
+    if (err != OS_OK && err != OS_ERR_ALREADY_EXISTS) {
+        return err;
+    }
+    
+    /* Announcements start interviews; discovery and setup responses
+     * advance them */
+    os_event_filter_t filter = {OS_EVENT_ZB_ANNOUNCE, OS_EVENT_ZB_REPORT_CFG_RSP};
+    os_event_subscribe(&filter, handle_zb_event, NULL);
+    
     LOG_I(INTERVIEW_MODULE, "Interview service initialized");
     
     return OS_OK;
@@ -80,41 +169,46 @@ os_err_t interview_start(os_eui64_t ieee_addr) {
         return OS_ERR_NOT_INITIALIZED;
     }
     
-    /* Check if already interviewing */
-    interview_ctx_t *existing = find_interview(ieee_addr);
-    if (existing) {
-        LOG_D(INTERVIEW_MODULE, "Interview already in progress for " OS_EUI64_FMT,
+    /* Check if already interviewing or waiting */
+    if (find_interview(ieee_addr) || find_waiting(ieee_addr)) {
+        LOG_D(INTERVIEW_MODULE, "Interview already pending for " OS_EUI64_FMT,
               OS_EUI64_ARG(ieee_addr));
         return OS_OK;
     }
     
-    /* Allocate context */
-    interview_ctx_t *ctx = alloc_interview(ieee_addr);
-    if (!ctx) {
-        LOG_E(INTERVIEW_MODULE, "Max interviews reached");
-        return OS_ERR_FULL;
+    reg_node_t *node = reg_find_node(ieee_addr);
+    if (!node) {
+        return OS_ERR_NOT_FOUND;
     }
     
-    /* Initialize */
-    ctx->ieee_addr = ieee_addr;
-    ctx->stage = INTERVIEW_STAGE_INIT;
-    ctx->retry_count = 0;
-    ctx->current_ep_index = 0;
-    ctx->start_time = os_now_ticks();
-    ctx->step_start_time = ctx->start_time;
-    ctx->active = true;
-    
-    service.active_count++;
+    /* Every interview goes through the queue so that admission order
+     * follows priority, not arrival */
+    interview_wait_t *wait = NULL;
+    for (uint32_t i = 0; i < INTERVIEW_QUEUE_SIZE; i++) {
+        if (!service.queue[i].valid) {
+            wait = &service.queue[i];
+            break;
+        }
+    }
+    if (!wait) {
+        LOG_E(INTERVIEW_MODULE, "Interview queue full, dropping " OS_EUI64_FMT,
+              OS_EUI64_ARG(ieee_addr));
+        service.stats.dropped++;
+        return OS_ERR_FULL;
+    }
     
-    /* Update node state */
-    reg_node_t *node = reg_find_node(ieee_addr);
-    if (node) {
-        reg_set_state(node, REG_STATE_INTERVIEWING);
+    wait->ieee_addr = ieee_addr;
+    wait->enqueued_at = os_now_ticks();
+    wait->valid = true;
+    service.queue_count++;
+    if (service.queue_count > service.stats.queue_peak) {
+        service.stats.queue_peak = service.queue_count;
     }
     
-    LOG_I(INTERVIEW_MODULE, "Starting interview for " OS_EUI64_FMT,
-          OS_EUI64_ARG(ieee_addr));
+    /* Update node state */
+    reg_set_state(node, REG_STATE_INTERVIEWING);
     
+    pump();
     return OS_OK;
 }
 
@@ -123,38 +217,72 @@ void interview_process(void) {
         return;
     }
     
+    pump();
+    
+    os_tick_t now = os_now_ticks();
     for (uint32_t i = 0; i < MAX_INTERVIEWS; i++) {
         interview_ctx_t *ctx = &service.interviews[i];
         if (!ctx->active) {
             continue;
         }
         
+        reg_node_t *node = reg_find_node(ctx->ieee_addr);
+        if (!node) {
+            LOG_E(INTERVIEW_MODULE, "Node not found in registry");
+            free_interview(ctx);
+            continue;
+        }
+        
         /* Check for overall timeout */
-        os_tick_t elapsed = os_now_ticks() - ctx->start_time;
-        if (OS_TICKS_TO_MS(elapsed) > INTERVIEW_TIMEOUT_MS) {
+        if (OS_TICKS_TO_MS(now - ctx->start_time) > INTERVIEW_TIMEOUT_MS) {
             LOG_W(INTERVIEW_MODULE, "Interview timeout for " OS_EUI64_FMT,
                   OS_EUI64_ARG(ctx->ieee_addr));
-            ctx->stage = INTERVIEW_STAGE_FAILED;
-            free_interview(ctx);
+            enter_stage(ctx, node, INTERVIEW_STAGE_FAILED);
             continue;
         }
         
-        /* Check for step timeout */
-        elapsed = os_now_ticks() - ctx->step_start_time;
-        if (OS_TICKS_TO_MS(elapsed) > STEP_TIMEOUT_MS) {
-            ctx->retry_count++;
-            if (ctx->retry_count > MAX_STEP_RETRIES) {
-                LOG_W(INTERVIEW_MODULE, "Step timeout, moving to next stage");
-                ctx->retry_count = 0;
-                /* Move to next stage on timeout */
-                ctx->stage++;
-            }
-            ctx->step_start_time = os_now_ticks();
+        /* Check for step timeout: re-send what is still unanswered. A
+         * stage held back by the request budget has nothing to time out. */
+        if (ctx->inflight == 0 ||
+            OS_TICKS_TO_MS(now - ctx->step_start_time) <= STEP_TIMEOUT_MS) {
+            continue;
+        }
+        ctx->retry_count++;
+        if (!ctx->probing && ctx->retry_count <= MAX_STEP_RETRIES) {
+            service.stats.retries++;
+            enter_stage(ctx, node, ctx->stage);
+            continue;
         }
         
-        /* Advance interview */
-        advance_interview(ctx);
+        /* Without endpoints there is nothing to interview; later stages
+         * carry on with whatever did arrive */
+        LOG_W(INTERVIEW_MODULE, "Step %s timed out for " OS_EUI64_FMT,
+              stage_names[ctx->stage], OS_EUI64_ARG(ctx->ieee_addr));
+        switch (ctx->stage) {
+            case INTERVIEW_STAGE_SIMPLE_DESC:
+                ctx->tree_complete = false;
+                discovery_done(ctx, node);
+                break;
+            case INTERVIEW_STAGE_BASIC_ATTR:
+                if (ctx->probing) {
+                    ctx->probing = false;
+                    enter_stage(ctx, node, INTERVIEW_STAGE_ACTIVE_EP);
+                } else {
+                    enter_stage(ctx, node, INTERVIEW_STAGE_BINDINGS);
+                }
+                break;
+            case INTERVIEW_STAGE_BINDINGS:
+                /* Usable without reports: state arrives on polls */
+                enter_stage(ctx, node, INTERVIEW_STAGE_COMPLETE);
+                break;
+            default:
+                enter_stage(ctx, node, INTERVIEW_STAGE_FAILED);
+                break;
+        }
     }
+    
+    /* Budget freed by timeouts goes to the requests held back */
+    pump();
 }
 
 interview_stage_t interview_get_stage(os_eui64_t ieee_addr) {
@@ -165,7 +293,25 @@ interview_stage_t interview_get_stage(os_eui64_t ieee_addr) {
     return INTERVIEW_STAGE_INIT;
 }
 
+os_err_t interview_get_stats(interview_stats_t *stats) {
+    if (!stats) {
+        return OS_ERR_INVALID_ARG;
+    }
+    *stats = service.stats;
+    stats->active = service.active_count;
+    stats->queued = service.queue_count;
+    stats->inflight = service.inflight;
+    return OS_OK;
+}
+
 os_err_t interview_cancel(os_eui64_t ieee_addr) {
+    interview_wait_t *wait = find_waiting(ieee_addr);
+    if (wait) {
+        wait->valid = false;
+        service.queue_count--;
+        return OS_OK;
+    }
+    
     interview_ctx_t *ctx = find_interview(ieee_addr);
     if (!ctx) {
         return OS_ERR_NOT_FOUND;
@@ -185,7 +331,7 @@ void interview_task(void *arg) {
     
     while (1) {
         interview_process();
-        os_sleep(INTERVIEW_POLL_MS);  /* Process at configured interval */
+        os_sleep(INTERVIEW_TIMER_MS);
     }
 }
 
@@ -218,115 +364,294 @@ static interview_ctx_t *alloc_interview(os_eui64_t ieee_addr) {
     return NULL;
 }
 
+static interview_wait_t *find_waiting(os_eui64_t ieee_addr) {
+    for (uint32_t i = 0; i < INTERVIEW_QUEUE_SIZE; i++) {
+        if (service.queue[i].valid && service.queue[i].ieee_addr == ieee_addr) {
+            return &service.queue[i];
+        }
+    }
+    return NULL;
+}
+
+/* Return the stage's requests on the air to the budget; anything still
+ * unanswered will be sent again */
+static void release_requests(interview_ctx_t *ctx) {
+    service.inflight -= ctx->inflight;
+    ctx->inflight = 0;
+    ctx->req_sent = 0;
+}
+
+/* One request of the current stage has been answered */
+static void request_done(interview_ctx_t *ctx, uint16_t bit) {
+    if (ctx->req_sent & bit) {
+        ctx->req_sent &= (uint16_t)~bit;
+        ctx->inflight--;
+        service.inflight--;
+    }
+    ctx->req_pending &= (uint16_t)~bit;
+}
+
 static void free_interview(interview_ctx_t *ctx) {
     if (ctx && ctx->active) {
+        release_requests(ctx);
         ctx->active = false;
         service.active_count--;
     }
 }
 
-/* Simulate Zigbee responses for host testing */
-static void simulate_active_endpoints(interview_ctx_t *ctx) {
-    reg_node_t *node = reg_find_node(ctx->ieee_addr);
-    if (!node) return;
-    
-    /* Simulate: endpoints 1 and 2 */
-    reg_add_endpoint(node, 1, 0x0104, 0x0100);  /* HA profile, On/Off Light */
-    reg_add_endpoint(node, 2, 0x0104, 0x0302);  /* HA profile, Temperature Sensor */
+/* Send request `index` of the current stage */
+static os_err_t send_request(interview_ctx_t *ctx, reg_node_t *node, uint8_t index) {
+    switch (ctx->stage) {
+        case INTERVIEW_STAGE_ACTIVE_EP:
+            return zba_request_active_ep(node->ieee_addr, ctx->corr_id);
+            
+        case INTERVIEW_STAGE_SIMPLE_DESC:
+            return zba_request_simple_desc(node->ieee_addr, ctx->endpoints[index],
+                                           ctx->corr_id);
+            
+        case INTERVIEW_STAGE_BASIC_ATTR: {
+            /* One Read Attributes request for everything outstanding */
+            uint16_t attrs[BASIC_ATTR_COUNT];
+            size_t count = 0;
+            for (size_t i = 0; i < BASIC_ATTR_COUNT; i++) {
+                if (ctx->attrs_pending & (1u << i)) {
+                    attrs[count++] = basic_attrs[i];
+                }
+            }
+            return zba_read_attrs(node->ieee_addr, ctx->basic_ep, ZCL_CLUSTER_BASIC,
+                                  attrs, count, ctx->corr_id);
+        }
+            
+        case INTERVIEW_STAGE_BINDINGS: {
+            /* Even requests bind a cluster, odd ones configure its reports */
+            const rplan_step_t *step = &ctx->plan.steps[index / 2];
+            if (index % 2 == 0) {
+                return zba_bind(node->ieee_addr, step->endpoint_id, step->cluster_id,
+                                ZBA_BIND_DST_COORDINATOR, ctx->corr_id);
+            }
+            return zba_configure_reporting(node->ieee_addr, step->endpoint_id,
+                                           step->cluster_id, step->cfgs,
+                                           step->cfg_count, ctx->corr_id);
+        }
+            
+        default:
+            return OS_OK;
+    }
+}
+
+/* Send the requests of the current stage that are neither answered nor
+ * on the air, as far as the in-flight budget allows. Simple descriptor
+ * requests for all endpoints go out back to back. */
+static void send_requests(interview_ctx_t *ctx, reg_node_t *node) {
+    uint16_t unsent = ctx->req_pending & (uint16_t)~ctx->req_sent;
     
-    LOG_D(INTERVIEW_MODULE, "Simulated active endpoints: 1, 2");
+    for (uint8_t i = 0; unsent != 0; i++) {
+        uint16_t bit = (uint16_t)(1u << i);
+        if (!(unsent & bit)) {
+            continue;
+        }
+        unsent &= (uint16_t)~bit;
+        
+        if (service.inflight >= INTERVIEW_MAX_INFLIGHT) {
+            return;     /* Sent by pump() when budget frees up */
+        }
+        
+        os_err_t err = send_request(ctx, node, i);
+        service.stats.requests++;
+        if (err != OS_OK) {
+            /* Counted as on the air; left to the step timeout to retry */
+            LOG_W(INTERVIEW_MODULE, "%s request for " OS_EUI64_FMT " failed: %d",
+                  stage_names[ctx->stage], OS_EUI64_ARG(node->ieee_addr), err);
+        }
+        ctx->req_sent |= bit;
+        ctx->inflight++;
+        service.inflight++;
+        if (service.inflight > service.stats.inflight_peak) {
+            service.stats.inflight_peak = service.inflight;
+        }
+        ctx->step_start_time = os_now_ticks();
+    }
 }
 
-static void simulate_simple_descriptor(interview_ctx_t *ctx) {
-    reg_node_t *node = reg_find_node(ctx->ieee_addr);
-    if (!node) return;
+static void begin_interview(interview_ctx_t *ctx, reg_node_t *node) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ieee_addr = node->ieee_addr;
+    ctx->stage = INTERVIEW_STAGE_INIT;
+    ctx->corr_id = os_event_new_corr_id();
+    ctx->start_time = os_now_ticks();
+    ctx->probing = true;
+    ctx->tree_complete = true;
+    ctx->active = true;
     
-    /* Add clusters to endpoint 1 */
-    reg_endpoint_t *ep1 = reg_find_endpoint(node, 1);
-    if (ep1) {
-        reg_add_cluster(ep1, 0x0000, REG_CLUSTER_SERVER);  /* Basic */
-        reg_add_cluster(ep1, 0x0006, REG_CLUSTER_SERVER);  /* OnOff */
-        reg_add_cluster(ep1, 0x0008, REG_CLUSTER_SERVER);  /* Level Control */
+    service.active_count++;
+    service.stats.started++;
+    
+    LOG_I(INTERVIEW_MODULE, "Starting interview for " OS_EUI64_FMT,
+          OS_EUI64_ARG(node->ieee_addr));
+    
+    /* The first request goes out now; responses drive the rest */
+    enter_stage(ctx, node, INTERVIEW_STAGE_BASIC_ATTR);
+}
+
+static admit_class_t admit_class(const reg_node_t *node, os_tick_t now) {
+    switch (node->power_source) {
+        case REG_POWER_MAINS:
+        case REG_POWER_DC:
+            return ADMIT_MAINS;
+        case REG_POWER_BATTERY:
+            /* Sleepy devices only answer shortly after they were heard */
+            return OS_TICKS_TO_MS(now - node->last_seen) <= INTERVIEW_AWAKE_MS
+                       ? ADMIT_BATTERY : ADMIT_ASLEEP;
+        default:
+            return ADMIT_UNKNOWN;
     }
+}
+
+/* Highest priority waiting device that can be interviewed now; oldest
+ * first within a class */
+static interview_wait_t *next_waiting(os_tick_t now, reg_node_t **node_out) {
+    interview_wait_t *best = NULL;
+    reg_node_t *best_node = NULL;
+    admit_class_t best_class = ADMIT_ASLEEP;
     
-    /* Add clusters to endpoint 2 */
-    reg_endpoint_t *ep2 = reg_find_endpoint(node, 2);
-    if (ep2) {
-        reg_add_cluster(ep2, 0x0000, REG_CLUSTER_SERVER);  /* Basic */
-        reg_add_cluster(ep2, 0x0402, REG_CLUSTER_SERVER);  /* Temperature */
+    for (uint32_t i = 0; i < INTERVIEW_QUEUE_SIZE; i++) {
+        interview_wait_t *wait = &service.queue[i];
+        if (!wait->valid) {
+            continue;
+        }
+        reg_node_t *node = reg_find_node(wait->ieee_addr);
+        if (!node) {
+            wait->valid = false;    /* Removed while waiting */
+            service.queue_count--;
+            continue;
+        }
+        admit_class_t cls = admit_class(node, now);
+        if (cls < best_class ||
+            (cls == best_class && cls != ADMIT_ASLEEP &&
+             (int32_t)(wait->enqueued_at - best->enqueued_at) < 0)) {
+            best = wait;
+            best_node = node;
+            best_class = cls;
+        }
     }
     
-    LOG_D(INTERVIEW_MODULE, "Simulated simple descriptors");
+    *node_out = best_node;
+    return best;
 }
 
-static void simulate_basic_attributes(interview_ctx_t *ctx) {
-    reg_node_t *node = reg_find_node(ctx->ieee_addr);
-    if (!node) return;
-    
-    /* Set node metadata */
-    strncpy(node->manufacturer, "Test Manufacturer", REG_MANUFACTURER_LEN - 1);
-    strncpy(node->model, "Test Model", REG_MODEL_LEN - 1);
-    node->sw_build = 1;
-    node->power_source = REG_POWER_MAINS;
+/* Spend free budget and free slots: first on requests held back from
+ * running interviews, then on admitting waiting devices */
+static void pump(void) {
+    for (uint32_t i = 0; i < MAX_INTERVIEWS; i++) {
+        interview_ctx_t *ctx = &service.interviews[i];
+        if (service.inflight >= INTERVIEW_MAX_INFLIGHT) {
+            return;
+        }
+        if (ctx->active && (ctx->req_pending & (uint16_t)~ctx->req_sent)) {
+            reg_node_t *node = reg_find_node(ctx->ieee_addr);
+            if (node) {
+                send_requests(ctx, node);
+            }
+        }
+    }
     
-    LOG_D(INTERVIEW_MODULE, "Simulated basic attributes");
+    os_tick_t now = os_now_ticks();
+    while (service.queue_count > 0 && service.active_count < MAX_INTERVIEWS &&
+           service.inflight < INTERVIEW_MAX_INFLIGHT) {
+        reg_node_t *node;
+        interview_wait_t *wait = next_waiting(now, &node);
+        if (!wait) {
+            return;     /* Only sleeping devices left */
+        }
+        
+        uint32_t waited = (uint32_t)OS_TICKS_TO_MS(now - wait->enqueued_at);
+        wait->valid = false;
+        service.queue_count--;
+        service.stats.admitted++;
+        service.stats.wait_ms_total += waited;
+        if (waited > service.stats.wait_ms_max) {
+            service.stats.wait_ms_max = waited;
+        }
+        
+        begin_interview(alloc_interview(node->ieee_addr), node);
+    }
 }
 
-static void advance_interview(interview_ctx_t *ctx) {
-    reg_node_t *node = reg_find_node(ctx->ieee_addr);
-    if (!node) {
-        LOG_E(INTERVIEW_MODULE, "Node not found in registry");
-        ctx->stage = INTERVIEW_STAGE_FAILED;
-        free_interview(ctx);
-        return;
+/* Endpoint to read the Basic cluster from: the first that has it */
+static uint8_t basic_endpoint(const interview_ctx_t *ctx, reg_node_t *node) {
+    for (uint8_t i = 0; i < ctx->ep_count; i++) {
+        reg_endpoint_t *ep = reg_find_endpoint(node, ctx->endpoints[i]);
+        if (ep && reg_find_cluster(ep, ZCL_CLUSTER_BASIC)) {
+            return ctx->endpoints[i];
+        }
+    }
+    return ctx->endpoints[0];
+}
+
+static void enter_stage(interview_ctx_t *ctx, reg_node_t *node,
+                        interview_stage_t stage) {
+    if (stage != ctx->stage) {
+        LOG_D(INTERVIEW_MODULE, OS_EUI64_FMT ": %s -> %s",
+              OS_EUI64_ARG(ctx->ieee_addr), stage_names[ctx->stage],
+              stage_names[stage]);
+        ctx->stage = stage;
+        ctx->retry_count = 0;
+        node->interview_stage = (uint8_t)stage;
+        
+        switch (stage) {
+            case INTERVIEW_STAGE_ACTIVE_EP:
+                ctx->req_pending = 0x01;
+                break;
+            case INTERVIEW_STAGE_SIMPLE_DESC:
+                ctx->req_pending = (uint16_t)((1u << ctx->ep_count) - 1);
+                break;
+            case INTERVIEW_STAGE_BASIC_ATTR:
+                ctx->basic_ep = ctx->probing ? INTERVIEW_PROBE_EP
+                                             : basic_endpoint(ctx, node);
+                ctx->attrs_pending = BASIC_ATTRS_ALL;
+                ctx->req_pending = 0x01;
+                break;
+            case INTERVIEW_STAGE_BINDINGS:
+                /* Capabilities follow from the clusters and quirks just
+                 * learnt; they decide what the device should report */
+                cap_compute_for_node(node);
+                rplan_build(node, &ctx->plan);
+                ctx->req_pending = (uint16_t)((1u << (2 * ctx->plan.count)) - 1);
+                break;
+            default:
+                ctx->req_pending = 0;
+                break;
+        }
     }
+    release_requests(ctx);
+    ctx->step_start_time = os_now_ticks();
     
-    switch (ctx->stage) {
-        case INTERVIEW_STAGE_INIT:
-            LOG_D(INTERVIEW_MODULE, "Stage: INIT -> ACTIVE_EP");
-            ctx->stage = INTERVIEW_STAGE_ACTIVE_EP;
-            ctx->step_start_time = os_now_ticks();
-            break;
-            
+    switch (stage) {
         case INTERVIEW_STAGE_ACTIVE_EP:
-            /* Request active endpoints */
-            /* In real implementation, this would send ZDP Active_EP_req */
-            simulate_active_endpoints(ctx);
-            ctx->stage = INTERVIEW_STAGE_SIMPLE_DESC;
-            ctx->step_start_time = os_now_ticks();
-            break;
-            
         case INTERVIEW_STAGE_SIMPLE_DESC:
-            /* Request simple descriptor for each endpoint */
-            simulate_simple_descriptor(ctx);
-            ctx->stage = INTERVIEW_STAGE_BASIC_ATTR;
-            ctx->step_start_time = os_now_ticks();
-            break;
-            
         case INTERVIEW_STAGE_BASIC_ATTR:
-            /* Read basic cluster attributes */
-            simulate_basic_attributes(ctx);
-            ctx->stage = INTERVIEW_STAGE_BINDINGS;
-            ctx->step_start_time = os_now_ticks();
+            send_requests(ctx, node);
             break;
             
         case INTERVIEW_STAGE_BINDINGS:
-            /* Set up bindings for reporting */
-            /* Skip for now */
-            ctx->stage = INTERVIEW_STAGE_COMPLETE;
+            /* Issued under the same request budget as discovery */
+            if (ctx->req_pending == 0) {
+                enter_stage(ctx, node, INTERVIEW_STAGE_COMPLETE);
+            } else {
+                send_requests(ctx, node);
+            }
             break;
             
         case INTERVIEW_STAGE_COMPLETE:
-            LOG_I(INTERVIEW_MODULE, "Interview complete for " OS_EUI64_FMT,
-                  OS_EUI64_ARG(ctx->ieee_addr));
+            LOG_I(INTERVIEW_MODULE, "Interview complete for " OS_EUI64_FMT " in %" PRIu32 " ms",
+                  OS_EUI64_ARG(ctx->ieee_addr),
+                  (uint32_t)OS_TICKS_TO_MS(os_now_ticks() - ctx->start_time));
             
-            /* Update node state */
+            /* Update node state; listeners learn of completion from the
+             * registry's state event */
             reg_set_state(node, REG_STATE_READY);
             
-            /* Emit event */
-            os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &ctx->ieee_addr, sizeof(ctx->ieee_addr));
-            
-            /* Free context */
+            service.stats.completed++;
             free_interview(ctx);
             break;
             
@@ -337,8 +662,348 @@ static void advance_interview(interview_ctx_t *ctx) {
             /* Update node state */
             reg_set_state(node, REG_STATE_STALE);
             
-            /* Free context */
+            service.stats.failed++;
             free_interview(ctx);
             break;
+            
+        default:
+            break;
+    }
+}
+
+/* Endpoint discovery finished (or gave up): read the Basic cluster unless
+ * the probe already did, and remember a complete result for the type */
+static void discovery_done(interview_ctx_t *ctx, reg_node_t *node) {
+    if (!ctx->basic_done) {
+        enter_stage(ctx, node, INTERVIEW_STAGE_BASIC_ATTR);
+        return;
+    }
+    if (ctx->tree_complete) {
+        icache_store(node);
+    }
+    enter_stage(ctx, node, INTERVIEW_STAGE_BINDINGS);
+}
+
+/* Interview waiting for this response, and its node */
+static interview_ctx_t *match_response(const os_event_t *event, os_eui64_t node_id,
+                                       interview_stage_t stage, reg_node_t **node) {
+    interview_ctx_t *ctx = find_interview(node_id);
+    if (!ctx || ctx->stage != stage || event->corr_id != ctx->corr_id) {
+        return NULL;
+    }
+    *node = reg_find_node(node_id);
+    if (!*node) {
+        free_interview(ctx);
+        return NULL;
+    }
+    reg_touch_node(*node);
+    return ctx;
+}
+
+static void handle_active_ep(const os_event_t *event) {
+    zba_active_ep_t rsp;
+    if (event->payload_len < sizeof(rsp)) {
+        return;
+    }
+    memcpy(&rsp, event->payload, sizeof(rsp));
+    
+    reg_node_t *node;
+    interview_ctx_t *ctx = match_response(event, rsp.node_id,
+                                          INTERVIEW_STAGE_ACTIVE_EP, &node);
+    if (!ctx || rsp.status != 0) {
+        return;     /* Errors are retried on the step timeout */
+    }
+    request_done(ctx, 0x01);
+    
+    ctx->ep_count = 0;
+    for (uint8_t i = 0; i < rsp.count && i < ZBA_MAX_ACTIVE_EP; i++) {
+        if (ctx->ep_count == REG_MAX_ENDPOINTS) {
+            ctx->tree_complete = false;
+            LOG_W(INTERVIEW_MODULE, OS_EUI64_FMT ": only %d of %d endpoints kept",
+                  OS_EUI64_ARG(rsp.node_id), REG_MAX_ENDPOINTS, rsp.count);
+            break;
+        }
+        ctx->endpoints[ctx->ep_count++] = rsp.endpoints[i];
+    }
+    
+    enter_stage(ctx, node, ctx->ep_count ? INTERVIEW_STAGE_SIMPLE_DESC
+                                         : INTERVIEW_STAGE_FAILED);
+}
+
+static void handle_simple_desc(const os_event_t *event) {
+    zba_simple_desc_t rsp;
+    if (event->payload_len < sizeof(rsp)) {
+        return;
+    }
+    memcpy(&rsp, event->payload, sizeof(rsp));
+    
+    reg_node_t *node;
+    interview_ctx_t *ctx = match_response(event, rsp.node_id,
+                                          INTERVIEW_STAGE_SIMPLE_DESC, &node);
+    if (!ctx) {
+        return;
+    }
+    
+    uint8_t idx = 0;
+    while (idx < ctx->ep_count && ctx->endpoints[idx] != rsp.endpoint) {
+        idx++;
+    }
+    if (idx == ctx->ep_count || !(ctx->req_pending & (1u << idx))) {
+        return;
+    }
+    
+    if (rsp.status == 0) {
+        reg_endpoint_t *ep = reg_add_endpoint(node, rsp.endpoint, rsp.profile_id,
+                                              rsp.device_id);
+        for (uint8_t i = 0; ep && i < rsp.count && i < ZBA_DESC_CLUSTERS; i++) {
+            reg_add_cluster(ep, rsp.clusters[i],
+                            (rsp.client_mask & (1u << i)) ? REG_CLUSTER_CLIENT
+                                                          : REG_CLUSTER_SERVER);
+        }
+        if (rsp.more) {
+            return;
+        }
+    } else {
+        ctx->tree_complete = false;
+    }
+    
+    request_done(ctx, (uint16_t)(1u << idx));
+    if (ctx->req_pending == 0) {
+        discovery_done(ctx, node);
+    }
+}
+
+/* SWBuildID is a string; keep it numeric when it is a plain number and
+ * otherwise fold it to a hash so different builds still compare unequal */
+static uint32_t parse_sw_build(const char *s) {
+    uint32_t number = 0;
+    uint32_t hash = 2166136261u;
+    bool numeric = *s != '\0';
+    for (; *s; s++) {
+        if (*s >= '0' && *s <= '9') {
+            number = number * 10 + (uint32_t)(*s - '0');
+        } else {
+            numeric = false;
+        }
+        hash = (hash ^ (uint8_t)*s) * 16777619u;
+    }
+    return numeric ? number : hash;
+}
+
+static reg_power_source_t decode_power_source(uint8_t v) {
+    switch (v & 0x7F) {
+        case ZCL_POWER_SOURCE_MAINS_1PH:
+        case ZCL_POWER_SOURCE_MAINS_3PH:
+            return REG_POWER_MAINS;
+        case ZCL_POWER_SOURCE_BATTERY:
+            return REG_POWER_BATTERY;
+        case ZCL_POWER_SOURCE_DC:
+            return REG_POWER_DC;
+        default:
+            return REG_POWER_UNKNOWN;
+    }
+}
+
+/* Copy one part of a string attribute into a NUL-terminated buffer */
+static void store_string(char *dst, size_t size, const zba_attr_read_t *rsp) {
+    if (rsp->offset == 0) {
+        memset(dst, 0, size);
+    }
+    if (rsp->offset >= size - 1) {
+        return;
+    }
+    size_t len = rsp->len;
+    if (len > size - 1 - rsp->offset) {
+        len = size - 1 - rsp->offset;
+    }
+    memcpy(dst + rsp->offset, rsp->data, len);
+}
+
+static void handle_attr_read(const os_event_t *event) {
+    zba_attr_read_t rsp;
+    if (event->payload_len < sizeof(rsp)) {
+        return;
+    }
+    memcpy(&rsp, event->payload, sizeof(rsp));
+    if (rsp.cluster_id != ZCL_CLUSTER_BASIC) {
+        return;
+    }
+    
+    reg_node_t *node;
+    interview_ctx_t *ctx = match_response(event, rsp.node_id,
+                                          INTERVIEW_STAGE_BASIC_ATTR, &node);
+    if (!ctx) {
+        return;
+    }
+    
+    /* The whole read was rejected: no Basic cluster on that endpoint */
+    if (rsp.attr_id == ZBA_ATTR_ID_NONE) {
+        request_done(ctx, 0x01);
+        if (ctx->probing) {
+            ctx->probing = false;
+            enter_stage(ctx, node, INTERVIEW_STAGE_ACTIVE_EP);
+        } else {
+            enter_stage(ctx, node, INTERVIEW_STAGE_BINDINGS);
+        }
+        return;
+    }
+    
+    size_t idx = 0;
+    while (idx < BASIC_ATTR_COUNT && basic_attrs[idx] != rsp.attr_id) {
+        idx++;
+    }
+    if (idx == BASIC_ATTR_COUNT || !(ctx->attrs_pending & (1u << idx))) {
+        return;
+    }
+    
+    if (rsp.status == ZBA_ZCL_STATUS_SUCCESS) {
+        switch (rsp.attr_id) {
+            case ZCL_ATTR_BASIC_MANUFACTURER:
+                store_string(node->manufacturer, sizeof(node->manufacturer), &rsp);
+                break;
+            case ZCL_ATTR_BASIC_MODEL:
+                store_string(node->model, sizeof(node->model), &rsp);
+                break;
+            case ZCL_ATTR_BASIC_SW_BUILD:
+                store_string(ctx->sw_build, sizeof(ctx->sw_build), &rsp);
+                break;
+            case ZCL_ATTR_BASIC_POWER_SOURCE:
+                node->power_source = decode_power_source(rsp.data[0]);
+                break;
+        }
+        if ((uint32_t)rsp.offset + rsp.len < rsp.total) {
+            return;     /* More parts to come */
+        }
+        if (rsp.attr_id == ZCL_ATTR_BASIC_SW_BUILD) {
+            node->sw_build = parse_sw_build(ctx->sw_build);
+        }
+    }
+    
+    ctx->attrs_pending &= (uint8_t)~(1u << idx);
+    if (ctx->attrs_pending != 0) {
+        return;
+    }
+    
+    request_done(ctx, 0x01);
+    ctx->basic_done = true;
+    reg_mark_changed(node);         /* Manufacturer/model: re-match quirks */
+    
+    if (!ctx->probing) {
+        discovery_done(ctx, node);
+        return;
+    }
+    
+    /* A device type interviewed before gets its endpoints from the cache */
+    ctx->probing = false;
+    if (icache_apply(node)) {
+        LOG_D(INTERVIEW_MODULE, OS_EUI64_FMT ": descriptors from cache",
+              OS_EUI64_ARG(node->ieee_addr));
+        service.stats.cache_hits++;
+        enter_stage(ctx, node, INTERVIEW_STAGE_BINDINGS);
+    } else {
+        enter_stage(ctx, node, INTERVIEW_STAGE_ACTIVE_EP);
+    }
+}
+
+/* Bind_rsp and Configure Reporting response. A refusal is final: the
+ * device keeps working, with that cluster's state coming from polls. */
+static void handle_setup_rsp(const os_event_t *event, bool bind) {
+    zba_setup_rsp_t rsp;
+    if (event->payload_len < sizeof(rsp)) {
+        return;
+    }
+    memcpy(&rsp, event->payload, sizeof(rsp));
+    
+    reg_node_t *node;
+    interview_ctx_t *ctx = match_response(event, rsp.node_id,
+                                          INTERVIEW_STAGE_BINDINGS, &node);
+    if (!ctx) {
+        return;
+    }
+    
+    uint8_t idx = 0;
+    while (idx < ctx->plan.count &&
+           (ctx->plan.steps[idx].endpoint_id != rsp.endpoint ||
+            ctx->plan.steps[idx].cluster_id != rsp.cluster_id)) {
+        idx++;
+    }
+    uint16_t bit = (uint16_t)(1u << (2 * idx + (bind ? 0 : 1)));
+    if (idx == ctx->plan.count || !(ctx->req_pending & bit)) {
+        return;
+    }
+    request_done(ctx, bit);
+    
+    if (rsp.status != 0) {
+        LOG_W(INTERVIEW_MODULE, OS_EUI64_FMT ": %s 0x%04X refused: 0x%02X",
+              OS_EUI64_ARG(rsp.node_id), bind ? "bind" : "reporting for",
+              rsp.cluster_id, rsp.status);
+        service.stats.setup_refused++;
+    } else if (bind) {
+        service.stats.bindings++;
+    } else {
+        service.stats.reports_configured += ctx->plan.steps[idx].cfg_count;
+    }
+    
+    if (ctx->req_pending == 0) {
+        enter_stage(ctx, node, INTERVIEW_STAGE_COMPLETE);
+    }
+}
+
+static void handle_announce(const os_event_t *event) {
+    zba_announce_t ann;
+    if (event->payload_len < sizeof(ann)) {
+        return;
+    }
+    memcpy(&ann, event->payload, sizeof(ann));
+    
+    /* Adds the node, or refreshes last_seen: a sleepy device that announces
+     * is awake now */
+    reg_node_t *node = reg_add_node(ann.node_id, ann.nwk_addr);
+    if (!node) {
+        LOG_W(INTERVIEW_MODULE, "Registry full, ignoring " OS_EUI64_FMT,
+              OS_EUI64_ARG(ann.node_id));
+        return;
+    }
+    
+    /* Enough to order the interview queue; the Basic PowerSource read
+     * replaces it */
+    if (node->power_source == REG_POWER_UNKNOWN) {
+        node->power_source = (ann.capability & ZBA_MAC_CAP_MAINS) ? REG_POWER_MAINS
+                                                                  : REG_POWER_BATTERY;
+    }
+    
+    /* A known device rejoining keeps its interview results */
+    if (node->state != REG_STATE_READY) {
+        interview_start(ann.node_id);
+    }
+}
+
+static void handle_zb_event(const os_event_t *event, void *ctx) {
+    (void)ctx;
+    
+    switch (event->type) {
+        case OS_EVENT_ZB_ANNOUNCE:
+            handle_announce(event);
+            break;
+        case OS_EVENT_ZB_DESC_ENDPOINTS:
+            handle_active_ep(event);
+            break;
+        case OS_EVENT_ZB_DESC_CLUSTERS:
+            handle_simple_desc(event);
+            break;
+        case OS_EVENT_ZB_ATTR_READ:
+            handle_attr_read(event);
+            break;
+        case OS_EVENT_ZB_BIND_RSP:
+            handle_setup_rsp(event, true);
+            break;
+        case OS_EVENT_ZB_REPORT_CFG_RSP:
+            handle_setup_rsp(event, false);
+            break;
+        default:
+            return;
     }
+    
+    /* Answers free budget and finished interviews free slots */
+    pump();
 }
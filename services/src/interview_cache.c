@@ -0,0 +1,258 @@
+/**
+ * @file interview_cache.c
+ * @brief Interview result (descriptor) cache implementation
+ *
+ * ESP32-C6 Zigbee Bridge OS - Device interview service
+ *
+ * A 40-bulb install has one device type, so after the first bulb every
+ * interview is a single Basic read plus a copy of this entry. Entries are
+ * identified by an FNV-1a hash of the key, which names the persisted blob;
+ * the stored strings are compared on lookup, so a hash collision is a miss
+ * (and the later type overwrites the earlier one on store).
+ */
+
+#include "interview_cache.h"
+#include "registry.h"
+#include "os.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ICACHE_MODULE "ICACHE"
+
+/* Device types kept in RAM */
+#define ICACHE_SIZE 8
+
+/* Persistence key: prefix + 8 hex digits of the key hash */
+#define ICACHE_PERSIST_PREFIX "icache/"
+#define ICACHE_KEY_SIZE 24
+
+/* Cached endpoint */
+typedef struct {
+    uint8_t endpoint_id;
+    uint8_t cluster_count;
+    uint16_t profile_id;
+    uint16_t device_id;
+    uint16_t cluster_ids[REG_MAX_CLUSTERS];
+    uint32_t client_mask;           /* Bit i: cluster_ids[i] is a client cluster */
+} icache_endpoint_t;
+
+/* Cached device type; also the persisted record */
+typedef struct {
+    char manufacturer[REG_MANUFACTURER_LEN];
+    char model[REG_MODEL_LEN];
+    uint32_t sw_build;
+    uint8_t endpoint_count;
+    icache_endpoint_t endpoints[REG_MAX_ENDPOINTS];
+} icache_entry_t;
+
+_Static_assert(REG_MAX_CLUSTERS <= 32, "client_mask holds one bit per cluster");
+_Static_assert(sizeof(icache_entry_t) <= OS_PERSIST_VALUE_MAX,
+               "icache_entry_t must fit a persisted value");
+
+/* RAM slot */
+typedef struct {
+    icache_entry_t entry;
+    uint32_t hash;
+    bool valid;
+} icache_slot_t;
+
+/* Service state */
+static struct {
+    bool initialized;
+    icache_slot_t slots[ICACHE_SIZE];
+    uint32_t next_victim;           /* Round-robin replacement */
+    icache_stats_t stats;
+} service = {0};
+
+/* FNV-1a over manufacturer, model (each with its NUL) and sw_build */
+static uint32_t key_hash(const char *manufacturer, const char *model, uint32_t sw_build) {
+    uint32_t hash = 2166136261u;
+    const char *parts[2] = {manufacturer, model};
+    for (uint32_t p = 0; p < 2; p++) {
+        const char *s = parts[p];
+        do {
+            hash = (hash ^ (uint8_t)*s) * 16777619u;
+        } while (*s++);
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        hash = (hash ^ ((sw_build >> (8 * i)) & 0xFF)) * 16777619u;
+    }
+    return hash;
+}
+
+static bool entry_matches(const icache_entry_t *entry, const reg_node_t *node) {
+    return entry->sw_build == node->sw_build &&
+           strncmp(entry->manufacturer, node->manufacturer, REG_MANUFACTURER_LEN) == 0 &&
+           strncmp(entry->model, node->model, REG_MODEL_LEN) == 0;
+}
+
+static void persist_key(uint32_t hash, char *key, size_t len) {
+    snprintf(key, len, ICACHE_PERSIST_PREFIX "%08" PRIX32, hash);
+}
+
+/* RAM slot for this hash: the existing one, else a free or the next victim */
+static icache_slot_t *slot_for(uint32_t hash) {
+    icache_slot_t *free_slot = NULL;
+    for (uint32_t i = 0; i < ICACHE_SIZE; i++) {
+        if (service.slots[i].valid && service.slots[i].hash == hash) {
+            return &service.slots[i];
+        }
+        if (!service.slots[i].valid && !free_slot) {
+            free_slot = &service.slots[i];
+        }
+    }
+    if (free_slot) {
+        return free_slot;
+    }
+    icache_slot_t *victim = &service.slots[service.next_victim];
+    service.next_victim = (service.next_victim + 1) % ICACHE_SIZE;
+    return victim;
+}
+
+static void slot_fill(icache_slot_t *slot, uint32_t hash, const icache_entry_t *entry) {
+    if (!slot->valid) {
+        service.stats.entries++;
+    }
+    slot->entry = *entry;
+    slot->hash = hash;
+    slot->valid = true;
+}
+
+os_err_t icache_init(void) {
+    if (service.initialized) {
+        return OS_ERR_ALREADY_EXISTS;
+    }
+
+    memset(&service, 0, sizeof(service));
+    service.initialized = true;
+
+    LOG_I(ICACHE_MODULE, "Interview cache initialized (%d types in RAM)", ICACHE_SIZE);
+
+    return OS_OK;
+}
+
+os_err_t icache_store(const reg_node_t *node) {
+    if (!service.initialized) {
+        return OS_ERR_NOT_INITIALIZED;
+    }
+    if (!node || node->manufacturer[0] == '\0' || node->model[0] == '\0') {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    icache_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.manufacturer, node->manufacturer, REG_MANUFACTURER_LEN - 1);
+    strncpy(entry.model, node->model, REG_MODEL_LEN - 1);
+    entry.sw_build = node->sw_build;
+
+    for (uint8_t i = 0; i < REG_MAX_ENDPOINTS; i++) {
+        const reg_endpoint_t *ep = &node->endpoints[i];
+        if (!ep->valid) {
+            continue;
+        }
+        icache_endpoint_t *out = &entry.endpoints[entry.endpoint_count++];
+        out->endpoint_id = ep->endpoint_id;
+        out->profile_id = ep->profile_id;
+        out->device_id = ep->device_id;
+        for (uint8_t c = 0; c < REG_MAX_CLUSTERS; c++) {
+            const reg_cluster_t *cl = &ep->clusters[c];
+            if (!cl->valid) {
+                continue;
+            }
+            if (cl->direction == REG_CLUSTER_CLIENT) {
+                out->client_mask |= 1u << out->cluster_count;
+            }
+            out->cluster_ids[out->cluster_count++] = cl->cluster_id;
+        }
+    }
+    if (entry.endpoint_count == 0) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    uint32_t hash = key_hash(entry.manufacturer, entry.model, entry.sw_build);
+    slot_fill(slot_for(hash), hash, &entry);
+    service.stats.stores++;
+
+    char key[ICACHE_KEY_SIZE];
+    persist_key(hash, key, sizeof(key));
+    os_err_t err = os_persist_put(key, &entry, sizeof(entry));
+    if (err != OS_OK) {
+        LOG_W(ICACHE_MODULE, "Failed to persist %s/%s: %d", entry.manufacturer,
+              entry.model, err);
+    }
+
+    LOG_D(ICACHE_MODULE, "Stored %s/%s build %" PRIu32 " (%u endpoints)",
+          entry.manufacturer, entry.model, entry.sw_build, entry.endpoint_count);
+    return OS_OK;
+}
+
+/* Cached entry for the node's type, from RAM or storage */
+static const icache_entry_t *lookup(const reg_node_t *node) {
+    uint32_t hash = key_hash(node->manufacturer, node->model, node->sw_build);
+    for (uint32_t i = 0; i < ICACHE_SIZE; i++) {
+        icache_slot_t *slot = &service.slots[i];
+        if (slot->valid && slot->hash == hash) {
+            return entry_matches(&slot->entry, node) ? &slot->entry : NULL;
+        }
+    }
+
+    char key[ICACHE_KEY_SIZE];
+    persist_key(hash, key, sizeof(key));
+    icache_entry_t entry;
+    size_t len = 0;
+    if (os_persist_get(key, &entry, sizeof(entry), &len) != OS_OK ||
+        len != sizeof(entry) || !entry_matches(&entry, node) ||
+        entry.endpoint_count > REG_MAX_ENDPOINTS) {
+        return NULL;
+    }
+
+    icache_slot_t *slot = slot_for(hash);
+    slot_fill(slot, hash, &entry);
+    service.stats.loads++;
+    return &slot->entry;
+}
+
+bool icache_apply(reg_node_t *node) {
+    if (!service.initialized || !node || node->manufacturer[0] == '\0') {
+        return false;
+    }
+
+    const icache_entry_t *entry = lookup(node);
+    if (!entry) {
+        service.stats.misses++;
+        return false;
+    }
+
+    for (uint8_t i = 0; i < entry->endpoint_count; i++) {
+        const icache_endpoint_t *src = &entry->endpoints[i];
+        reg_endpoint_t *ep = reg_add_endpoint(node, src->endpoint_id, src->profile_id,
+                                              src->device_id);
+        for (uint8_t c = 0; ep && c < src->cluster_count && c < REG_MAX_CLUSTERS; c++) {
+            reg_add_cluster(ep, src->cluster_ids[c],
+                            (src->client_mask & (1u << c)) ? REG_CLUSTER_CLIENT
+                                                           : REG_CLUSTER_SERVER);
+        }
+    }
+
+    service.stats.hits++;
+    LOG_D(ICACHE_MODULE, "Applied %s/%s to " OS_EUI64_FMT, entry->manufacturer,
+          entry->model, OS_EUI64_ARG(node->ieee_addr));
+    return true;
+}
+
+void icache_evict_all(void) {
+    for (uint32_t i = 0; i < ICACHE_SIZE; i++) {
+        service.slots[i].valid = false;
+    }
+    service.next_victim = 0;
+    service.stats.entries = 0;
+}
+
+os_err_t icache_get_stats(icache_stats_t *stats) {
+    if (!stats) {
+        return OS_ERR_INVALID_ARG;
+    }
+    *stats = service.stats;
+    return OS_OK;
+}
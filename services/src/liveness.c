@@ -0,0 +1,348 @@
+/**
+ * @file liveness.c
+ * @brief Device liveness service implementation
+ *
+ * ESP32-C6 Zigbee Bridge OS - Liveness sweeper
+ *
+ * Each READY node has one entry in a binary min-heap keyed by the tick at
+ * which it would expire. reg_touch_node() only updates last_seen, so heap
+ * keys are allowed to go stale: when an entry reaches the top it is checked
+ * against the node's current last_seen and either expired or pushed back to
+ * its real deadline. A sweep therefore costs O(k log n) for k due entries
+ * rather than a scan of the whole registry. Each node's heap position is
+ * kept by registry slot, so arming and disarming are O(log n) as well.
+ *
+ * Nodes are touched by every inbound frame: attribute reports through
+ * cap_handle_attribute_report_by_node(), read responses here and command
+ * confirms in the command scheduler.
+ */
+
+#include "liveness.h"
+#include "registry.h"
+#include "os.h"
+#include <string.h>
+
+#define LIVENESS_MODULE "LIVE"
+
+/* Heap entry */
+typedef struct {
+    os_tick_t expiry;
+    os_eui64_t ieee_addr;       /* Guards against slot reuse */
+    uint16_t slot;
+} live_entry_t;
+
+/* Service state */
+static struct {
+    bool initialized;
+    live_entry_t heap[REG_MAX_NODES];
+    uint32_t heap_size;
+    int16_t heap_pos[REG_MAX_NODES];    /* Slot -> heap index, -1 if unarmed */
+    os_time_ms_t timeout_mains_ms;
+    os_time_ms_t timeout_battery_ms;
+    liveness_stats_t stats;
+} service = {0};
+
+/* Wrap-safe tick comparison: true if a is before b */
+static inline bool tick_before(os_tick_t a, os_tick_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static os_tick_t node_expiry(const reg_node_t *node) {
+    return node->last_seen +
+           OS_MS_TO_TICKS(liveness_get_timeout(node->power_source));
+}
+
+/* Heap helpers */
+
+static void heap_set(uint32_t idx, const live_entry_t *entry) {
+    service.heap[idx] = *entry;
+    service.heap_pos[entry->slot] = (int16_t)idx;
+}
+
+static void heap_sift_up(uint32_t idx) {
+    live_entry_t entry = service.heap[idx];
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (!tick_before(entry.expiry, service.heap[parent].expiry)) {
+            break;
+        }
+        heap_set(idx, &service.heap[parent]);
+        idx = parent;
+    }
+    heap_set(idx, &entry);
+}
+
+static void heap_sift_down(uint32_t idx) {
+    live_entry_t entry = service.heap[idx];
+    for (;;) {
+        uint32_t child = 2 * idx + 1;
+        if (child >= service.heap_size) {
+            break;
+        }
+        if (child + 1 < service.heap_size &&
+            tick_before(service.heap[child + 1].expiry,
+                        service.heap[child].expiry)) {
+            child++;
+        }
+        if (!tick_before(service.heap[child].expiry, entry.expiry)) {
+            break;
+        }
+        heap_set(idx, &service.heap[child]);
+        idx = child;
+    }
+    heap_set(idx, &entry);
+}
+
+static void heap_remove(uint32_t idx) {
+    service.heap_pos[service.heap[idx].slot] = -1;
+    service.heap_size--;
+    if (idx == service.heap_size) {
+        return;
+    }
+    uint16_t moved = service.heap[service.heap_size].slot;
+    heap_set(idx, &service.heap[service.heap_size]);
+    heap_sift_down(idx);
+    heap_sift_up((uint32_t)service.heap_pos[moved]);
+}
+
+/* Arm or re-key a node */
+static void arm_node(const reg_node_t *node) {
+    int32_t slot = reg_node_slot(node);
+    if (slot < 0) {
+        return;
+    }
+
+    live_entry_t entry = {
+        .expiry = node_expiry(node),
+        .ieee_addr = node->ieee_addr,
+        .slot = (uint16_t)slot,
+    };
+
+    int16_t pos = service.heap_pos[slot];
+    if (pos >= 0) {
+        heap_set((uint32_t)pos, &entry);
+        heap_sift_down((uint32_t)pos);
+        heap_sift_up((uint32_t)service.heap_pos[slot]);
+        return;
+    }
+
+    heap_set(service.heap_size++, &entry);
+    heap_sift_up(service.heap_size - 1);
+}
+
+/* Drop a node's entry, found through its registry slot */
+static void disarm_slot(int32_t slot, os_eui64_t ieee_addr) {
+    if (slot < 0 || slot >= REG_MAX_NODES) {
+        return;
+    }
+    int16_t pos = service.heap_pos[slot];
+    if (pos >= 0 && service.heap[pos].ieee_addr == ieee_addr) {
+        heap_remove((uint32_t)pos);
+    }
+}
+
+/* Event handlers */
+
+static void handle_state_changed(const os_event_t *event, void *ctx) {
+    (void)ctx;
+
+    if (event->payload_len < sizeof(reg_state_event_t)) {
+        return;
+    }
+
+    reg_state_event_t change;
+    memcpy(&change, event->payload, sizeof(change));
+
+    /* A node gone from the registry is disarmed by its leave event */
+    reg_node_t *node = reg_find_node(change.ieee_addr);
+    if (node && node->state == REG_STATE_READY) {
+        arm_node(node);
+    } else if (node) {
+        disarm_slot(reg_node_slot(node), change.ieee_addr);
+    }
+}
+
+static void handle_device_left(const os_event_t *event, void *ctx) {
+    (void)ctx;
+
+    if (event->payload_len < sizeof(os_eui64_t)) {
+        return;
+    }
+
+    /* Removed from the registry: the event names the slot. Reported by
+     * the driver: the node is still registered */
+    reg_left_event_t left;
+    if (event->payload_len >= sizeof(left)) {
+        memcpy(&left, event->payload, sizeof(left));
+        disarm_slot(left.slot, left.ieee_addr);
+        return;
+    }
+
+    memcpy(&left.ieee_addr, event->payload, sizeof(left.ieee_addr));
+    reg_node_t *node = reg_find_node(left.ieee_addr);
+    if (node) {
+        disarm_slot(reg_node_slot(node), left.ieee_addr);
+    }
+}
+
+/* Any frame from a node shows it is alive. Every event in the subscribed
+ * range starts with the sender's address */
+static void handle_node_frame(const os_event_t *event, void *ctx) {
+    (void)ctx;
+
+    if (event->payload_len < sizeof(os_eui64_t)) {
+        return;
+    }
+
+    os_eui64_t ieee_addr;
+    memcpy(&ieee_addr, event->payload, sizeof(ieee_addr));
+    reg_touch_node(reg_find_node(ieee_addr));
+}
+
+os_err_t liveness_init(void) {
+    if (service.initialized) {
+        return OS_ERR_ALREADY_EXISTS;
+    }
+
+    memset(&service, 0, sizeof(service));
+    memset(service.heap_pos, -1, sizeof(service.heap_pos));
+    service.timeout_mains_ms = LIVENESS_TIMEOUT_MAINS_MS;
+    service.timeout_battery_ms = LIVENESS_TIMEOUT_BATTERY_MS;
+    service.initialized = true;
+
+    /* Seed from nodes that are already operational */
+    reg_iter_t it;
+    reg_node_t *node;
+    reg_iter_init(&it);
+    while ((node = reg_iter_next(&it)) != NULL) {
+        if (node->state == REG_STATE_READY) {
+            arm_node(node);
+        }
+    }
+
+    os_event_filter_t filter = {OS_EVENT_REG_NODE_STATE_CHANGED,
+                                OS_EVENT_REG_NODE_STATE_CHANGED};
+    os_event_subscribe(&filter, handle_state_changed, NULL);
+
+    filter.type_min = OS_EVENT_ZB_DEVICE_LEFT;
+    filter.type_max = OS_EVENT_ZB_DEVICE_LEFT;
+    os_event_subscribe(&filter, handle_device_left, NULL);
+
+    filter.type_min = OS_EVENT_ZB_ATTR_REPORT;
+    filter.type_max = OS_EVENT_ZB_ATTR_READ;
+    os_event_subscribe(&filter, handle_node_frame, NULL);
+
+    LOG_I(LIVENESS_MODULE, "Liveness service initialized (%lu armed)",
+          (unsigned long)service.heap_size);
+
+    return OS_OK;
+}
+
+os_err_t liveness_set_timeout(reg_power_source_t power_source,
+                              os_time_ms_t timeout_ms) {
+    if (timeout_ms == 0) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    if (power_source == REG_POWER_MAINS || power_source == REG_POWER_DC) {
+        service.timeout_mains_ms = timeout_ms;
+    } else {
+        service.timeout_battery_ms = timeout_ms;
+    }
+
+    /* Re-key every armed node and rebuild the heap */
+    for (uint32_t i = 0; i < service.heap_size; i++) {
+        reg_node_t *node = reg_get_node_by_slot(service.heap[i].slot);
+        if (node && node->ieee_addr == service.heap[i].ieee_addr) {
+            service.heap[i].expiry = node_expiry(node);
+        }
+    }
+    for (uint32_t i = service.heap_size / 2; i-- > 0;) {
+        heap_sift_down(i);
+    }
+
+    return OS_OK;
+}
+
+os_time_ms_t liveness_get_timeout(reg_power_source_t power_source) {
+    if (power_source == REG_POWER_MAINS || power_source == REG_POWER_DC) {
+        return service.timeout_mains_ms;
+    }
+    return service.timeout_battery_ms;
+}
+
+uint32_t liveness_process(void) {
+    if (!service.initialized) {
+        return 0;
+    }
+
+    os_tick_t now = os_now_ticks();
+    uint32_t expired = 0;
+
+    while (service.heap_size > 0 && !tick_before(now, service.heap[0].expiry)) {
+        live_entry_t *top = &service.heap[0];
+        reg_node_t *node = reg_get_node_by_slot(top->slot);
+
+        if (!node || node->ieee_addr != top->ieee_addr ||
+            node->state != REG_STATE_READY) {
+            heap_remove(0);
+            continue;
+        }
+
+        /* Node was heard from since it was armed: push back */
+        os_tick_t expiry = node_expiry(node);
+        if (tick_before(now, expiry)) {
+            top->expiry = expiry;
+            heap_sift_down(0);
+            service.stats.rearmed++;
+            continue;
+        }
+
+        heap_remove(0);
+        LOG_W(LIVENESS_MODULE, "Node " OS_EUI64_FMT " silent for %lu ms",
+              OS_EUI64_ARG(node->ieee_addr),
+              (unsigned long)OS_TICKS_TO_MS(now - node->last_seen));
+        reg_set_state(node, REG_STATE_OFFLINE);
+        service.stats.expired++;
+        expired++;
+    }
+
+    return expired;
+}
+
+os_time_ms_t liveness_next_due_ms(void) {
+    if (service.heap_size == 0) {
+        return LIVENESS_MAX_SLEEP_MS;
+    }
+
+    os_tick_t now = os_now_ticks();
+    if (!tick_before(now, service.heap[0].expiry)) {
+        return 0;
+    }
+
+    os_time_ms_t due = OS_TICKS_TO_MS(service.heap[0].expiry - now);
+    return due < LIVENESS_MAX_SLEEP_MS ? due : LIVENESS_MAX_SLEEP_MS;
+}
+
+os_err_t liveness_get_stats(liveness_stats_t *stats) {
+    if (!stats) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    *stats = service.stats;
+    stats->tracked = service.heap_size;
+    return OS_OK;
+}
+
+void liveness_task(void *arg) {
+    (void)arg;
+
+    LOG_I(LIVENESS_MODULE, "Liveness task started");
+
+    while (1) {
+        liveness_process();
+
+        os_time_ms_t sleep_ms = liveness_next_due_ms();
+        os_sleep(sleep_ms > 0 ? sleep_ms : 1);
+    }
+}
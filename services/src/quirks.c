@@ -4,18 +4,37 @@
  * 
  * ESP32-C6 Zigbee Bridge OS - Device quirks system
  * 
- * Pre-defined table of quirks for non-standard Zigbee devices.
+ * Pre-defined table of quirks for non-standard Zigbee devices, optionally
+ * replaced at boot by a database compiled with tools/quirks_compile.py
+ * (see quirks_db.h).
+ *
+ * quirks_init() compiles the table into an index: manufacturers are hashed
+ * into an open-addressed table, and each manufacturer owns a byte trie of
+ * its model strings. A lookup is one hash probe, one strcmp on the
+ * manufacturer and a walk of at most strlen(model) trie nodes, regardless
+ * of table size. Resolved entries are cached on the registry node by
+ * quirks_for_node(), so the report path does not look anything up.
+ *
+ * A loaded database carries the same index in its image and is searched in
+ * place; only entries that match a device are decoded into RAM.
  */
 
 #include "quirks.h"
+#include "quirks_db.h"
+#include "registry.h"
 #include "os.h"
 #include <string.h>
-#include <math.h>
 
-#define QUIRKS_MODULE "QUIRKS"
+#ifdef OS_PLATFORM_HOST
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include "esp_partition.h"
+#endif
 
-/* Epsilon for floating point comparisons */
-#define QUIRKS_FLOAT_EPSILON 1e-6f
+#define QUIRKS_MODULE "QUIRKS"
 
 /* Built-in quirks table */
 static const quirk_entry_t quirks_table[] = {
@@ -73,7 +92,7 @@ static const quirk_entry_t quirks_table[] = {
             {
                 .type = QUIRK_ACTION_SCALE_NUMERIC,
                 .target_cap = CAP_SENSOR_TEMPERATURE,
-                .params.scale = { .multiplier = 0.1f, .offset = 0.0f }
+                .params.scale = { .multiplier = 1, .divisor = 10, .offset = 0 }
             }
         },
         .action_count = 1
@@ -90,31 +109,209 @@ static const char *action_names[] = {
     "scale_numeric",
     "remap_attribute",
     "override_reporting",
-    "ignore_spurious"
+    "ignore_spurious_reports",
+    "state_policy"
 };
 
+#define ACTION_NAME_COUNT (sizeof(action_names) / sizeof(action_names[0]))
+
+/* Database entry materialized as a quirk_entry_t */
+typedef struct {
+    uint16_t index;             /* Database entry index, QDB_NONE if free */
+    quirk_entry_t entry;
+} pool_slot_t;
+
 /* Service state */
 static struct {
     bool initialized;
-} service = {0};
+    bool indexed;               /* False: built-in lookups scan the table */
+    uint32_t generation;        /* Bumped whenever a cached entry may go stale */
+    /* Index of the built-in table */
+    qdb_bucket_t mfr[QUIRKS_MFR_BUCKETS];
+    qdb_trie_node_t trie[QUIRKS_TRIE_MAX_NODES];
+    uint32_t trie_count;
+    /* Loaded database, used in place (hdr NULL: built-in table active) */
+    struct {
+        const qdb_header_t *hdr;
+        const qdb_bucket_t *buckets;
+        const qdb_trie_node_t *trie;
+        const qdb_entry_t *entries;
+        const qdb_action_t *actions;
+        const char *strings;
+    } db;
+    pool_slot_t pool[QUIRKS_DB_CACHE_ENTRIES];
+    uint32_t pool_next;
+    /* Mapping owned by quirks_load_file() */
+#ifdef OS_PLATFORM_HOST
+    void *map;
+    size_t map_len;
+#else
+    esp_partition_mmap_handle_t map;
+    bool mapped;
+#endif
+} service = {.generation = 1};
 
-os_err_t quirks_init(void) {
-    if (service.initialized) {
-        return OS_ERR_ALREADY_EXISTS;
+/* FNV-1a */
+static uint32_t str_hash(const char *str) {
+    uint32_t h = 2166136261U;
+    while (*str) {
+        h ^= (uint8_t)*str++;
+        h *= 16777619U;
     }
-    
-    service.initialized = true;
-    
-    LOG_I(QUIRKS_MODULE, "Quirks service initialized (%zu entries)", QUIRKS_TABLE_SIZE);
-    
-    return OS_OK;
+    return h;
 }
 
-const quirk_entry_t *quirks_find(const char *manufacturer, const char *model) {
-    if (!manufacturer || !model) {
-        return NULL;
+/* CRC-32 (IEEE 802.3, reflected), bitwise: only run on load */
+static uint32_t crc32_calc(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFFU;
+    while (len--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+        }
     }
-    
+    return ~crc;
+}
+
+static const char *entry_manufacturer(bool from_db, uint16_t idx) {
+    if (from_db) {
+        return service.db.strings + service.db.entries[idx].manufacturer;
+    }
+    return quirks_table[idx].manufacturer;
+}
+
+/* Bucket holding the manufacturer, else the empty bucket ending its probe
+ * sequence; UINT32_MAX if the table is full */
+static uint32_t mfr_probe(const qdb_bucket_t *buckets, uint32_t count,
+                          bool from_db, const char *manufacturer, uint32_t hash) {
+    uint32_t mask = count - 1;
+    for (uint32_t n = 0, i = hash & mask; n < count; n++, i = (i + 1) & mask) {
+        const qdb_bucket_t *b = &buckets[i];
+        if (b->root == QDB_NONE) {
+            return i;
+        }
+        if (b->hash == hash &&
+            strcmp(entry_manufacturer(from_db, b->first), manufacturer) == 0) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static uint16_t trie_child(const qdb_trie_node_t *trie, uint16_t node, char c) {
+    for (uint16_t i = trie[node].child; i != QDB_NONE; i = trie[i].sibling) {
+        if (trie[i].c == (uint8_t)c) {
+            return i;
+        }
+    }
+    return QDB_NONE;
+}
+
+/* Lowest matching entry index, QDB_NONE if none */
+static uint16_t index_lookup(const qdb_bucket_t *buckets, uint32_t bucket_count,
+                             const qdb_trie_node_t *trie, bool from_db,
+                             const char *manufacturer, const char *model) {
+    uint32_t bi = mfr_probe(buckets, bucket_count, from_db, manufacturer,
+                            str_hash(manufacturer));
+    if (bi == UINT32_MAX || buckets[bi].root == QDB_NONE) {
+        return QDB_NONE;
+    }
+
+    uint16_t best = QDB_NONE;
+    uint16_t node = buckets[bi].root;
+    for (const char *p = model;; p++) {
+        const qdb_trie_node_t *t = &trie[node];
+        if (t->prefix < best) {
+            best = t->prefix;
+        }
+        if (*p == '\0') {
+            if (t->exact < best) {
+                best = t->exact;
+            }
+            break;
+        }
+        node = trie_child(trie, node, *p);
+        if (node == QDB_NONE) {
+            break;
+        }
+    }
+    return best;
+}
+
+static uint16_t trie_alloc(char c) {
+    if (service.trie_count >= QUIRKS_TRIE_MAX_NODES) {
+        return QDB_NONE;
+    }
+    uint16_t idx = (uint16_t)service.trie_count++;
+    qdb_trie_node_t *t = &service.trie[idx];
+    t->child = QDB_NONE;
+    t->sibling = QDB_NONE;
+    t->exact = QDB_NONE;
+    t->prefix = QDB_NONE;
+    t->c = (uint8_t)c;
+    t->reserved = 0;
+    return idx;
+}
+
+static bool index_add(uint16_t idx) {
+    const quirk_entry_t *entry = &quirks_table[idx];
+    uint32_t hash = str_hash(entry->manufacturer);
+    uint32_t bi = mfr_probe(service.mfr, QUIRKS_MFR_BUCKETS, false,
+                            entry->manufacturer, hash);
+    if (bi == UINT32_MAX) {
+        return false;
+    }
+    qdb_bucket_t *b = &service.mfr[bi];
+    if (b->root == QDB_NONE) {
+        b->root = trie_alloc('\0');
+        if (b->root == QDB_NONE) {
+            return false;
+        }
+        b->hash = hash;
+        b->first = idx;
+    }
+
+    uint16_t node = b->root;
+    for (const char *p = entry->model; *p; p++) {
+        /* Append to the sibling list, so links always point to newer nodes
+         * (the same layout quirks_compile.py emits) */
+        uint16_t *link = &service.trie[node].child;
+        while (*link != QDB_NONE && service.trie[*link].c != (uint8_t)*p) {
+            link = &service.trie[*link].sibling;
+        }
+        if (*link == QDB_NONE) {
+            uint16_t next = trie_alloc(*p);
+            if (next == QDB_NONE) {
+                return false;
+            }
+            *link = next;
+        }
+        node = *link;
+    }
+
+    /* Entries are added in table order, so the first one wins as before */
+    uint16_t *slot = entry->prefix_match ? &service.trie[node].prefix
+                                         : &service.trie[node].exact;
+    if (*slot == QDB_NONE) {
+        *slot = idx;
+    }
+    return true;
+}
+
+static bool index_build(void) {
+    memset(service.mfr, 0xFF, sizeof(service.mfr));    /* root = QDB_NONE */
+    service.trie_count = 0;
+    service.generation++;
+
+    for (size_t i = 0; i < QUIRKS_TABLE_SIZE; i++) {
+        if (!index_add((uint16_t)i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const quirk_entry_t *scan_find(const char *manufacturer, const char *model) {
     for (size_t i = 0; i < QUIRKS_TABLE_SIZE; i++) {
         const quirk_entry_t *entry = &quirks_table[i];
         
@@ -138,9 +335,357 @@ const quirk_entry_t *quirks_find(const char *manufacturer, const char *model) {
     return NULL;
 }
 
+static void decode_action(const qdb_action_t *in, quirk_action_t *out) {
+    out->type = (quirk_action_type_t)in->type;
+    out->target_cap = (cap_id_t)in->target_cap;
+
+    switch (out->type) {
+        case QUIRK_ACTION_CLAMP_RANGE:
+            out->params.clamp.min = (int32_t)in->params[0];
+            out->params.clamp.max = (int32_t)in->params[1];
+            break;
+
+        case QUIRK_ACTION_INVERT_BOOLEAN:
+            out->params.invert.enabled = in->params[0] != 0;
+            break;
+
+        case QUIRK_ACTION_SCALE_NUMERIC:
+            out->params.scale.multiplier = (int32_t)in->params[0];
+            out->params.scale.divisor = (int32_t)in->params[1];
+            out->params.scale.offset = (int32_t)in->params[2];
+            break;
+
+        case QUIRK_ACTION_REMAP_ATTRIBUTE:
+            out->params.remap.cluster_id = (uint16_t)in->params[0];
+            out->params.remap.attr_id = (uint16_t)in->params[1];
+            break;
+
+        case QUIRK_ACTION_OVERRIDE_REPORTING:
+            out->params.reporting.min_interval_s = (uint16_t)in->params[0];
+            out->params.reporting.max_interval_s = (uint16_t)in->params[1];
+            out->params.reporting.reportable_change = in->params[2];
+            break;
+
+        case QUIRK_ACTION_IGNORE_SPURIOUS:
+            out->params.spurious.window_ms = in->params[0];
+            break;
+
+        case QUIRK_ACTION_STATE_POLICY:
+            out->params.policy.deadband = (int32_t)in->params[0];
+            out->params.policy.min_interval_ms = in->params[1];
+            out->params.policy.max_staleness_ms = in->params[2];
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Get a database entry as a quirk_entry_t. Entries are decoded into a
+ * small pool; reusing a slot bumps the generation, since a node may still
+ * cache a pointer to the entry it held. */
+static const quirk_entry_t *db_entry(uint16_t idx) {
+    for (uint32_t i = 0; i < QUIRKS_DB_CACHE_ENTRIES; i++) {
+        if (service.pool[i].index == idx) {
+            return &service.pool[i].entry;
+        }
+    }
+
+    pool_slot_t *slot = &service.pool[service.pool_next];
+    service.pool_next = (service.pool_next + 1) % QUIRKS_DB_CACHE_ENTRIES;
+    if (slot->index != QDB_NONE) {
+        service.generation++;
+    }
+
+    const qdb_entry_t *e = &service.db.entries[idx];
+    quirk_entry_t *q = &slot->entry;
+    memset(q, 0, sizeof(*q));
+    q->manufacturer = service.db.strings + e->manufacturer;
+    q->model = service.db.strings + e->model;
+    q->prefix_match = (e->flags & QDB_ENTRY_PREFIX) != 0;
+    q->action_count = e->action_count;
+    for (uint8_t i = 0; i < e->action_count; i++) {
+        decode_action(&service.db.actions[e->first_action + i], &q->actions[i]);
+    }
+    slot->index = idx;
+    return q;
+}
+
+static uint32_t align4(uint32_t n) {
+    return (n + 3U) & ~3U;
+}
+
+/* Check a database image before using it in place: sizes, CRC, and that
+ * every index and string offset stays inside its section */
+static os_err_t db_validate(const uint8_t *data, size_t len) {
+    if (len < sizeof(qdb_header_t)) {
+        return OS_ERR_INVALID_ARG;
+    }
+    const qdb_header_t *hdr = (const qdb_header_t *)data;
+    if (hdr->magic != QDB_MAGIC) {
+        return OS_ERR_NOT_FOUND;    /* Erased partition or not a database */
+    }
+    if (hdr->version != QDB_VERSION || hdr->bucket_count == 0 ||
+        (hdr->bucket_count & (hdr->bucket_count - 1)) != 0 ||
+        hdr->strings_len == 0 || hdr->strings_len > len) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    uint32_t trie_off = sizeof(qdb_header_t) + hdr->bucket_count * sizeof(qdb_bucket_t);
+    uint32_t entries_off = align4(trie_off + hdr->trie_count * sizeof(qdb_trie_node_t));
+    uint32_t actions_off = entries_off + hdr->entry_count * sizeof(qdb_entry_t);
+    uint32_t strings_off = actions_off + hdr->action_count * sizeof(qdb_action_t);
+    if (strings_off > len - hdr->strings_len) {
+        return OS_ERR_INVALID_ARG;
+    }
+    size_t total = strings_off + hdr->strings_len;
+    if (crc32_calc(data + sizeof(qdb_header_t), total - sizeof(qdb_header_t)) != hdr->crc32) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    const qdb_bucket_t *buckets = (const qdb_bucket_t *)(data + sizeof(qdb_header_t));
+    const qdb_trie_node_t *trie = (const qdb_trie_node_t *)(data + trie_off);
+    const qdb_entry_t *entries = (const qdb_entry_t *)(data + entries_off);
+    const qdb_action_t *actions = (const qdb_action_t *)(data + actions_off);
+    const char *strings = (const char *)(data + strings_off);
+
+    if (strings[hdr->strings_len - 1] != '\0') {
+        return OS_ERR_INVALID_ARG;
+    }
+    for (uint32_t i = 0; i < hdr->bucket_count; i++) {
+        if (buckets[i].root != QDB_NONE &&
+            (buckets[i].root >= hdr->trie_count || buckets[i].first >= hdr->entry_count)) {
+            return OS_ERR_INVALID_ARG;
+        }
+    }
+    /* Links must point forward, so a corrupt image cannot make a walk loop */
+    for (uint32_t i = 0; i < hdr->trie_count; i++) {
+        const qdb_trie_node_t *t = &trie[i];
+        if ((t->child != QDB_NONE && (t->child <= i || t->child >= hdr->trie_count)) ||
+            (t->sibling != QDB_NONE && (t->sibling <= i || t->sibling >= hdr->trie_count)) ||
+            (t->exact != QDB_NONE && t->exact >= hdr->entry_count) ||
+            (t->prefix != QDB_NONE && t->prefix >= hdr->entry_count)) {
+            return OS_ERR_INVALID_ARG;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->entry_count; i++) {
+        const qdb_entry_t *e = &entries[i];
+        if (e->manufacturer >= hdr->strings_len || e->model >= hdr->strings_len ||
+            e->action_count > QUIRK_MAX_ACTIONS ||
+            (uint32_t)e->first_action + e->action_count > hdr->action_count) {
+            return OS_ERR_INVALID_ARG;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->action_count; i++) {
+        if (actions[i].type >= ACTION_NAME_COUNT || actions[i].target_cap >= CAP_MAX) {
+            return OS_ERR_INVALID_ARG;
+        }
+    }
+
+    return OS_OK;
+}
+
+static os_err_t db_activate(const void *data, size_t len) {
+    if (!data || ((uintptr_t)data & 3U) != 0) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    os_err_t err = db_validate(data, len);
+    if (err != OS_OK) {
+        return err;
+    }
+
+    const uint8_t *base = data;
+    const qdb_header_t *hdr = data;
+    uint32_t trie_off = sizeof(qdb_header_t) + hdr->bucket_count * sizeof(qdb_bucket_t);
+    uint32_t entries_off = align4(trie_off + hdr->trie_count * sizeof(qdb_trie_node_t));
+    uint32_t actions_off = entries_off + hdr->entry_count * sizeof(qdb_entry_t);
+
+    service.db.hdr = hdr;
+    service.db.buckets = (const qdb_bucket_t *)(base + sizeof(qdb_header_t));
+    service.db.trie = (const qdb_trie_node_t *)(base + trie_off);
+    service.db.entries = (const qdb_entry_t *)(base + entries_off);
+    service.db.actions = (const qdb_action_t *)(base + actions_off);
+    service.db.strings = (const char *)(base + actions_off +
+                                        hdr->action_count * sizeof(qdb_action_t));
+    for (uint32_t i = 0; i < QUIRKS_DB_CACHE_ENTRIES; i++) {
+        service.pool[i].index = QDB_NONE;
+    }
+    service.pool_next = 0;
+    service.generation++;
+
+    LOG_I(QUIRKS_MODULE, "Quirk database loaded (%u entries, %u trie nodes)",
+          hdr->entry_count, hdr->trie_count);
+    return OS_OK;
+}
+
+static void map_release(void) {
+#ifdef OS_PLATFORM_HOST
+    if (service.map) {
+        munmap(service.map, service.map_len);
+        service.map = NULL;
+        service.map_len = 0;
+    }
+#else
+    if (service.mapped) {
+        esp_partition_munmap(service.map);
+        service.mapped = false;
+    }
+#endif
+}
+
+os_err_t quirks_init(void) {
+    if (service.initialized) {
+        return OS_ERR_ALREADY_EXISTS;
+    }
+    
+    service.indexed = index_build();
+    if (!service.indexed) {
+        LOG_W(QUIRKS_MODULE, "Quirk index full, falling back to table scan");
+    }
+    service.initialized = true;
+    
+    LOG_I(QUIRKS_MODULE, "Quirks service initialized (%zu entries, %lu trie nodes)",
+          QUIRKS_TABLE_SIZE, (unsigned long)service.trie_count);
+    
+    return OS_OK;
+}
+
+os_err_t quirks_load_db(const void *data, size_t len) {
+    os_err_t err = db_activate(data, len);
+    if (err == OS_OK) {
+        map_release();
+    }
+    return err;
+}
+
+os_err_t quirks_load_file(const char *path) {
+    if (!path) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+#ifdef OS_PLATFORM_HOST
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return OS_ERR_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return OS_ERR_INVALID_ARG;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return OS_ERR_NO_MEM;
+    }
+
+    os_err_t err = db_activate(map, len);
+    if (err != OS_OK) {
+        munmap(map, len);
+        return err;
+    }
+    map_release();
+    service.map = map;
+    service.map_len = len;
+#else
+    const esp_partition_t *part = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, path);
+    if (!part) {
+        return OS_ERR_NOT_FOUND;
+    }
+    const void *ptr = NULL;
+    esp_partition_mmap_handle_t map;
+    if (esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA,
+                           &ptr, &map) != ESP_OK) {
+        return OS_ERR_NO_MEM;
+    }
+
+    os_err_t err = db_activate(ptr, part->size);
+    if (err != OS_OK) {
+        esp_partition_munmap(map);
+        return err;
+    }
+    map_release();
+    service.map = map;
+    service.mapped = true;
+#endif
+
+    return OS_OK;
+}
+
+void quirks_load_builtin(void) {
+    if (!service.db.hdr) {
+        return;
+    }
+    memset(&service.db, 0, sizeof(service.db));
+    service.generation++;
+    map_release();
+    LOG_I(QUIRKS_MODULE, "Using built-in quirks table");
+}
+
+const quirk_entry_t *quirks_find(const char *manufacturer, const char *model) {
+    if (!manufacturer || !model) {
+        return NULL;
+    }
+    
+    if (service.db.hdr) {
+        uint16_t idx = index_lookup(service.db.buckets, service.db.hdr->bucket_count,
+                                    service.db.trie, true, manufacturer, model);
+        return idx == QDB_NONE ? NULL : db_entry(idx);
+    }
+    if (service.indexed) {
+        uint16_t idx = index_lookup(service.mfr, QUIRKS_MFR_BUCKETS, service.trie,
+                                    false, manufacturer, model);
+        return idx == QDB_NONE ? NULL : &quirks_table[idx];
+    }
+    return scan_find(manufacturer, model);
+}
+
+const quirk_entry_t *quirks_for_node(reg_node_t *node) {
+    if (!node) {
+        return NULL;
+    }
+    
+    if (node->quirk_gen != service.generation) {
+        node->quirk = quirks_find(node->manufacturer, node->model);
+        node->quirk_gen = service.generation;
+    }
+    return node->quirk;
+}
+
+static int32_t sat_i32(int64_t v) {
+    if (v > INT32_MAX) return INT32_MAX;
+    if (v < INT32_MIN) return INT32_MIN;
+    return (int32_t)v;
+}
+
+static int32_t sat_sub(int32_t a, int32_t b) {
+    return sat_i32((int64_t)a - b);
+}
+
+/* value * mul / div + offset in 64-bit integers, rounded half away from zero */
+static int32_t scale_apply(int32_t value, int32_t mul, int32_t div, int32_t offset) {
+    int64_t num = (int64_t)value * mul;
+    int64_t den = div ? div : 1;
+    if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+    int64_t q = (num >= 0 ? num + den / 2 : num - den / 2) / den;
+    return sat_i32(q + offset);
+}
+
 os_err_t quirks_apply_value(const char *manufacturer, const char *model,
                              cap_id_t cap_id, cap_value_t *value,
                              quirk_result_t *result) {
+    return quirks_entry_apply_value(quirks_find(manufacturer, model), cap_id,
+                                    value, result);
+}
+
+os_err_t quirks_entry_apply_value(const quirk_entry_t *entry, cap_id_t cap_id,
+                                  cap_value_t *value, quirk_result_t *result) {
     if (!value) {
         return OS_ERR_INVALID_ARG;
     }
@@ -150,7 +695,6 @@ os_err_t quirks_apply_value(const char *manufacturer, const char *model,
         result->actions_applied = 0;
     }
     
-    const quirk_entry_t *entry = quirks_find(manufacturer, model);
     if (!entry) {
         return OS_OK;  /* No quirks, value unchanged */
     }
@@ -187,7 +731,9 @@ os_err_t quirks_apply_value(const char *manufacturer, const char *model,
                 break;
                 
             case QUIRK_ACTION_SCALE_NUMERIC:
-                value->f = value->f * action->params.scale.multiplier + action->params.scale.offset;
+                value->i = scale_apply(value->i, action->params.scale.multiplier,
+                                       action->params.scale.divisor,
+                                       action->params.scale.offset);
                 LOG_D(QUIRKS_MODULE, "Applied scale_numeric to cap %d", cap_id);
                 break;
                 
@@ -207,6 +753,12 @@ os_err_t quirks_apply_value(const char *manufacturer, const char *model,
 os_err_t quirks_apply_command(const char *manufacturer, const char *model,
                                cap_id_t cap_id, cap_value_t *value,
                                quirk_result_t *result) {
+    return quirks_entry_apply_command(quirks_find(manufacturer, model), cap_id,
+                                      value, result);
+}
+
+os_err_t quirks_entry_apply_command(const quirk_entry_t *entry, cap_id_t cap_id,
+                                    cap_value_t *value, quirk_result_t *result) {
     if (!value) {
         return OS_ERR_INVALID_ARG;
     }
@@ -216,7 +768,6 @@ os_err_t quirks_apply_command(const char *manufacturer, const char *model,
         result->actions_applied = 0;
     }
     
-    const quirk_entry_t *entry = quirks_find(manufacturer, model);
     if (!entry) {
         return OS_OK;  /* No quirks, value unchanged */
     }
@@ -253,8 +804,10 @@ os_err_t quirks_apply_command(const char *manufacturer, const char *model,
                 
             case QUIRK_ACTION_SCALE_NUMERIC:
                 /* Reverse scale for commands */
-                if (fabsf(action->params.scale.multiplier) > QUIRKS_FLOAT_EPSILON) {
-                    value->f = (value->f - action->params.scale.offset) / action->params.scale.multiplier;
+                if (action->params.scale.multiplier != 0) {
+                    int32_t divisor = action->params.scale.divisor ? action->params.scale.divisor : 1;
+                    value->i = scale_apply(sat_sub(value->i, action->params.scale.offset),
+                                           divisor, action->params.scale.multiplier, 0);
                 }
                 break;
                 
@@ -271,19 +824,82 @@ os_err_t quirks_apply_command(const char *manufacturer, const char *model,
     return OS_OK;
 }
 
+const cap_policy_t *quirks_get_policy(const char *manufacturer,
+                                      const char *model, cap_id_t cap_id) {
+    return quirks_entry_get_policy(quirks_find(manufacturer, model), cap_id);
+}
+
+const cap_policy_t *quirks_entry_get_policy(const quirk_entry_t *entry,
+                                            cap_id_t cap_id) {
+    if (!entry || entry->action_count > QUIRK_MAX_ACTIONS) {
+        return NULL;
+    }
+    
+    for (uint8_t i = 0; i < entry->action_count; i++) {
+        const quirk_action_t *action = &entry->actions[i];
+        if (action->type == QUIRK_ACTION_STATE_POLICY &&
+            action->target_cap == cap_id) {
+            return &action->params.policy;
+        }
+    }
+    
+    return NULL;
+}
+
+cap_id_t quirks_entry_remap_attribute(const quirk_entry_t *entry,
+                                      uint16_t cluster_id, uint16_t attr_id) {
+    if (!entry || entry->action_count > QUIRK_MAX_ACTIONS) {
+        return CAP_UNKNOWN;
+    }
+    
+    for (uint8_t i = 0; i < entry->action_count; i++) {
+        const quirk_action_t *action = &entry->actions[i];
+        if (action->type == QUIRK_ACTION_REMAP_ATTRIBUTE &&
+            action->params.remap.cluster_id == cluster_id &&
+            action->params.remap.attr_id == attr_id) {
+            return action->target_cap;
+        }
+    }
+    
+    return CAP_UNKNOWN;
+}
+
+uint32_t quirks_entry_get_spurious_window(const quirk_entry_t *entry,
+                                          cap_id_t cap_id) {
+    if (!entry || entry->action_count > QUIRK_MAX_ACTIONS) {
+        return 0;
+    }
+    
+    for (uint8_t i = 0; i < entry->action_count; i++) {
+        const quirk_action_t *action = &entry->actions[i];
+        if (action->type == QUIRK_ACTION_IGNORE_SPURIOUS &&
+            action->target_cap == cap_id) {
+            return action->params.spurious.window_ms;
+        }
+    }
+    
+    return 0;
+}
+
 uint32_t quirks_count(void) {
+    if (service.db.hdr) {
+        return service.db.hdr->entry_count;
+    }
     return QUIRKS_TABLE_SIZE;
 }
 
 const quirk_entry_t *quirks_get_entry(uint32_t index) {
-    if (index >= QUIRKS_TABLE_SIZE) {
+    if (index >= quirks_count()) {
         return NULL;
     }
+    if (service.db.hdr) {
+        return db_entry((uint16_t)index);
+    }
     return &quirks_table[index];
 }
 
 const char *quirks_action_name(quirk_action_type_t type) {
-    if (type < sizeof(action_names) / sizeof(action_names[0])) {
+    if (type < ACTION_NAME_COUNT) {
         return action_names[type];
     }
     return "unknown";
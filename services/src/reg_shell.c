@@ -29,15 +29,15 @@ static int cmd_devices(int argc, char *argv[]) {
   printf("------------------ ------ ------------ -------------------- "
          "--------------------\n");
 
-  for (uint32_t i = 0; i < count; i++) {
-    reg_node_info_t info;
-    if (reg_get_node_info(i, &info) == OS_OK) {
-      printf(OS_EUI64_FMT " 0x%04X %-12s %-20.20s %-20.20s\n",
-             OS_EUI64_ARG(info.ieee_addr), info.nwk_addr,
-             reg_state_name(info.state),
-             info.manufacturer[0] ? info.manufacturer : "-",
-             info.model[0] ? info.model : "-");
-    }
+  reg_iter_t it;
+  reg_node_t *node;
+  reg_iter_init(&it);
+  while ((node = reg_iter_next(&it)) != NULL) {
+    printf(OS_EUI64_FMT " 0x%04X %-12s %-20.20s %-20.20s\n",
+           OS_EUI64_ARG(node->ieee_addr), node->nwk_addr,
+           reg_state_name(node->state),
+           node->manufacturer[0] ? node->manufacturer : "-",
+           node->model[0] ? node->model : "-");
   }
 
   printf("\nTotal: %" PRIu32 " device(s)\n", count);
@@ -13,11 +13,23 @@
 
 #define REG_MODULE "REG"
 
+/* Occupancy bitmap words */
+#define REG_SLOT_WORDS ((REG_MAX_NODES + 31) / 32)
+
+/* EUI64 -> slot index: open addressing, at most half full */
+#define REG_INDEX_SIZE (2 * REG_MAX_NODES)
+#define REG_INDEX_EMPTY 0xFFFF
+
 /* Registry storage */
 static struct {
   bool initialized;
   reg_node_t nodes[REG_MAX_NODES];
   uint32_t node_count;
+  uint32_t slot_used[REG_SLOT_WORDS]; /* Bit per valid node slot */
+  uint16_t index[REG_INDEX_SIZE];     /* Node slot, or REG_INDEX_EMPTY */
+  uint32_t generation;
+  reg_snapshot_t snapshots[2]; /* Double-buffered read views */
+  uint32_t snap_current;
 } registry = {0};
 
 /* State names (per 00_context_and_guardrails.yaml FSM) */
@@ -25,12 +37,59 @@ static const char *state_names[] = {"NEW",   "ANNOUNCED", "INTERVIEWING",
                                     "READY", "OFFLINE",   "FAILED",
                                     "STALE", "LEFT"};
 
+/* EUI64 index: lookups by IEEE address (every report, every command) cost
+ * one or two probes instead of a scan of the node table */
+
+static uint32_t index_home(os_eui64_t ieee_addr) {
+  /* Fibonacci hashing spreads the vendor-prefix-heavy EUI64s */
+  return (uint32_t)((ieee_addr * 0x9E3779B97F4A7C15ULL) >> 32) % REG_INDEX_SIZE;
+}
+
+static void index_insert(os_eui64_t ieee_addr, uint32_t slot) {
+  uint32_t i = index_home(ieee_addr);
+  while (registry.index[i] != REG_INDEX_EMPTY) {
+    i = (i + 1) % REG_INDEX_SIZE;
+  }
+  registry.index[i] = (uint16_t)slot;
+}
+
+static void index_remove(os_eui64_t ieee_addr) {
+  uint32_t i = index_home(ieee_addr);
+  while (registry.index[i] != REG_INDEX_EMPTY &&
+         registry.nodes[registry.index[i]].ieee_addr != ieee_addr) {
+    i = (i + 1) % REG_INDEX_SIZE;
+  }
+  if (registry.index[i] == REG_INDEX_EMPTY) {
+    return;
+  }
+
+  /* Backward-shift deletion: pull later entries of the probe run into the
+   * gap unless that would move them before their home position */
+  uint32_t gap = i;
+  uint32_t j = i;
+  while (true) {
+    j = (j + 1) % REG_INDEX_SIZE;
+    if (registry.index[j] == REG_INDEX_EMPTY) {
+      break;
+    }
+    uint32_t home = index_home(registry.nodes[registry.index[j]].ieee_addr);
+    bool movable = gap <= j ? (home <= gap || home > j) : (home <= gap && home > j);
+    if (movable) {
+      registry.index[gap] = registry.index[j];
+      gap = j;
+    }
+  }
+  registry.index[gap] = REG_INDEX_EMPTY;
+}
+
 os_err_t reg_init(void) {
   if (registry.initialized) {
     return OS_ERR_ALREADY_EXISTS;
   }
 
   memset(&registry, 0, sizeof(registry));
+  memset(registry.index, 0xFF, sizeof(registry.index));
+  registry.generation = 1; /* Snapshots start at 0, i.e. stale */
   registry.initialized = true;
 
   LOG_I(REG_MODULE, "Device registry initialized (max %d nodes)",
@@ -51,6 +110,7 @@ reg_node_t *reg_add_node(os_eui64_t ieee_addr, uint16_t nwk_addr) {
           OS_EUI64_ARG(ieee_addr));
     existing->nwk_addr = nwk_addr;
     reg_touch_node(existing);
+    reg_mark_changed(existing);
     return existing;
   }
 
@@ -77,7 +137,11 @@ reg_node_t *reg_add_node(os_eui64_t ieee_addr, uint16_t nwk_addr) {
   node->last_seen = node->join_time;
   node->valid = true;
 
+  uint32_t slot = (uint32_t)(node - registry.nodes);
+  registry.slot_used[slot / 32] |= 1U << (slot % 32);
+  index_insert(ieee_addr, slot);
   registry.node_count++;
+  registry.generation++;
 
   LOG_I(REG_MODULE, "Added node " OS_EUI64_FMT " (nwk=0x%04X)",
         OS_EUI64_ARG(ieee_addr), nwk_addr);
@@ -97,9 +161,11 @@ reg_node_t *reg_find_node(os_eui64_t ieee_addr) {
     return NULL;
   }
 
-  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
-    if (registry.nodes[i].valid && registry.nodes[i].ieee_addr == ieee_addr) {
-      return &registry.nodes[i];
+  for (uint32_t i = index_home(ieee_addr); registry.index[i] != REG_INDEX_EMPTY;
+       i = (i + 1) % REG_INDEX_SIZE) {
+    reg_node_t *node = &registry.nodes[registry.index[i]];
+    if (node->ieee_addr == ieee_addr) {
+      return node;
     }
   }
 
@@ -129,10 +195,15 @@ os_err_t reg_remove_node(os_eui64_t ieee_addr) {
   LOG_I(REG_MODULE, "Removing node " OS_EUI64_FMT, OS_EUI64_ARG(ieee_addr));
 
   /* Emit event before removal */
-  os_event_emit(OS_EVENT_ZB_DEVICE_LEFT, &ieee_addr, sizeof(ieee_addr));
+  uint32_t slot = (uint32_t)(node - registry.nodes);
+  reg_left_event_t left = {ieee_addr, (uint16_t)slot};
+  os_event_emit(OS_EVENT_ZB_DEVICE_LEFT, &left, sizeof(left));
 
+  registry.slot_used[slot / 32] &= ~(1U << (slot % 32));
+  index_remove(ieee_addr);
   node->valid = false;
   registry.node_count--;
+  registry.generation++;
 
   return OS_OK;
 }
@@ -148,18 +219,44 @@ os_err_t reg_set_state(reg_node_t *node, reg_state_t state) {
   }
 
   node->state = state;
+  registry.generation++;
 
   LOG_I(REG_MODULE, "Node " OS_EUI64_FMT " state: %s -> %s",
         OS_EUI64_ARG(node->ieee_addr), state_names[old_state],
         state_names[state]);
 
+  reg_state_event_t payload = {node->ieee_addr, (uint8_t)old_state,
+                               (uint8_t)state};
+  os_event_emit(OS_EVENT_REG_NODE_STATE_CHANGED, &payload, sizeof(payload));
+
   return OS_OK;
 }
 
 void reg_touch_node(reg_node_t *node) {
   if (node && node->valid) {
     node->last_seen = os_now_ticks();
+
+    /* Traffic from a node that went quiet brings it back */
+    if (node->state == REG_STATE_OFFLINE) {
+      reg_set_state(node, REG_STATE_READY);
+    }
+  }
+}
+
+int32_t reg_node_slot(const reg_node_t *node) {
+  if (!node || node < &registry.nodes[0] ||
+      node >= &registry.nodes[REG_MAX_NODES]) {
+    return -1;
   }
+  return (int32_t)(node - &registry.nodes[0]);
+}
+
+reg_node_t *reg_get_node_by_slot(uint32_t slot) {
+  if (!registry.initialized || slot >= REG_MAX_NODES ||
+      !registry.nodes[slot].valid) {
+    return NULL;
+  }
+  return &registry.nodes[slot];
 }
 
 uint32_t reg_node_count(void) { return registry.node_count; }
@@ -191,6 +288,102 @@ os_err_t reg_get_node_info(uint32_t index, reg_node_info_t *info) {
   return OS_ERR_NOT_FOUND;
 }
 
+void reg_iter_init(reg_iter_t *iter) {
+  if (iter) {
+    iter->slot = 0;
+  }
+}
+
+reg_node_t *reg_iter_next(reg_iter_t *iter) {
+  if (!registry.initialized || !iter) {
+    return NULL;
+  }
+
+  while (iter->slot < REG_MAX_NODES) {
+    uint32_t word = iter->slot / 32;
+    uint32_t bits = registry.slot_used[word] >> (iter->slot % 32);
+
+    if (bits == 0) {
+      /* Rest of this word is empty: skip to the next one */
+      iter->slot = (word + 1) * 32;
+      continue;
+    }
+
+    iter->slot += (uint32_t)__builtin_ctz(bits);
+    if (iter->slot >= REG_MAX_NODES) {
+      break;
+    }
+    return &registry.nodes[iter->slot++];
+  }
+
+  return NULL;
+}
+
+void reg_mark_changed(reg_node_t *node) {
+  if (node && node->valid) {
+    node->quirk_gen = 0; /* Identity may have changed: re-resolve quirks */
+    registry.generation++;
+  }
+}
+
+uint32_t reg_generation(void) { return registry.generation; }
+
+static void snapshot_build(reg_snapshot_t *snap) {
+  reg_iter_t it;
+  reg_node_t *node;
+  uint32_t n = 0;
+
+  reg_iter_init(&it);
+  while ((node = reg_iter_next(&it)) != NULL) {
+    reg_snapshot_entry_t *e = &snap->entries[n++];
+    e->ieee_addr = node->ieee_addr;
+    e->nwk_addr = node->nwk_addr;
+    e->state = node->state;
+    e->power_source = node->power_source;
+    memcpy(e->manufacturer, node->manufacturer, sizeof(e->manufacturer));
+    memcpy(e->model, node->model, sizeof(e->model));
+    memcpy(e->friendly_name, node->friendly_name, sizeof(e->friendly_name));
+    e->lqi = node->lqi;
+    e->endpoint_count = node->endpoint_count;
+  }
+
+  snap->count = n;
+  snap->generation = registry.generation;
+}
+
+const reg_snapshot_t *reg_snapshot_acquire(void) {
+  if (!registry.initialized) {
+    return NULL;
+  }
+
+  reg_snapshot_t *cur = &registry.snapshots[registry.snap_current];
+
+  if (cur->generation != registry.generation) {
+    /* Copy-on-write: rebuild into a buffer no reader holds */
+    uint32_t spare = registry.snap_current ^ 1;
+    if (cur->refs == 0) {
+      spare = registry.snap_current;
+    }
+    if (registry.snapshots[spare].refs == 0) {
+      snapshot_build(&registry.snapshots[spare]);
+      registry.snap_current = spare;
+      cur = &registry.snapshots[spare];
+    }
+  }
+
+  cur->refs++;
+  return cur;
+}
+
+void reg_snapshot_release(const reg_snapshot_t *snap) {
+  for (uint32_t i = 0; i < 2; i++) {
+    if (snap == &registry.snapshots[i] && registry.snapshots[i].refs > 0) {
+      registry.snapshots[i].refs--;
+      return;
+    }
+  }
+}
+
 reg_endpoint_t *reg_add_endpoint(reg_node_t *node, uint8_t endpoint_id,
                                  uint16_t profile_id, uint16_t device_id) {
   if (!node || !node->valid) {
@@ -222,6 +415,7 @@ reg_endpoint_t *reg_add_endpoint(reg_node_t *node, uint8_t endpoint_id,
   ep->device_id = device_id;
   ep->valid = true;
   node->endpoint_count++;
+  registry.generation++;
 
   LOG_D(REG_MODULE,
         "Node " OS_EUI64_FMT
@@ -0,0 +1,196 @@
+/**
+ * @file report_plan.c
+ * @brief Binding and attribute reporting planner implementation
+ *
+ * ESP32-C6 Zigbee Bridge OS - Device interview service
+ */
+
+#include "report_plan.h"
+#include "capability.h"
+#include "quirks.h"
+#include "registry.h"
+#include "zcl_ids.h"
+#include "os.h"
+#include <inttypes.h>
+#include <string.h>
+
+#define RPLAN_MODULE "RPLAN"
+
+/* Attributes worth reporting, with the values used where the capability's
+ * policy sets no interval. change is in raw attribute units and matches
+ * the default policy deadband; 0 for discrete types. */
+typedef struct {
+    uint16_t cluster_id;
+    uint16_t attr_id;
+    cap_id_t cap_id;
+    uint8_t type;
+    uint16_t min_s;
+    uint16_t max_s;
+    uint32_t change;
+} rplan_attr_t;
+
+static const rplan_attr_t report_attrs[] = {
+    {ZCL_CLUSTER_ONOFF,        ZCL_ATTR_ONOFF,              CAP_LIGHT_ON,           ZBA_ZCL_TYPE_BOOL,    0, 300,   0},
+    {ZCL_CLUSTER_LEVEL,        ZCL_ATTR_LEVEL,              CAP_LIGHT_LEVEL,        ZBA_ZCL_TYPE_UINT8,   1, 300,   3},  /* ~1 % */
+    {ZCL_CLUSTER_COLOR,        ZCL_ATTR_COLOR_TEMP,         CAP_LIGHT_COLOR_TEMP,   ZBA_ZCL_TYPE_UINT16,  1, 300,  10},  /* mireds */
+    {ZCL_CLUSTER_ILLUMINANCE,  ZCL_ATTR_ILLUMINANCE,        CAP_SENSOR_ILLUMINANCE, ZBA_ZCL_TYPE_UINT16,  5, 900, 500},  /* log scale */
+    {ZCL_CLUSTER_TEMPERATURE,  ZCL_ATTR_TEMPERATURE,        CAP_SENSOR_TEMPERATURE, ZBA_ZCL_TYPE_INT16,  10, 900,  10},  /* 0.1 degC */
+    {ZCL_CLUSTER_HUMIDITY,     ZCL_ATTR_HUMIDITY,           CAP_SENSOR_HUMIDITY,    ZBA_ZCL_TYPE_UINT16, 10, 900, 100},  /* 1 % */
+    {ZCL_CLUSTER_OCCUPANCY,    ZCL_ATTR_OCCUPANCY,          CAP_SENSOR_MOTION,      ZBA_ZCL_TYPE_BITMAP8, 0, 300,   0},
+    {ZCL_CLUSTER_METERING,     ZCL_ATTR_METERING_SUMMATION, CAP_ENERGY_KWH,         ZBA_ZCL_TYPE_UINT48, 30, 900,  10},  /* 0.01 kWh */
+    {ZCL_CLUSTER_METERING,     ZCL_ATTR_METERING_DEMAND,    CAP_POWER_WATTS,        ZBA_ZCL_TYPE_INT24,   2, 300,   1},  /* 1 W */
+    {ZCL_CLUSTER_ELEC_MEASURE, ZCL_ATTR_ACTIVE_POWER,       CAP_POWER_WATTS,        ZBA_ZCL_TYPE_INT16,   2, 300,   1},  /* 1 W */
+};
+
+#define REPORT_ATTR_COUNT (sizeof(report_attrs) / sizeof(report_attrs[0]))
+
+/* First action of this type for the capability */
+static const quirk_action_t *find_action(const quirk_entry_t *quirk,
+                                         quirk_action_type_t type, cap_id_t cap_id) {
+    if (!quirk || quirk->action_count > QUIRK_MAX_ACTIONS) {
+        return NULL;
+    }
+    for (uint8_t i = 0; i < quirk->action_count; i++) {
+        if (quirk->actions[i].type == type && quirk->actions[i].target_cap == cap_id) {
+            return &quirk->actions[i];
+        }
+    }
+    return NULL;
+}
+
+/* Endpoint with this server cluster, or NULL */
+static const reg_endpoint_t *server_endpoint(const reg_node_t *node, uint16_t cluster_id) {
+    for (uint8_t i = 0; i < REG_MAX_ENDPOINTS; i++) {
+        const reg_endpoint_t *ep = &node->endpoints[i];
+        if (!ep->valid) {
+            continue;
+        }
+        for (uint8_t c = 0; c < REG_MAX_CLUSTERS; c++) {
+            const reg_cluster_t *cl = &ep->clusters[c];
+            if (cl->valid && cl->cluster_id == cluster_id &&
+                cl->direction == REG_CLUSTER_SERVER) {
+                return ep;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Step for this cluster, added if new; NULL when the plan is full */
+static rplan_step_t *step_for(rplan_t *plan, uint8_t endpoint_id, uint16_t cluster_id) {
+    for (uint8_t i = 0; i < plan->count; i++) {
+        rplan_step_t *step = &plan->steps[i];
+        if (step->endpoint_id == endpoint_id && step->cluster_id == cluster_id) {
+            return step;
+        }
+    }
+    if (plan->count == RPLAN_MAX_STEPS) {
+        return NULL;
+    }
+    rplan_step_t *step = &plan->steps[plan->count++];
+    step->endpoint_id = endpoint_id;
+    step->cluster_id = cluster_id;
+    step->cfg_count = 0;
+    return step;
+}
+
+/* Reporting parameters for one attribute of the node */
+static void plan_intervals(reg_node_t *node, const quirk_entry_t *quirk,
+                           const rplan_attr_t *attr, zba_report_cfg_t *cfg) {
+    const quirk_action_t *override =
+        find_action(quirk, QUIRK_ACTION_OVERRIDE_REPORTING, attr->cap_id);
+    if (override) {
+        cfg->min_s = override->params.reporting.min_interval_s;
+        cfg->max_s = override->params.reporting.max_interval_s;
+        cfg->change = override->params.reporting.reportable_change;
+        return;
+    }
+
+    cfg->min_s = attr->min_s;
+    cfg->max_s = attr->max_s;
+    cfg->change = attr->change;
+
+    cap_policy_t policy;
+    if (cap_get_policy(node, attr->cap_id, &policy) == OS_OK) {
+        if (policy.min_interval_ms > 0) {
+            uint32_t min_s = (policy.min_interval_ms + 999) / 1000;
+            cfg->min_s = (uint16_t)(min_s > UINT16_MAX ? UINT16_MAX : min_s);
+        }
+        if (policy.max_staleness_ms > 0) {
+            uint32_t max_s = policy.max_staleness_ms / 1000;
+            cfg->max_s = (uint16_t)(max_s > UINT16_MAX ? UINT16_MAX : max_s);
+        }
+    }
+
+    /* Every report wakes a battery device; discrete changes still go out
+     * at once */
+    if (node->power_source == REG_POWER_BATTERY && attr->change != 0 &&
+        cfg->min_s < RPLAN_BATTERY_MIN_S) {
+        cfg->min_s = RPLAN_BATTERY_MIN_S;
+    }
+    if (cfg->max_s < cfg->min_s) {
+        cfg->max_s = cfg->min_s;
+    }
+}
+
+uint32_t rplan_build(reg_node_t *node, rplan_t *plan) {
+    if (!plan) {
+        return 0;
+    }
+    memset(plan, 0, sizeof(*plan));
+    if (!node) {
+        return 0;
+    }
+
+    uint32_t caps = cap_get_mask(node);
+    const quirk_entry_t *quirk = quirks_for_node(node);
+    uint32_t planned = 0;
+
+    for (size_t i = 0; i < REPORT_ATTR_COUNT; i++) {
+        const rplan_attr_t *attr = &report_attrs[i];
+        if (!(caps & (1u << attr->cap_id))) {
+            continue;
+        }
+
+        /* A remapped capability reports through the vendor attribute */
+        uint16_t cluster_id = attr->cluster_id;
+        uint16_t attr_id = attr->attr_id;
+        const quirk_action_t *remap =
+            find_action(quirk, QUIRK_ACTION_REMAP_ATTRIBUTE, attr->cap_id);
+        if (remap) {
+            cluster_id = remap->params.remap.cluster_id;
+            attr_id = remap->params.remap.attr_id;
+        }
+
+        const reg_endpoint_t *ep = server_endpoint(node, cluster_id);
+        if (!ep) {
+            continue;
+        }
+        rplan_step_t *step = step_for(plan, ep->endpoint_id, cluster_id);
+        if (!step || step->cfg_count == ZBA_MAX_REPORT_CFGS) {
+            LOG_W(RPLAN_MODULE, OS_EUI64_FMT ": no room to report 0x%04X/0x%04X",
+                  OS_EUI64_ARG(node->ieee_addr), cluster_id, attr_id);
+            continue;
+        }
+
+        /* Both power attributes may remap to the same vendor attribute */
+        bool duplicate = false;
+        for (uint8_t c = 0; c < step->cfg_count; c++) {
+            duplicate |= step->cfgs[c].attr_id == attr_id;
+        }
+        if (duplicate) {
+            continue;
+        }
+
+        zba_report_cfg_t *cfg = &step->cfgs[step->cfg_count++];
+        cfg->attr_id = attr_id;
+        cfg->type = attr->type;
+        plan_intervals(node, quirk, attr, cfg);
+        planned++;
+
+        LOG_D(RPLAN_MODULE, "Report 0x%04X/0x%04X: %u-%us change %" PRIu32,
+              cluster_id, attr_id, cfg->min_s, cfg->max_s, cfg->change);
+    }
+
+    return planned;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file bench_main.c
+ * @brief Benchmark runner
+ *
+ * ESP32-C6 Zigbee Bridge OS - Host benchmarks
+ */
+
+#include "bench_support.h"
+#include "os_log.h"
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+
+    printf("=== ESP32-C6 Zigbee Bridge OS Benchmarks ===\n");
+
+    os_log_init();
+    os_log_set_level(OS_LOG_LEVEL_ERROR);
+
+    run_registry_benches();
+    run_report_benches();
+    run_mqtt_benches();
+
+    printf("\n");
+    return 0;
+}
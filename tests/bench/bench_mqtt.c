@@ -0,0 +1,488 @@
+/**
+ * @file bench_mqtt.c
+ * @brief Northbound MQTT publish benchmarks
+ *
+ * Capability state changes published through the real client to the
+ * in-process broker stand-in over loopback TCP. Latency runs from emitting
+ * OS_EVENT_CAP_STATE_CHANGED to the socket write that carried the last
+ * byte of the message; the rate counts every state change from event to
+ * broker. Client and broker share one thread, so the rate includes the
+ * broker's reads. The burst run queues changes for many nodes between two
+ * polls, as a busy mesh does, and reports how many packets each socket
+ * write carried and how many updates coalesced. The command run sends
+ * bridge/<node>/light.on/set from the broker and times it to the Zigbee
+ * adapter's send call, over the socket and for the decode alone. The
+ * encode run builds state topics and payloads without publishing, with
+ * the snprintf code the adapter used before its topic cache and JSON
+ * writer, and with mqtt_format_state(). The aggregate run updates all
+ * four capabilities of a multisensor light each cycle and counts what
+ * reaches the broker with a topic per capability and with one document
+ * per node.
+ */
+
+#include "bench_support.h"
+#include "capability.h"
+#include "cmd_sched.h"
+#include "mqtt_adapter.h"
+#include "mqtt_broker_stub.h"
+#include "os_event.h"
+#include "os_fibre.h"
+#include "registry.h"
+#include "zcl_ids.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MQTT_NODE     0x00124B00BE000002ULL
+#define BENCH_MQTT_MESSAGES 50000
+#define BENCH_MQTT_ROUNDS   100000
+
+/* Burst run: nodes per burst, changes per node per burst */
+#define BENCH_MQTT_BURSTS      2000
+#define BENCH_MQTT_BURST_NODES 16
+#define BENCH_MQTT_BURST_DUPS  2
+
+/* Command run */
+#define BENCH_MQTT_CMD_NODE  0x00124B00BE000003ULL
+#define BENCH_MQTT_CMD_TOPIC "bridge/00124B00BE000003/light.on/set"
+#define BENCH_MQTT_COMMANDS  20000
+
+/* Encode run */
+#define BENCH_MQTT_ENC_NODE     0x00124B00BE000004ULL
+#define BENCH_MQTT_ENC_MESSAGES 1000000
+
+/* Aggregate run */
+#define BENCH_MQTT_AGG_NODE   0x00124B00BE000005ULL
+#define BENCH_MQTT_AGG_CYCLES 5000
+
+/* Broker is drained this often while the client has no backlog */
+#define BENCH_MQTT_DRAIN_EVERY 32
+
+static uint32_t latency_ns[BENCH_MQTT_MESSAGES];
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t tx_backlog(void) {
+    mqtt_stats_t stats;
+    mqtt_get_stats(&stats);
+    return stats.tx_backlog;
+}
+
+static bool wait_connected(void) {
+    for (uint32_t i = 0; i < BENCH_MQTT_ROUNDS; i++) {
+        broker_poll();
+        mqtt_poll();
+        if (mqtt_get_state() == MQTT_STATE_CONNECTED) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void drain(uint32_t publishes) {
+    broker_stats_t bs;
+    for (uint32_t i = 0; i < BENCH_MQTT_ROUNDS; i++) {
+        broker_poll();
+        mqtt_poll();
+        broker_get_stats(&bs);
+        if (bs.publishes >= publishes) {
+            return;
+        }
+    }
+}
+
+/* Changes for many nodes between two polls */
+static void run_burst(void) {
+    BENCH_SECTION("MQTT state burst, queued between polls");
+
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    uint32_t base = bs.publishes;
+    mqtt_stats_t before;
+    mqtt_get_stats(&before);
+
+    struct {
+        os_eui64_t node_addr;
+        cap_id_t cap_id;
+        cap_value_t value;
+    } change = {0, CAP_SENSOR_TEMPERATURE, {.i = 0}};
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t b = 0; b < BENCH_MQTT_BURSTS; b++) {
+        for (uint32_t d = 0; d < BENCH_MQTT_BURST_DUPS; d++) {
+            for (uint32_t n = 0; n < BENCH_MQTT_BURST_NODES; n++) {
+                change.node_addr = BENCH_MQTT_NODE + n;
+                change.value.i = (int32_t)(b * BENCH_MQTT_BURST_DUPS + d);
+                os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &change, sizeof(change));
+            }
+            os_event_dispatch(0);
+        }
+        mqtt_poll();
+        while (tx_backlog() > 0) {
+            broker_poll();
+            mqtt_poll();
+        }
+        broker_poll();
+    }
+    uint32_t expected = BENCH_MQTT_BURSTS * BENCH_MQTT_BURST_NODES;
+    drain(base + expected);
+    uint64_t elapsed = bench_now_ns() - start;
+
+    broker_get_stats(&bs);
+    mqtt_stats_t stats;
+    mqtt_get_stats(&stats);
+    uint32_t writes = stats.writes - before.writes;
+
+    printf("  %-40s %8.0f\n", "state changes per second",
+           (double)expected * BENCH_MQTT_BURST_DUPS * 1e9 / (double)elapsed);
+    printf("  %-40s %8" PRIu32 " / %" PRIu32 "\n", "delivered / expected",
+           bs.publishes - base, expected);
+    printf("  %-40s %8" PRIu32 "\n", "coalesced updates",
+           stats.coalesced - before.coalesced);
+    printf("  %-40s %8.1f\n", "packets per socket write",
+           writes ? (double)(bs.publishes - base) / writes : 0.0);
+    printf("  %-40s %8" PRIu32 "\n", "queue peak", stats.queue_peak);
+}
+
+static uint32_t commands_sent(void) {
+    cmd_sched_stats_t stats;
+    cmd_sched_get_stats(&stats);
+    return stats.sent;
+}
+
+/* bridge/<node>/light.on/set to zba_send_onoff() */
+static void run_commands(void) {
+    BENCH_SECTION("MQTT command, receive to Zigbee send");
+
+    if (cmd_sched_init() != OS_OK) {
+        printf("  init failed\n");
+        return;
+    }
+    cmd_sched_set_min_gap(0);
+    reg_node_t *node = reg_add_node(BENCH_MQTT_CMD_NODE, 0x1003);
+    if (!node) {
+        printf("  reg_add_node failed\n");
+        return;
+    }
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0100);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    os_event_dispatch(0);
+
+    /* Over the socket: broker write to the adapter's send call */
+    char payload[48];
+    uint32_t done = 0;
+    for (uint32_t i = 0; i < BENCH_MQTT_COMMANDS; i++) {
+        snprintf(payload, sizeof(payload), "{\"v\":%s,\"corr_id\":%" PRIu32 "}",
+                 (i & 1) ? "true" : "false", i + 1);
+        uint32_t sent = commands_sent();
+
+        uint64_t t0 = bench_now_ns();
+        broker_publish(BENCH_MQTT_CMD_TOPIC, payload);
+        for (uint32_t r = 0; r < BENCH_MQTT_ROUNDS && commands_sent() == sent; r++) {
+            mqtt_poll();
+        }
+        latency_ns[i] = (uint32_t)(bench_now_ns() - t0);
+        done += commands_sent() - sent;
+
+        os_event_dispatch(0); /* Confirm: the node is free again */
+        broker_poll();
+    }
+    qsort(latency_ns, BENCH_MQTT_COMMANDS, sizeof(latency_ns[0]), cmp_u32);
+
+    /* Decode and dispatch alone, from the topic to the send call */
+    const char *topic = BENCH_MQTT_CMD_TOPIC;
+    size_t topic_len = strlen(topic);
+    uint64_t cycles = 0;
+    for (uint32_t i = 0; i < BENCH_MQTT_COMMANDS; i++) {
+        const char *p = (i & 1) ? "{\"v\":true,\"corr_id\":7}"
+                                : "{\"v\":false,\"corr_id\":8}";
+        uint64_t c0 = bench_cycles();
+        mqtt_handle_message(topic, topic_len, (const uint8_t *)p, strlen(p));
+        cycles += bench_cycles() - c0;
+        os_event_dispatch(0);
+    }
+
+    printf("  %-40s %8.2f\n", "latency p50 (us)",
+           latency_ns[BENCH_MQTT_COMMANDS / 2] / 1000.0);
+    printf("  %-40s %8.2f\n", "latency p99 (us)",
+           latency_ns[BENCH_MQTT_COMMANDS * 99 / 100] / 1000.0);
+    printf("  %-40s %8" PRIu32 " / %" PRIu32 "\n", "sent / received", done,
+           (uint32_t)BENCH_MQTT_COMMANDS);
+    printf("  %-40s %8" PRIu64 "\n", "decode + dispatch (" BENCH_CYCLE_UNIT ")",
+           cycles / BENCH_MQTT_COMMANDS);
+
+    reg_remove_node(BENCH_MQTT_CMD_NODE);
+}
+
+/* State message as the adapter built it before mqtt_format_state() */
+static void format_state_snprintf(os_eui64_t node_addr, cap_id_t cap_id,
+                                  const cap_value_t *value, char *topic,
+                                  size_t topic_size, char *payload,
+                                  size_t payload_size) {
+    const cap_info_t *info = cap_get_info(cap_id);
+    snprintf(topic, topic_size, "bridge/" OS_EUI64_FMT "/%s/state",
+             OS_EUI64_ARG(node_addr), info->name);
+    switch (info->type) {
+    case CAP_VALUE_BOOL:
+        snprintf(payload, payload_size, "{\"v\":%s,\"ts\":%" PRIu32 "}",
+                 value->b ? "true" : "false", os_now_ticks());
+        break;
+    case CAP_VALUE_INT:
+        snprintf(payload, payload_size, "{\"v\":%" PRId32 ",\"ts\":%" PRIu32 "}",
+                 value->i, os_now_ticks());
+        break;
+    default: {
+        char num[CAP_VALUE_TEXT_MAX];
+        cap_format_fixed(value->i, info->decimals, num, sizeof(num));
+        snprintf(payload, payload_size, "{\"v\":%s,\"ts\":%" PRIu32 "}", num,
+                 os_now_ticks());
+        break;
+    }
+    }
+}
+
+/* Topic and payload for a mix of fixed, bool and int capabilities */
+static void run_encode(void) {
+    BENCH_SECTION("MQTT state encode, topic + payload");
+
+    static const cap_id_t caps[] = {CAP_SENSOR_TEMPERATURE, CAP_LIGHT_ON,
+                                    CAP_LIGHT_LEVEL, CAP_SENSOR_HUMIDITY};
+    const uint32_t ncaps = sizeof(caps) / sizeof(caps[0]);
+    if (!reg_add_node(BENCH_MQTT_ENC_NODE, 0x1004)) {
+        printf("  reg_add_node failed\n");
+        return;
+    }
+
+    char topic[128];
+    char payload[96];
+    char check_topic[128];
+    char check_payload[96];
+    cap_value_t value;
+    uint64_t sink = 0;
+
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_MQTT_ENC_MESSAGES; i++) {
+        value.i = 1995 + (int32_t)(i & 255);
+        format_state_snprintf(BENCH_MQTT_ENC_NODE, caps[i % ncaps], &value, topic,
+                              sizeof(topic), payload, sizeof(payload));
+        sink += (uint8_t)payload[6];
+    }
+    uint64_t before_ns = bench_now_ns() - t0;
+
+    t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_MQTT_ENC_MESSAGES; i++) {
+        value.i = 1995 + (int32_t)(i & 255);
+        mqtt_format_state(BENCH_MQTT_ENC_NODE, caps[i % ncaps], &value, topic,
+                          sizeof(topic), payload, sizeof(payload), NULL);
+        sink += (uint8_t)payload[6];
+    }
+    uint64_t after_ns = bench_now_ns() - t0;
+    bench_sink(sink);
+
+    /* Both produce the same bytes */
+    bool same = true;
+    for (uint32_t i = 0; i < ncaps; i++) {
+        value.i = -5 + (int32_t)i * 1000;
+        format_state_snprintf(BENCH_MQTT_ENC_NODE, caps[i], &value, check_topic,
+                              sizeof(check_topic), check_payload,
+                              sizeof(check_payload));
+        mqtt_format_state(BENCH_MQTT_ENC_NODE, caps[i], &value, topic,
+                          sizeof(topic), payload, sizeof(payload), NULL);
+        same = same && strcmp(topic, check_topic) == 0 &&
+               strcmp(payload, check_payload) == 0;
+    }
+
+    printf("  %-40s %8.0f\n", "snprintf messages per second",
+           (double)BENCH_MQTT_ENC_MESSAGES * 1e9 / (double)before_ns);
+    printf("  %-40s %8.0f\n", "cached + writer messages per second",
+           (double)BENCH_MQTT_ENC_MESSAGES * 1e9 / (double)after_ns);
+    printf("  %-40s %8.1fx\n", "speedup", (double)before_ns / (double)after_ns);
+    printf("  %-40s %8s\n", "output identical", same ? "yes" : "NO");
+
+    reg_remove_node(BENCH_MQTT_ENC_NODE);
+    os_event_dispatch(0);
+}
+
+/* One cycle of reports for every capability, then the merge window */
+static void agg_cycle(reg_node_t *node, uint32_t i) {
+    bool odd = (i & 1) != 0;
+    reg_attr_value_t v = {.b = odd};
+    cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF, ZCL_ATTR_ONOFF, &v);
+    v.u8 = odd ? 200 : 100;
+    cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_LEVEL, ZCL_ATTR_LEVEL, &v);
+    v.s16 = (int16_t)(odd ? 2150 : 2000);
+    cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_TEMPERATURE,
+                                        ZCL_ATTR_TEMPERATURE, &v);
+    v.u16 = (uint16_t)(odd ? 5000 : 4000);
+    cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_HUMIDITY,
+                                        ZCL_ATTR_HUMIDITY, &v);
+    os_event_dispatch(0);
+    for (uint32_t t = 0; t < MQTT_MERGE_WINDOW_DEFAULT_MS; t++) {
+        os_tick_advance();
+    }
+    mqtt_poll();
+    while (tx_backlog() > 0) {
+        broker_poll();
+        mqtt_poll();
+    }
+    broker_poll();
+}
+
+/* Four capabilities on one node: per-capability topics vs one document */
+static void run_aggregate(void) {
+    BENCH_SECTION("MQTT aggregate state, 4-capability node");
+
+    reg_node_t *node = reg_add_node(BENCH_MQTT_AGG_NODE, 0x1005);
+    if (!node) {
+        printf("  reg_add_node failed\n");
+        return;
+    }
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0101);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_LEVEL, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_TEMPERATURE, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_HUMIDITY, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    os_event_dispatch(0);
+
+    /* Every report is a change to publish */
+    cap_policy_t temp_policy;
+    cap_policy_t hum_policy;
+    cap_get_policy(NULL, CAP_SENSOR_TEMPERATURE, &temp_policy);
+    cap_get_policy(NULL, CAP_SENSOR_HUMIDITY, &hum_policy);
+    const cap_policy_t every = {0};
+    cap_set_policy(CAP_SENSOR_TEMPERATURE, &every);
+    cap_set_policy(CAP_SENSOR_HUMIDITY, &every);
+
+    static const mqtt_state_mode_t modes[] = {MQTT_STATE_MODE_PER_CAP,
+                                              MQTT_STATE_MODE_AGGREGATE};
+    static const char *names[] = {"per capability", "aggregate"};
+    double per_cycle[2] = {0};
+    for (uint32_t m = 0; m < 2; m++) {
+        mqtt_set_state_mode(modes[m]);
+        agg_cycle(node, 0);
+        drain(0);
+        for (uint32_t i = 0; i < 1000; i++) {
+            broker_poll();
+            mqtt_poll();
+        }
+
+        broker_stats_t b0;
+        broker_stats_t b1;
+        broker_get_stats(&b0);
+        uint64_t start = bench_now_ns();
+        for (uint32_t i = 1; i <= BENCH_MQTT_AGG_CYCLES; i++) {
+            agg_cycle(node, i);
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        for (uint32_t i = 0; i < 1000; i++) {
+            broker_poll();
+            mqtt_poll();
+        }
+        broker_get_stats(&b1);
+
+        uint32_t msgs = b1.publishes - b0.publishes;
+        per_cycle[m] = (double)msgs / BENCH_MQTT_AGG_CYCLES;
+        printf("  %-28s %-11s %8.2f\n", names[m], "msgs/cycle", per_cycle[m]);
+        printf("  %-28s %-11s %8.0f\n", names[m], "bytes/cycle",
+               (double)(b1.bytes_received - b0.bytes_received) /
+                   BENCH_MQTT_AGG_CYCLES);
+        printf("  %-28s %-11s %8.0f\n", names[m], "cycles/s",
+               (double)BENCH_MQTT_AGG_CYCLES * 1e9 / (double)elapsed);
+    }
+    printf("  %-40s %8.1fx\n", "fewer messages",
+           per_cycle[1] > 0 ? per_cycle[0] / per_cycle[1] : 0.0);
+
+    mqtt_set_state_mode(MQTT_STATE_MODE_PER_CAP);
+    cap_set_policy(CAP_SENSOR_TEMPERATURE, &temp_policy);
+    cap_set_policy(CAP_SENSOR_HUMIDITY, &hum_policy);
+    reg_remove_node(BENCH_MQTT_AGG_NODE);
+    os_event_dispatch(0);
+}
+
+void run_mqtt_benches(void) {
+    BENCH_SECTION("MQTT state publish, CAP_STATE_CHANGED to socket write");
+
+    uint16_t port;
+    static char uri[32];
+    if (os_event_init() != OS_OK || broker_start(&port) != OS_OK) {
+        printf("  init failed\n");
+        return;
+    }
+    snprintf(uri, sizeof(uri), "mqtt://127.0.0.1:%u", port);
+    mqtt_config_t config = {
+        .broker_uri = uri,
+        .client_id = "bench-bridge",
+        .keepalive_sec = 30,
+    };
+    if (mqtt_init(&config) != OS_OK || mqtt_connect() != OS_OK ||
+        !wait_connected()) {
+        printf("  connect failed\n");
+        broker_stop();
+        return;
+    }
+    os_event_dispatch(0);
+    drain(1);
+
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    uint32_t base = bs.publishes;
+
+    struct {
+        os_eui64_t node_addr;
+        cap_id_t cap_id;
+        cap_value_t value;
+    } change = {BENCH_MQTT_NODE, CAP_SENSOR_TEMPERATURE, {.i = 0}};
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_MQTT_MESSAGES; i++) {
+        change.value.i = 2000 + (int32_t)(i & 1023);
+
+        uint64_t t0 = bench_now_ns();
+        os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &change, sizeof(change));
+        os_event_dispatch(0);
+        mqtt_poll();
+        /* A full socket leaves bytes behind; they go once the broker reads */
+        while (tx_backlog() > 0) {
+            broker_poll();
+            mqtt_poll();
+        }
+        latency_ns[i] = (uint32_t)(bench_now_ns() - t0);
+
+        if ((i % BENCH_MQTT_DRAIN_EVERY) == 0) {
+            broker_poll();
+        }
+    }
+    drain(base + BENCH_MQTT_MESSAGES);
+    uint64_t elapsed = bench_now_ns() - start;
+
+    broker_get_stats(&bs);
+    mqtt_stats_t stats;
+    mqtt_get_stats(&stats);
+
+    qsort(latency_ns, BENCH_MQTT_MESSAGES, sizeof(latency_ns[0]), cmp_u32);
+    printf("  %-40s %8.0f\n", "publishes per second",
+           (double)BENCH_MQTT_MESSAGES * 1e9 / (double)elapsed);
+    printf("  %-40s %8.2f\n", "latency p50 (us)",
+           latency_ns[BENCH_MQTT_MESSAGES / 2] / 1000.0);
+    printf("  %-40s %8.2f\n", "latency p99 (us)",
+           latency_ns[BENCH_MQTT_MESSAGES * 99 / 100] / 1000.0);
+    printf("  %-40s %8.2f\n", "latency max (us)",
+           latency_ns[BENCH_MQTT_MESSAGES - 1] / 1000.0);
+    printf("  %-40s %8" PRIu32 " / %" PRIu32 "\n", "delivered / published",
+           bs.publishes - base, (uint32_t)BENCH_MQTT_MESSAGES);
+    printf("  %-40s %8" PRIu32 "\n", "partial socket writes", stats.partial_writes);
+
+    run_burst();
+    run_commands();
+    run_encode();
+    run_aggregate();
+
+    mqtt_disconnect();
+    broker_stop();
+}
@@ -0,0 +1,182 @@
+/**
+ * @file bench_registry.c
+ * @brief Registry enumeration and lookup benchmarks
+ *
+ * Compares the index API (reg_get_node_info, O(n) per call) with the cursor
+ * iterator and snapshots as the registry grows, and reg_find_node()'s hash
+ * index with the slot scan it replaced. The event bus is left
+ * uninitialized so add/remove events are discarded rather than queued.
+ */
+
+#include "bench_support.h"
+#include "registry.h"
+
+#define BENCH_BASE_EUI64 0x00124B0000000000ULL
+
+static void fill_registry(uint32_t n) {
+    reg_iter_t it;
+    reg_node_t *node;
+
+    /* Empty it, then add n nodes; remove every fourth one and re-add so the
+     * occupied slots are not a single dense prefix */
+    reg_iter_init(&it);
+    while ((node = reg_iter_next(&it)) != NULL) {
+        reg_remove_node(node->ieee_addr);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        reg_add_node(BENCH_BASE_EUI64 + i, (uint16_t)i);
+    }
+    for (uint32_t i = 0; i < n; i += 4) {
+        reg_remove_node(BENCH_BASE_EUI64 + i);
+    }
+    for (uint32_t i = 0; i < n; i += 4) {
+        reg_add_node(BENCH_BASE_EUI64 + i, (uint16_t)i);
+    }
+}
+
+static uint32_t iterations_for(uint32_t n) {
+    return 2000000 / (n * n) + 10;
+}
+
+static double bench_index_walk(uint32_t n) {
+    uint32_t iters = iterations_for(n);
+    uint64_t acc = 0;
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t r = 0; r < iters; r++) {
+        uint32_t count = reg_node_count();
+        for (uint32_t i = 0; i < count; i++) {
+            reg_node_info_t info;
+            if (reg_get_node_info(i, &info) == OS_OK) {
+                acc += info.nwk_addr;
+            }
+        }
+    }
+
+    bench_sink(acc);
+    return (double)(bench_now_ns() - start) / iters;
+}
+
+static double bench_iter_walk(uint32_t n) {
+    uint32_t iters = iterations_for(n) * 16;
+    uint64_t acc = 0;
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t r = 0; r < iters; r++) {
+        reg_iter_t it;
+        reg_node_t *node;
+        reg_iter_init(&it);
+        while ((node = reg_iter_next(&it)) != NULL) {
+            acc += node->nwk_addr;
+        }
+    }
+
+    bench_sink(acc);
+    return (double)(bench_now_ns() - start) / iters;
+}
+
+static double bench_snapshot_walk(uint32_t n, bool rebuild) {
+    uint32_t iters = iterations_for(n) * 16;
+    uint64_t acc = 0;
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t r = 0; r < iters; r++) {
+        if (rebuild) {
+            /* Force copy-on-write on every acquire */
+            reg_mark_changed(reg_find_node(BENCH_BASE_EUI64 + 1));
+        }
+        const reg_snapshot_t *snap = reg_snapshot_acquire();
+        for (uint32_t i = 0; i < snap->count; i++) {
+            acc += snap->entries[i].nwk_addr;
+        }
+        reg_snapshot_release(snap);
+    }
+
+    bench_sink(acc);
+    return (double)(bench_now_ns() - start) / iters;
+}
+
+#define BENCH_LOOKUPS 1000000
+
+/* Scattered lookups of present nodes */
+static double bench_find(uint32_t n) {
+    uint64_t acc = 0;
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t r = 0; r < BENCH_LOOKUPS; r++) {
+        reg_node_t *node = reg_find_node(BENCH_BASE_EUI64 + (r * 7919u) % n);
+        acc += node->nwk_addr;
+    }
+
+    bench_sink(acc);
+    return (double)(bench_now_ns() - start) / BENCH_LOOKUPS;
+}
+
+/* The lookup as it was: compare every valid slot */
+static double bench_find_scan(uint32_t n) {
+    uint64_t acc = 0;
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t r = 0; r < BENCH_LOOKUPS; r++) {
+        os_eui64_t addr = BENCH_BASE_EUI64 + (r * 7919u) % n;
+        for (uint32_t slot = 0; slot < REG_MAX_NODES; slot++) {
+            reg_node_t *node = reg_get_node_by_slot(slot);
+            if (node && node->ieee_addr == addr) {
+                acc += node->nwk_addr;
+                break;
+            }
+        }
+    }
+
+    bench_sink(acc);
+    return (double)(bench_now_ns() - start) / BENCH_LOOKUPS;
+}
+
+static void run_lookup_benches(const uint32_t *sizes, size_t count) {
+    BENCH_SECTION("Registry lookup by EUI64 (ns per lookup)");
+
+    printf("  %5s %22s %22s\n", "n", "reg_find_node (hash)", "slot scan (before)");
+    for (size_t s = 0; s < count; s++) {
+        uint32_t n = sizes[s];
+        if (n > REG_MAX_NODES) {
+            break;
+        }
+        fill_registry(n);
+        printf("  %5u %22.1f %22.1f\n", (unsigned)n, bench_find(n),
+               bench_find_scan(n));
+    }
+}
+
+void run_registry_benches(void) {
+    static const uint32_t sizes[] = {32, 64, 128, 256};
+
+    BENCH_SECTION("Registry enumeration (ns per full walk / ns per node)");
+
+    if (reg_init() != OS_OK) {
+        printf("  reg_init failed\n");
+        return;
+    }
+
+    printf("  %5s %22s %22s %22s %22s\n", "n", "index (get_node_info)",
+           "reg_iter_next", "snapshot (cached)", "snapshot (rebuilt)");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t n = sizes[s];
+        if (n > REG_MAX_NODES) {
+            break;
+        }
+        fill_registry(n);
+
+        double idx = bench_index_walk(n);
+        double it = bench_iter_walk(n);
+        double snap = bench_snapshot_walk(n, false);
+        double snap_rb = bench_snapshot_walk(n, true);
+
+        printf("  %5u %12.0f / %7.1f %12.0f / %7.1f %12.0f / %7.1f "
+               "%12.0f / %7.1f\n",
+               (unsigned)n, idx, idx / n, it, it / n, snap, snap / n, snap_rb,
+               snap_rb / n);
+    }
+
+    run_lookup_benches(sizes, sizeof(sizes) / sizeof(sizes[0]));
+}
@@ -0,0 +1,175 @@
+/**
+ * @file bench_report.c
+ * @brief Attribute report value pipeline benchmarks
+ *
+ * Cost per temperature report from ZCL value to MQTT JSON payload, for the
+ * value stages only (convert, quirk scale, deadband, format) and for the
+ * full capability report path.
+ *
+ * The "float" rows replicate the pipeline as it was before capability
+ * values became fixed-point: float conversion, float multiply/offset quirk,
+ * fabsf deadband and "%.2f" formatting. The host has an FPU, so the gap
+ * here understates the gain on the ESP32-C6, where every float operation
+ * and the printf float path are soft-float library calls.
+ */
+
+#include "bench_support.h"
+#include "capability.h"
+#include "quirks.h"
+#include "registry.h"
+#include "zcl_ids.h"
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#define BENCH_NODE_EUI64 0x00124B00BE000001ULL
+#define BENCH_REPORTS    200000
+#define BENCH_PAYLOAD    96
+
+/* Raw ZCL temperature sequence; volatile so nothing is constant-folded */
+static volatile int16_t raw_seq[16] = {
+    2134, 2135, 2141, 2150, 2150, 2162, 2170, 2171,
+    2168, 2160, 2151, 2140, 2133, 2131, 2130, 2134,
+};
+
+/* Old pipeline: float all the way */
+static uint64_t bench_float_pipeline(void) {
+    const float scale = 0.01f;
+    volatile float multiplier = 0.1f;
+    volatile float offset = 0.0f;
+    volatile float deadband = 0.2f;
+    float last = 0.0f;
+    char payload[BENCH_PAYLOAD];
+    uint64_t len = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_REPORTS; i++) {
+        float v = (float)raw_seq[i & 15] * scale;
+        v = v * multiplier + offset;
+        if (fabsf(v - last) >= deadband) {
+            last = v;
+        }
+        len += (uint64_t)snprintf(payload, sizeof(payload),
+                                  "{\"v\":%.2f,\"ts\":%" PRIu32 "}",
+                                  (double)v, i);
+    }
+    uint64_t cycles = bench_cycles() - start;
+    bench_sink(len);
+    return cycles / BENCH_REPORTS;
+}
+
+/* New pipeline: scaled integers and the real quirk/format code */
+static uint64_t bench_fixed_pipeline(void) {
+    const quirk_entry_t *quirk = quirks_find("_TZE200", "TS0601");
+    volatile int32_t deadband = 20;
+    int32_t last = 0;
+    char num[CAP_VALUE_TEXT_MAX];
+    char payload[BENCH_PAYLOAD];
+    uint64_t len = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_REPORTS; i++) {
+        cap_value_t v = {.i = raw_seq[i & 15]};
+        quirks_entry_apply_value(quirk, CAP_SENSOR_TEMPERATURE, &v, NULL);
+        int32_t diff = v.i - last;
+        if ((diff < 0 ? -diff : diff) >= deadband) {
+            last = v.i;
+        }
+        cap_format_fixed(v.i, 2, num, sizeof(num));
+        len += (uint64_t)snprintf(payload, sizeof(payload),
+                                  "{\"v\":%s,\"ts\":%" PRIu32 "}", num, i);
+    }
+    uint64_t cycles = bench_cycles() - start;
+    bench_sink(len);
+    return cycles / BENCH_REPORTS;
+}
+
+static uint64_t bench_format_float(void) {
+    char buf[CAP_VALUE_TEXT_MAX];
+    uint64_t len = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_REPORTS; i++) {
+        len += (uint64_t)snprintf(buf, sizeof(buf), "%.2f",
+                                  (double)((float)raw_seq[i & 15] * 0.01f));
+    }
+    uint64_t cycles = bench_cycles() - start;
+    bench_sink(len);
+    return cycles / BENCH_REPORTS;
+}
+
+static uint64_t bench_format_fixed(void) {
+    char buf[CAP_VALUE_TEXT_MAX];
+    uint64_t len = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_REPORTS; i++) {
+        len += (uint64_t)cap_format_fixed(raw_seq[i & 15], 2, buf, sizeof(buf));
+    }
+    uint64_t cycles = bench_cycles() - start;
+    bench_sink(len);
+    return cycles / BENCH_REPORTS;
+}
+
+/* cap_handle_attribute_report_by_node() plus value formatting */
+static uint64_t bench_report_path(reg_node_t *node) {
+    reg_attr_value_t raw = {0};
+    cap_state_t state;
+    char num[CAP_VALUE_TEXT_MAX];
+    uint64_t len = 0;
+
+    uint64_t start = bench_cycles();
+    for (uint32_t i = 0; i < BENCH_REPORTS; i++) {
+        raw.s16 = raw_seq[i & 15];
+        cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_TEMPERATURE,
+                                            ZCL_ATTR_TEMPERATURE, &raw);
+        cap_get_state_by_node(node, CAP_SENSOR_TEMPERATURE, &state);
+        len += (uint64_t)cap_format_value(CAP_SENSOR_TEMPERATURE, &state.value,
+                                          num, sizeof(num));
+    }
+    uint64_t cycles = bench_cycles() - start;
+    bench_sink(len);
+    return cycles / BENCH_REPORTS;
+}
+
+void run_report_benches(void) {
+    BENCH_SECTION("Temperature report pipeline (" BENCH_CYCLE_UNIT " per report)");
+
+    if (quirks_init() != OS_OK || cap_init() != OS_OK) {
+        printf("  init failed\n");
+        return;
+    }
+
+    /* The registry benches leave the registry full */
+    reg_iter_t it;
+    reg_node_t *node;
+    reg_iter_init(&it);
+    while ((node = reg_iter_next(&it)) != NULL) {
+        reg_remove_node(node->ieee_addr);
+    }
+
+    node = reg_add_node(BENCH_NODE_EUI64, 0x1001);
+    if (!node) {
+        printf("  reg_add_node failed\n");
+        return;
+    }
+    strncpy(node->manufacturer, "_TZE200", REG_MANUFACTURER_LEN - 1);
+    strncpy(node->model, "TS0601", REG_MODEL_LEN - 1);
+    reg_mark_changed(node);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0302);
+    reg_add_cluster(ep, ZCL_CLUSTER_TEMPERATURE, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+
+    printf("  %-40s %8" PRIu64 "\n", "value stages, float (before)",
+           bench_float_pipeline());
+    printf("  %-40s %8" PRIu64 "\n", "value stages, fixed-point",
+           bench_fixed_pipeline());
+    printf("  %-40s %8" PRIu64 "\n", "format only, snprintf %.2f",
+           bench_format_float());
+    printf("  %-40s %8" PRIu64 "\n", "format only, cap_format_fixed",
+           bench_format_fixed());
+    printf("  %-40s %8" PRIu64 "\n", "full report path, fixed-point",
+           bench_report_path(node));
+
+    reg_remove_node(BENCH_NODE_EUI64);
+}
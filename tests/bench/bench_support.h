@@ -0,0 +1,55 @@
+/**
+ * @file bench_support.h
+ * @brief Shared benchmark infrastructure
+ *
+ * Host-only micro-benchmarks, built by `make bench` with optimisation on and
+ * REG_MAX_NODES raised so registry-sized workloads can be scaled up. Each
+ * bench_*.c file exposes one run_*_benches() entry point called from
+ * bench_main.c.
+ */
+
+#ifndef BENCH_SUPPORT_H
+#define BENCH_SUPPORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Monotonic time in ns */
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* CPU cycle counter where the host has one, otherwise ns */
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_CYCLE_UNIT "cycles"
+static inline uint64_t bench_cycles(void) {
+    return __rdtsc();
+}
+#else
+#define BENCH_CYCLE_UNIT "ns"
+static inline uint64_t bench_cycles(void) {
+    return bench_now_ns();
+}
+#endif
+
+/* Keeps the optimiser from discarding a computed value */
+static inline void bench_sink(uint64_t v) {
+    static volatile uint64_t sink;
+    sink += v;
+}
+
+#define BENCH_SECTION(name)  printf("\n%s:\n", name)
+
+/* Benchmark groups */
+void run_registry_benches(void);
+void run_report_benches(void);
+void run_mqtt_benches(void);
+
+#endif /* BENCH_SUPPORT_H */
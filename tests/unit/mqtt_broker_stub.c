@@ -0,0 +1,392 @@
+/**
+ * @file mqtt_broker_stub.c
+ * @brief In-process MQTT broker stand-in for tests and benchmarks
+ *
+ * Decodes packets independently of the client so the tests check the
+ * client against the wire format rather than against itself.
+ */
+
+#include "mqtt_broker_stub.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+/* Small receive buffer so a paused broker pushes back quickly */
+#define BROKER_SOCK_RCVBUF 4096
+#define BROKER_RX_SIZE     8192
+
+/* Retained message store */
+#define BROKER_RETAINED    64
+
+typedef struct {
+    char topic[128];
+    char payload[256];
+} retained_t;
+
+static struct {
+    int listen_fd;
+    int client_fd;
+    bool paused;
+    uint8_t rx[BROKER_RX_SIZE];
+    size_t rx_len;
+    broker_publish_hook_t hook;
+    void *hook_ctx;
+    broker_stats_t stats;
+    retained_t retained[BROKER_RETAINED];
+} broker = {.listen_fd = -1, .client_fd = -1};
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void send_all(const uint8_t *buf, size_t len) {
+    while (len > 0 && broker.client_fd >= 0) {
+        ssize_t n = send(broker.client_fd, buf, len, SEND_FLAGS);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* Copy a length-prefixed string; returns bytes consumed or 0 if short */
+static size_t get_str(const uint8_t *p, size_t avail, char *out, size_t out_size) {
+    if (avail < 2) {
+        return 0;
+    }
+    size_t len = get_u16(p);
+    if (avail < 2 + len) {
+        return 0;
+    }
+    size_t copy = len < out_size - 1 ? len : out_size - 1;
+    memcpy(out, p + 2, copy);
+    out[copy] = '\0';
+    return 2 + len;
+}
+
+static void copy_text(char *out, size_t out_size, const uint8_t *p, size_t len) {
+    size_t copy = len < out_size - 1 ? len : out_size - 1;
+    memcpy(out, p, copy);
+    out[copy] = '\0';
+}
+
+static void handle_connect(const uint8_t *body, size_t len) {
+    /* "MQTT", level, flags, keepalive, then the client id */
+    if (len < 10) {
+        return;
+    }
+    uint8_t flags = body[7];
+    broker.stats.keepalive_sec = get_u16(body + 8);
+    size_t off = 10;
+    size_t used = get_str(body + off, len - off, broker.stats.client_id,
+                          sizeof(broker.stats.client_id));
+    off += used;
+    if (used && (flags & 0x04)) {
+        get_str(body + off, len - off, broker.stats.will_topic,
+                sizeof(broker.stats.will_topic));
+    }
+    broker.stats.connects++;
+
+    const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+    send_all(connack, sizeof(connack));
+}
+
+static retained_t *find_retained(const char *topic) {
+    for (uint32_t i = 0; i < BROKER_RETAINED; i++) {
+        if (broker.retained[i].topic[0] &&
+            strcmp(broker.retained[i].topic, topic) == 0) {
+            return &broker.retained[i];
+        }
+    }
+    return NULL;
+}
+
+/* Replace a topic's retained message; an empty payload deletes it */
+static void store_retained(const char *topic, const uint8_t *payload,
+                           size_t len) {
+    retained_t *r = find_retained(topic);
+    if (len == 0) {
+        if (r) {
+            r->topic[0] = '\0';
+        }
+        return;
+    }
+    for (uint32_t i = 0; !r && i < BROKER_RETAINED; i++) {
+        if (!broker.retained[i].topic[0]) {
+            r = &broker.retained[i];
+        }
+    }
+    if (r) {
+        copy_text(r->topic, sizeof(r->topic), (const uint8_t *)topic,
+                  strlen(topic));
+        copy_text(r->payload, sizeof(r->payload), payload, len);
+    }
+}
+
+static void handle_publish(uint8_t header, const uint8_t *body, size_t len) {
+    uint8_t qos = (header >> 1) & 0x03;
+    if (len < 2) {
+        return;
+    }
+    size_t topic_len = get_u16(body);
+    size_t off = 2 + topic_len + (qos ? 2 : 0);
+    if (off > len) {
+        return;
+    }
+
+    broker.stats.publishes++;
+    if (header & 0x01) {
+        broker.stats.retained++;
+    }
+    copy_text(broker.stats.last_topic, sizeof(broker.stats.last_topic), body + 2,
+              topic_len);
+    copy_text(broker.stats.last_payload, sizeof(broker.stats.last_payload),
+              body + off, len - off);
+    if (header & 0x01) {
+        store_retained(broker.stats.last_topic, body + off, len - off);
+    }
+    if (broker.hook) {
+        broker.hook((const char *)body + 2, topic_len, body + off, len - off,
+                    broker.hook_ctx);
+    }
+
+    if (qos == 1) {
+        const uint8_t *id = body + 2 + topic_len;
+        const uint8_t puback[] = {0x40, 0x02, id[0], id[1]};
+        send_all(puback, sizeof(puback));
+    }
+}
+
+static void handle_subscribe(const uint8_t *body, size_t len) {
+    if (len < 5) {
+        return;
+    }
+    size_t used = get_str(body + 2, len - 2, broker.stats.last_filter,
+                          sizeof(broker.stats.last_filter));
+    uint8_t qos = (used && 2 + used < len) ? body[2 + used] : 0;
+    broker.stats.subscribes++;
+
+    const uint8_t suback[] = {0x90, 0x03, body[0], body[1], qos};
+    send_all(suback, sizeof(suback));
+}
+
+static void handle_packet(uint8_t header, const uint8_t *body, size_t len) {
+    switch (header >> 4) {
+    case 1:
+        handle_connect(body, len);
+        break;
+    case 3:
+        handle_publish(header, body, len);
+        break;
+    case 8:
+        handle_subscribe(body, len);
+        break;
+    case 12: {
+        const uint8_t pingresp[] = {0xD0, 0x00};
+        broker.stats.pings++;
+        send_all(pingresp, sizeof(pingresp));
+        break;
+    }
+    case 14:
+        broker.stats.disconnects++;
+        break;
+    default:
+        break;
+    }
+}
+
+static void parse(void) {
+    size_t off = 0;
+    while (broker.rx_len - off >= 2) {
+        const uint8_t *p = broker.rx + off;
+        size_t avail = broker.rx_len - off;
+        uint32_t remaining = 0;
+        size_t i = 1;
+        while (i < avail && i <= 4) {
+            remaining |= (uint32_t)(p[i] & 0x7F) << (7 * (i - 1));
+            if (!(p[i] & 0x80)) {
+                break;
+            }
+            i++;
+        }
+        if (i >= avail || i > 4) {
+            break;
+        }
+        size_t total = i + 1 + remaining;
+        if (avail < total) {
+            break;
+        }
+        handle_packet(p[0], p + i + 1, remaining);
+        off += total;
+    }
+    memmove(broker.rx, broker.rx + off, broker.rx_len - off);
+    broker.rx_len -= off;
+}
+
+os_err_t broker_start(uint16_t *port) {
+    if (!port) {
+        return OS_ERR_INVALID_ARG;
+    }
+    broker_stop();
+    memset(&broker.stats, 0, sizeof(broker.stats));
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return OS_ERR_NOT_READY;
+    }
+    int one = 1;
+    int rcvbuf = BROKER_SOCK_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr = {0};
+    socklen_t addr_len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 1) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        close(fd);
+        return OS_ERR_NOT_READY;
+    }
+    set_nonblocking(fd);
+
+    broker.listen_fd = fd;
+    *port = ntohs(addr.sin_port);
+    return OS_OK;
+}
+
+void broker_drop_client(void) {
+    if (broker.client_fd >= 0) {
+        close(broker.client_fd);
+    }
+    broker.client_fd = -1;
+    broker.rx_len = 0;
+}
+
+void broker_stop(void) {
+    broker_drop_client();
+    if (broker.listen_fd >= 0) {
+        close(broker.listen_fd);
+    }
+    broker.listen_fd = -1;
+    broker.paused = false;
+    broker.hook = NULL;
+}
+
+void broker_poll(void) {
+    if (broker.listen_fd < 0) {
+        return;
+    }
+
+    /* A new connection replaces the current one */
+    int fd = accept(broker.listen_fd, NULL, NULL);
+    if (fd >= 0) {
+        broker_drop_client();
+        set_nonblocking(fd);
+        /* Acknowledgements go out at once, as from a real broker */
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        broker.client_fd = fd;
+    }
+
+    while (broker.client_fd >= 0 && !broker.paused) {
+        ssize_t n = recv(broker.client_fd, broker.rx + broker.rx_len,
+                         sizeof(broker.rx) - broker.rx_len, 0);
+        if (n == 0) {
+            broker_drop_client();
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                broker_drop_client();
+            }
+            break;
+        }
+        broker.rx_len += (size_t)n;
+        broker.stats.bytes_received += (uint32_t)n;
+        parse();
+    }
+}
+
+void broker_pause(bool paused) {
+    broker.paused = paused;
+}
+
+os_err_t broker_publish(const char *topic, const char *payload) {
+    if (broker.client_fd < 0) {
+        return OS_ERR_NOT_READY;
+    }
+    size_t topic_len = strlen(topic);
+    size_t payload_len = strlen(payload);
+    size_t remaining = 2 + topic_len + payload_len;
+    uint8_t buf[512];
+    if (remaining > 127 * 128 || remaining + 3 > sizeof(buf)) {
+        return OS_ERR_INVALID_ARG;
+    }
+
+    size_t off = 0;
+    buf[off++] = 0x30;
+    if (remaining < 128) {
+        buf[off++] = (uint8_t)remaining;
+    } else {
+        buf[off++] = (uint8_t)((remaining & 0x7F) | 0x80);
+        buf[off++] = (uint8_t)(remaining >> 7);
+    }
+    buf[off++] = (uint8_t)(topic_len >> 8);
+    buf[off++] = (uint8_t)topic_len;
+    memcpy(buf + off, topic, topic_len);
+    off += topic_len;
+    memcpy(buf + off, payload, payload_len);
+    off += payload_len;
+
+    send_all(buf, off);
+    return OS_OK;
+}
+
+void broker_set_publish_hook(broker_publish_hook_t hook, void *ctx) {
+    broker.hook = hook;
+    broker.hook_ctx = ctx;
+}
+
+bool broker_get_retained(const char *topic, char *payload, size_t size) {
+    retained_t *r = find_retained(topic);
+    if (!r) {
+        return false;
+    }
+    copy_text(payload, size, (const uint8_t *)r->payload, strlen(r->payload));
+    return true;
+}
+
+void broker_clear_retained(void) {
+    memset(broker.retained, 0, sizeof(broker.retained));
+}
+
+void broker_get_stats(broker_stats_t *stats) {
+    if (stats) {
+        *stats = broker.stats;
+    }
+}
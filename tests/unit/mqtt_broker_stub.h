@@ -0,0 +1,103 @@
+/**
+ * @file mqtt_broker_stub.h
+ * @brief In-process MQTT broker stand-in for tests and benchmarks
+ *
+ * Listens on 127.0.0.1 (ephemeral port) and serves one client from the
+ * caller's thread: every broker_poll() accepts, reads and answers without
+ * blocking. CONNECT, SUBSCRIBE, PINGREQ and QoS 1 PUBLISH are acknowledged
+ * and PUBLISH packets are counted and passed to an optional hook. Retained
+ * messages are kept per topic, as a broker would hand them to a new
+ * subscriber, until cleared as by a restart without persistence. Reading
+ * can be paused so the client's socket fills and its partial-write path
+ * runs.
+ */
+
+#ifndef MQTT_BROKER_STUB_H
+#define MQTT_BROKER_STUB_H
+
+#include "os_types.h"
+
+/* Broker counters and the last values seen */
+typedef struct {
+    uint32_t connects;
+    uint32_t disconnects;           /* DISCONNECT packets */
+    uint32_t subscribes;
+    uint32_t pings;
+    uint32_t publishes;
+    uint32_t retained;              /* Publishes with the retain flag */
+    uint32_t bytes_received;
+    uint16_t keepalive_sec;
+    char client_id[64];
+    char will_topic[64];
+    char last_filter[128];
+    char last_topic[128];
+    char last_payload[256];
+} broker_stats_t;
+
+/* Called for every PUBLISH received */
+typedef void (*broker_publish_hook_t)(const char *topic, size_t topic_len,
+                                      const uint8_t *payload, size_t len,
+                                      void *ctx);
+
+/**
+ * @brief Start listening
+ * @param port Output: the port to connect to
+ * @return OS_OK on success
+ */
+os_err_t broker_start(uint16_t *port);
+
+/**
+ * @brief Close the client and listening sockets
+ */
+void broker_stop(void);
+
+/**
+ * @brief Accept, read and answer whatever is ready; never blocks
+ */
+void broker_poll(void);
+
+/**
+ * @brief Stop or resume reading from the client
+ * @param paused true to leave incoming data in the socket
+ */
+void broker_pause(bool paused);
+
+/**
+ * @brief Close the client connection without a DISCONNECT
+ */
+void broker_drop_client(void);
+
+/**
+ * @brief Send a QoS 0 PUBLISH to the client
+ * @param topic Topic name
+ * @param payload Payload string
+ * @return OS_OK if written, OS_ERR_NOT_READY without a client
+ */
+os_err_t broker_publish(const char *topic, const char *payload);
+
+/**
+ * @brief Set the PUBLISH hook (NULL to clear)
+ */
+void broker_set_publish_hook(broker_publish_hook_t hook, void *ctx);
+
+/**
+ * @brief Get the retained message a new subscriber to a topic would get
+ * @param topic Topic name
+ * @param payload Output payload (NUL-terminated, truncated to fit)
+ * @param size Output size
+ * @return true if a message is retained for the topic
+ */
+bool broker_get_retained(const char *topic, char *payload, size_t size);
+
+/**
+ * @brief Forget every retained message, as a broker restarted without
+ *        persistence would
+ */
+void broker_clear_retained(void);
+
+/**
+ * @brief Get counters
+ */
+void broker_get_stats(broker_stats_t *stats);
+
+#endif /* MQTT_BROKER_STUB_H */
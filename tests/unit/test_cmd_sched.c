@@ -0,0 +1,428 @@
+/**
+ * @file test_cmd_sched.c
+ * @brief Command scheduler tests
+ */
+
+#include "cmd_sched.h"
+#include "capability.h"
+#include "registry.h"
+#include "zcl_ids.h"
+#include "os_event.h"
+#include "os_fibre.h"
+#include "os_types.h"
+#include "test_support.h"
+#include <string.h>
+
+#define SCHED_NODE_SLIDER 0x2222333344445501ULL
+#define SCHED_NODE_PACED  0x2222333344445502ULL
+#define SCHED_NODE_LOST   0x2222333344445503ULL
+#define SCHED_NODE_OPT    0x2222333344445504ULL
+#define SCHED_NODE_GROUP  0x2222333344445510ULL   /* + 0..3 */
+#define SCHED_GROUP_SIZE  4
+
+static uint32_t cap_cmd_events;
+static cap_cmd_event_t last_cap_cmd;
+static os_corr_id_t last_cap_corr_id;
+
+static void on_cap_command(const os_event_t *event, void *ctx) {
+    (void)ctx;
+    if (event->payload_len >= sizeof(cap_cmd_event_t)) {
+        memcpy(&last_cap_cmd, event->payload, sizeof(last_cap_cmd));
+        last_cap_corr_id = event->corr_id;
+        cap_cmd_events++;
+    }
+}
+
+static void advance_ms(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        os_tick_advance();
+    }
+}
+
+static cap_command_t make_cmd(os_eui64_t node, cap_id_t cap_id,
+                              cap_cmd_type_t type, int32_t value) {
+    cap_command_t cmd = {
+        .node_addr = node,
+        .endpoint_id = 1,
+        .cap_id = cap_id,
+        .cmd_type = type,
+    };
+    cmd.value.i = value;
+    return cmd;
+}
+
+static void test_cmd_sched_init(void) {
+    TEST_START("cmd_sched_init");
+
+    os_err_t err = cmd_sched_init();
+    ASSERT_EQ(err, OS_OK);
+
+    /* Double init should return error */
+    err = cmd_sched_init();
+    ASSERT_EQ(err, OS_ERR_ALREADY_EXISTS);
+
+    os_event_filter_t filter = {OS_EVENT_CAP_COMMAND, OS_EVENT_CAP_COMMAND};
+    ASSERT_EQ(os_event_subscribe(&filter, on_cap_command, NULL), OS_OK);
+
+    /* Unknown node */
+    cap_command_t cmd = make_cmd(0xDEAD, CAP_LIGHT_LEVEL, CAP_CMD_SET, 10);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_ERR_NOT_FOUND);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_cmd_sched_coalesce(void) {
+    TEST_START("cmd_sched_coalesce");
+
+    ASSERT_TRUE(reg_add_node(SCHED_NODE_SLIDER, 0x5501) != NULL);
+    cmd_sched_set_min_gap(0);
+    os_event_dispatch(0);
+
+    cmd_sched_stats_t before, stats;
+    cmd_sched_get_stats(&before);
+
+    /* First value goes straight out */
+    cap_command_t cmd = make_cmd(SCHED_NODE_SLIDER, CAP_LIGHT_LEVEL, CAP_CMD_SET, 10);
+    ASSERT_EQ(cap_execute_command(&cmd), OS_OK);
+    ASSERT_EQ(cmd_sched_pending_count(), 0);
+
+    /* The rest of the drag collapses onto one entry behind it */
+    for (int32_t level = 20; level <= 90; level += 10) {
+        cmd.value.i = level;
+        ASSERT_EQ(cap_execute_command(&cmd), OS_OK);
+    }
+    ASSERT_EQ(cmd_sched_pending_count(), 1);
+
+    cap_value_t pending;
+    ASSERT_EQ(cmd_sched_get_pending(SCHED_NODE_SLIDER, 1, CAP_LIGHT_LEVEL, &pending), OS_OK);
+    ASSERT_EQ(pending.i, 90);
+
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.sent - before.sent, 1);
+    ASSERT_EQ(stats.coalesced - before.coalesced, 7);
+    ASSERT_EQ(stats.superseded - before.superseded, 1);
+
+    /* Confirm of the first frame releases the last value */
+    os_event_dispatch(0);
+    ASSERT_EQ(cmd_sched_pending_count(), 0);
+    os_event_dispatch(0);
+
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.sent - before.sent, 2);
+    ASSERT_EQ(stats.confirmed - before.confirmed, 2);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_cmd_sched_relative(void) {
+    TEST_START("cmd_sched_relative");
+
+    ASSERT_TRUE(reg_add_node(SCHED_NODE_PACED, 0x5502) != NULL);
+    cmd_sched_set_min_gap(1000);
+
+    cap_command_t cmd = make_cmd(SCHED_NODE_PACED, CAP_LIGHT_LEVEL, CAP_CMD_SET, 50);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    os_event_dispatch(0);
+
+    /* Relative commands fold onto the in-flight/queued value */
+    cmd = make_cmd(SCHED_NODE_PACED, CAP_LIGHT_LEVEL, CAP_CMD_INCREMENT, 10);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cmd = make_cmd(SCHED_NODE_PACED, CAP_LIGHT_LEVEL, CAP_CMD_DECREMENT, 5);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+
+    cap_value_t pending;
+    ASSERT_EQ(cmd_sched_get_pending(SCHED_NODE_PACED, 1, CAP_LIGHT_LEVEL, &pending), OS_OK);
+    ASSERT_EQ(pending.i, 65);
+
+    /* Clamped to the level range */
+    cmd = make_cmd(SCHED_NODE_PACED, CAP_LIGHT_LEVEL, CAP_CMD_INCREMENT, 80);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cmd_sched_get_pending(SCHED_NODE_PACED, 1, CAP_LIGHT_LEVEL, &pending);
+    ASSERT_EQ(pending.i, 100);
+
+    /* Two toggles cancel out */
+    cmd = make_cmd(SCHED_NODE_PACED, CAP_LIGHT_ON, CAP_CMD_TOGGLE, 0);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cmd_sched_get_pending(SCHED_NODE_PACED, 1, CAP_LIGHT_ON, &pending);
+    ASSERT_TRUE(pending.b);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cmd_sched_get_pending(SCHED_NODE_PACED, 1, CAP_LIGHT_ON, &pending);
+    ASSERT_FALSE(pending.b);
+
+    /* Node is paced: nothing goes out inside the gap */
+    ASSERT_EQ(cmd_sched_process(), 0);
+    ASSERT_TRUE(cmd_sched_next_due_ms() > 0);
+    ASSERT_EQ(cmd_sched_pending_count(), 2);
+
+    /* One frame per gap, oldest key first */
+    advance_ms(1000);
+    ASSERT_EQ(cmd_sched_process(), 1);
+    ASSERT_EQ(cmd_sched_get_pending(SCHED_NODE_PACED, 1, CAP_LIGHT_LEVEL, &pending),
+              OS_ERR_NOT_FOUND);
+    os_event_dispatch(0);
+    ASSERT_EQ(cmd_sched_pending_count(), 1);
+
+    advance_ms(1000);
+    ASSERT_EQ(cmd_sched_process(), 1);
+    ASSERT_EQ(cmd_sched_pending_count(), 0);
+    os_event_dispatch(0);
+
+    /* Next increment builds on the level that was sent */
+    advance_ms(1000);
+    cmd = make_cmd(SCHED_NODE_PACED, CAP_LIGHT_LEVEL, CAP_CMD_DECREMENT, 30);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cmd = make_cmd(SCHED_NODE_PACED, CAP_LIGHT_LEVEL, CAP_CMD_SET, 0);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cmd_sched_get_pending(SCHED_NODE_PACED, 1, CAP_LIGHT_LEVEL, &pending);
+    ASSERT_EQ(pending.i, 0);
+    advance_ms(1000);
+    cmd_sched_process();
+    os_event_dispatch(0);
+
+    cmd_sched_set_min_gap(0);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_cmd_sched_group(void) {
+    TEST_START("cmd_sched_group");
+
+    os_eui64_t nodes[SCHED_GROUP_SIZE + 1];
+    for (uint32_t i = 0; i < SCHED_GROUP_SIZE; i++) {
+        nodes[i] = SCHED_NODE_GROUP + i;
+        ASSERT_TRUE(reg_add_node(nodes[i], (uint16_t)(0x5510 + i)) != NULL);
+    }
+    nodes[SCHED_GROUP_SIZE] = 0xDEAD;   /* Not in the registry */
+
+    cmd_sched_stats_t before, stats;
+    cmd_sched_get_stats(&before);
+    uint32_t events_before = cap_cmd_events;
+
+    /* Color temperature has no adapter primitive and goes out as an event */
+    cap_command_t cmd = make_cmd(0, CAP_LIGHT_COLOR_TEMP, CAP_CMD_SET, 300);
+    ASSERT_EQ(cmd_sched_submit_group(nodes, SCHED_GROUP_SIZE + 1, &cmd),
+              OS_ERR_NOT_FOUND);
+
+    /* Every member is sent in the same pass */
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.sent - before.sent, SCHED_GROUP_SIZE);
+    ASSERT_EQ(cmd_sched_pending_count(), 0);
+
+    os_event_dispatch(0);
+    ASSERT_EQ(cap_cmd_events - events_before, SCHED_GROUP_SIZE);
+    ASSERT_EQ(last_cap_cmd.cap_id, CAP_LIGHT_COLOR_TEMP);
+    ASSERT_EQ(last_cap_cmd.value.i, 300);
+    ASSERT_TRUE(last_cap_corr_id != 0);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_cmd_sched_timeout(void) {
+    TEST_START("cmd_sched_timeout");
+
+    ASSERT_TRUE(reg_add_node(SCHED_NODE_LOST, 0x5503) != NULL);
+
+    cmd_sched_stats_t before, stats;
+    cmd_sched_get_stats(&before);
+
+    cap_command_t cmd = make_cmd(SCHED_NODE_LOST, CAP_SWITCH_ON, CAP_CMD_SET, 0);
+    cmd.value.b = true;
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cmd.value.b = false;
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    ASSERT_EQ(cmd_sched_pending_count(), 1);
+
+    /* Confirm never seen: the node is released after the timeout */
+    advance_ms(CMD_SCHED_CONFIRM_TIMEOUT_MS - 1);
+    ASSERT_EQ(cmd_sched_process(), 0);
+    advance_ms(1);
+    ASSERT_EQ(cmd_sched_process(), 1);
+
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.timeouts - before.timeouts, 1);
+
+    /* The late confirm for the abandoned frame is ignored */
+    os_event_dispatch(0);
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.confirmed - before.confirmed, 1);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static reg_node_t *add_light(os_eui64_t addr, uint16_t nwk) {
+    reg_node_t *node = reg_add_node(addr, nwk);
+    if (!node) {
+        return NULL;
+    }
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0102);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_LEVEL, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_COLOR, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    return node;
+}
+
+static void test_cmd_sched_optimistic(void) {
+    TEST_START("cmd_sched_optimistic");
+
+    reg_node_t *node = add_light(SCHED_NODE_OPT, 0x5504);
+    ASSERT_TRUE(node != NULL);
+    os_event_dispatch(0);
+
+    cmd_sched_stats_t before, stats;
+    cmd_sched_get_stats(&before);
+
+    /* State is published before the device has answered */
+    cap_command_t cmd = make_cmd(SCHED_NODE_OPT, CAP_LIGHT_ON, CAP_CMD_SET, 0);
+    cmd.value.b = true;
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cap_state_t state;
+    ASSERT_EQ(cap_get_state_by_node(node, CAP_LIGHT_ON, &state), OS_OK);
+    ASSERT_TRUE(state.valid && state.value.b);
+
+    /* Confirm, then the report closes it out */
+    os_event_dispatch(0);
+    reg_attr_value_t v = {.b = true};
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF,
+                                                  ZCL_ATTR_ONOFF, &v), OS_OK);
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.optimistic - before.optimistic, 1);
+    ASSERT_EQ(stats.reconciled - before.reconciled, 1);
+
+    /* Confirmed but never reported: read back after the window */
+    cmd = make_cmd(SCHED_NODE_OPT, CAP_LIGHT_LEVEL, CAP_CMD_SET, 40);
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    os_event_dispatch(0);
+    advance_ms(CMD_SCHED_RECONCILE_MS - 1);
+    cmd_sched_process();
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.reads - before.reads, 0);
+    advance_ms(1);
+    cmd_sched_process();
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.reads - before.reads, 1);
+    os_event_dispatch(0);
+
+    /* No confirm at all: read back when the in-flight command times out */
+    cmd.value.i = 60;
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    advance_ms(CMD_SCHED_CONFIRM_TIMEOUT_MS);
+    cmd_sched_process();
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.reads - before.reads, 2);
+    os_event_dispatch(0);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_cmd_sched_rollback(void) {
+    TEST_START("cmd_sched_rollback");
+
+    reg_node_t *node = reg_find_node(SCHED_NODE_OPT);
+    ASSERT_TRUE(node != NULL);
+
+    reg_attr_value_t v = {.u16 = 250};
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_COLOR,
+                                                  ZCL_ATTR_COLOR_TEMP, &v), OS_OK);
+
+    cmd_sched_stats_t before, stats;
+    cmd_sched_get_stats(&before);
+
+    cap_command_t cmd = make_cmd(SCHED_NODE_OPT, CAP_LIGHT_COLOR_TEMP, CAP_CMD_SET, 400);
+    cmd.corr_id = os_event_new_corr_id();
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    cap_state_t state;
+    cap_get_state_by_node(node, CAP_LIGHT_COLOR_TEMP, &state);
+    ASSERT_EQ(state.value.i, 400);
+
+    /* Whoever handles the command reports failure, ESP32 driver style */
+    struct {
+        os_corr_id_t corr_id;
+        uint16_t err;
+    } payload = {cmd.corr_id, 0x0087};
+    os_event_emit(OS_EVENT_ZB_CMD_ERROR, &payload, sizeof(payload));
+    os_event_dispatch(0);
+
+    cap_get_state_by_node(node, CAP_LIGHT_COLOR_TEMP, &state);
+    ASSERT_EQ(state.value.i, 250);
+    cmd_sched_get_stats(&stats);
+    ASSERT_EQ(stats.rolled_back - before.rolled_back, 1);
+
+    /* A late confirm for a finished command is ignored */
+    os_event_t late = {0};
+    late.type = OS_EVENT_ZB_CMD_CONFIRM;
+    late.corr_id = cmd.corr_id;
+    os_event_publish(&late);
+    os_event_dispatch(0);
+    cap_get_state_by_node(node, CAP_LIGHT_COLOR_TEMP, &state);
+    ASSERT_EQ(state.value.i, 250);
+
+    /* Two failures in a row: the second command was queued behind the
+     * first, and rolls back to what the device had before either */
+    cmd_sched_set_min_gap(1000);
+    advance_ms(1000);
+    cmd.value.i = 400;
+    cmd.corr_id = os_event_new_corr_id();
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    ASSERT_EQ(cmd_sched_pending_count(), 0);
+    os_corr_id_t first = cmd.corr_id;
+    cmd.value.i = 300;
+    cmd.corr_id = os_event_new_corr_id();
+    ASSERT_EQ(cmd_sched_submit(&cmd), OS_OK);
+    ASSERT_EQ(cmd_sched_pending_count(), 1);
+    cap_get_state_by_node(node, CAP_LIGHT_COLOR_TEMP, &state);
+    ASSERT_EQ(state.value.i, 300);
+
+    payload.corr_id = first;
+    os_event_emit(OS_EVENT_ZB_CMD_ERROR, &payload, sizeof(payload));
+    os_event_dispatch(0);
+    advance_ms(1000);
+    ASSERT_EQ(cmd_sched_process(), 1);
+    os_event_dispatch(0);
+    payload.corr_id = cmd.corr_id;
+    os_event_emit(OS_EVENT_ZB_CMD_ERROR, &payload, sizeof(payload));
+    os_event_dispatch(0);
+    cap_get_state_by_node(node, CAP_LIGHT_COLOR_TEMP, &state);
+    ASSERT_EQ(state.value.i, 250);
+    cmd_sched_set_min_gap(0);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_cmd_sched_cleanup(void) {
+    TEST_START("cmd_sched_cleanup");
+
+    reg_remove_node(SCHED_NODE_SLIDER);
+    reg_remove_node(SCHED_NODE_PACED);
+    reg_remove_node(SCHED_NODE_LOST);
+    reg_remove_node(SCHED_NODE_OPT);
+    for (uint32_t i = 0; i < SCHED_GROUP_SIZE; i++) {
+        reg_remove_node(SCHED_NODE_GROUP + i);
+    }
+    os_event_dispatch(0);
+    cmd_sched_set_min_gap(CMD_SCHED_MIN_GAP_MS);
+
+    ASSERT_EQ(cmd_sched_pending_count(), 0);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+void run_cmd_sched_tests(void) {
+    test_cmd_sched_init();
+    test_cmd_sched_coalesce();
+    test_cmd_sched_relative();
+    test_cmd_sched_group();
+    test_cmd_sched_timeout();
+    test_cmd_sched_optimistic();
+    test_cmd_sched_rollback();
+    test_cmd_sched_cleanup();
+}
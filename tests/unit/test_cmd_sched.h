@@ -0,0 +1,11 @@
+/**
+ * @file test_cmd_sched.h
+ * @brief Command scheduler tests
+ */
+
+#ifndef TEST_CMD_SCHED_H
+#define TEST_CMD_SCHED_H
+
+void run_cmd_sched_tests(void);
+
+#endif /* TEST_CMD_SCHED_H */
@@ -49,6 +49,21 @@ static void test_ha_disc_generate_config(void) {
     ASSERT_TRUE(strlen(config.state_topic) > 0);
     ASSERT_TRUE(strlen(config.command_topic) > 0);
     
+    /* Every capability maps; merged ones report their light */
+    ASSERT_EQ(ha_disc_generate_config(addr, CAP_LIGHT_COLOR_TEMP, &config), OS_OK);
+    ASSERT_EQ(config.component, HA_COMPONENT_LIGHT);
+    ASSERT_EQ(ha_disc_generate_config(addr, CAP_SWITCH_ON, &config), OS_OK);
+    ASSERT_EQ(config.component, HA_COMPONENT_SWITCH);
+    ASSERT_EQ(ha_disc_generate_config(addr, CAP_SENSOR_MOTION, &config), OS_OK);
+    ASSERT_EQ(config.component, HA_COMPONENT_BINARY_SENSOR);
+    ASSERT_EQ(ha_disc_generate_config(addr, CAP_SENSOR_ILLUMINANCE, &config), OS_OK);
+    ASSERT_EQ(config.component, HA_COMPONENT_SENSOR);
+    ASSERT_EQ(ha_disc_generate_config(addr, CAP_POWER_WATTS, &config), OS_OK);
+    ASSERT_EQ(config.component, HA_COMPONENT_SENSOR);
+    ASSERT_EQ(ha_disc_generate_config(addr, CAP_ENERGY_KWH, &config), OS_OK);
+    ASSERT_EQ(config.component, HA_COMPONENT_SENSOR);
+    ASSERT_EQ(ha_disc_generate_config(addr, CAP_UNKNOWN, &config), OS_ERR_INVALID_ARG);
+    
     tests_passed++;
     TEST_PASS();
 }
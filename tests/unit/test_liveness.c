@@ -0,0 +1,183 @@
+/**
+ * @file test_liveness.c
+ * @brief Liveness service tests
+ */
+
+#include "liveness.h"
+#include "capability.h"
+#include "registry.h"
+#include "zb_adapter.h"
+#include "zcl_ids.h"
+#include "os_event.h"
+#include "os_fibre.h"
+#include "os_types.h"
+#include "test_support.h"
+
+#define LIVE_NODE_MAINS   0x1111222233334401ULL
+#define LIVE_NODE_BATTERY 0x1111222233334402ULL
+#define LIVE_NODE_TRAFFIC 0x1111222233334403ULL
+
+static void advance_ms(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        os_tick_advance();
+    }
+}
+
+static void test_liveness_init(void) {
+    TEST_START("liveness_init");
+
+    os_err_t err = liveness_init();
+    ASSERT_EQ(err, OS_OK);
+
+    /* Double init should return error */
+    err = liveness_init();
+    ASSERT_EQ(err, OS_ERR_ALREADY_EXISTS);
+
+    ASSERT_EQ(liveness_set_timeout(REG_POWER_MAINS, 0), OS_ERR_INVALID_ARG);
+    ASSERT_EQ(liveness_get_timeout(REG_POWER_DC), LIVENESS_TIMEOUT_MAINS_MS);
+    ASSERT_EQ(liveness_get_timeout(REG_POWER_UNKNOWN),
+              LIVENESS_TIMEOUT_BATTERY_MS);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_liveness_expiry(void) {
+    TEST_START("liveness_expiry");
+
+    ASSERT_EQ(liveness_set_timeout(REG_POWER_MAINS, 50), OS_OK);
+    ASSERT_EQ(liveness_set_timeout(REG_POWER_BATTERY, 200), OS_OK);
+
+    reg_node_t *mains = reg_add_node(LIVE_NODE_MAINS, 0x4401);
+    reg_node_t *battery = reg_add_node(LIVE_NODE_BATTERY, 0x4402);
+    ASSERT_TRUE(mains != NULL && battery != NULL);
+    mains->power_source = REG_POWER_MAINS;
+    battery->power_source = REG_POWER_BATTERY;
+
+    /* Only READY nodes are armed */
+    reg_set_state(mains, REG_STATE_READY);
+    reg_set_state(battery, REG_STATE_READY);
+    os_event_dispatch(0);
+
+    liveness_stats_t before, stats;
+    liveness_get_stats(&before);
+    ASSERT_TRUE(before.tracked >= 2);
+
+    /* Nothing due yet */
+    advance_ms(49);
+    liveness_process();
+    ASSERT_EQ(mains->state, REG_STATE_READY);
+
+    /* Mains node expires first */
+    advance_ms(11);
+    ASSERT_TRUE(liveness_process() >= 1);
+    ASSERT_EQ(mains->state, REG_STATE_OFFLINE);
+    ASSERT_EQ(battery->state, REG_STATE_READY);
+
+    /* Battery node is heard from, pushing its deadline out */
+    advance_ms(40);
+    reg_touch_node(battery);
+    advance_ms(110);
+    liveness_process();
+    ASSERT_EQ(battery->state, REG_STATE_READY);
+    liveness_get_stats(&stats);
+    ASSERT_TRUE(stats.rearmed > before.rearmed);
+
+    advance_ms(100);
+    ASSERT_TRUE(liveness_process() >= 1);
+    ASSERT_EQ(battery->state, REG_STATE_OFFLINE);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_liveness_recovery(void) {
+    TEST_START("liveness_recovery");
+
+    reg_node_t *mains = reg_find_node(LIVE_NODE_MAINS);
+    ASSERT_TRUE(mains != NULL);
+    os_event_dispatch(0);
+
+    liveness_stats_t before, stats;
+    liveness_get_stats(&before);
+
+    /* Traffic from an OFFLINE node brings it back and re-arms it */
+    reg_touch_node(mains);
+    ASSERT_EQ(mains->state, REG_STATE_READY);
+    os_event_dispatch(0);
+    liveness_get_stats(&stats);
+    ASSERT_EQ(stats.tracked, before.tracked + 1);
+
+    /* Leaving disarms */
+    reg_remove_node(LIVE_NODE_MAINS);
+    reg_remove_node(LIVE_NODE_BATTERY);
+    os_event_dispatch(0);
+    liveness_get_stats(&stats);
+    ASSERT_EQ(stats.tracked, before.tracked);
+
+    liveness_set_timeout(REG_POWER_MAINS, LIVENESS_TIMEOUT_MAINS_MS);
+    liveness_set_timeout(REG_POWER_BATTERY, LIVENESS_TIMEOUT_BATTERY_MS);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_liveness_traffic(void) {
+    TEST_START("liveness_traffic");
+
+    ASSERT_EQ(liveness_set_timeout(REG_POWER_MAINS, 50), OS_OK);
+
+    reg_node_t *node = reg_add_node(LIVE_NODE_TRAFFIC, 0x4403);
+    ASSERT_TRUE(node != NULL);
+    node->power_source = REG_POWER_MAINS;
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0302);
+    reg_add_cluster(ep, ZCL_CLUSTER_TEMPERATURE, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    reg_set_state(node, REG_STATE_READY);
+    os_event_dispatch(0);
+
+    /* Reports and read responses every 30 ms keep it READY well past
+     * its 50 ms timeout */
+    reg_attr_value_t v = {0};
+    for (uint32_t i = 0; i < 10; i++) {
+        advance_ms(30);
+        if (i % 2 == 0) {
+            v.s16 = (int16_t)(2000 + i);
+            cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_TEMPERATURE,
+                                                ZCL_ATTR_TEMPERATURE, &v);
+        } else {
+            zba_attr_read_t rsp = {
+                .node_id = LIVE_NODE_TRAFFIC,
+                .cluster_id = ZCL_CLUSTER_TEMPERATURE,
+                .attr_id = ZCL_ATTR_TEMPERATURE,
+                .endpoint = 1,
+                .type = ZBA_ZCL_TYPE_INT16,
+                .len = 2,
+                .total = 2,
+            };
+            os_event_emit(OS_EVENT_ZB_ATTR_READ, &rsp, sizeof(rsp));
+        }
+        os_event_dispatch(0);
+        liveness_process();
+        ASSERT_EQ(node->state, REG_STATE_READY);
+    }
+
+    /* Then silence: it expires */
+    advance_ms(60);
+    liveness_process();
+    ASSERT_EQ(node->state, REG_STATE_OFFLINE);
+
+    reg_remove_node(LIVE_NODE_TRAFFIC);
+    os_event_dispatch(0);
+    liveness_set_timeout(REG_POWER_MAINS, LIVENESS_TIMEOUT_MAINS_MS);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+void run_liveness_tests(void) {
+    test_liveness_init();
+    test_liveness_expiry();
+    test_liveness_recovery();
+    test_liveness_traffic();
+}
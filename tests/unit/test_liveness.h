@@ -0,0 +1,11 @@
+/**
+ * @file test_liveness.h
+ * @brief Liveness service tests
+ */
+
+#ifndef TEST_LIVENESS_H
+#define TEST_LIVENESS_H
+
+void run_liveness_tests(void);
+
+#endif /* TEST_LIVENESS_H */
@@ -45,9 +45,9 @@ static void test_i2c_sensor_driver(void) {
     ASSERT_EQ(err, OS_OK);
     
     /* Should be able to read temperature */
-    float temp = i2c_sensor_read_temperature_c();
+    int16_t temp = i2c_sensor_read_temperature_centi();
     /* Temperature should be within simulation bounds (20-25°C) */
-    ASSERT_TRUE(temp >= 20.0f && temp <= 25.0f);
+    ASSERT_TRUE(temp >= 2000 && temp <= 2500);
     
     tests_passed++;
     TEST_PASS();
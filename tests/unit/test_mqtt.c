@@ -0,0 +1,1501 @@
+/**
+ * @file test_mqtt.c
+ * @brief MQTT adapter tests, against the in-process broker stand-in
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capability.h"
+#include "ha_disc.h"
+#include "mqtt_adapter.h"
+#include "mqtt_broker_stub.h"
+#include "mqtt_json.h"
+#include "os_event.h"
+#include "os_fibre.h"
+#include "os_types.h"
+#include "registry.h"
+#include "test_support.h"
+#include "zb_adapter.h"
+#include "zb_fake.h"
+#include "zcl_ids.h"
+
+#define MQTT_TEST_NODE  0x00124B00CAFE0001ULL
+#define MQTT_CMD_NODE   0x00124B00CAFE0002ULL
+#define MQTT_FMT_NODE   0x00124B00CAFE0003ULL
+#define MQTT_SNAP_NODE  0x00124B00CAFE0100ULL
+#define MQTT_SNAP_NODES 10
+#define MQTT_AGG_NODE   0x00124B00CAFE0200ULL
+#define MQTT_DISC_NODE  0x00124B00CAFE0300ULL
+#define MQTT_JOIN_NODE  0x00124B00CAFE0400ULL
+#define MQTT_ENT_NODE   0x00124B00CAFE0500ULL
+#define MQTT_RET_NODE   0x00124B00CAFE0600ULL
+#define MQTT_BIRTH_NODE 0x00124B00CAFE0700ULL
+#define MQTT_LOST_NODE  0x00124B00CAFE0800ULL
+#define MQTT_MAX_ROUNDS 20000
+
+static char broker_uri[32];
+
+/* One scheduler pass: broker, client and event bus */
+static void pump(void) {
+    broker_poll();
+    mqtt_poll();
+    os_event_dispatch(0);
+}
+
+static void pump_n(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        pump();
+    }
+}
+
+static bool pump_until_state(mqtt_state_t state) {
+    for (uint32_t i = 0; i < MQTT_MAX_ROUNDS && mqtt_get_state() != state; i++) {
+        pump();
+    }
+    return mqtt_get_state() == state;
+}
+
+static bool pump_until_publishes(uint32_t publishes) {
+    broker_stats_t bs;
+    for (uint32_t i = 0; i < MQTT_MAX_ROUNDS; i++) {
+        pump();
+        broker_get_stats(&bs);
+        if (bs.publishes >= publishes) {
+            return bs.publishes == publishes;
+        }
+    }
+    return false;
+}
+
+static void test_mqtt_connect(void) {
+    TEST_START("mqtt_connect");
+
+    uint16_t port = 0;
+    ASSERT_EQ(broker_start(&port), OS_OK);
+    snprintf(broker_uri, sizeof(broker_uri), "mqtt://127.0.0.1:%u", port);
+
+    mqtt_config_t config = {
+        .broker_uri = broker_uri,
+        .client_id = "test-bridge",
+        .keepalive_sec = 30,
+    };
+    ASSERT_EQ(mqtt_init(&config), OS_OK);
+    ASSERT_EQ(mqtt_init(&config), OS_ERR_ALREADY_EXISTS);
+
+    /* Held until connected, then sent after the higher priority status */
+    ASSERT_EQ(mqtt_publish("bridge/x", "1", 1), OS_OK);
+
+    /* Connecting completes on CONNACK, not in mqtt_connect() */
+    ASSERT_EQ(mqtt_connect(), OS_OK);
+    ASSERT_EQ(mqtt_get_state(), MQTT_STATE_CONNECTING);
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_CONNECTED));
+
+    /* Session: client id, keepalive, offline will; then retained online
+     * status and the command subscription */
+    ASSERT_TRUE(pump_until_publishes(2));
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.connects, 1);
+    ASSERT_TRUE(strcmp(bs.client_id, "test-bridge") == 0);
+    ASSERT_TRUE(strcmp(bs.will_topic, "bridge/status") == 0);
+    ASSERT_EQ(bs.keepalive_sec, 30);
+    ASSERT_EQ(bs.subscribes, 2); /* homeassistant/status, then commands */
+    ASSERT_TRUE(strcmp(bs.last_filter, "bridge/+/+/set") == 0);
+    ASSERT_EQ(bs.retained, 1);
+    ASSERT_TRUE(strcmp(bs.last_topic, "bridge/x") == 0);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_publish_state(void) {
+    TEST_START("mqtt_publish_state");
+
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    mqtt_stats_t before;
+    ASSERT_EQ(mqtt_get_stats(&before), OS_OK);
+
+    /* A capability state change reaches the broker as a state message */
+    struct {
+        os_eui64_t node_addr;
+        cap_id_t cap_id;
+        cap_value_t value;
+    } change = {MQTT_TEST_NODE, CAP_SENSOR_TEMPERATURE, {.i = 2150}};
+    ASSERT_EQ(os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &change, sizeof(change)),
+              OS_OK);
+    ASSERT_TRUE(pump_until_publishes(bs.publishes + 1));
+
+    broker_get_stats(&bs);
+    ASSERT_TRUE(strcmp(bs.last_topic,
+                       "bridge/00124B00CAFE0001/sensor.temperature/state") == 0);
+    ASSERT_TRUE(strncmp(bs.last_payload, "{\"v\":21.50,", 11) == 0);
+
+    mqtt_stats_t after;
+    ASSERT_EQ(mqtt_get_stats(&after), OS_OK);
+    ASSERT_EQ(after.messages_published, before.messages_published + 1);
+    ASSERT_TRUE(after.bytes_sent > before.bytes_sent);
+    ASSERT_EQ(after.tx_backlog, 0);
+
+    /* Events that name no capability publish nothing: an address alone,
+     * or CAP_UNKNOWN */
+    broker_get_stats(&bs);
+    os_eui64_t addr_only = MQTT_TEST_NODE;
+    ASSERT_EQ(os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &addr_only,
+                            sizeof(addr_only)),
+              OS_OK);
+    change.cap_id = CAP_UNKNOWN;
+    ASSERT_EQ(os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &change, sizeof(change)),
+              OS_OK);
+    pump_n(100);
+    broker_stats_t bs_after;
+    broker_get_stats(&bs_after);
+    ASSERT_EQ(bs_after.publishes, bs.publishes);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+/* Sequence number in 8 digits, padded to a size that fills the socket in
+ * a few batches */
+#define SEQ_PAYLOAD_LEN 200
+
+/* Checks publishes arrive whole and in order */
+typedef struct {
+    uint32_t next;
+    uint32_t errors;
+} seq_check_t;
+
+static void check_seq(const char *topic, size_t topic_len, const uint8_t *payload,
+                      size_t len, void *ctx) {
+    seq_check_t *check = ctx;
+    char text[16];
+    char expect[32];
+    snprintf(expect, sizeof(expect), "bridge/test/seq/%u", check->next);
+    if (topic_len != strlen(expect) || strncmp(topic, expect, topic_len) != 0 ||
+        len != SEQ_PAYLOAD_LEN) {
+        check->errors++;
+        check->next++;
+        return;
+    }
+    memcpy(text, payload, 8);
+    text[8] = '\0';
+    if ((uint32_t)strtoul(text, NULL, 10) != check->next) {
+        check->errors++;
+    }
+    check->next++;
+}
+
+static void test_mqtt_partial_writes(void) {
+    TEST_START("mqtt_partial_writes");
+
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    seq_check_t check = {0};
+    broker_set_publish_hook(check_seq, &check);
+
+    /* With the broker not reading, the socket fills, then the client's
+     * buffer, then the queue; the publish that does not fit is refused.
+     * Polling after every 16 publishes makes each write a batch. */
+    broker_pause(true);
+    uint32_t accepted = 0;
+    os_err_t err = OS_OK;
+    const mqtt_pub_opts_t opts = {.prio = MQTT_PRIO_LOW};
+    char payload[SEQ_PAYLOAD_LEN];
+    memset(payload, 'x', sizeof(payload));
+    for (uint32_t i = 0; i < 100000 && err == OS_OK; i++) {
+        char topic[32];
+        char seq[9];
+        snprintf(topic, sizeof(topic), "bridge/test/seq/%u", i);
+        snprintf(seq, sizeof(seq), "%08u", i);
+        memcpy(payload, seq, 8);
+        err = mqtt_publish_ex(topic, payload, sizeof(payload), &opts);
+        if (err == OS_OK) {
+            accepted++;
+        }
+        if ((i % 16) == 15) {
+            mqtt_poll();
+        }
+    }
+    ASSERT_EQ(err, OS_ERR_FULL);
+    mqtt_stats_t stats;
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_TRUE(stats.partial_writes > 0);
+    ASSERT_TRUE(stats.tx_backlog > 0);
+    ASSERT_TRUE(stats.tx_backlog_peak >= stats.tx_backlog);
+    ASSERT_EQ(stats.queue_depth, MQTT_QUEUE_SIZE);
+
+    /* Everything accepted arrives intact and in order once it reads again */
+    broker_pause(false);
+    ASSERT_TRUE(pump_until_publishes(bs.publishes + accepted));
+    ASSERT_EQ(check.next, accepted);
+    ASSERT_EQ(check.errors, 0);
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.tx_backlog, 0);
+    ASSERT_EQ(stats.queue_depth, 0);
+    ASSERT_EQ(mqtt_get_state(), MQTT_STATE_CONNECTED);
+
+    broker_set_publish_hook(NULL, NULL);
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_batching(void) {
+    TEST_START("mqtt_batching");
+
+    for (uint32_t i = 0; i < 20; i++) {
+        pump();
+    }
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    mqtt_stats_t before;
+    ASSERT_EQ(mqtt_get_stats(&before), OS_OK);
+
+    /* Ten topics, one of them updated three times: nothing is written
+     * until the poll, which sends the ten latest values in one write */
+    for (uint32_t i = 0; i < 10; i++) {
+        char topic[32];
+        snprintf(topic, sizeof(topic), "bridge/test/batch/%u", i);
+        ASSERT_EQ(mqtt_publish(topic, "a", 1), OS_OK);
+    }
+    ASSERT_EQ(mqtt_publish("bridge/test/batch/3", "b", 1), OS_OK);
+    ASSERT_EQ(mqtt_publish("bridge/test/batch/3", "c", 1), OS_OK);
+
+    mqtt_stats_t stats;
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.queue_depth, 10);
+    ASSERT_EQ(stats.coalesced, before.coalesced + 2);
+    ASSERT_EQ(stats.bytes_sent, before.bytes_sent);
+
+    mqtt_poll();
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.writes, before.writes + 1);
+    ASSERT_EQ(stats.messages_published, before.messages_published + 10);
+    ASSERT_EQ(stats.queue_depth, 0);
+    ASSERT_TRUE(pump_until_publishes(bs.publishes + 10));
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+/* Records the order topics arrive in */
+typedef struct {
+    uint32_t count;
+    char topics[4][64];
+} topic_log_t;
+
+static void log_topic(const char *topic, size_t topic_len, const uint8_t *payload,
+                      size_t len, void *ctx) {
+    topic_log_t *log = ctx;
+    (void)payload;
+    (void)len;
+    if (log->count < 4) {
+        size_t n = topic_len < sizeof(log->topics[0]) - 1 ? topic_len
+                                                          : sizeof(log->topics[0]) - 1;
+        memcpy(log->topics[log->count], topic, n);
+        log->topics[log->count][n] = '\0';
+    }
+    log->count++;
+}
+
+static void test_mqtt_queue(void) {
+    TEST_START("mqtt_queue");
+
+    mqtt_stats_t before;
+    ASSERT_EQ(mqtt_get_stats(&before), OS_OK);
+
+    /* A QoS 1 state written to a broker that never answers is sent again
+     * on the next session */
+    broker_pause(true);
+    cap_value_t value = {.i = 2000};
+    ASSERT_EQ(mqtt_publish_state(MQTT_TEST_NODE, CAP_SENSOR_TEMPERATURE, &value),
+              OS_OK);
+    mqtt_poll();
+    mqtt_stats_t stats;
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.messages_published, before.messages_published + 1);
+    ASSERT_EQ(stats.queue_depth, 1);
+    broker_drop_client();
+    broker_pause(false);
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_DISCONNECTED));
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.retries, before.retries + 1);
+
+    /* Disconnected: updates coalesce, and a full queue refuses what it
+     * cannot place; at the reconnect the online status evicts the lowest
+     * priority message */
+    value.i = 2100;
+    ASSERT_EQ(mqtt_publish_state(MQTT_TEST_NODE, CAP_SENSOR_TEMPERATURE, &value),
+              OS_OK);
+    value.i = 2200;
+    ASSERT_EQ(mqtt_publish_state(MQTT_TEST_NODE, CAP_SENSOR_TEMPERATURE, &value),
+              OS_OK);
+    ASSERT_EQ(mqtt_publish_meta(MQTT_TEST_NODE, "Acme", "TH"), OS_OK);
+    const mqtt_pub_opts_t high = {.qos = 1, .prio = MQTT_PRIO_HIGH};
+    ASSERT_EQ(mqtt_publish_ex("bridge/test/alert", "1", 1, &high), OS_OK);
+    for (uint32_t i = 0; i < MQTT_QUEUE_SIZE - 3; i++) {
+        char topic[32];
+        snprintf(topic, sizeof(topic), "bridge/test/fill/%u", i);
+        ASSERT_EQ(mqtt_publish(topic, "f", 1), OS_OK);
+    }
+    const mqtt_pub_opts_t low = {.prio = MQTT_PRIO_LOW};
+    ASSERT_EQ(mqtt_publish_ex("bridge/test/low", "1", 1, &low), OS_ERR_FULL);
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.queue_depth, MQTT_QUEUE_SIZE);
+    ASSERT_EQ(stats.coalesced, before.coalesced + 2);
+    ASSERT_EQ(stats.dropped, before.dropped + 1);
+
+    /* After the reconnect the high priority messages go first, and the
+     * temperature arrives once with its latest value */
+    topic_log_t log = {0};
+    broker_set_publish_hook(log_topic, &log);
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    ASSERT_EQ(mqtt_connect(), OS_OK);
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_CONNECTED));
+    ASSERT_TRUE(pump_until_publishes(bs.publishes + MQTT_QUEUE_SIZE));
+    ASSERT_TRUE(strcmp(log.topics[0], "bridge/test/alert") == 0);
+    ASSERT_TRUE(strcmp(log.topics[1], "bridge/status") == 0);
+    ASSERT_TRUE(strcmp(log.topics[2],
+                       "bridge/00124B00CAFE0001/sensor.temperature/state") == 0);
+    broker_get_stats(&bs);
+    ASSERT_TRUE(strcmp(bs.last_topic, "bridge/test/fill/28") == 0);
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.dropped, before.dropped + 2); /* The meta message */
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.queue_depth, 0);
+
+    broker_set_publish_hook(NULL, NULL);
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_inbound_keepalive(void) {
+    TEST_START("mqtt_inbound_keepalive");
+
+    mqtt_stats_t before;
+    ASSERT_EQ(mqtt_get_stats(&before), OS_OK);
+    ASSERT_EQ(broker_publish("bridge/00124B00CAFE0001/light.on/set",
+                             "{\"v\":true}"), OS_OK);
+    mqtt_stats_t stats = before;
+    for (uint32_t i = 0; i < MQTT_MAX_ROUNDS &&
+                         stats.messages_received == before.messages_received;
+         i++) {
+        pump();
+        mqtt_get_stats(&stats);
+    }
+    ASSERT_EQ(stats.messages_received, before.messages_received + 1);
+
+    /* An idle session pings once per keepalive period and stays up */
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.pings, 0);
+    for (uint32_t i = 0; i < 30000; i++) {
+        os_tick_advance();
+    }
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.pings, 1);
+    ASSERT_EQ(mqtt_get_state(), MQTT_STATE_CONNECTED);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_json(void) {
+    TEST_START("mqtt_json");
+
+    /* Nested values are skipped whole, braces inside strings included */
+    const char *doc = " {\"a\":{\"b\":[1,{\"c\":\"}]\"}]},\"s\":\"x\\\"y\","
+                      "\"v\":-21.5,\"corr_id\":42 } ";
+    mqtt_json_iter_t it;
+    mqtt_json_token_t key, value;
+    ASSERT_EQ(mqtt_json_object_begin(&it, doc, strlen(doc)), OS_OK);
+    ASSERT_EQ(mqtt_json_object_next(&it, &key, &value), OS_OK);
+    ASSERT_TRUE(mqtt_json_equals(&key, "a"));
+    ASSERT_EQ(value.type, MQTT_JSON_OBJECT);
+    ASSERT_EQ(mqtt_json_object_next(&it, &key, &value), OS_OK);
+    ASSERT_TRUE(mqtt_json_equals(&value, "x\\\"y")); /* Escapes kept as sent */
+    ASSERT_EQ(mqtt_json_object_next(&it, &key, &value), OS_OK);
+    ASSERT_TRUE(mqtt_json_equals(&key, "v"));
+    int32_t fixed;
+    ASSERT_EQ(mqtt_json_to_fixed(&value, 2, &fixed), OS_OK);
+    ASSERT_EQ(fixed, -2150);
+    ASSERT_EQ(mqtt_json_to_fixed(&value, 0, &fixed), OS_OK);
+    ASSERT_EQ(fixed, -21);
+    ASSERT_EQ(mqtt_json_object_next(&it, &key, &value), OS_OK);
+    uint32_t u;
+    ASSERT_EQ(mqtt_json_to_u32(&value, &u), OS_OK);
+    ASSERT_EQ(u, 42);
+    ASSERT_EQ(mqtt_json_object_next(&it, &key, &value), OS_ERR_NOT_FOUND);
+
+    /* Malformed or truncated text */
+    const char *bad[] = {"{\"v\":tru}", "{\"v\" 1}", "{\"v\":1", "{\"v\":[1}]}",
+                         "{\"v\":\"open}"};
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        ASSERT_EQ(mqtt_json_object_begin(&it, bad[i], strlen(bad[i])), OS_OK);
+        os_err_t err;
+        while ((err = mqtt_json_object_next(&it, &key, &value)) == OS_OK) {
+        }
+        ASSERT_EQ(err, OS_ERR_INVALID_ARG);
+    }
+
+    /* Bare values; numbers stay integer-only */
+    ASSERT_EQ(mqtt_json_value(" 128 ", 5, &value), OS_OK);
+    ASSERT_EQ(mqtt_json_to_fixed(&value, 0, &fixed), OS_OK);
+    ASSERT_EQ(fixed, 128);
+    ASSERT_EQ(mqtt_json_value("1 2", 3, &value), OS_ERR_INVALID_ARG);
+    ASSERT_EQ(mqtt_json_value("1e3", 3, &value), OS_OK);
+    ASSERT_EQ(mqtt_json_to_fixed(&value, 0, &fixed), OS_ERR_INVALID_ARG);
+    ASSERT_EQ(mqtt_json_value("3000000000", 10, &value), OS_OK);
+    ASSERT_EQ(mqtt_json_to_fixed(&value, 0, &fixed), OS_ERR_INVALID_ARG);
+    ASSERT_EQ(mqtt_json_to_u32(&value, &u), OS_OK);
+    ASSERT_EQ(u, 3000000000u);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_json_writer(void) {
+    TEST_START("mqtt_json_writer");
+
+    char buf[160];
+    mqtt_json_writer_t w;
+    mqtt_json_writer_init(&w, buf, sizeof(buf));
+    mqtt_json_write_object_begin(&w);
+    mqtt_json_write_key(&w, "a");
+    mqtt_json_write_fixed(&w, -5, 2);
+    mqtt_json_write_key(&w, "b");
+    mqtt_json_write_array_begin(&w);
+    mqtt_json_write_int(&w, INT32_MIN);
+    mqtt_json_write_uint(&w, 4294967295u);
+    mqtt_json_write_fixed(&w, 2134, 2);
+    mqtt_json_write_fixed(&w, 1000, 3);
+    mqtt_json_write_array_end(&w);
+    mqtt_json_write_key(&w, "s");
+    mqtt_json_write_string(&w, "q\"b\\n\n\x01");
+    mqtt_json_write_key(&w, "e");
+    mqtt_json_write_object_begin(&w);
+    mqtt_json_write_object_end(&w);
+    mqtt_json_write_key(&w, "t");
+    mqtt_json_write_bool(&w, false);
+    mqtt_json_write_object_end(&w);
+    const char *expect = "{\"a\":-0.05,\"b\":[-2147483648,4294967295,21.34,1.000],"
+                         "\"s\":\"q\\\"b\\\\n\\n\\u0001\",\"e\":{},\"t\":false}";
+    ASSERT_EQ(mqtt_json_writer_finish(&w), (int)strlen(expect));
+    ASSERT_TRUE(strcmp(buf, expect) == 0);
+
+    /* What the writer produces, the scanner reads back */
+    mqtt_json_iter_t it;
+    mqtt_json_token_t key, value;
+    ASSERT_EQ(mqtt_json_object_begin(&it, buf, strlen(buf)), OS_OK);
+    uint32_t members = 0;
+    while (mqtt_json_object_next(&it, &key, &value) == OS_OK) {
+        members++;
+    }
+    ASSERT_EQ(members, 5);
+
+    /* Overflow is reported once, at the end */
+    char small[8];
+    mqtt_json_writer_init(&w, small, sizeof(small));
+    mqtt_json_write_object_begin(&w);
+    mqtt_json_write_key(&w, "value");
+    mqtt_json_write_int(&w, 12345);
+    mqtt_json_write_object_end(&w);
+    ASSERT_EQ(mqtt_json_writer_finish(&w), -1);
+    ASSERT_EQ(small[0], '\0');
+
+    /* A string written in parts is escaped the same way */
+    mqtt_json_writer_init(&w, buf, sizeof(buf));
+    mqtt_json_write_array_begin(&w);
+    mqtt_json_write_string(&w, "x");
+    mqtt_json_write_string_begin(&w);
+    mqtt_json_write_string_part(&w, "a\"");
+    mqtt_json_write_string_part(&w, NULL);
+    mqtt_json_write_string_part(&w, "/b");
+    mqtt_json_write_string_end(&w);
+    mqtt_json_write_array_end(&w);
+    ASSERT_EQ(mqtt_json_writer_finish(&w), 13);
+    ASSERT_TRUE(strcmp(buf, "[\"x\",\"a\\\"/b\"]") == 0);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_format_state(void) {
+    TEST_START("mqtt_format_state");
+
+    char topic[128];
+    char payload[64];
+    size_t len;
+    char expect[64];
+
+    /* Not in the registry: prefix formatted on the spot */
+    cap_value_t value = {.i = -1234};
+    ASSERT_EQ(mqtt_format_state(MQTT_TEST_NODE, CAP_SENSOR_TEMPERATURE, &value,
+                                topic, sizeof(topic), payload, sizeof(payload),
+                                &len), OS_OK);
+    ASSERT_TRUE(strcmp(topic, "bridge/00124B00CAFE0001/sensor.temperature/state") == 0);
+    snprintf(expect, sizeof(expect), "{\"v\":-12.34,\"ts\":%u}",
+             (unsigned)os_now_ticks());
+    ASSERT_TRUE(strcmp(payload, expect) == 0);
+    ASSERT_EQ(len, strlen(expect));
+
+    /* Registered: the cached prefix follows the slot's owner */
+    ASSERT_TRUE(reg_add_node(MQTT_FMT_NODE, 0xCA03) != NULL);
+    value.b = true;
+    ASSERT_EQ(mqtt_format_state(MQTT_FMT_NODE, CAP_LIGHT_ON, &value, topic,
+                                sizeof(topic), payload, sizeof(payload), NULL),
+              OS_OK);
+    ASSERT_TRUE(strcmp(topic, "bridge/00124B00CAFE0003/light.on/state") == 0);
+    ASSERT_TRUE(strncmp(payload, "{\"v\":true,", 10) == 0);
+    ASSERT_EQ(reg_remove_node(MQTT_FMT_NODE), OS_OK);
+    ASSERT_TRUE(reg_add_node(MQTT_FMT_NODE + 0x10, 0xCA13) != NULL);
+    value.i = 55;
+    ASSERT_EQ(mqtt_format_state(MQTT_FMT_NODE + 0x10, CAP_LIGHT_LEVEL, &value,
+                                topic, sizeof(topic), payload, sizeof(payload),
+                                NULL), OS_OK);
+    ASSERT_TRUE(strcmp(topic, "bridge/00124B00CAFE0013/light.level/state") == 0);
+    ASSERT_TRUE(strncmp(payload, "{\"v\":55,", 8) == 0);
+    ASSERT_EQ(reg_remove_node(MQTT_FMT_NODE + 0x10), OS_OK);
+    os_event_dispatch(0);
+
+    /* Buffers too small */
+    ASSERT_EQ(mqtt_format_state(MQTT_TEST_NODE, CAP_LIGHT_LEVEL, &value, topic,
+                                20, payload, sizeof(payload), NULL),
+              OS_ERR_NO_MEM);
+    ASSERT_EQ(mqtt_format_state(MQTT_TEST_NODE, CAP_LIGHT_LEVEL, &value, topic,
+                                sizeof(topic), payload, 8, NULL),
+              OS_ERR_NO_MEM);
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static uint32_t cmd_confirms;
+static zba_cmd_confirm_t last_confirm;
+static os_corr_id_t last_confirm_corr;
+
+static void on_cmd_confirm(const os_event_t *event, void *ctx) {
+    (void)ctx;
+    memcpy(&last_confirm, event->payload, sizeof(last_confirm));
+    last_confirm_corr = event->corr_id;
+    cmd_confirms++;
+}
+
+static bool pump_until_confirms(uint32_t confirms) {
+    for (uint32_t i = 0; i < MQTT_MAX_ROUNDS && cmd_confirms < confirms; i++) {
+        pump();
+    }
+    return cmd_confirms == confirms;
+}
+
+static os_err_t handle(const char *topic, const char *payload) {
+    return mqtt_handle_message(topic, strlen(topic), (const uint8_t *)payload,
+                               strlen(payload));
+}
+
+static void test_mqtt_commands(void) {
+    TEST_START("mqtt_commands");
+
+    reg_node_t *node = reg_add_node(MQTT_CMD_NODE, 0xCA02);
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0101);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_LEVEL, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    os_event_dispatch(0);
+
+    os_event_filter_t filter = {OS_EVENT_ZB_CMD_CONFIRM, OS_EVENT_ZB_CMD_CONFIRM};
+    ASSERT_EQ(os_event_subscribe(&filter, on_cmd_confirm, NULL), OS_OK);
+    mqtt_stats_t before;
+    ASSERT_EQ(mqtt_get_stats(&before), OS_OK);
+
+    /* Over the wire: the corr_id reaches the Zigbee command */
+    ASSERT_EQ(broker_publish("bridge/00124B00CAFE0002/light.on/set",
+                             "{\"v\":true,\"corr_id\":77}"), OS_OK);
+    ASSERT_TRUE(pump_until_confirms(1));
+    ASSERT_EQ(last_confirm.cluster_id, ZCL_CLUSTER_ONOFF);
+    ASSERT_EQ(last_confirm_corr, 77);
+
+    /* Lower-case node id, members in any order, numbers scaled */
+    for (uint32_t i = 0; i < 100; i++) {
+        os_tick_advance();
+    }
+    ASSERT_EQ(handle("bridge/00124b00cafe0002/light.level/set",
+                     "{\"corr_id\":78,\"extra\":[1,2],\"v\":40.7}"), OS_OK);
+    ASSERT_TRUE(pump_until_confirms(2));
+    ASSERT_EQ(last_confirm.cluster_id, ZCL_CLUSTER_LEVEL);
+    ASSERT_EQ(last_confirm_corr, 78);
+
+    /* Bare values and HA-style strings */
+    for (uint32_t i = 0; i < 100; i++) {
+        os_tick_advance();
+    }
+    ASSERT_EQ(handle("bridge/00124B00CAFE0002/light.on/set", "TOGGLE"),
+              OS_ERR_INVALID_ARG); /* Not JSON */
+    ASSERT_EQ(handle("bridge/00124B00CAFE0002/light.on/set", "\"OFF\""), OS_OK);
+    ASSERT_TRUE(pump_until_confirms(3));
+
+    /* Rejected: unknown capability, malformed payload, wrong value type,
+     * unknown node */
+    ASSERT_EQ(handle("bridge/00124B00CAFE0002/light.bogus/set", "{\"v\":1}"),
+              OS_ERR_NOT_FOUND);
+    ASSERT_EQ(handle("bridge/00124B00CAFE0002/light.on/set", "{\"v\":}"),
+              OS_ERR_INVALID_ARG);
+    ASSERT_EQ(handle("bridge/00124B00CAFE0002/light.level/set", "{\"v\":\"high\"}"),
+              OS_ERR_INVALID_ARG);
+    ASSERT_EQ(handle("bridge/00124B00DEAD0000/light.on/set", "{\"v\":true}"),
+              OS_ERR_NOT_FOUND);
+
+    /* Not a command topic: ignored, not counted */
+    ASSERT_EQ(handle("bridge/status", "{}"), OS_ERR_NOT_FOUND);
+    ASSERT_EQ(handle("bridge/00124B00CAFE0002/light.on/state", "{}"),
+              OS_ERR_NOT_FOUND);
+    ASSERT_EQ(handle("bridge/00124B00CAFE000X/light.on/set", "{}"), OS_ERR_NOT_FOUND);
+
+    mqtt_stats_t stats;
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.commands, before.commands + 3);
+    ASSERT_EQ(stats.commands_rejected, before.commands_rejected + 5);
+
+    os_event_unsubscribe(on_cmd_confirm);
+    tests_passed++;
+    TEST_PASS();
+}
+
+/* Valid cached states across the registry: what a snapshot publishes */
+static uint32_t valid_states(void) {
+    uint32_t count = 0;
+    for (uint32_t slot = 0; slot < REG_MAX_NODES; slot++) {
+        reg_node_t *node = reg_get_node_by_slot(slot);
+        for (uint32_t id = 0; node && id < CAP_MAX; id++) {
+            cap_state_t state;
+            if (cap_get_state_by_node(node, (cap_id_t)id, &state) == OS_OK &&
+                state.valid) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static void advance_ms(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        os_tick_advance();
+    }
+}
+
+static void test_mqtt_snapshot(void) {
+    TEST_START("mqtt_snapshot");
+
+    for (uint32_t i = 0; i < MQTT_SNAP_NODES; i++) {
+        reg_node_t *node = reg_add_node(MQTT_SNAP_NODE + i, (uint16_t)(0xCB00 + i));
+        ASSERT_TRUE(node != NULL);
+        reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0101);
+        reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+        reg_add_cluster(ep, ZCL_CLUSTER_LEVEL, REG_CLUSTER_SERVER);
+        cap_compute_for_node(node);
+        reg_attr_value_t v = {.b = (i & 1) != 0};
+        ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF,
+                                                      ZCL_ATTR_ONOFF, &v), OS_OK);
+        v.u8 = (uint8_t)(10 * i);
+        ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_LEVEL,
+                                                      ZCL_ATTR_LEVEL, &v), OS_OK);
+    }
+    for (uint32_t i = 0; i < 200; i++) {
+        pump(); /* Live changes out of the way */
+    }
+    uint32_t expected = valid_states();
+    ASSERT_TRUE(expected >= 2 * MQTT_SNAP_NODES);
+
+    mqtt_snapshot_stats_t before;
+    ASSERT_EQ(mqtt_get_snapshot_stats(&before), OS_OK);
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    uint32_t retained = bs.retained;
+    ASSERT_EQ(mqtt_snapshot_start(), OS_OK);
+
+    /* Paced: nothing until time passes, one per 20 ms at 50/s, and no more
+     * than a burst after a stall */
+    mqtt_snapshot_stats_t snap;
+    pump();
+    ASSERT_EQ(mqtt_get_snapshot_stats(&snap), OS_OK);
+    ASSERT_TRUE(snap.active);
+    ASSERT_EQ(snap.runs, before.runs + 1);
+    ASSERT_EQ(snap.nodes_total, reg_node_count());
+    ASSERT_EQ(snap.published, 0);
+    advance_ms(1000 / MQTT_SNAPSHOT_RATE_DEFAULT);
+    pump();
+    ASSERT_EQ(mqtt_get_snapshot_stats(&snap), OS_OK);
+    ASSERT_EQ(snap.published, 1);
+    advance_ms(1000);
+    pump();
+    ASSERT_EQ(mqtt_get_snapshot_stats(&snap), OS_OK);
+    ASSERT_EQ(snap.published, 1 + MQTT_SNAPSHOT_BURST);
+
+    /* A broker that stops acknowledging holds it at the queue limit */
+    broker_pause(true);
+    for (uint32_t i = 0; i < 20; i++) {
+        advance_ms(1000);
+        mqtt_poll();
+    }
+    mqtt_stats_t stats;
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.queue_depth, MQTT_SNAPSHOT_QUEUE_LIMIT);
+    ASSERT_EQ(mqtt_get_snapshot_stats(&snap), OS_OK);
+    ASSERT_TRUE(snap.active);
+    ASSERT_TRUE(snap.throttled > 0);
+    broker_pause(false);
+
+    /* Runs to the end, every state retained */
+    for (uint32_t i = 0; i < MQTT_MAX_ROUNDS && snap.active; i++) {
+        advance_ms(1);
+        pump();
+        mqtt_get_snapshot_stats(&snap);
+    }
+    ASSERT_EQ(snap.completed, before.completed + 1);
+    ASSERT_EQ(snap.published, expected);
+    ASSERT_EQ(snap.nodes_done, snap.nodes_total);
+    ASSERT_TRUE(snap.elapsed_ms >= expected * 1000 / MQTT_SNAPSHOT_RATE_DEFAULT -
+                                       MQTT_SNAPSHOT_BURST * 20);
+    for (uint32_t i = 0; i < 200; i++) {
+        pump();
+    }
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.retained - retained, expected);
+
+    /* A lost connection aborts it; the next connect starts over */
+    ASSERT_EQ(mqtt_snapshot_start(), OS_OK);
+    broker_drop_client();
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_DISCONNECTED));
+    ASSERT_EQ(mqtt_snapshot_start(), OS_ERR_NOT_READY);
+    ASSERT_EQ(mqtt_get_snapshot_stats(&snap), OS_OK);
+    ASSERT_FALSE(snap.active);
+    ASSERT_EQ(snap.aborted, before.aborted + 1);
+    ASSERT_EQ(mqtt_connect(), OS_OK);
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_CONNECTED));
+    ASSERT_EQ(mqtt_get_snapshot_stats(&snap), OS_OK);
+    ASSERT_TRUE(snap.active);
+    ASSERT_EQ(snap.runs, before.runs + 3);
+    ASSERT_EQ(snap.published, 0);
+
+    for (uint32_t i = 0; i < MQTT_SNAP_NODES; i++) {
+        ASSERT_EQ(reg_remove_node(MQTT_SNAP_NODE + i), OS_OK);
+    }
+    for (uint32_t i = 0; i < MQTT_MAX_ROUNDS && snap.active; i++) {
+        advance_ms(1);
+        pump();
+        mqtt_get_snapshot_stats(&snap);
+    }
+    ASSERT_FALSE(snap.active);
+    for (uint32_t i = 0; i < 200; i++) {
+        pump();
+    }
+
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_retained_state(void) {
+    TEST_START("mqtt_retained_state");
+
+    reg_node_t *node = reg_add_node(MQTT_RET_NODE, 0xCC60);
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0100);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    reg_attr_value_t v = {.b = true};
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF,
+                                                  ZCL_ATTR_ONOFF, &v), OS_OK);
+    pump_n(200);
+
+    /* The snapshot leaves the current value retained */
+    const char *topic = "bridge/00124B00CAFE0600/light.on/state";
+    char retained[256];
+    broker_clear_retained();
+    ASSERT_EQ(mqtt_snapshot_start(), OS_OK);
+    mqtt_snapshot_stats_t snap;
+    ASSERT_EQ(mqtt_get_snapshot_stats(&snap), OS_OK);
+    for (uint32_t i = 0; i < MQTT_MAX_ROUNDS && snap.active; i++) {
+        advance_ms(1);
+        pump();
+        mqtt_get_snapshot_stats(&snap);
+    }
+    pump_n(200);
+    ASSERT_TRUE(broker_get_retained(topic, retained, sizeof(retained)));
+    ASSERT_TRUE(strstr(retained, "\"v\":true") != NULL);
+
+    /* A live change replaces it, so a subscriber arriving afterwards
+     * starts from the new value rather than the snapshot's */
+    v.b = false;
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF,
+                                                  ZCL_ATTR_ONOFF, &v), OS_OK);
+    pump_n(200);
+    ASSERT_TRUE(broker_get_retained(topic, retained, sizeof(retained)));
+    ASSERT_TRUE(strstr(retained, "\"v\":false") != NULL);
+
+    /* Aggregate documents are retained the same way */
+    ASSERT_EQ(mqtt_set_state_mode(MQTT_STATE_MODE_AGGREGATE), OS_OK);
+    v.b = true;
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF,
+                                                  ZCL_ATTR_ONOFF, &v), OS_OK);
+    for (uint32_t i = 0; i < 200; i++) {
+        advance_ms(1);
+        pump();
+    }
+    ASSERT_TRUE(broker_get_retained("bridge/00124B00CAFE0600/state", retained,
+                                    sizeof(retained)));
+    ASSERT_TRUE(strstr(retained, "\"light.on\":true") != NULL);
+    ASSERT_EQ(mqtt_set_state_mode(MQTT_STATE_MODE_PER_CAP), OS_OK);
+
+    ASSERT_EQ(reg_remove_node(MQTT_RET_NODE), OS_OK);
+    pump_n(100);
+    tests_passed++;
+    TEST_PASS();
+}
+
+/* Last publish on a topic prefix, in full */
+typedef struct {
+    const char *prefix;
+    uint32_t count;
+    char payload[1024];
+} capture_t;
+
+static void capture(const char *topic, size_t topic_len, const uint8_t *payload,
+                    size_t len, void *ctx) {
+    capture_t *cap = ctx;
+    size_t n = strlen(cap->prefix);
+    if (topic_len < n || memcmp(topic, cap->prefix, n) != 0) {
+        return;
+    }
+    n = len < sizeof(cap->payload) - 1 ? len : sizeof(cap->payload) - 1;
+    memcpy(cap->payload, payload, n);
+    cap->payload[n] = '\0';
+    cap->count++;
+}
+
+static void test_mqtt_stream(void) {
+    TEST_START("mqtt_stream");
+
+    for (uint32_t i = 0; i < 20; i++) {
+        pump();
+    }
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    uint32_t publishes = bs.publishes;
+    uint32_t retained = bs.retained;
+    capture_t got = {.prefix = "bridge/test/stream"};
+    broker_set_publish_hook(capture, &got);
+    const mqtt_pub_opts_t opts = {.retain = true, .prio = MQTT_PRIO_NORMAL};
+
+    /* Written in place: a large payload, then one short enough that the
+     * reserved length field shrinks */
+    char *buf;
+    size_t room;
+    ASSERT_EQ(mqtt_publish_begin("bridge/test/stream", &opts, &buf, &room), OS_OK);
+    ASSERT_TRUE(room > 600);
+    memset(buf, 'x', 600);
+    ASSERT_EQ(mqtt_publish_end(600), OS_OK);
+    ASSERT_TRUE(pump_until_publishes(publishes + 1));
+    ASSERT_EQ(strlen(got.payload), 600);
+    ASSERT_EQ(mqtt_publish_begin("bridge/test/stream", &opts, &buf, &room), OS_OK);
+    memcpy(buf, "short", 5);
+    ASSERT_EQ(mqtt_publish_end(5), OS_OK);
+    ASSERT_TRUE(pump_until_publishes(publishes + 2));
+    ASSERT_TRUE(strcmp(got.payload, "short") == 0);
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.retained, retained + 2);
+
+    /* One at a time; an aborted one leaves nothing behind */
+    ASSERT_EQ(mqtt_publish_begin("bridge/test/stream", &opts, &buf, &room), OS_OK);
+    memcpy(buf, "dropped", 7);
+    ASSERT_EQ(mqtt_publish_begin("bridge/test/stream", &opts, &buf, &room),
+              OS_ERR_BUSY);
+    mqtt_publish_abort();
+    ASSERT_EQ(mqtt_publish("bridge/test/stream/after", "ok", 2), OS_OK);
+    ASSERT_TRUE(pump_until_publishes(publishes + 3));
+    ASSERT_EQ(got.count, 3);
+    ASSERT_TRUE(strcmp(got.payload, "ok") == 0);
+
+    broker_set_publish_hook(NULL, NULL);
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_aggregate(void) {
+    TEST_START("mqtt_aggregate");
+
+    reg_node_t *node = reg_add_node(MQTT_AGG_NODE, 0xCC00);
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0101);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_LEVEL, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    reg_set_state(node, REG_STATE_READY);
+    ASSERT_EQ(mqtt_set_state_mode(MQTT_STATE_MODE_AGGREGATE), OS_OK);
+    ASSERT_EQ(mqtt_get_state_mode(), MQTT_STATE_MODE_AGGREGATE);
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+
+    mqtt_stats_t before;
+    ASSERT_EQ(mqtt_get_stats(&before), OS_OK);
+    capture_t state = {.prefix = "bridge/00124B00CAFE0200/"};
+    broker_set_publish_hook(capture, &state);
+
+    /* Changes inside the window become one document */
+    reg_attr_value_t v = {.b = true};
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF,
+                                                  ZCL_ATTR_ONOFF, &v), OS_OK);
+    v.u8 = 102; /* 40 % */
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_LEVEL,
+                                                  ZCL_ATTR_LEVEL, &v), OS_OK);
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    ASSERT_EQ(state.count, 0);
+    advance_ms(MQTT_MERGE_WINDOW_DEFAULT_MS);
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    ASSERT_EQ(state.count, 1);
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    ASSERT_TRUE(strcmp(bs.last_topic, "bridge/00124B00CAFE0200/state") == 0);
+    char expect[96];
+    snprintf(expect, sizeof(expect), "{\"light.on\":true,\"light.level\":40,"
+             "\"ts\":%u}", (unsigned)(os_now_ticks() - MQTT_MERGE_WINDOW_DEFAULT_MS));
+    ASSERT_TRUE(strcmp(state.payload, expect) == 0);
+    mqtt_stats_t stats;
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.merged, before.merged + 1);
+
+    char topic[128];
+    char payload[256];
+    ASSERT_EQ(mqtt_format_node_state(MQTT_AGG_NODE, topic, sizeof(topic), payload,
+                                     sizeof(payload), NULL), OS_OK);
+    ASSERT_TRUE(strcmp(payload, expect) == 0);
+    ASSERT_EQ(mqtt_format_node_state(MQTT_AGG_NODE, topic, sizeof(topic), payload,
+                                     20, NULL), OS_ERR_NO_MEM);
+    ASSERT_EQ(mqtt_format_node_state(MQTT_TEST_NODE, topic, sizeof(topic), payload,
+                                     sizeof(payload), NULL), OS_ERR_NOT_FOUND);
+
+    /* Discovery reads the document through value_template */
+    ha_disc_config_t config;
+    ASSERT_EQ(ha_disc_generate_config(MQTT_AGG_NODE, CAP_LIGHT_LEVEL, &config),
+              OS_OK);
+    ASSERT_TRUE(strcmp(config.state_topic, "bridge/00124B00CAFE0200/state") == 0);
+    ASSERT_TRUE(strcmp(config.value_template,
+                       "{{ value_json['light.level'] }}") == 0);
+    capture_t disc = {.prefix = "homeassistant/light/"};
+    broker_set_publish_hook(capture, &disc);
+    ASSERT_EQ(ha_disc_publish_node(MQTT_AGG_NODE), OS_OK);
+    for (uint32_t i = 0; i < 100 && disc.count == 0; i++) {
+        pump();
+    }
+    ASSERT_EQ(disc.count, 1);
+    ASSERT_TRUE(strstr(disc.payload, "\"state_topic\":\"bridge/00124B00CAFE0200/state\"") != NULL);
+    ASSERT_TRUE(strstr(disc.payload, "{{ 'ON' if value_json['light.on'] else 'OFF' }}") != NULL);
+    ASSERT_TRUE(strstr(disc.payload, "{{ (value_json['light.level'] | float * 2.55) | int }}") != NULL);
+
+    /* Back to per-capability topics: a document still in its window goes now */
+    broker_set_publish_hook(capture, &state);
+    v.b = false;
+    ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, ZCL_CLUSTER_ONOFF,
+                                                  ZCL_ATTR_ONOFF, &v), OS_OK);
+    os_event_dispatch(0);
+    ASSERT_EQ(mqtt_set_state_mode(MQTT_STATE_MODE_PER_CAP), OS_OK);
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    ASSERT_EQ(state.count, 2);
+    ASSERT_TRUE(strncmp(state.payload, "{\"light.on\":false,", 18) == 0);
+    ASSERT_EQ(ha_disc_generate_config(MQTT_AGG_NODE, CAP_LIGHT_LEVEL, &config),
+              OS_OK);
+    ASSERT_TRUE(strcmp(config.value_template, "{{ value_json.v }}") == 0);
+
+    broker_set_publish_hook(NULL, NULL);
+    ASSERT_EQ(reg_remove_node(MQTT_AGG_NODE), OS_OK);
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_discovery_cache(void) {
+    TEST_START("mqtt_discovery_cache");
+
+    reg_node_t *node = reg_add_node(MQTT_DISC_NODE, 0xCD00);
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0101);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    strcpy(node->model, "Bulb A");
+    reg_set_state(node, REG_STATE_READY);
+    pump_n(100);
+
+    capture_t disc = {.prefix = "homeassistant/"};
+    broker_set_publish_hook(capture, &disc);
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    uint32_t retained = bs.retained;
+    ha_disc_stats_t before;
+    ASSERT_EQ(ha_disc_get_stats(&before), OS_OK);
+
+    /* First publish goes out, retained */
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 1);
+    ASSERT_TRUE(strstr(disc.payload, "\"model\":\"Bulb A\"") != NULL);
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.retained, retained + 1);
+
+    /* Nothing changed: nothing built, nothing sent */
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 1);
+    ha_disc_stats_t stats;
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.published, before.published + 1);
+    ASSERT_EQ(stats.skipped, before.skipped + 1);
+
+    /* Registry touched but the config bytes are the same */
+    reg_mark_changed(node);
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 1);
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.unchanged, before.unchanged + 1);
+
+    /* A different model is a different config */
+    strcpy(node->model, "Bulb B");
+    reg_mark_changed(node);
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 2);
+    ASSERT_TRUE(strstr(disc.payload, "\"model\":\"Bulb B\"") != NULL);
+
+    /* A new capability sends its entity only */
+    reg_add_cluster(ep, ZCL_CLUSTER_TEMPERATURE, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 3);
+    ASSERT_TRUE(strstr(disc.payload, "\"device_class\":\"temperature\"") != NULL);
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.published, before.published + 3);
+    ASSERT_EQ(stats.unchanged, before.unchanged + 2);
+
+    /* Another state mode changes every state_topic */
+    ASSERT_EQ(mqtt_set_state_mode(MQTT_STATE_MODE_AGGREGATE), OS_OK);
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 5);
+    ASSERT_EQ(mqtt_set_state_mode(MQTT_STATE_MODE_PER_CAP), OS_OK);
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 7);
+
+    /* Once everything is out, republishing everything sends nothing */
+    ha_disc_publish_all();
+    pump_n(100);
+    uint32_t count = disc.count;
+    ha_disc_publish_all();
+    pump_n(100);
+    ASSERT_EQ(disc.count, count);
+
+    /* Invalidated: everything goes again */
+    ha_disc_invalidate_all();
+    ha_disc_publish_all();
+    pump_n(100);
+    ASSERT_TRUE(disc.count >= count + 2);
+
+    /* Removal clears every entity and forgets the node */
+    ASSERT_EQ(ha_disc_get_stats(&before), OS_OK);
+    ASSERT_EQ(ha_disc_unpublish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.removed, before.removed + 9); /* Every entity kind */
+    ASSERT_EQ(ha_disc_publish_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.published, before.published + 2);
+
+    broker_set_publish_hook(NULL, NULL);
+    ASSERT_EQ(ha_disc_unpublish_node(MQTT_DISC_NODE), OS_OK);
+    ASSERT_EQ(reg_remove_node(MQTT_DISC_NODE), OS_OK);
+    pump_n(100);
+    tests_passed++;
+    TEST_PASS();
+}
+
+/* Every discovery publish, "<topic> <payload>" one per line */
+typedef struct {
+    uint32_t count;
+    size_t len;
+    char text[8192];
+} collect_t;
+
+static void collect(const char *topic, size_t topic_len, const uint8_t *payload,
+                    size_t len, void *ctx) {
+    collect_t *c = ctx;
+    if (topic_len < 14 || memcmp(topic, "homeassistant/", 14) != 0) {
+        return;
+    }
+    size_t room = sizeof(c->text) - c->len;
+    int n = snprintf(c->text + c->len, room, "%.*s %.*s\n", (int)topic_len,
+                     topic, (int)len, (const char *)payload);
+    if (n > 0) {
+        c->len += (size_t)n < room ? (size_t)n : room - 1;
+    }
+    c->count++;
+}
+
+static void test_mqtt_discovery_entities(void) {
+    TEST_START("mqtt_discovery_entities");
+
+    /* Light with brightness and colour temperature, plus illuminance,
+     * metering (power and energy) and occupancy */
+    reg_node_t *node = reg_add_node(MQTT_ENT_NODE, 0xCF00);
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0102);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_LEVEL, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_COLOR, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_ILLUMINANCE, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_METERING, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, ZCL_CLUSTER_OCCUPANCY, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    strcpy(node->model, "Multi E");
+    reg_set_state(node, REG_STATE_READY);
+    pump_n(100);
+
+    static collect_t disc;
+    memset(&disc, 0, sizeof(disc));
+    broker_set_publish_hook(collect, &disc);
+
+    /* Seven capabilities, five entities: the light carries two */
+    ASSERT_EQ(ha_disc_publish_node(MQTT_ENT_NODE), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 5);
+    ASSERT_TRUE(strstr(disc.text, "homeassistant/light/zigbee_bridge_"
+                                  "00124B00CAFE0500_light/config ") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"brightness_scale\":255") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"color_temp_state_topic\":\"bridge/"
+                                  "00124B00CAFE0500/light.color_temp/state\"") !=
+                NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"color_temp_command_topic\"") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"availability_topic\":\"bridge/status\","
+                                  "\"availability_template\":"
+                                  "\"{{ value_json.v }}\","
+                                  "\"payload_available\":\"online\"") != NULL);
+
+    ASSERT_TRUE(strstr(disc.text, "homeassistant/sensor/zigbee_bridge_"
+                                  "00124B00CAFE0500_power_watts/config ") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"device_class\":\"power\"") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"unit_of_measurement\":\"W\"") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"device_class\":\"energy\"") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"state_class\":\"total_increasing\"") !=
+                NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"device_class\":\"illuminance\"") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"unit_of_measurement\":\"lx\"") != NULL);
+
+    /* Binary sensors report ON/OFF and carry no empty unit */
+    ASSERT_TRUE(strstr(disc.text, "homeassistant/binary_sensor/zigbee_bridge_"
+                                  "00124B00CAFE0500_sensor_motion/config ") !=
+                NULL);
+    ASSERT_TRUE(strstr(disc.text, "'ON' if value_json.v else 'OFF'") != NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"unit_of_measurement\":\"\"") == NULL);
+    ASSERT_TRUE(strstr(disc.text, "\"device_class\":\"\"") == NULL);
+
+    broker_set_publish_hook(NULL, NULL);
+    ASSERT_EQ(ha_disc_unpublish_node(MQTT_ENT_NODE), OS_OK);
+    ASSERT_EQ(reg_remove_node(MQTT_ENT_NODE), OS_OK);
+    pump_n(100);
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_discovery_birth(void) {
+    TEST_START("mqtt_discovery_birth");
+
+    reg_node_t *node = reg_add_node(MQTT_BIRTH_NODE, 0xCC70);
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0100);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    reg_set_state(node, REG_STATE_READY);
+    pump_n(10);
+    ha_disc_flush_pending();
+    pump_n(100);
+
+    const char *topic =
+        "homeassistant/light/zigbee_bridge_00124B00CAFE0700_light/config";
+    char retained[256];
+    ASSERT_TRUE(broker_get_retained(topic, retained, sizeof(retained)));
+    capture_t disc = {.prefix = topic};
+    broker_set_publish_hook(capture, &disc);
+
+    /* The broker lost its retained configs; the cache does not know */
+    broker_clear_retained();
+    ha_disc_publish_all();
+    pump_n(100);
+    ASSERT_EQ(disc.count, 0);
+
+    /* Anything but "online" is ignored */
+    ASSERT_EQ(broker_publish("homeassistant/status", "offline"), OS_OK);
+    pump_n(100);
+    ASSERT_EQ(ha_disc_flush_pending(), 0);
+
+    /* HA's birth message sends everything again */
+    ASSERT_EQ(broker_publish("homeassistant/status", "online"), OS_OK);
+    pump_n(100);
+    ha_disc_stats_t stats;
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_TRUE(stats.pending >= 1);
+    ASSERT_TRUE(ha_disc_flush_pending() >= 1);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 1);
+    ASSERT_TRUE(broker_get_retained(topic, retained, sizeof(retained)));
+
+    broker_set_publish_hook(NULL, NULL);
+    ASSERT_EQ(ha_disc_unpublish_node(MQTT_BIRTH_NODE), OS_OK);
+    ASSERT_EQ(reg_remove_node(MQTT_BIRTH_NODE), OS_OK);
+    pump_n(100);
+    tests_passed++;
+    TEST_PASS();
+}
+
+/* One millisecond of the bridge: a scheduler pass, the discovery task's
+ * pass if it is due, then a tick */
+static void disc_task_tick(void) {
+    pump();
+    if (ha_disc_next_due_ms() == 0) {
+        ha_disc_flush_pending();
+    }
+    advance_ms(1);
+}
+
+static void test_mqtt_discovery_lost(void) {
+    TEST_START("mqtt_discovery_lost");
+
+    const char *topic =
+        "homeassistant/light/zigbee_bridge_00124B00CAFE0800_light/config";
+    capture_t disc = {.prefix = topic};
+    broker_set_publish_hook(capture, &disc);
+
+    /* The broker stops reading until the socket is full, so a config
+     * written now waits in the send buffer */
+    broker_pause(true);
+    const mqtt_pub_opts_t opts = {.prio = MQTT_PRIO_LOW};
+    char filler[SEQ_PAYLOAD_LEN];
+    memset(filler, 'x', sizeof(filler));
+    mqtt_stats_t stats = {0};
+    for (uint32_t i = 0; i < 1000 && stats.tx_backlog == 0; i++) {
+        ASSERT_EQ(mqtt_publish_ex("bridge/test/filler", filler, sizeof(filler),
+                                  &opts),
+                  OS_OK);
+        mqtt_poll();
+        ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    }
+    ASSERT_TRUE(stats.tx_backlog > 0);
+
+    reg_node_t *node = reg_add_node(MQTT_LOST_NODE, 0xCC80);
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0100);
+    reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    reg_set_state(node, REG_STATE_READY);
+    os_event_dispatch(0);
+    ASSERT_EQ(ha_disc_flush_pending(), 1);
+
+    /* The session drops with the config unsent; the reconnect sends it */
+    broker_drop_client();
+    broker_pause(false);
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_DISCONNECTED));
+    ASSERT_EQ(disc.count, 0);
+    ASSERT_EQ(mqtt_connect(), OS_OK);
+    for (uint32_t ms = 0; ms < 1000 && disc.count == 0; ms++) {
+        disc_task_tick();
+    }
+    broker_set_publish_hook(NULL, NULL);
+    ASSERT_EQ(disc.count, 1);
+    char retained[256];
+    ASSERT_TRUE(broker_get_retained(topic, retained, sizeof(retained)));
+
+    pump_n(100);
+    ASSERT_EQ(ha_disc_unpublish_node(MQTT_LOST_NODE), OS_OK);
+    ASSERT_EQ(reg_remove_node(MQTT_LOST_NODE), OS_OK);
+    pump_n(100);
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_discovery_events(void) {
+    TEST_START("mqtt_discovery_events");
+
+    zb_fake_device_t bulb = {
+        .node_id = MQTT_JOIN_NODE,
+        .manufacturer = "Acme",
+        .model = "Bulb J",
+        .sw_build = "1",
+        .power_source = 0x01,
+        .endpoint_count = 1,
+        .endpoints = {{1, 0x0104, 0x0101, 3, 0,
+                       {ZCL_CLUSTER_BASIC, ZCL_CLUSTER_ONOFF, ZCL_CLUSTER_LEVEL}}},
+    };
+    ASSERT_EQ(zb_fake_add_device(&bulb), OS_OK);
+    capture_t disc = {.prefix = "homeassistant/"};
+    broker_set_publish_hook(capture, &disc);
+
+    /* Join, interview, READY: the entity reaches the broker within a few
+     * ticks, with no polling interval */
+    zba_announce_t ann = {MQTT_JOIN_NODE, 0xCE00,
+                          ZBA_MAC_CAP_ROUTER | ZBA_MAC_CAP_MAINS |
+                              ZBA_MAC_CAP_RX_ON_IDLE};
+    os_event_emit(OS_EVENT_ZB_ANNOUNCE, &ann, sizeof(ann));
+    uint32_t ms = 0;
+    while (disc.count == 0 && ms < MQTT_MAX_ROUNDS) {
+        disc_task_tick();
+        ms++;
+    }
+    ASSERT_EQ(disc.count, 1);
+    ASSERT_TRUE(ms < 100);
+    ASSERT_TRUE(strstr(disc.payload, "\"model\":\"Bulb J\"") != NULL);
+    ASSERT_TRUE(strstr(disc.payload, "\"brightness_scale\":255") != NULL);
+    reg_node_t *node = reg_find_node(MQTT_JOIN_NODE);
+    ASSERT_TRUE(node != NULL);
+    ASSERT_EQ(node->state, REG_STATE_READY);
+    ha_disc_stats_t stats;
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.pending, 0);
+
+    /* Completing the interview publishes no state of its own */
+    char state_topic[64];
+    char retained[256];
+    snprintf(state_topic, sizeof(state_topic),
+             "bridge/" OS_EUI64_FMT "/unknown/state", OS_EUI64_ARG(MQTT_JOIN_NODE));
+    pump_n(100);
+    ASSERT_FALSE(broker_get_retained(state_topic, retained, sizeof(retained)));
+
+    /* Capability changes coalesce: two events, one node, one pass */
+    reg_endpoint_t *ep = reg_find_endpoint(node, 1);
+    reg_add_cluster(ep, ZCL_CLUSTER_TEMPERATURE, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    reg_add_cluster(ep, ZCL_CLUSTER_HUMIDITY, REG_CLUSTER_SERVER);
+    cap_compute_for_node(node);
+    cap_compute_for_node(node); /* Same set: no event */
+    os_event_dispatch(0);
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.pending, 1);
+    ASSERT_EQ(ha_disc_flush_pending(), 1);
+    ASSERT_EQ(ha_disc_flush_pending(), 0);
+    pump_n(100);
+    ASSERT_EQ(disc.count, 3);
+
+    /* While MQTT is down nodes stay marked and the task goes back to its
+     * idle sleep; the connection wakes it to flush them */
+    broker_drop_client();
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_DISCONNECTED));
+    node->state = REG_STATE_INTERVIEWING;
+    reg_set_state(node, REG_STATE_READY);
+    for (uint32_t i = 0; i < 20; i++) {
+        disc_task_tick();
+    }
+    ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.pending, 1);
+    ASSERT_TRUE(ha_disc_next_due_ms() > 1000);
+    ASSERT_EQ(mqtt_connect(), OS_OK);
+    ms = 0;
+    do {
+        disc_task_tick();
+        ms++;
+        ASSERT_EQ(ha_disc_get_stats(&stats), OS_OK);
+    } while (stats.pending > 0 && ms < MQTT_MAX_ROUNDS);
+    ASSERT_EQ(stats.pending, 0);
+    ASSERT_TRUE(ms < 100);
+
+    broker_set_publish_hook(NULL, NULL);
+    ASSERT_EQ(ha_disc_unpublish_node(MQTT_JOIN_NODE), OS_OK);
+    ASSERT_EQ(reg_remove_node(MQTT_JOIN_NODE), OS_OK);
+    zb_fake_reset();
+    pump_n(100);
+    tests_passed++;
+    TEST_PASS();
+}
+
+static void test_mqtt_reconnect(void) {
+    TEST_START("mqtt_reconnect");
+
+    mqtt_stats_t before;
+    ASSERT_EQ(mqtt_get_stats(&before), OS_OK);
+    broker_stats_t bs;
+    broker_get_stats(&bs);
+    uint32_t connects = bs.connects;
+
+    /* Losing the broker is noticed by the poll */
+    broker_drop_client();
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_DISCONNECTED));
+    mqtt_stats_t stats;
+    ASSERT_EQ(mqtt_get_stats(&stats), OS_OK);
+    ASSERT_EQ(stats.errors, before.errors + 1);
+    ASSERT_EQ(stats.tx_backlog, 0);
+
+    ASSERT_EQ(mqtt_connect(), OS_OK);
+    ASSERT_TRUE(pump_until_state(MQTT_STATE_CONNECTED));
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.connects, connects + 1);
+
+    /* A clean disconnect says offline first */
+    uint32_t publishes = bs.publishes;
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    broker_get_stats(&bs);
+    publishes = bs.publishes;
+    ASSERT_EQ(mqtt_disconnect(), OS_OK);
+    ASSERT_EQ(mqtt_get_state(), MQTT_STATE_DISCONNECTED);
+    ASSERT_TRUE(pump_until_publishes(publishes + 1));
+    for (uint32_t i = 0; i < 100; i++) {
+        pump();
+    }
+    broker_get_stats(&bs);
+    ASSERT_EQ(bs.disconnects, 1);
+    ASSERT_TRUE(strcmp(bs.last_payload, "{\"v\":\"offline\"}") == 0);
+
+    broker_stop();
+    tests_passed++;
+    TEST_PASS();
+}
+
+void run_mqtt_tests(void) {
+    test_mqtt_connect();
+    test_mqtt_publish_state();
+    test_mqtt_partial_writes();
+    test_mqtt_batching();
+    test_mqtt_queue();
+    test_mqtt_inbound_keepalive();
+    test_mqtt_json();
+    test_mqtt_json_writer();
+    test_mqtt_format_state();
+    test_mqtt_commands();
+    test_mqtt_snapshot();
+    test_mqtt_retained_state();
+    test_mqtt_stream();
+    test_mqtt_aggregate();
+    test_mqtt_discovery_cache();
+    test_mqtt_discovery_entities();
+    test_mqtt_discovery_birth();
+    test_mqtt_discovery_events();
+    test_mqtt_discovery_lost();
+    test_mqtt_reconnect();
+}
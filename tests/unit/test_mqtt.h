@@ -0,0 +1,11 @@
+/**
+ * @file test_mqtt.h
+ * @brief MQTT adapter tests
+ */
+
+#ifndef TEST_MQTT_H
+#define TEST_MQTT_H
+
+void run_mqtt_tests(void);
+
+#endif /* TEST_MQTT_H */
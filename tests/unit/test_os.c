@@ -17,17 +17,25 @@
 /* Include OS headers directly for testing */
 #include "capability.h"
 #include "interview.h"
+#include "interview_cache.h"
 #include "os_config.h"
 #include "os_event.h"
+#include "os_fibre.h"
 #include "os_log.h"
 #include "os_persist.h"
 #include "os_types.h"
 #include "quirks.h"
 #include "registry.h"
+#include "report_plan.h"
+#include "test_cmd_sched.h"
 #include "test_ha_disc.h"
+#include "test_liveness.h"
 #include "test_local_node.h"
+#include "test_mqtt.h"
 #include "test_support.h"
 #include "test_zb_adapter.h"
+#include "zb_fake.h"
+#include "zcl_ids.h"
 
 /* Test helper: safely remove directory and contents */
 static void remove_directory(const char *path) {
@@ -530,6 +538,73 @@ static void test_reg_set_state(void) {
   TEST_PASS();
 }
 
+static void test_reg_iterator(void) {
+  TEST_START("reg_iterator");
+
+  /* Fill a few slots and punch a hole in the middle */
+  reg_add_node(0x00112233445566B1, 0x2001);
+  reg_add_node(0x00112233445566B2, 0x2002);
+  reg_add_node(0x00112233445566B3, 0x2003);
+  reg_remove_node(0x00112233445566B2);
+
+  reg_iter_t it;
+  reg_node_t *node;
+  uint32_t seen = 0;
+  bool found_hole = false;
+  reg_iter_init(&it);
+  while ((node = reg_iter_next(&it)) != NULL) {
+    ASSERT_TRUE(node->valid);
+    if (node->ieee_addr == 0x00112233445566B2) {
+      found_hole = true;
+    }
+    seen++;
+  }
+  ASSERT_EQ(seen, reg_node_count());
+  ASSERT_FALSE(found_hole);
+
+  reg_remove_node(0x00112233445566B1);
+  reg_remove_node(0x00112233445566B3);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_snapshot(void) {
+  TEST_START("reg_snapshot");
+
+  os_eui64_t addr = 0x00112233445566AA;
+  reg_node_t *node = reg_find_node(addr);
+  ASSERT_TRUE(node != NULL);
+
+  const reg_snapshot_t *snap = reg_snapshot_acquire();
+  ASSERT_TRUE(snap != NULL);
+  ASSERT_EQ(snap->count, reg_node_count());
+  ASSERT_EQ(snap->generation, reg_generation());
+
+  /* Unchanged registry shares the same buffer */
+  const reg_snapshot_t *again = reg_snapshot_acquire();
+  ASSERT_TRUE(again == snap);
+  reg_snapshot_release(again);
+
+  /* Changes made while a reader holds the snapshot are not visible to it */
+  uint32_t held_gen = snap->generation;
+  reg_set_state(node, REG_STATE_OFFLINE);
+  ASSERT_EQ(snap->generation, held_gen);
+  ASSERT_EQ(snap->entries[0].state, REG_STATE_READY);
+
+  const reg_snapshot_t *fresh = reg_snapshot_acquire();
+  ASSERT_TRUE(fresh != snap);
+  ASSERT_EQ(fresh->generation, reg_generation());
+  ASSERT_EQ(fresh->entries[0].state, REG_STATE_OFFLINE);
+
+  reg_snapshot_release(fresh);
+  reg_snapshot_release(snap);
+  reg_set_state(node, REG_STATE_READY);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_reg_remove_node(void) {
   TEST_START("reg_remove_node");
 
@@ -547,6 +622,49 @@ static void test_reg_remove_node(void) {
   TEST_PASS();
 }
 
+static void test_reg_index(void) {
+  TEST_START("reg_index");
+
+  /* Fill every slot so probe runs collide and wrap, then punch holes and
+   * refill them: lookups must survive the backward shifts */
+  os_eui64_t base = 0x00124B0000000000ULL;
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    ASSERT_TRUE(reg_add_node(base + i * 0x100, (uint16_t)(0x4000 + i)) != NULL);
+  }
+  os_event_dispatch(0);
+  ASSERT_TRUE(reg_add_node(base + 1, 0x3FFF) == NULL);
+
+  for (uint32_t i = 0; i < REG_MAX_NODES; i += 3) {
+    ASSERT_EQ(reg_remove_node(base + i * 0x100), OS_OK);
+  }
+  os_event_dispatch(0);
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    reg_node_t *node = reg_find_node(base + i * 0x100);
+    if (i % 3 == 0) {
+      ASSERT_TRUE(node == NULL);
+    } else {
+      ASSERT_TRUE(node != NULL);
+      ASSERT_EQ(node->nwk_addr, 0x4000 + i);
+    }
+  }
+
+  for (uint32_t i = 0; i < REG_MAX_NODES; i += 3) {
+    ASSERT_TRUE(reg_add_node(base + i * 0x100 + 1, (uint16_t)(0x5000 + i)) != NULL);
+  }
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    os_eui64_t addr = base + i * 0x100 + (i % 3 == 0 ? 1 : 0);
+    reg_node_t *node = reg_find_node(addr);
+    ASSERT_TRUE(node != NULL);
+    ASSERT_EQ(node->ieee_addr, addr);
+    ASSERT_EQ(reg_remove_node(addr), OS_OK);
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_node_count(), 0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 /* Interview tests */
 
 static void test_interview_init(void) {
@@ -571,13 +689,18 @@ static void test_interview_start(void) {
   os_err_t err = interview_start(addr);
   ASSERT_EQ(err, OS_OK);
 
-  /* Check stage */
+  /* The Basic probe goes out immediately */
   interview_stage_t stage = interview_get_stage(addr);
-  ASSERT_EQ(stage, INTERVIEW_STAGE_INIT);
+  ASSERT_EQ(stage, INTERVIEW_STAGE_BASIC_ATTR);
 
   /* Node should be in interviewing state */
   ASSERT_EQ(node->state, REG_STATE_INTERVIEWING);
 
+  /* Responses for a cancelled interview are ignored */
+  ASSERT_EQ(interview_cancel(addr), OS_OK);
+  os_event_dispatch(0);
+  ASSERT_EQ(node->state, REG_STATE_INTERVIEWING);
+
   tests_passed++;
   TEST_PASS();
 }
@@ -616,6 +739,208 @@ static void test_cap_compute(void) {
   TEST_PASS();
 }
 
+/* ZCL uint48 as it arrives on the air: six little-endian bytes */
+static void set_u48(reg_attr_value_t *v, uint64_t x) {
+  memset(v, 0, sizeof(*v));
+  for (int i = 0; i < 6; i++) {
+    v->bytes[i] = (uint8_t)(x >> (8 * i));
+  }
+}
+
+static void test_cap_report_table(void) {
+  TEST_START("cap_report_table");
+
+  os_eui64_t addr = 0x00124B00CAFE0001;
+  reg_node_t *node = reg_add_node(addr, 0x6601);
+  ASSERT_TRUE(node != NULL);
+
+  reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0107);
+  ASSERT_TRUE(ep != NULL);
+  reg_add_cluster(ep, 0x0400, REG_CLUSTER_SERVER); /* Illuminance */
+  reg_add_cluster(ep, 0x0406, REG_CLUSTER_SERVER); /* Occupancy */
+  reg_add_cluster(ep, 0x0500, REG_CLUSTER_SERVER); /* IAS zone */
+  reg_add_cluster(ep, 0x0702, REG_CLUSTER_SERVER); /* Metering */
+
+  /* Metering yields both energy and power; the IAS zone nothing until its
+   * zone type is known */
+  ASSERT_EQ(cap_compute_for_node(node), 4);
+
+  cap_state_t state;
+  reg_attr_value_t v = {0};
+
+  /* Illuminance: 10000 * log10(lux) + 1 */
+  v.u16 = 20001;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0400, 0x0000, &v), OS_OK);
+  ASSERT_EQ(cap_get_state(addr, CAP_SENSOR_ILLUMINANCE, &state), OS_OK);
+  ASSERT_EQ(state.value.i, 100);
+  v.u16 = 1;
+  cap_handle_attribute_report(addr, 1, 0x0400, 0x0000, &v);
+  cap_get_state(addr, CAP_SENSOR_ILLUMINANCE, &state);
+  ASSERT_EQ(state.value.i, 1);
+
+  v.u16 = 0;
+  v.u8 = 0x01;
+  cap_handle_attribute_report(addr, 1, 0x0406, 0x0000, &v);
+  cap_get_state(addr, CAP_SENSOR_MOTION, &state);
+  ASSERT_TRUE(state.valid && state.value.b);
+
+  v.u16 = 0x0021; /* alarm1 + battery-low bits */
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0500, 0x0002, &v), OS_OK);
+  ASSERT_EQ(cap_get_state(addr, CAP_SENSOR_CONTACT, &state), OS_ERR_NOT_FOUND);
+
+  set_u48(&v, 12345);
+  cap_handle_attribute_report(addr, 1, 0x0702, 0x0000, &v);
+  cap_get_state(addr, CAP_ENERGY_KWH, &state);
+  ASSERT_EQ(state.value.i, 12345); /* 0.001 kWh */
+  char text[CAP_VALUE_TEXT_MAX];
+  ASSERT_EQ(cap_format_value(CAP_ENERGY_KWH, &state.value, text, sizeof(text)), 6);
+  ASSERT_TRUE(strcmp(text, "12.345") == 0);
+
+  /* Summation past 2^32 saturates rather than wrapping to its low word */
+  set_u48(&v, (1ULL << 32) + 5);
+  cap_handle_attribute_report(addr, 1, 0x0702, 0x0000, &v);
+  cap_get_state(addr, CAP_ENERGY_KWH, &state);
+  ASSERT_EQ(state.value.i, INT32_MAX);
+  set_u48(&v, 0xFFFFFFFFFFFFULL);
+  cap_handle_attribute_report(addr, 1, 0x0702, 0x0000, &v);
+  cap_get_state(addr, CAP_ENERGY_KWH, &state);
+  ASSERT_EQ(state.value.i, INT32_MAX);
+
+  /* Demand is int24: -500 W as three raw bytes, or already sign-extended */
+  memset(&v, 0, sizeof(v));
+  v.u32 = 0x00FFFE0C;
+  cap_handle_attribute_report(addr, 1, 0x0702, 0x0400, &v);
+  cap_get_state(addr, CAP_POWER_WATTS, &state);
+  ASSERT_EQ(state.value.i, -5000); /* 0.1 W */
+  ASSERT_EQ(cap_format_value(CAP_POWER_WATTS, &state.value, text, sizeof(text)), 6);
+  ASSERT_TRUE(strcmp(text, "-500.0") == 0);
+  v.s32 = -1;
+  cap_handle_attribute_report(addr, 1, 0x0702, 0x0400, &v);
+  cap_get_state(addr, CAP_POWER_WATTS, &state);
+  ASSERT_EQ(state.value.i, -10);
+  v.u32 = 0x007FFFFF;
+  cap_handle_attribute_report(addr, 1, 0x0702, 0x0400, &v);
+  cap_get_state(addr, CAP_POWER_WATTS, &state);
+  ASSERT_EQ(state.value.i, 83886070);
+
+  /* Unmapped attribute of a mapped cluster is ignored */
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0702, 0x0001, &v), OS_OK);
+
+  reg_remove_node(addr);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_cap_by_node(void) {
+  TEST_START("cap_by_node");
+
+  reg_node_t *node = reg_find_node(0xAABBCCDDEEFF0011);
+  ASSERT_TRUE(node != NULL);
+
+  uint32_t mask = cap_get_mask(node);
+  ASSERT_TRUE(mask & (1UL << CAP_LIGHT_ON));
+  ASSERT_TRUE(mask & (1UL << CAP_LIGHT_LEVEL));
+  ASSERT_FALSE(mask & (1UL << CAP_SENSOR_TEMPERATURE));
+
+  reg_attr_value_t v = {.u8 = 254};
+  ASSERT_EQ(cap_handle_attribute_report_by_node(node, 1, 0x0008, 0x0000, &v),
+            OS_OK);
+  cap_state_t state;
+  ASSERT_EQ(cap_get_state_by_node(node, CAP_LIGHT_LEVEL, &state), OS_OK);
+  ASSERT_EQ(state.value.i, 100);
+
+  /* A capability the node does not have */
+  ASSERT_EQ(cap_get_state_by_node(node, CAP_SENSOR_TEMPERATURE, &state),
+            OS_ERR_NOT_FOUND);
+
+  /* A new node reusing a freed slot does not inherit its state */
+  reg_node_t *tmp = reg_add_node(0x00124B00CAFE0002, 0x6602);
+  ASSERT_TRUE(tmp != NULL);
+  cap_compute_for_node(tmp);
+  reg_remove_node(0x00124B00CAFE0002);
+  reg_node_t *reused = reg_add_node(0x00124B00CAFE0003, 0x6603);
+  ASSERT_TRUE(reused == tmp);
+  ASSERT_EQ(cap_get_mask(reused), 0);
+  reg_remove_node(0x00124B00CAFE0003);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void advance_ticks(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    os_tick_advance();
+  }
+}
+
+static void test_cap_deadband(void) {
+  TEST_START("cap_deadband");
+
+  cap_policy_t saved;
+  ASSERT_EQ(cap_get_policy(NULL, CAP_SENSOR_TEMPERATURE, &saved), OS_OK);
+  cap_policy_t policy = {.deadband = 50,
+                         .min_interval_ms = 100,
+                         .max_staleness_ms = 1000};
+  ASSERT_EQ(cap_set_policy(CAP_SENSOR_TEMPERATURE, &policy), OS_OK);
+
+  os_eui64_t addr = 0x00124B00CAFE0004;
+  reg_node_t *node = reg_add_node(addr, 0x6604);
+  ASSERT_TRUE(node != NULL);
+  reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0302);
+  reg_add_cluster(ep, 0x0402, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(node), 1);
+
+  cap_stats_t before, after;
+  cap_get_stats(&before);
+  reg_attr_value_t v = {0};
+
+  /* First value is always published */
+  v.s16 = 2000;
+  cap_handle_attribute_report_by_node(node, 1, 0x0402, 0x0000, &v);
+  /* 0.1 degC move stays inside the deadband */
+  v.s16 = 2010;
+  cap_handle_attribute_report_by_node(node, 1, 0x0402, 0x0000, &v);
+  cap_get_stats(&after);
+  ASSERT_EQ(after.published - before.published, 1);
+  ASSERT_EQ(after.suppressed - before.suppressed, 1);
+
+  /* The cached state still tracks every report */
+  cap_state_t state;
+  cap_get_state_by_node(node, CAP_SENSOR_TEMPERATURE, &state);
+  ASSERT_EQ(state.value.i, 2010);
+
+  /* Significant change after min_interval publishes immediately */
+  advance_ticks(200);
+  v.s16 = 2100;
+  cap_handle_attribute_report_by_node(node, 1, 0x0402, 0x0000, &v);
+  cap_get_stats(&after);
+  ASSERT_EQ(after.published - before.published, 2);
+
+  /* Significant change inside min_interval is deferred to cap_process */
+  v.s16 = 2200;
+  cap_handle_attribute_report_by_node(node, 1, 0x0402, 0x0000, &v);
+  ASSERT_EQ(cap_process(), 0);
+  advance_ticks(100);
+  ASSERT_EQ(cap_process(), 1);
+  cap_get_stats(&after);
+  ASSERT_EQ(after.published - before.published, 3);
+  ASSERT_EQ(after.deferred - before.deferred, 1);
+
+  /* Unchanged value is re-published once it is stale */
+  advance_ticks(1000);
+  cap_handle_attribute_report_by_node(node, 1, 0x0402, 0x0000, &v);
+  cap_get_stats(&after);
+  ASSERT_EQ(after.heartbeats - before.heartbeats, 1);
+  ASSERT_EQ(after.published - before.published, 4);
+
+  reg_remove_node(addr);
+  cap_set_policy(CAP_SENSOR_TEMPERATURE, &saved);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_cap_get_info(void) {
   TEST_START("cap_get_info");
 
@@ -628,6 +953,37 @@ static void test_cap_get_info(void) {
   TEST_PASS();
 }
 
+static void test_cap_format_fixed(void) {
+  TEST_START("cap_format_fixed");
+
+  char buf[CAP_VALUE_TEXT_MAX];
+  ASSERT_EQ(cap_format_fixed(2134, 2, buf, sizeof(buf)), 5);
+  ASSERT_TRUE(strcmp(buf, "21.34") == 0);
+  cap_format_fixed(-5, 2, buf, sizeof(buf));
+  ASSERT_TRUE(strcmp(buf, "-0.05") == 0);
+  cap_format_fixed(0, 2, buf, sizeof(buf));
+  ASSERT_TRUE(strcmp(buf, "0.00") == 0);
+  cap_format_fixed(-1200, 0, buf, sizeof(buf));
+  ASSERT_TRUE(strcmp(buf, "-1200") == 0);
+  cap_format_fixed(INT32_MIN, 2, buf, sizeof(buf));
+  ASSERT_TRUE(strcmp(buf, "-21474836.48") == 0);
+
+  /* Too small: nothing partial is left behind */
+  char small[5];
+  ASSERT_EQ(cap_format_fixed(2134, 2, small, sizeof(small)), -1);
+  ASSERT_EQ(small[0], '\0');
+
+  /* Capability decimals */
+  cap_value_t v = {.i = 1234};
+  cap_format_value(CAP_POWER_WATTS, &v, buf, sizeof(buf));
+  ASSERT_TRUE(strcmp(buf, "123.4") == 0);
+  cap_format_value(CAP_LIGHT_LEVEL, &v, buf, sizeof(buf));
+  ASSERT_TRUE(strcmp(buf, "1234") == 0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_cap_parse_name(void) {
   TEST_START("cap_parse_name");
 
@@ -677,6 +1033,45 @@ static void test_quirks_find(void) {
   TEST_PASS();
 }
 
+static void test_quirks_index(void) {
+  TEST_START("quirks_index");
+
+  /* Prefix entries match any model that starts with the prefix */
+  const quirk_entry_t *ikea =
+      quirks_find("IKEA of Sweden", "TRADFRI bulb E27 WS opal 980lm");
+  ASSERT_TRUE(ikea != NULL);
+  ASSERT_TRUE(strcmp(ikea->model, "TRADFRI bulb") == 0);
+  ASSERT_TRUE(quirks_find("IKEA of Sweden", "TRADFRI bulb") == ikea);
+  ASSERT_TRUE(quirks_find("IKEA of Sweden", "TRADFRI bul") == NULL);
+  ASSERT_TRUE(quirks_find("IKEA of Sweden", "TRADFRI remote") == NULL);
+
+  /* Exact entries do not match longer models */
+  ASSERT_TRUE(quirks_find("DUMMY", "DUMMY-LIGHT-1") != NULL);
+  ASSERT_TRUE(quirks_find("DUMMY", "DUMMY-LIGHT-10") == NULL);
+  ASSERT_TRUE(quirks_find("DUMMY", "") == NULL);
+
+  /* Manufacturer must match exactly */
+  ASSERT_TRUE(quirks_find("IKEA", "TRADFRI bulb") == NULL);
+  ASSERT_TRUE(quirks_find("", "") == NULL);
+
+  /* Resolved once per node, re-resolved when its identity changes */
+  reg_node_t *node = reg_add_node(0x00124B00CAFE0033, 0x6633);
+  ASSERT_TRUE(node != NULL);
+  ASSERT_TRUE(quirks_for_node(node) == NULL);
+  strncpy(node->manufacturer, "LUMI", REG_MANUFACTURER_LEN - 1);
+  strncpy(node->model, "lumi.sensor_magnet.aq2", REG_MODEL_LEN - 1);
+  ASSERT_TRUE(quirks_for_node(node) == NULL); /* Still cached */
+  reg_mark_changed(node);
+  const quirk_entry_t *lumi = quirks_for_node(node);
+  ASSERT_TRUE(lumi != NULL);
+  ASSERT_TRUE(strcmp(lumi->manufacturer, "LUMI") == 0);
+  ASSERT_TRUE(quirks_for_node(node) == lumi);
+  reg_remove_node(0x00124B00CAFE0033);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_quirks_apply_value(void) {
   TEST_START("quirks_apply_value");
 
@@ -703,6 +1098,39 @@ static void test_quirks_apply_value(void) {
   TEST_PASS();
 }
 
+#define QUIRKS_TEST_DB "tests/unit/fixtures/quirks_test.qdb"
+
+static void test_quirks_policy(void) {
+  TEST_START("quirks_policy");
+
+  /* Tenths reported as hundredths: 0.1 is exact, halves round away */
+  cap_value_t value = {.i = 2345};
+  quirks_apply_value("_TZE200", "TS0601", CAP_SENSOR_TEMPERATURE, &value, NULL);
+  ASSERT_EQ(value.i, 235);
+  value.i = -2345;
+  quirks_apply_value("_TZE200", "TS0601", CAP_SENSOR_TEMPERATURE, &value, NULL);
+  ASSERT_EQ(value.i, -235);
+
+  /* The built-in table carries no policies; they come from a database */
+  ASSERT_TRUE(quirks_get_policy("_TZE200", "TS0601", CAP_SENSOR_TEMPERATURE) ==
+              NULL);
+  ASSERT_EQ(quirks_load_file(QUIRKS_TEST_DB), OS_OK);
+  const cap_policy_t *policy =
+      quirks_get_policy("_TZE200", "TS0601", CAP_SENSOR_TEMPERATURE);
+  ASSERT_TRUE(policy != NULL);
+  ASSERT_EQ(policy->deadband, 20);
+  ASSERT_EQ(policy->min_interval_ms, 30000);
+  ASSERT_EQ(policy->max_staleness_ms, 1800000);
+
+  ASSERT_TRUE(quirks_get_policy("_TZE200", "TS0601", CAP_SENSOR_HUMIDITY) ==
+              NULL);
+  ASSERT_TRUE(quirks_get_policy("ACME", "LAMP-2", CAP_LIGHT_LEVEL) == NULL);
+  quirks_load_builtin();
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_quirks_count(void) {
   TEST_START("quirks_count");
 
@@ -713,6 +1141,210 @@ static void test_quirks_count(void) {
   TEST_PASS();
 }
 
+static void test_quirks_db(void) {
+  TEST_START("quirks_db");
+
+  uint32_t builtin_count = quirks_count();
+  ASSERT_EQ(quirks_load_file("tests/unit/fixtures/missing.qdb"),
+            OS_ERR_NOT_FOUND);
+  ASSERT_EQ(quirks_count(), builtin_count);
+
+  reg_node_t *node = reg_add_node(0x00124B00CAFE0034, 0x6634);
+  ASSERT_TRUE(node != NULL);
+  strncpy(node->manufacturer, "DUMMY", REG_MANUFACTURER_LEN - 1);
+  strncpy(node->model, "DUMMY-LIGHT-1", REG_MODEL_LEN - 1);
+  reg_mark_changed(node);
+  ASSERT_TRUE(quirks_for_node(node) != NULL);
+
+  ASSERT_EQ(quirks_load_file(QUIRKS_TEST_DB), OS_OK);
+  ASSERT_EQ(quirks_count(), 6);
+
+  /* Node caches are invalidated by the switch */
+  ASSERT_TRUE(quirks_for_node(node) == NULL);
+  ASSERT_TRUE(quirks_find("DUMMY", "DUMMY-LIGHT-1") == NULL);
+
+  /* First entry in source order wins over a later prefix entry */
+  const quirk_entry_t *e = quirks_find("ACME", "LAMP-2");
+  ASSERT_TRUE(e != NULL);
+  ASSERT_TRUE(strcmp(e->model, "LAMP-2") == 0);
+  ASSERT_TRUE(!e->prefix_match);
+  ASSERT_EQ(e->actions[0].params.clamp.min, 5);
+  ASSERT_TRUE(quirks_find("ACME", "LAMP-2") == e); /* Decoded once */
+
+  e = quirks_find("ACME", "LAMP-3");
+  ASSERT_TRUE(e != NULL && e->prefix_match);
+  ASSERT_EQ(e->actions[0].params.clamp.max, 80);
+  ASSERT_TRUE(quirks_find("ACME", "LAM") == NULL);
+  ASSERT_TRUE(quirks_find("ACME", "LAMB") != NULL);
+  ASSERT_TRUE(quirks_find("ACME", "LAMBS") == NULL);
+  ASSERT_TRUE(quirks_find("Acme", "LAMP") == NULL);
+
+  /* Decoded parameters behave like the built-in table */
+  cap_value_t value = {.i = 4400};
+  quirk_result_t result;
+  ASSERT_EQ(quirks_apply_value("Thermo Co", "TH-1", CAP_SENSOR_TEMPERATURE,
+                               &value, &result),
+            OS_OK);
+  ASSERT_TRUE(result.applied);
+  ASSERT_EQ(value.i, 2100);
+  ASSERT_EQ(quirks_apply_command("Thermo Co", "TH-1", CAP_SENSOR_TEMPERATURE,
+                                 &value, NULL),
+            OS_OK);
+  ASSERT_EQ(value.i, 4400);
+  const cap_policy_t *policy =
+      quirks_get_policy("Thermo Co", "TH-1", CAP_SENSOR_TEMPERATURE);
+  ASSERT_TRUE(policy != NULL);
+  ASSERT_EQ(policy->deadband, 25);
+  ASSERT_EQ(policy->min_interval_ms, 1000);
+  ASSERT_EQ(policy->max_staleness_ms, 60000);
+  e = quirks_get_entry(4);
+  ASSERT_TRUE(e != NULL && strcmp(e->manufacturer, "LUMI") == 0);
+  ASSERT_EQ(quirks_entry_get_spurious_window(e, CAP_SENSOR_CONTACT), 1000);
+  ASSERT_TRUE(quirks_get_entry(6) == NULL);
+
+  /* A node keeps its quirk policy when the decode slot that held the
+   * entry is reused for another one */
+  ASSERT_EQ(quirks_load_file(QUIRKS_TEST_DB), OS_OK);
+  reg_node_t *thermo = reg_add_node(0x00124B00CAFE0035, 0x6635);
+  ASSERT_TRUE(thermo != NULL);
+  strncpy(thermo->manufacturer, "Thermo Co", REG_MANUFACTURER_LEN - 1);
+  strncpy(thermo->model, "TH-1", REG_MODEL_LEN - 1);
+  reg_mark_changed(thermo);
+  reg_endpoint_t *ep = reg_add_endpoint(thermo, 1, 0x0104, 0x0302);
+  reg_add_cluster(ep, ZCL_CLUSTER_TEMPERATURE, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(thermo), 1);
+  ASSERT_EQ(quirks_load_file(QUIRKS_TEST_DB), OS_OK);
+  ASSERT_TRUE(quirks_find("ACME", "LAMP-2") != NULL);
+  cap_policy_t node_policy;
+  ASSERT_EQ(cap_get_policy(thermo, CAP_SENSOR_TEMPERATURE, &node_policy),
+            OS_OK);
+  ASSERT_EQ(node_policy.deadband, 25);
+  ASSERT_EQ(node_policy.min_interval_ms, 1000);
+  ASSERT_EQ(node_policy.max_staleness_ms, 60000);
+  reg_remove_node(0x00124B00CAFE0035);
+
+  /* Corrupt images are rejected and the loaded database stays active */
+  FILE *f = fopen(QUIRKS_TEST_DB, "rb");
+  ASSERT_TRUE(f != NULL);
+  static uint32_t image[1024];
+  size_t len = fread(image, 1, sizeof(image), f);
+  fclose(f);
+  ASSERT_TRUE(len > 64 && len < sizeof(image));
+  uint8_t *bytes = (uint8_t *)image;
+
+  bytes[len - 2] ^= 0x20; /* String pool: CRC mismatch */
+  ASSERT_EQ(quirks_load_db(image, len), OS_ERR_INVALID_ARG);
+  bytes[len - 2] ^= 0x20;
+  ASSERT_EQ(quirks_load_db(image, len - 1), OS_ERR_INVALID_ARG);
+  image[0] = 0xFFFFFFFF; /* Erased flash */
+  ASSERT_EQ(quirks_load_db(image, len), OS_ERR_NOT_FOUND);
+  ASSERT_TRUE(quirks_find("ACME", "LAMB") != NULL);
+
+  /* Trailing padding (partition size) is ignored */
+  f = fopen(QUIRKS_TEST_DB, "rb");
+  ASSERT_TRUE(f != NULL);
+  ASSERT_EQ(fread(image, 1, len, f), len);
+  fclose(f);
+  memset(bytes + len, 0xFF, 64);
+  ASSERT_EQ(quirks_load_db(image, len + 64), OS_OK);
+  ASSERT_TRUE(quirks_find("LUMI", "lumi.sensor_magnet.aq2") != NULL);
+
+  quirks_load_builtin();
+  ASSERT_EQ(quirks_count(), builtin_count);
+  ASSERT_TRUE(quirks_for_node(node) != NULL);
+  ASSERT_TRUE(quirks_find("ACME", "LAMB") == NULL);
+  reg_remove_node(0x00124B00CAFE0034);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_quirks_report_actions(void) {
+  TEST_START("quirks_report_actions");
+
+  ASSERT_EQ(quirks_load_file(QUIRKS_TEST_DB), OS_OK);
+  cap_stats_t before, after;
+  cap_get_stats(&before);
+  reg_attr_value_t v = {0};
+
+  /* ignore_spurious_reports: repeats inside the window never reach the state */
+  os_eui64_t lamb_addr = 0x00124B00CAFE0035;
+  reg_node_t *lamb = reg_add_node(lamb_addr, 0x6635);
+  ASSERT_TRUE(lamb != NULL);
+  strncpy(lamb->manufacturer, "ACME", REG_MANUFACTURER_LEN - 1);
+  strncpy(lamb->model, "LAMB", REG_MODEL_LEN - 1);
+  reg_mark_changed(lamb);
+  reg_endpoint_t *ep = reg_add_endpoint(lamb, 1, 0x0104, 0x0100);
+  reg_add_cluster(ep, ZCL_CLUSTER_ONOFF, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(lamb), 1);
+
+  v.u8 = 1;
+  cap_handle_attribute_report_by_node(lamb, 1, ZCL_CLUSTER_ONOFF, ZCL_ATTR_ONOFF, &v);
+  cap_handle_attribute_report_by_node(lamb, 1, ZCL_CLUSTER_ONOFF, ZCL_ATTR_ONOFF, &v);
+  cap_get_stats(&after);
+  ASSERT_EQ(after.reports - before.reports, 1);
+  ASSERT_EQ(after.spurious - before.spurious, 1);
+  cap_state_t state;
+  ASSERT_EQ(cap_get_state_by_node(lamb, CAP_LIGHT_ON, &state), OS_OK);
+  ASSERT_FALSE(state.value.b); /* Inverted after the check */
+
+  /* A different value, or the same one after the window, is accepted */
+  v.u8 = 0;
+  cap_handle_attribute_report_by_node(lamb, 1, ZCL_CLUSTER_ONOFF, ZCL_ATTR_ONOFF, &v);
+  advance_ticks(OS_MS_TO_TICKS(2000));
+  cap_handle_attribute_report_by_node(lamb, 1, ZCL_CLUSTER_ONOFF, ZCL_ATTR_ONOFF, &v);
+  cap_get_stats(&after);
+  ASSERT_EQ(after.reports - before.reports, 3);
+  ASSERT_EQ(after.spurious - before.spurious, 1);
+  reg_remove_node(lamb_addr);
+
+  /* remap_attribute: a vendor cluster provides the capability */
+  os_eui64_t th_addr = 0x00124B00CAFE0036;
+  reg_node_t *th = reg_add_node(th_addr, 0x6636);
+  ASSERT_TRUE(th != NULL);
+  strncpy(th->manufacturer, "Thermo Co", REG_MANUFACTURER_LEN - 1);
+  strncpy(th->model, "TH-1", REG_MODEL_LEN - 1);
+  reg_mark_changed(th);
+  ep = reg_add_endpoint(th, 1, 0x0104, 0x0302);
+  reg_add_cluster(ep, ZCL_CLUSTER_TEMPERATURE, REG_CLUSTER_SERVER);
+  reg_add_cluster(ep, 0xFC00, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(th), 2);
+  ASSERT_EQ(cap_get_endpoint(th, CAP_SENSOR_HUMIDITY), 1);
+
+  v.u16 = 5250;
+  ASSERT_EQ(cap_handle_attribute_report_by_node(th, 1, 0xFC00, 0x0001, &v), OS_OK);
+  ASSERT_EQ(cap_get_state_by_node(th, CAP_SENSOR_HUMIDITY, &state), OS_OK);
+  ASSERT_TRUE(state.valid);
+  ASSERT_EQ(state.value.i, 5250);
+
+  /* Other vendor attributes stay unmapped */
+  cap_get_stats(&before);
+  ASSERT_EQ(cap_handle_attribute_report_by_node(th, 1, 0xFC00, 0x0002, &v), OS_OK);
+  cap_get_stats(&after);
+  ASSERT_EQ(after.reports, before.reports);
+
+  /* override_reporting replaces the planned temperature reporting; the
+   * remapped humidity is configured on the vendor attribute */
+  rplan_t plan;
+  ASSERT_EQ(rplan_build(th, &plan), 2);
+  ASSERT_EQ(plan.count, 2);
+  ASSERT_EQ(plan.steps[0].cluster_id, ZCL_CLUSTER_TEMPERATURE);
+  ASSERT_EQ(plan.steps[0].cfgs[0].min_s, 30);
+  ASSERT_EQ(plan.steps[0].cfgs[0].max_s, 600);
+  ASSERT_EQ(plan.steps[0].cfgs[0].change, 20);
+  ASSERT_EQ(plan.steps[1].endpoint_id, 1);
+  ASSERT_EQ(plan.steps[1].cluster_id, 0xFC00);
+  ASSERT_EQ(plan.steps[1].cfg_count, 1);
+  ASSERT_EQ(plan.steps[1].cfgs[0].attr_id, 0x0001);
+  ASSERT_EQ(plan.steps[1].cfgs[0].type, ZBA_ZCL_TYPE_UINT16);
+  reg_remove_node(th_addr);
+
+  quirks_load_builtin();
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_quirks_action_name(void) {
   TEST_START("quirks_action_name");
 
@@ -727,6 +1359,488 @@ static void test_quirks_action_name(void) {
   TEST_PASS();
 }
 
+/* Interview pipeline tests (need the capability and quirk services) */
+
+#define MAC_CAP_MAINS_ROUTER                                                   \
+  (ZBA_MAC_CAP_ROUTER | ZBA_MAC_CAP_MAINS | ZBA_MAC_CAP_RX_ON_IDLE)
+#define MAC_CAP_SLEEPY 0x00
+
+static void announce_cap(os_eui64_t eui64, uint16_t nwk_addr,
+                         uint8_t capability) {
+  zba_announce_t ann = {eui64, nwk_addr, capability};
+  os_event_emit(OS_EVENT_ZB_ANNOUNCE, &ann, sizeof(ann));
+}
+
+static void announce(os_eui64_t eui64, uint16_t nwk_addr) {
+  announce_cap(eui64, nwk_addr, MAC_CAP_MAINS_ROUTER);
+}
+
+static void drain_events(void) {
+  while (os_event_dispatch(0) > 0) {
+  }
+}
+
+static void test_interview_pipeline(void) {
+  TEST_START("interview_pipeline");
+
+  zb_fake_reset();
+  zb_fake_device_t sensor = {
+      .manufacturer = "Acme Environmental Sensors Ltd",
+      .model = "TH-1",
+      .sw_build = "0122052017",
+      .power_source = 0x03,
+      .endpoint_count = 1,
+      .endpoints = {{1, 0x0104, 0x0302, 4, 1,
+                     {ZCL_CLUSTER_BASIC, ZCL_CLUSTER_POWER_CONFIG,
+                      ZCL_CLUSTER_TEMPERATURE, ZCL_CLUSTER_HUMIDITY,
+                      0x0019}}},
+  };
+  zb_fake_device_t plug = {
+      .manufacturer = "Plugs",
+      .model = "P1",
+      .sw_build = "v2.1",
+      .power_source = 0x01,
+      .endpoint_count = 3,
+      .endpoints = {{1, 0x0104, 0x0051, 2, 0, {0x0003, 0x0006}},
+                    {2, 0x0104, 0x0051, 8, 1,
+                     {0x0003, 0x0004, 0x0005, 0x0006, 0x0702, 0x0B04, 0x0B05,
+                      ZCL_CLUSTER_BASIC, 0x0019}},
+                    {242, 0xA1E0, 0x0061, 0, 1, {0x0021}}},
+  };
+  sensor.node_id = 0x00124B00AA000001;
+  plug.node_id = 0x00124B00AA000002;
+  ASSERT_EQ(zb_fake_add_device(&sensor), OS_OK);
+  ASSERT_EQ(zb_fake_add_device(&plug), OS_OK);
+
+  interview_stats_t before;
+  ASSERT_EQ(interview_get_stats(&before), OS_OK);
+
+  /* Four devices (two default ones) join at once; no time passes */
+  announce(0x00124B00AA000001, 0x1001);
+  announce(0x00124B00AA000002, 0x1002);
+  announce(0x00124B00AA000003, 0x1003);
+  announce(0x00124B00AA000004, 0x1004);
+  drain_events();
+
+  for (os_eui64_t id = 0x00124B00AA000001; id <= 0x00124B00AA000004; id++) {
+    reg_node_t *node = reg_find_node(id);
+    ASSERT_TRUE(node != NULL);
+    ASSERT_EQ(node->state, REG_STATE_READY);
+  }
+
+  /* One active endpoint request and one Basic read per device, one
+   * descriptor request per endpoint. The plug has no Basic cluster on
+   * endpoint 1, so its probe is rejected and it is read again later. */
+  zb_fake_stats_t zs;
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.active_ep_reqs, 4);
+  ASSERT_EQ(zs.simple_desc_reqs, 1 + 3 + 2 + 2);
+  ASSERT_EQ(zs.read_reqs, 5);
+  ASSERT_EQ(zs.attrs_read, 20);
+
+  interview_stats_t after;
+  ASSERT_EQ(interview_get_stats(&after), OS_OK);
+  ASSERT_EQ(after.completed - before.completed, 4);
+  ASSERT_EQ(after.retries, before.retries);
+  ASSERT_EQ(after.active, 0);
+  ASSERT_EQ(after.inflight, 0);
+  ASSERT_TRUE(after.inflight_peak > 1);
+  ASSERT_TRUE(after.inflight_peak <= 6);
+
+  /* Strings longer than one event arrive in parts */
+  reg_node_t *th = reg_find_node(0x00124B00AA000001);
+  ASSERT_TRUE(strcmp(th->manufacturer, "Acme Environmental Sensors Ltd") == 0);
+  ASSERT_TRUE(strcmp(th->model, "TH-1") == 0);
+  ASSERT_EQ(th->power_source, REG_POWER_BATTERY);
+  ASSERT_EQ(th->sw_build, 122052017);
+  reg_endpoint_t *ep = reg_find_endpoint(th, 1);
+  ASSERT_TRUE(ep != NULL);
+  reg_cluster_t *ota = reg_find_cluster(ep, 0x0019);
+  ASSERT_TRUE(ota != NULL);
+  ASSERT_EQ(ota->direction, REG_CLUSTER_CLIENT);
+  ASSERT_TRUE(cap_get_mask(th) & (1u << CAP_SENSOR_TEMPERATURE));
+
+  /* Descriptors longer than one event arrive in parts too */
+  reg_node_t *p1 = reg_find_node(0x00124B00AA000002);
+  ASSERT_EQ(p1->power_source, REG_POWER_MAINS);
+  ASSERT_TRUE(p1->sw_build != 0);
+  ep = reg_find_endpoint(p1, 2);
+  ASSERT_TRUE(ep != NULL);
+  ASSERT_TRUE(reg_find_cluster(ep, 0x0B05) != NULL);
+  ASSERT_TRUE(reg_find_cluster(ep, ZCL_CLUSTER_BASIC) != NULL);
+  ASSERT_TRUE(reg_find_endpoint(p1, 242) != NULL);
+
+  reg_node_t *dflt = reg_find_node(0x00124B00AA000003);
+  ASSERT_TRUE(strcmp(dflt->manufacturer, "Test Manufacturer") == 0);
+  ASSERT_EQ(dflt->sw_build, 1);
+
+  /* A rejoin of a ready device does not interview it again */
+  announce(0x00124B00AA000001, 0x2001);
+  drain_events();
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.active_ep_reqs, 4);
+  ASSERT_EQ(th->nwk_addr, 0x2001);
+
+  for (os_eui64_t id = 0x00124B00AA000001; id <= 0x00124B00AA000004; id++) {
+    reg_remove_node(id);
+  }
+  zb_fake_reset();
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_interview_retry(void) {
+  TEST_START("interview_retry");
+
+  zb_fake_reset();
+  zb_fake_device_t dev = {
+      .node_id = 0x00124B00AA000010,
+      .manufacturer = "Sleepy",
+      .model = "S1",
+      .sw_build = "3",
+      .power_source = 0x03,
+      .endpoint_count = 1,
+      .endpoints = {{1, 0x0104, 0x0402, 2, 0, {0x0000, 0x0500}}},
+      .silent = true,
+  };
+  ASSERT_EQ(zb_fake_add_device(&dev), OS_OK);
+
+  interview_stats_t before;
+  ASSERT_EQ(interview_get_stats(&before), OS_OK);
+
+  announce_cap(dev.node_id, 0x3001, MAC_CAP_SLEEPY);
+  drain_events();
+  ASSERT_EQ(interview_get_stage(dev.node_id), INTERVIEW_STAGE_BASIC_ATTR);
+
+  /* Nothing is re-sent before the step timeout */
+  advance_ticks(OS_MS_TO_TICKS(1000));
+  interview_process();
+  zb_fake_stats_t zs;
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.read_reqs, 1);
+
+  /* An unanswered probe is not retried; discovery starts instead */
+  advance_ticks(OS_MS_TO_TICKS(5000));
+  interview_process();
+  ASSERT_EQ(interview_get_stage(dev.node_id), INTERVIEW_STAGE_ACTIVE_EP);
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.active_ep_reqs, 1);
+
+  /* The device wakes up; the retry goes through and the rest follows */
+  dev.silent = false;
+  ASSERT_EQ(zb_fake_add_device(&dev), OS_OK);
+  advance_ticks(OS_MS_TO_TICKS(5001));
+  interview_process();
+  drain_events();
+
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.active_ep_reqs, 2);
+  ASSERT_EQ(zs.read_reqs, 2);
+  reg_node_t *node = reg_find_node(dev.node_id);
+  ASSERT_TRUE(node != NULL);
+  ASSERT_EQ(node->state, REG_STATE_READY);
+  ASSERT_TRUE(strcmp(node->model, "S1") == 0);
+
+  interview_stats_t after;
+  ASSERT_EQ(interview_get_stats(&after), OS_OK);
+  ASSERT_EQ(after.retries - before.retries, 1);
+  ASSERT_EQ(after.completed - before.completed, 1);
+
+  /* A device that never answers fails the interview */
+  dev.node_id = 0x00124B00AA000011;
+  dev.silent = true;
+  ASSERT_EQ(zb_fake_add_device(&dev), OS_OK);
+  announce(dev.node_id, 0x3002);
+  drain_events();
+  for (int i = 0; i < 5; i++) {
+    advance_ticks(OS_MS_TO_TICKS(5001));
+    interview_process();
+  }
+  reg_node_t *dead = reg_find_node(dev.node_id);
+  ASSERT_TRUE(dead != NULL);
+  ASSERT_EQ(dead->state, REG_STATE_STALE);
+  ASSERT_EQ(interview_get_stats(&after), OS_OK);
+  ASSERT_EQ(after.failed - before.failed, 1);
+
+  reg_remove_node(0x00124B00AA000010);
+  reg_remove_node(0x00124B00AA000011);
+  drain_events();
+  zb_fake_reset();
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_interview_queue(void) {
+  TEST_START("interview_queue");
+
+  const os_eui64_t busy = 0x00124B00AA000020;  /* +0..3: fill the slots */
+  const os_eui64_t sleepy = 0x00124B00AA000030;
+  const os_eui64_t router = 0x00124B00AA000031;
+  ASSERT_TRUE(reg_node_count() + 6 <= REG_MAX_NODES);
+
+  zb_fake_reset();
+  for (os_eui64_t id = busy; id < busy + 4; id++) {
+    zb_fake_device_t dev = {.node_id = id, .silent = true};
+    ASSERT_EQ(zb_fake_add_device(&dev), OS_OK);
+    announce(id, (uint16_t)(0x4000 + (id & 0xFF)));
+  }
+  drain_events();
+
+  interview_stats_t before;
+  ASSERT_EQ(interview_get_stats(&before), OS_OK);
+  ASSERT_EQ(before.active, 4);
+  ASSERT_EQ(before.queued, 0);
+
+  /* A battery device announces before a router; both have to wait */
+  announce_cap(sleepy, 0x4101, MAC_CAP_SLEEPY);
+  announce(router, 0x4102);
+  drain_events();
+  interview_stats_t stats;
+  ASSERT_EQ(interview_get_stats(&stats), OS_OK);
+  ASSERT_EQ(stats.queued, 2);
+  ASSERT_EQ(interview_get_stage(sleepy), INTERVIEW_STAGE_INIT);
+  ASSERT_EQ(reg_find_node(sleepy)->state, REG_STATE_INTERVIEWING);
+  ASSERT_EQ(reg_find_node(sleepy)->power_source, REG_POWER_BATTERY);
+
+  /* The router takes the first free slot */
+  ASSERT_EQ(interview_cancel(busy), OS_OK);
+  interview_process();
+  ASSERT_EQ(interview_get_stage(router), INTERVIEW_STAGE_BASIC_ATTR);
+  ASSERT_EQ(interview_get_stage(sleepy), INTERVIEW_STAGE_INIT);
+
+  /* The slot it frees is not spent on a battery device that went back to
+   * sleep in the meantime */
+  advance_ticks(OS_MS_TO_TICKS(11000));
+  drain_events();
+  ASSERT_EQ(reg_find_node(router)->state, REG_STATE_READY);
+  interview_process();
+  ASSERT_EQ(interview_get_stage(sleepy), INTERVIEW_STAGE_INIT);
+  ASSERT_EQ(interview_get_stats(&stats), OS_OK);
+  ASSERT_EQ(stats.queued, 1);
+  ASSERT_EQ(stats.active, 3);
+
+  /* ...until it is heard from again */
+  reg_touch_node(reg_find_node(sleepy));
+  interview_process();
+  ASSERT_EQ(interview_get_stage(sleepy), INTERVIEW_STAGE_BASIC_ATTR);
+  drain_events();
+  ASSERT_EQ(reg_find_node(sleepy)->state, REG_STATE_READY);
+
+  ASSERT_EQ(interview_get_stats(&stats), OS_OK);
+  ASSERT_EQ(stats.queued, 0);
+  ASSERT_EQ(stats.queue_peak, 2);
+  ASSERT_EQ(stats.admitted - before.admitted, 2);
+  ASSERT_TRUE(stats.wait_ms_max >= 11000);
+  ASSERT_TRUE(stats.inflight <= 6);
+
+  for (os_eui64_t id = busy; id < busy + 4; id++) {
+    interview_cancel(id);
+    reg_remove_node(id);
+  }
+  reg_remove_node(sleepy);
+  reg_remove_node(router);
+  drain_events();
+  zb_fake_reset();
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_interview_cache(void) {
+  TEST_START("interview_cache");
+
+  const os_eui64_t bulb = 0x00124B00AA000040;  /* +0..2: same type */
+  const os_eui64_t newer = 0x00124B00AA000043; /* Same model, newer build */
+  ASSERT_TRUE(reg_node_count() + 4 <= REG_MAX_NODES);
+
+  zb_fake_reset();
+  zb_fake_device_t dev = {
+      .manufacturer = "Bulbs Inc",
+      .model = "B22-RGB",
+      .sw_build = "0x0107",
+      .power_source = 0x01,
+      .endpoint_count = 2,
+      .endpoints = {{1, 0x0104, 0x010D, 5, 1,
+                     {ZCL_CLUSTER_BASIC, 0x0003, 0x0004, 0x0006, 0x0300,
+                      0x0019}},
+                    {242, 0xA1E0, 0x0061, 0, 1, {0x0021}}},
+  };
+  for (os_eui64_t id = bulb; id < bulb + 3; id++) {
+    dev.node_id = id;
+    ASSERT_EQ(zb_fake_add_device(&dev), OS_OK);
+  }
+  dev.node_id = newer;
+  dev.sw_build = "0x0108";
+  ASSERT_EQ(zb_fake_add_device(&dev), OS_OK);
+
+  interview_stats_t before;
+  icache_stats_t cbefore;
+  ASSERT_EQ(interview_get_stats(&before), OS_OK);
+  ASSERT_EQ(icache_get_stats(&cbefore), OS_OK);
+
+  /* The first bulb is interviewed in full */
+  announce(bulb, 0x5001);
+  drain_events();
+  ASSERT_EQ(reg_find_node(bulb)->state, REG_STATE_READY);
+  zb_fake_stats_t first;
+  zb_fake_get_stats(&first);
+  ASSERT_EQ(first.active_ep_reqs, 1);
+  ASSERT_EQ(first.simple_desc_reqs, 2);
+
+  /* The next one of the same type needs only the Basic read */
+  announce(bulb + 1, 0x5002);
+  drain_events();
+  reg_node_t *node = reg_find_node(bulb + 1);
+  ASSERT_EQ(node->state, REG_STATE_READY);
+  zb_fake_stats_t zs;
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.active_ep_reqs, first.active_ep_reqs);
+  ASSERT_EQ(zs.simple_desc_reqs, first.simple_desc_reqs);
+  ASSERT_EQ(zs.read_reqs, first.read_reqs + 1);
+
+  /* The copied tree matches, cluster directions included */
+  reg_endpoint_t *ep = reg_find_endpoint(node, 1);
+  ASSERT_TRUE(ep != NULL);
+  ASSERT_EQ(ep->device_id, 0x010D);
+  ASSERT_EQ(reg_find_cluster(ep, 0x0300)->direction, REG_CLUSTER_SERVER);
+  ASSERT_EQ(reg_find_cluster(ep, 0x0019)->direction, REG_CLUSTER_CLIENT);
+  ep = reg_find_endpoint(node, 242);
+  ASSERT_TRUE(ep != NULL);
+  ASSERT_EQ(ep->profile_id, 0xA1E0);
+  ASSERT_EQ(reg_find_cluster(ep, 0x0021)->direction, REG_CLUSTER_CLIENT);
+  ASSERT_TRUE(cap_get_mask(node) & (1u << CAP_LIGHT_ON));
+
+  /* Entries dropped from RAM come back from storage */
+  icache_evict_all();
+  announce(bulb + 2, 0x5003);
+  drain_events();
+  ASSERT_EQ(reg_find_node(bulb + 2)->state, REG_STATE_READY);
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.active_ep_reqs, first.active_ep_reqs);
+  icache_stats_t cs;
+  ASSERT_EQ(icache_get_stats(&cs), OS_OK);
+  ASSERT_EQ(cs.hits - cbefore.hits, 2);
+  ASSERT_EQ(cs.loads - cbefore.loads, 1);
+
+  /* A firmware update may change the endpoints: interview in full */
+  announce(newer, 0x5004);
+  drain_events();
+  ASSERT_EQ(reg_find_node(newer)->state, REG_STATE_READY);
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.active_ep_reqs, first.active_ep_reqs + 1);
+  ASSERT_EQ(zs.simple_desc_reqs, first.simple_desc_reqs + 2);
+
+  interview_stats_t after;
+  ASSERT_EQ(interview_get_stats(&after), OS_OK);
+  ASSERT_EQ(after.completed - before.completed, 4);
+  ASSERT_EQ(after.cache_hits - before.cache_hits, 2);
+  ASSERT_EQ(icache_get_stats(&cs), OS_OK);
+  ASSERT_EQ(cs.stores - cbefore.stores, 2);
+
+  for (os_eui64_t id = bulb; id <= newer; id++) {
+    reg_remove_node(id);
+  }
+  drain_events();
+  zb_fake_reset();
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_interview_bindings(void) {
+  TEST_START("interview_bindings");
+
+  const os_eui64_t sensor_id = 0x00124B00AA000050;
+  const os_eui64_t meter_id = 0x00124B00AA000051;
+  ASSERT_TRUE(reg_node_count() + 2 <= REG_MAX_NODES);
+
+  zb_fake_reset();
+  zb_fake_device_t sensor = {
+      .node_id = sensor_id,
+      .manufacturer = "Binding Test",
+      .model = "TH-2",
+      .sw_build = "3",
+      .power_source = 0x03,
+      .endpoint_count = 1,
+      .endpoints = {{1, 0x0104, 0x0302, 4, 1,
+                     {ZCL_CLUSTER_BASIC, ZCL_CLUSTER_POWER_CONFIG,
+                      ZCL_CLUSTER_TEMPERATURE, ZCL_CLUSTER_HUMIDITY, 0x0019}}},
+  };
+  zb_fake_device_t meter = {
+      .node_id = meter_id,
+      .manufacturer = "Binding Test",
+      .model = "PM-1",
+      .sw_build = "3",
+      .power_source = 0x01,
+      .endpoint_count = 1,
+      .endpoints = {{1, 0x0104, 0x0051, 4, 0,
+                     {ZCL_CLUSTER_BASIC, ZCL_CLUSTER_ONOFF,
+                      ZCL_CLUSTER_METERING, ZCL_CLUSTER_ELEC_MEASURE}}},
+      .no_reporting = true,
+  };
+  ASSERT_EQ(zb_fake_add_device(&sensor), OS_OK);
+  ASSERT_EQ(zb_fake_add_device(&meter), OS_OK);
+
+  interview_stats_t before;
+  ASSERT_EQ(interview_get_stats(&before), OS_OK);
+
+  /* Temperature and humidity are bound and report; the battery device
+   * reports at most every RPLAN_BATTERY_MIN_S */
+  announce_cap(sensor_id, 0x5101, MAC_CAP_SLEEPY);
+  drain_events();
+  reg_node_t *node = reg_find_node(sensor_id);
+  ASSERT_EQ(node->state, REG_STATE_READY);
+  zb_fake_stats_t zs;
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.bind_reqs, 2);
+  ASSERT_EQ(zs.report_cfg_reqs, 2);
+  ASSERT_EQ(zs.report_cfgs, 2);
+
+  rplan_t plan;
+  ASSERT_EQ(rplan_build(node, &plan), 2);
+  ASSERT_EQ(plan.steps[0].cluster_id, ZCL_CLUSTER_TEMPERATURE);
+  ASSERT_EQ(plan.steps[0].cfgs[0].type, ZBA_ZCL_TYPE_INT16);
+  ASSERT_EQ(plan.steps[0].cfgs[0].min_s, RPLAN_BATTERY_MIN_S);
+  ASSERT_EQ(plan.steps[0].cfgs[0].max_s, 900); /* Policy heartbeat */
+  ASSERT_EQ(plan.steps[0].cfgs[0].change, 10);
+
+  interview_stats_t after;
+  ASSERT_EQ(interview_get_stats(&after), OS_OK);
+  ASSERT_EQ(after.bindings - before.bindings, 2);
+  ASSERT_EQ(after.reports_configured - before.reports_configured, 2);
+  ASSERT_EQ(after.setup_refused, before.setup_refused);
+
+  /* Both metering attributes go out in one request per cluster; a device
+   * that refuses reporting is still usable */
+  announce(meter_id, 0x5102);
+  drain_events();
+  node = reg_find_node(meter_id);
+  ASSERT_EQ(node->state, REG_STATE_READY);
+  ASSERT_EQ(rplan_build(node, &plan), 4);
+  ASSERT_EQ(plan.count, 3);
+  ASSERT_EQ(plan.steps[1].cluster_id, ZCL_CLUSTER_METERING);
+  ASSERT_EQ(plan.steps[1].cfg_count, 2);
+  ASSERT_EQ(plan.steps[0].cfgs[0].min_s, 0); /* On/off goes out at once */
+  zb_fake_get_stats(&zs);
+  ASSERT_EQ(zs.bind_reqs, 2 + 3);
+  ASSERT_EQ(zs.report_cfg_reqs, 2 + 3);
+  ASSERT_EQ(zs.report_cfgs, 2 + 4);
+  ASSERT_EQ(interview_get_stats(&after), OS_OK);
+  ASSERT_EQ(after.bindings - before.bindings, 2 + 3);
+  ASSERT_EQ(after.setup_refused - before.setup_refused, 3);
+  ASSERT_EQ(after.inflight, 0);
+
+  reg_remove_node(sensor_id);
+  reg_remove_node(meter_id);
+  drain_events();
+  zb_fake_reset();
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 int main(int argc, char *argv[]) {
   (void)argc;
   (void)argv;
@@ -766,7 +1880,10 @@ int main(int argc, char *argv[]) {
   test_reg_add_cluster();
   test_reg_update_attribute();
   test_reg_set_state();
+  test_reg_iterator();
+  test_reg_snapshot();
   test_reg_remove_node();
+  test_reg_index();
 
   printf("\nInterview tests:\n");
   test_interview_init();
@@ -775,7 +1892,11 @@ int main(int argc, char *argv[]) {
   printf("\nCapability tests:\n");
   test_cap_init();
   test_cap_compute();
+  test_cap_report_table();
+  test_cap_by_node();
+  test_cap_deadband();
   test_cap_get_info();
+  test_cap_format_fixed();
   test_cap_parse_name();
 
   printf("\nHA Discovery tests:\n");
@@ -787,13 +1908,33 @@ int main(int argc, char *argv[]) {
   printf("\nLocal node tests:\n");
   run_local_node_tests();
 
+  printf("\nLiveness tests:\n");
+  run_liveness_tests();
+
+  printf("\nCommand scheduler tests:\n");
+  run_cmd_sched_tests();
+
+  printf("\nMQTT tests:\n");
+  run_mqtt_tests();
+
   printf("\nQuirks tests:\n");
   test_quirks_init();
   test_quirks_find();
+  test_quirks_index();
   test_quirks_apply_value();
+  test_quirks_policy();
   test_quirks_count();
+  test_quirks_db();
+  test_quirks_report_actions();
   test_quirks_action_name();
 
+  printf("\nInterview pipeline tests:\n");
+  test_interview_pipeline();
+  test_interview_retry();
+  test_interview_queue();
+  test_interview_cache();
+  test_interview_bindings();
+
   printf("\n=== Results ===\n");
   printf("Passed: %d\n", tests_passed);
   printf("Failed: %d\n", tests_failed);
@@ -0,0 +1,278 @@
+#!/usr/bin/env python3
+"""Compile the device quirks table into a binary quirk database.
+
+Reads the YAML table (docs/spec/60_device_quirks_table.yaml layout) and
+writes the image described in services/include/quirks_db.h, ready to be
+mmap'd on host or flashed to the "quirks" data partition:
+
+    tools/quirks_compile.py docs/spec/60_device_quirks_table.yaml build/quirks.qdb
+    esptool.py write_flash <quirks partition offset> build/quirks.qdb
+
+Entries keep their source order: when several entries match a device, the
+first one wins, as with the built-in table.
+"""
+
+import argparse
+from decimal import Decimal, InvalidOperation
+from fractions import Fraction
+import struct
+import sys
+import zlib
+
+import yaml
+
+QDB_MAGIC = 0x31424451
+QDB_VERSION = 2
+QDB_NONE = 0xFFFF
+QDB_ENTRY_PREFIX = 0x01
+QUIRK_MAX_ACTIONS = 4
+
+# cap_id_t and cap_info_t.decimals (services/include/capability.h)
+CAPS = {
+    "switch.on": (1, 0),
+    "light.on": (2, 0),
+    "light.level": (3, 0),
+    "light.color_temp": (4, 0),
+    "sensor.temperature": (5, 2),
+    "sensor.humidity": (6, 2),
+    "sensor.contact": (7, 0),
+    "sensor.motion": (8, 0),
+    "sensor.illuminance": (9, 0),
+    "power.watts": (10, 1),
+    "energy.kwh": (11, 3),
+}
+
+# quirk_action_type_t (services/include/quirks.h) and parameter encoders.
+# Each encoder takes the YAML value and the target's decimals and returns
+# the parameter's 32-bit words (see qdb_action_t).
+def _i32(v, decimals=0):
+    v = int(v)
+    if not -0x80000000 <= v <= 0x7FFFFFFF:
+        raise ValueError(f"{v} does not fit in 32 bits")
+    return [struct.unpack("<I", struct.pack("<i", v))[0]]
+
+
+def _decimal(v):
+    try:
+        return Decimal(str(v))
+    except InvalidOperation:
+        raise ValueError(f"{v!r} is not a number") from None
+
+
+def _fixed(v, decimals):
+    """Capability units -> fixed-point value units (exact)."""
+    scaled = _decimal(v).scaleb(decimals)
+    if scaled != scaled.to_integral_value():
+        raise ValueError(f"{v} has more than {decimals} decimal places")
+    return _i32(scaled, decimals)
+
+
+def _ratio(v, decimals):
+    """Decimal multiplier -> exact multiplier/divisor pair."""
+    r = Fraction(_decimal(v))
+    return _i32(r.numerator) + _i32(r.denominator)
+
+
+def _u16(v, decimals=0):
+    v = int(v)
+    if not 0 <= v <= 0xFFFF:
+        raise ValueError(f"{v} does not fit in 16 bits")
+    return [v]
+
+
+def _u32(v, decimals=0):
+    v = int(v)
+    if not 0 <= v <= 0xFFFFFFFF:
+        raise ValueError(f"{v} does not fit in 32 bits")
+    return [v]
+
+
+def _bool(v, decimals=0):
+    return [1 if v else 0]
+
+
+ACTIONS = {
+    "clamp_range": (1, [("min", _i32, None), ("max", _i32, None)]),
+    "invert_boolean": (2, [("enabled", _bool, True)]),
+    "scale_numeric": (3, [("multiplier", _ratio, 1), ("offset", _fixed, 0)]),
+    "remap_attribute": (4, [("cluster_id", _u16, None), ("attr_id", _u16, None)]),
+    "override_reporting": (5, [("min_interval_s", _u16, None),
+                               ("max_interval_s", _u16, None),
+                               ("reportable_change", _u32, 0)]),
+    "ignore_spurious_reports": (6, [("window_ms", _u32, None)]),
+    "state_policy": (7, [("deadband", _fixed, 0),
+                         ("min_interval_ms", _u32, 0),
+                         ("max_staleness_ms", _u32, 0)]),
+}
+
+
+class CompileError(Exception):
+    pass
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+class Strings:
+    def __init__(self):
+        self.pool = bytearray()
+        self.offsets = {}
+
+    def add(self, s):
+        if s not in self.offsets:
+            self.offsets[s] = len(self.pool)
+            self.pool += s.encode("utf-8") + b"\0"
+        return self.offsets[s]
+
+
+class Trie:
+    """First-child/next-sibling trie; children are appended to the end of
+    the sibling list so every link points to a newer node."""
+
+    def __init__(self):
+        self.nodes = []
+
+    def alloc(self, c):
+        self.nodes.append({"child": QDB_NONE, "sibling": QDB_NONE,
+                           "exact": QDB_NONE, "prefix": QDB_NONE, "c": c})
+        return len(self.nodes) - 1
+
+    def insert(self, root, model, entry, prefix):
+        node = root
+        for c in model:
+            link = (node, "child")
+            cur = self.nodes[node]["child"]
+            while cur != QDB_NONE and self.nodes[cur]["c"] != c:
+                link = (cur, "sibling")
+                cur = self.nodes[cur]["sibling"]
+            if cur == QDB_NONE:
+                cur = self.alloc(c)
+                self.nodes[link[0]][link[1]] = cur
+            node = cur
+        slot = "prefix" if prefix else "exact"
+        if self.nodes[node][slot] == QDB_NONE:
+            self.nodes[node][slot] = entry
+
+
+def encode_action(where, action):
+    kind = action.get("type")
+    if kind not in ACTIONS:
+        raise CompileError(f"{where}: unsupported action type {kind!r}")
+    cap = (action.get("target") or {}).get("cap")
+    if cap not in CAPS:
+        raise CompileError(f"{where}: unknown capability {cap!r}")
+    type_id, fields = ACTIONS[kind]
+    cap_id, decimals = CAPS[cap]
+    params = action.get("params") or {}
+    unknown = set(params) - {name for name, _, _ in fields}
+    if unknown:
+        raise CompileError(f"{where}: unknown {kind} params {sorted(unknown)}")
+    words = []
+    for name, enc, default in fields:
+        if name not in params and default is None:
+            raise CompileError(f"{where}: {kind} requires {name!r}")
+        try:
+            words += enc(params.get(name, default), decimals)
+        except (TypeError, ValueError) as e:
+            raise CompileError(f"{where}: {kind} {name}: {e}") from None
+    words += [0] * (3 - len(words))
+    return struct.pack("<BBH3I", type_id, cap_id, 0, *words)
+
+
+def compile_table(table):
+    if len(table) >= QDB_NONE:
+        raise CompileError("too many entries")
+
+    strings = Strings()
+    trie = Trie()
+    roots = {}          # manufacturer -> (trie root, first entry)
+    entries = []
+    actions = []
+
+    for idx, item in enumerate(table):
+        match = item.get("match") or {}
+        mfr = match.get("manufacturer")
+        model = match.get("model")
+        where = f"entry {idx} ({mfr}/{model})"
+        if not isinstance(mfr, str) or not isinstance(model, str):
+            raise CompileError(f"{where}: match needs manufacturer and model")
+        prefix = bool(match.get("prefix", False))
+        item_actions = item.get("actions") or []
+        if len(item_actions) > QUIRK_MAX_ACTIONS:
+            raise CompileError(f"{where}: more than {QUIRK_MAX_ACTIONS} actions")
+
+        first_action = len(actions)
+        actions += [encode_action(where, a) for a in item_actions]
+        entries.append(struct.pack("<IIHBB", strings.add(mfr), strings.add(model),
+                                   first_action, len(item_actions),
+                                   QDB_ENTRY_PREFIX if prefix else 0))
+
+        if mfr not in roots:
+            roots[mfr] = (trie.alloc(0), idx)
+        trie.insert(roots[mfr][0], model.encode("utf-8"), idx, prefix)
+
+    if len(trie.nodes) >= QDB_NONE or len(actions) >= QDB_NONE:
+        raise CompileError("table too large")
+
+    # Keep the manufacturer table at most half full
+    bucket_count = 1
+    while bucket_count < 2 * max(len(roots), 1):
+        bucket_count *= 2
+    buckets = [(0, QDB_NONE, QDB_NONE)] * bucket_count
+    for mfr, (root, first) in roots.items():
+        h = fnv1a(mfr.encode("utf-8"))
+        i = h & (bucket_count - 1)
+        while buckets[i][1] != QDB_NONE:
+            i = (i + 1) & (bucket_count - 1)
+        buckets[i] = (h, root, first)
+
+    body = bytearray()
+    for h, root, first in buckets:
+        body += struct.pack("<IHH", h, root, first)
+    for n in trie.nodes:
+        body += struct.pack("<HHHHBB", n["child"], n["sibling"],
+                            n["exact"], n["prefix"], n["c"], 0)
+    body += b"\0" * (-len(body) % 4)
+    for e in entries:
+        body += e
+    for a in actions:
+        body += a
+    body += strings.pool or b"\0"
+
+    header = struct.pack("<IHHHHHHII", QDB_MAGIC, QDB_VERSION, bucket_count,
+                         len(trie.nodes), len(entries), len(actions), 0,
+                         len(strings.pool) or 1, zlib.crc32(body))
+    return header + bytes(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("table", help="YAML quirks table")
+    parser.add_argument("output", help="output database image")
+    args = parser.parse_args()
+
+    with open(args.table, encoding="utf-8") as f:
+        doc = yaml.safe_load(f)
+    table = doc.get("table") if isinstance(doc, dict) else None
+    if not isinstance(table, list):
+        print(f"{args.table}: no 'table' list", file=sys.stderr)
+        return 1
+
+    try:
+        image = compile_table(table)
+    except CompileError as e:
+        print(f"{args.table}: {e}", file=sys.stderr)
+        return 1
+
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print(f"{args.output}: {len(table)} entries, {len(image)} bytes")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())